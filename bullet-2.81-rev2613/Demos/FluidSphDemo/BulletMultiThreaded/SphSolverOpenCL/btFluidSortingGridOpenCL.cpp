@@ -24,9 +24,6 @@ subject to the following restrictions:
 
 
 #define SWAP_REARRANGED_ARRAY
-#ifdef SWAP_REARRANGED_ARRAY
-#include <cstring>	//memcpy()
-#endif
 
 // /////////////////////////////////////////////////////////////////////////////
 //class btFluidSortingGridOpenCL
@@ -265,15 +262,15 @@ void rearrangeToMatchSortedValues2(const btAlignedObjectArray<btSortData>& sorte
 #ifndef SWAP_REARRANGED_ARRAY
 	out_rearranged = temp;
 #else
-	const int SIZEOF_ARRAY = sizeof(btAlignedObjectArray<T>);
-	
-	char swap[SIZEOF_ARRAY];
-		
-	memcpy(swap, &temp, SIZEOF_ARRAY);
-	memcpy(&temp, &out_rearranged, SIZEOF_ARRAY);
-	memcpy(&out_rearranged, swap, SIZEOF_ARRAY);
+	btFluidSwapArrays(temp, out_rearranged);
 #endif
 }
+template<typename T>
+void rearrangeChannelsToMatchSortedValues2(const btAlignedObjectArray<btSortData>& sortedValues, 
+											btAlignedObjectArray<T>& temp, btFluidParticleChannels<T>& out_rearranged)
+{
+	for(int i = 0; i < out_rearranged.size(); ++i) rearrangeToMatchSortedValues2(sortedValues, temp, out_rearranged[i]);
+}
 void btFluidSortingGridOpenCLProgram::insertParticlesIntoGrid(cl_context context, cl_command_queue commandQueue,
 															  btFluidSph* fluid, btFluidSphOpenCL* fluidData, btFluidSortingGridOpenCL* gridData)
 {
@@ -361,7 +358,20 @@ void btFluidSortingGridOpenCLProgram::rearrangeParticlesOnHost(btFluidSph* fluid
 	rearrangeToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferVector, particles.m_vel);
 	rearrangeToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferVector, particles.m_vel_eval);
 	rearrangeToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferVector, particles.m_accumulatedForce);
+	rearrangeToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferScalar, particles.m_massScale);
 	rearrangeToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferVoid, particles.m_userPointer);
+	rearrangeToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferInt, particles.m_sleepCounter);
+	rearrangeToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferInt, particles.m_sleeping);
+	rearrangeToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferInt, particles.m_rigidContactCacheIndex);
+	rearrangeToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferInt, particles.m_id);
+	rearrangeToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferScalar, particles.m_age);
+	
+	rearrangeChannelsToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferScalar, particles.m_scalarChannels);
+	rearrangeChannelsToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferVector, particles.m_vectorChannels);
+	rearrangeChannelsToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferInt, particles.m_intChannels);
+	rearrangeChannelsToMatchSortedValues2(m_valueIndexPairsHost, m_tempBufferByte, particles.m_byteChannels);
+	
+	fluid->internalUpdateParticleIdTable();
 }
 
 void btFluidSortingGridOpenCLProgram::generateValueIndexPairs(cl_command_queue commandQueue, int numFluidParticles, 
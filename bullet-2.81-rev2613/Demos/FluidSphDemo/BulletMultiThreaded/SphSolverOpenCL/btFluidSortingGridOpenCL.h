@@ -80,6 +80,9 @@ class btFluidSortingGridOpenCLProgram
 	btOpenCLArray<btVector3> m_tempBufferCL;		//Used to rearrange fluid particle arrays(position, velocity, etc.)
 	btAlignedObjectArray<btVector3> m_tempBufferVector;
 	btAlignedObjectArray<void*> m_tempBufferVoid;
+	btAlignedObjectArray<btScalar> m_tempBufferScalar;
+	btAlignedObjectArray<int> m_tempBufferInt;
+	btAlignedObjectArray<unsigned char> m_tempBufferByte;
 	
 	btRadixSort32CL m_radixSorter;
 	btOpenCLArray<btSortData> m_valueIndexPairs;
@@ -67,7 +67,8 @@ void btFluidSphSolverOpenCL::updateGridAndCalculateSphForces(const btFluidSphPar
 	return;
 #endif	
 
-	btAlignedObjectArray<btFluidSph*> validFluids;
+	btAlignedObjectArray<btFluidSph*>& validFluids = m_tempValidFluids;
+	validFluids.resize(0);
 	for(int i = 0; i < numFluids; ++i) 
 	{
 		if( fluids[i]->numParticles() ) 
@@ -47,6 +47,7 @@ class btFluidSphSolverOpenCL : public btFluidSphSolver
 	btFluidSortingGridOpenCLProgram m_sortingGridProgram;
 	
 	btAlignedObjectArray<btVector3> m_tempSphForce;
+	btAlignedObjectArray<btFluidSph*> m_tempValidFluids;	//Fluids with particles
 	
 public:	
 	btFluidSphSolverOpenCL(cl_context context, cl_command_queue queue, cl_device_id device);
@@ -0,0 +1,98 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef BT_FLUID_RIGID_DYNAMICS_WORLD_MULTITHREADED_H
+#define BT_FLUID_RIGID_DYNAMICS_WORLD_MULTITHREADED_H
+
+#include "btParallelFor.h"
+
+#include "BulletFluids/btFluidRigidDynamicsWorld.h"
+
+//Fluid and rigid body functions executed on the additional threads contain BT_PROFILE scopes
+#ifndef BT_NO_PROFILE
+#error "CProfileManager is not thread safe; BT_NO_PROFILE must be defined when building Bullet to use btFluidRigidDynamicsWorldMultithreaded"
+#endif
+
+///@brief Solves rigid body constraints on one thread while SPH forces are calculated on another.
+///@remarks Fluids with btFluidSphRigidBoundaryParticles still calculate SPH forces after the rigid body step.
+///The btFluidSphSolver may itself be multithreaded, e.g. btFluidSphSolverMultithreaded.
+///@par
+///Nodes of the step graph that do not depend on each other are executed concurrently, e.g. the integration of
+///a fluid may be performed during the narrowphase of another, along with btFluidStepStage that are btFluidStepStage::isParallel().
+///@par
+///CProfileManager is not thread safe, so BT_NO_PROFILE must be defined for Bullet and the program using this world.
+///The allocation counter read by btFluidRigidDynamicsWorld::getNumHeapAllocationsLastStep() is also not thread safe, 
+///so it is approximate when using this world.
+class btFluidRigidDynamicsWorldMultithreaded : public btFluidRigidDynamicsWorld
+{
+	btParallelFor m_parallelFor;
+	btContactSolverInfo* m_currentSolverInfo;
+	
+	//Arguments of the level processed by PF_ExecuteStepNode()
+	const btFluidStepGraph* m_currentGraph;
+	int m_currentLevel;
+	btScalar m_currentTimeStep;
+
+public:
+	///Use a different string for uniqueName if creating multiple instances of btFluidRigidDynamicsWorldMultithreaded
+	///@param numThreads Only 2 threads are used to solve constraints and calculate SPH forces; all threads are used for the step graph.
+	btFluidRigidDynamicsWorldMultithreaded(btDispatcher* dispatcher, btBroadphaseInterface* pairCache, btConstraintSolver* constraintSolver,
+											btCollisionConfiguration* collisionConfiguration, btFluidSphSolver* fluidSolver,
+											const char* uniqueName = "btFluidRigidWorld_threads", int numThreads = 2)
+	: btFluidRigidDynamicsWorld(dispatcher, pairCache, constraintSolver, collisionConfiguration, fluidSolver),
+	m_parallelFor( uniqueName, btMax(numThreads, 2) ), m_currentSolverInfo(0), m_currentGraph(0), m_currentLevel(0), m_currentTimeStep(0) {}
+
+protected:
+	virtual void solveConstraintsAndCalculateSphForces(btContactSolverInfo& solverInfo)
+	{
+		m_currentSolverInfo = &solverInfo;
+		m_parallelFor.execute( btFluidRigidDynamicsWorldMultithreaded::PF_SolveConstraintsOrCalculateSphForces, this, 0, 1, 1 );
+		m_currentSolverInfo = 0;
+	}
+	
+	virtual void executeStepGraphLevel(const btFluidStepGraph& graph, int level, btScalar timeStep)
+	{
+		int numConcurrentNodes = graph.getNumConcurrentLevelNodes(level);
+		if(numConcurrentNodes > 1)
+		{
+			m_currentGraph = &graph;
+			m_currentLevel = level;
+			m_currentTimeStep = timeStep;
+			m_parallelFor.execute( btFluidRigidDynamicsWorldMultithreaded::PF_ExecuteStepNode, this, 0, numConcurrentNodes - 1, 1 );
+			m_currentGraph = 0;
+		}
+		else if(numConcurrentNodes == 1) executeStepNode( graph.getNode( graph.getLevelNode(level, 0) ), timeStep );
+		
+		//Exclusive nodes
+		for(int i = numConcurrentNodes; i < graph.getNumLevelNodes(level); ++i) executeStepNode( graph.getNode( graph.getLevelNode(level, i) ), timeStep );
+	}
+
+private:
+	static void PF_SolveConstraintsOrCalculateSphForces(void* parameters, int index)
+	{
+		btFluidRigidDynamicsWorldMultithreaded* world = static_cast<btFluidRigidDynamicsWorldMultithreaded*>(parameters);
+		
+		if(index == 0) world->btDiscreteDynamicsWorld::solveConstraints(*world->m_currentSolverInfo);
+		else world->calculateSphForces(false);
+	}
+	static void PF_ExecuteStepNode(void* parameters, int index)
+	{
+		btFluidRigidDynamicsWorldMultithreaded* world = static_cast<btFluidRigidDynamicsWorldMultithreaded*>(parameters);
+		
+		const btFluidStepGraph& graph = *world->m_currentGraph;
+		world->executeStepNode( graph.getNode( graph.getLevelNode(world->m_currentLevel, index) ), world->m_currentTimeStep );
+	}
+};
+
+#endif
@@ -0,0 +1,77 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef BT_FLUID_SPH_RIGID_COLLISION_DETECTOR_MULTITHREADED_H
+#define BT_FLUID_SPH_RIGID_COLLISION_DETECTOR_MULTITHREADED_H
+
+#include "btParallelFor.h"
+
+#include "BulletFluids/Sph/btFluidSphRigidCollisionDetector.h"
+
+inline void PF_NarrowphaseWorkItemFunction(void* parameters, int index)
+{
+	const btFluidSphRigidNarrowphaseWorkItems* workItems = static_cast<const btFluidSphRigidNarrowphaseWorkItems*>(parameters);
+	
+	btFluidSphRigidCollisionDetector::processNarrowphaseWorkItem(*workItems, index);
+}
+
+inline void PF_TestCcdBatchFunction(void* parameters, int index)
+{
+	btFluidSphRigidCcdBatches* batches = static_cast<btFluidSphRigidCcdBatches*>(parameters);
+
+	btFluidSphRigidCollisionDetector::testCcdBatch(*batches, index);
+}
+
+///@brief Multithreaded implementation of btFluidSphRigidCollisionDetector.
+///@remarks Objects that use the btDispatcher or btFluidSphRigidSdfCache are still processed serially,
+///as are continuous collisions with btGImpactMeshShape.
+class btFluidSphRigidCollisionDetectorMultithreaded : public btFluidSphRigidCollisionDetector
+{
+	btParallelFor m_parallelFor;
+
+public:
+	///Use a different string for uniqueName if creating multiple instances of btFluidSphRigidCollisionDetectorMultithreaded
+	btFluidSphRigidCollisionDetectorMultithreaded(int numThreads, const char* uniqueName = "btSphRigidDetector_threads")
+	: m_parallelFor(uniqueName, numThreads) {}
+
+	virtual void processNarrowphaseWorkItems(const btFluidSphRigidNarrowphaseWorkItems& workItems)
+	{
+		if(workItems.m_numItems < 2)
+		{
+			btFluidSphRigidCollisionDetector::processNarrowphaseWorkItems(workItems);
+			return;
+		}
+		
+		//btParallelFor takes a non-const pointer
+		void* parameters = const_cast<btFluidSphRigidNarrowphaseWorkItems*>(&workItems);
+		m_parallelFor.execute( PF_NarrowphaseWorkItemFunction, parameters, 0, workItems.m_numItems - 1, 1 );
+	}
+	
+	virtual void testCcdBatches(btFluidSphRigidCcdBatches& batches)
+	{
+		//btGImpactMeshShape locks its child shapes and updates its box set when triangles are processed, which is not thread safe
+		bool isGImpactShape = ( batches.m_rigidObject->getCollisionShape()->getShapeType() == GIMPACT_SHAPE_PROXYTYPE );
+		
+		int numBatches = batches.getNumBatches();
+		if(numBatches < 2 || isGImpactShape)
+		{
+			btFluidSphRigidCollisionDetector::testCcdBatches(batches);
+			return;
+		}
+
+		m_parallelFor.execute( PF_TestCcdBatchFunction, &batches, 0, numBatches - 1, 1 );
+	}
+};
+
+#endif
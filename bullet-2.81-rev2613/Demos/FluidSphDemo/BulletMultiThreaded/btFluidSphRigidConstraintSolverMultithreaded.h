@@ -0,0 +1,55 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef BT_FLUID_SPH_RIGID_CONSTRAINT_SOLVER_MULTITHREADED_H
+#define BT_FLUID_SPH_RIGID_CONSTRAINT_SOLVER_MULTITHREADED_H
+
+#include "btParallelFor.h"
+
+#include "BulletFluids/Sph/btFluidSphRigidConstraintSolver.h"
+
+inline void PF_ResolveContactRangeFunction(void* parameters, int index)
+{
+	const btFluidSphRigidSortedContacts* contacts = static_cast<const btFluidSphRigidSortedContacts*>(parameters);
+	
+	btFluidSphRigidConstraintSolver::resolveContactRange(*contacts, index);
+}
+
+///@brief Multithreaded implementation of btFluidSphRigidConstraintSolver.
+///@remarks Produces the same result as btFluidSphRigidConstraintSolver, since each particle
+///is modified by a single range, and the reactions on rigid bodies are summed in a fixed order.
+class btFluidSphRigidConstraintSolverMultithreaded : public btFluidSphRigidConstraintSolver
+{
+	btParallelFor m_parallelFor;
+	
+public:
+	///Use a different string for uniqueName if creating multiple instances of btFluidSphRigidConstraintSolverMultithreaded
+	btFluidSphRigidConstraintSolverMultithreaded(int numThreads, const char* uniqueName = "btSphRigidSolver_threads")
+	: m_parallelFor(uniqueName, numThreads) {}
+	
+	virtual void resolveContactRanges(const btFluidSphRigidSortedContacts& contacts)
+	{
+		if(contacts.m_numRanges < 2)
+		{
+			btFluidSphRigidConstraintSolver::resolveContactRanges(contacts);
+			return;
+		}
+		
+		//btParallelFor takes a non-const pointer
+		void* parameters = const_cast<btFluidSphRigidSortedContacts*>(&contacts);
+		m_parallelFor.execute( PF_ResolveContactRangeFunction, parameters, 0, contacts.m_numRanges - 1, 1 );
+	}
+};
+
+#endif
@@ -61,20 +61,91 @@ inline void PF_ComputeForceFunction(void* parameters, int index)
 															data->m_grid, data->m_particles, data->m_sphData);
 }
 
+struct PF_IntegrateData
+{
+	const btFluidSphParametersGlobal& m_globalParameters;
+	btFluidSph* m_fluid;
+	const bool m_applyForces;
+	const int m_particlesPerRange;
+	btAlignedObjectArray<btVector3>& m_rangePointMin;
+	btAlignedObjectArray<btVector3>& m_rangePointMax;
+	
+	PF_IntegrateData(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, bool applyForces, int particlesPerRange,
+					btAlignedObjectArray<btVector3>& rangePointMin, btAlignedObjectArray<btVector3>& rangePointMax)
+	: m_globalParameters(FG), m_fluid(fluid), m_applyForces(applyForces), m_particlesPerRange(particlesPerRange),
+	m_rangePointMin(rangePointMin), m_rangePointMax(rangePointMax) {}
+};
+inline void PF_IntegrateFunction(void* parameters, int index)
+{
+	PF_IntegrateData* data = static_cast<PF_IntegrateData*>(parameters);
+	
+	int firstIndex = index * data->m_particlesPerRange;
+	int lastIndex = btMin(firstIndex + data->m_particlesPerRange, data->m_fluid->numParticles()) - 1;
+	
+	btFluidSphSolver::integrateParticles(data->m_globalParameters, data->m_fluid, data->m_applyForces, firstIndex, lastIndex, 
+										data->m_rangePointMin[index], data->m_rangePointMax[index]);
+}
+
 ///@brief Multithreaded implementation of btFluidSphSolverDefault.
+///@remarks If several fluids are passed to updateGridAndCalculateSphForces(), and none of them contains most of the particles,
+///each fluid is processed by a single thread instead of dividing the grid cells of each fluid among the threads.
+///@par
+///CProfileManager is not thread safe, and the functions called for each fluid contain BT_PROFILE scopes,
+///so fluids are only processed in parallel if BT_NO_PROFILE is defined; e.g. with premake4 --with-multithreaded-fluids.
 class btFluidSphSolverMultithreaded : public btFluidSphSolverDefault
 {
 	btParallelFor m_parallelFor;
 	
+	//Point AABB of each range of particles processed by PF_IntegrateFunction()
+	btAlignedObjectArray<btVector3> m_rangePointMin;
+	btAlignedObjectArray<btVector3> m_rangePointMax;
+	
+	//If true, each fluid is being processed by a single thread, so the functions below must not use m_parallelFor
+	bool m_processingFluidsInParallel;
+	
+	struct FluidTaskData
+	{
+		btFluidSphSolverMultithreaded* m_solver;
+		const btFluidSphParametersGlobal& m_globalParameters;
+		btFluidSph** m_fluids;
+		
+		FluidTaskData(btFluidSphSolverMultithreaded* solver, const btFluidSphParametersGlobal& FG, btFluidSph** fluids)
+		: m_solver(solver), m_globalParameters(FG), m_fluids(fluids) {}
+	};
+	
 public:
 	///Use a different string for uniqueName if creating multiple instances of btFluidSphSolverMultithreaded
 	btFluidSphSolverMultithreaded(int numThreads, const char* uniqueName = "btSphSolver_threads")
-	: m_parallelFor(uniqueName, numThreads) {}
+	: m_parallelFor(uniqueName, numThreads), m_processingFluidsInParallel(false) {}
 
+	virtual void updateGridAndCalculateSphForces(const btFluidSphParametersGlobal& FG, btFluidSph** fluids, int numFluids)
+	{
+		if( !shouldProcessFluidsInParallel(fluids, numFluids) )
+		{
+			btFluidSphSolverDefault::updateGridAndCalculateSphForces(FG, fluids, numFluids);
+			return;
+		}
+		
+		BT_PROFILE("btFluidSphSolverMultithreaded::updateGridAndCalculateSphForces()");
+		
+		if( m_sphData.size() < numFluids ) m_sphData.resize(numFluids);
+		
+		FluidTaskData TaskData(this, FG, fluids);
+		m_processingFluidsInParallel = true;
+		m_parallelFor.execute( btFluidSphSolverMultithreaded::PF_UpdateGridAndCalculateSphForcesFunction, &TaskData, 0, numFluids - 1, 1 );
+		m_processingFluidsInParallel = false;
+	}
+	
 	virtual void computeSumsInMultithreadingGroup(const btFluidSphParametersGlobal& FG, const btAlignedObjectArray<int>& multithreadingGroup,
 												const btFluidSortingGrid& grid, btFluidParticles& particles, 
 												btFluidSphSolverDefault::SphParticles& sphData)
 	{
+		if(m_processingFluidsInParallel)
+		{
+			btFluidSphSolverDefault::computeSumsInMultithreadingGroup(FG, multithreadingGroup, grid, particles, sphData);
+			return;
+		}
+		
 		PF_ComputePressureData PressureData(FG, multithreadingGroup, grid, particles, sphData);
 		m_parallelFor.execute( PF_ComputePressureFunction, &PressureData, 0, multithreadingGroup.size() - 1, 1 );
 	}
@@ -82,9 +153,86 @@ public:
 													const btAlignedObjectArray<int>& multithreadingGroup, const btFluidSortingGrid& grid, 
 													btFluidParticles& particles, btFluidSphSolverDefault::SphParticles& sphData)
 	{
+		if(m_processingFluidsInParallel)
+		{
+			btFluidSphSolverDefault::computeForcesInMultithreadingGroup(FG, vterm, multithreadingGroup, grid, particles, sphData);
+			return;
+		}
+		
 		PF_ComputeForceData ForceData(FG, vterm, multithreadingGroup, grid, particles, sphData);
 		m_parallelFor.execute( PF_ComputeForceFunction, &ForceData, 0, multithreadingGroup.size() - 1, 1 );
 	}
+	
+	virtual void integrateSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, bool applyForces)
+	{
+		const int PARTICLES_PER_RANGE = 1024;
+		
+		int numRanges = (fluid->numParticles() + PARTICLES_PER_RANGE - 1) / PARTICLES_PER_RANGE;
+		if(numRanges < 2)
+		{
+			btFluidSphSolverDefault::integrateSingleFluid(FG, fluid, applyForces);
+			return;
+		}
+		
+		BT_PROFILE("btFluidSphSolverMultithreaded::integrateSingleFluid()");
+		
+		//PARTICLES_PER_RANGE is a multiple of 32, so ranges do not mark expired particles in the same element of the removal mask
+		if( fluid->getLocalParameters().m_particleLifetime > btScalar(0.0) ) fluid->internalResizeRemovalMask();
+		
+		m_rangePointMin.resize(numRanges);
+		m_rangePointMax.resize(numRanges);
+		
+		PF_IntegrateData IntegrateData(FG, fluid, applyForces, PARTICLES_PER_RANGE, m_rangePointMin, m_rangePointMax);
+		m_parallelFor.execute( PF_IntegrateFunction, &IntegrateData, 0, numRanges - 1, 1 );
+		
+		btVector3& pointMin = fluid->internalGetGrid().internalGetPointAabbMin();
+		btVector3& pointMax = fluid->internalGetGrid().internalGetPointAabbMax();
+		pointMin = m_rangePointMin[0];
+		pointMax = m_rangePointMax[0];
+		for(int i = 1; i < numRanges; ++i)
+		{
+			pointMin.setMin(m_rangePointMin[i]);
+			pointMax.setMax(m_rangePointMax[i]);
+		}
+	}
+	
+private:
+	///Returns true if fluids should be processed as separate tasks; a single large fluid would otherwise
+	///occupy one thread while the others are idle. Fluids that share btFluidSphRigidBoundaryParticles accumulate
+	///reaction forces into the same boundary, so they are not processed in parallel.
+	static bool shouldProcessFluidsInParallel(btFluidSph** fluids, int numFluids)
+	{
+#ifndef BT_NO_PROFILE
+		return false;
+#else
+		if(numFluids < 2) return false;
+		
+		int totalParticles = 0;
+		int maxParticles = 0;
+		for(int i = 0; i < numFluids; ++i)
+		{
+			totalParticles += fluids[i]->numParticles();
+			maxParticles = btMax( maxParticles, fluids[i]->numParticles() );
+			
+			btFluidSphRigidBoundaryParticles* boundary = fluids[i]->getRigidBoundaryParticles();
+			if(boundary)
+			{
+				for(int n = 0; n < i; ++n) 
+					if(fluids[n]->getRigidBoundaryParticles() == boundary) return false;
+			}
+		}
+		
+		return (maxParticles * 2 <= totalParticles);
+#endif
+	}
+	
+	static void PF_UpdateGridAndCalculateSphForcesFunction(void* parameters, int index)
+	{
+		FluidTaskData* data = static_cast<FluidTaskData*>(parameters);
+		
+		btFluidSphSolverMultithreaded* solver = data->m_solver;
+		solver->updateGridAndCalculateSphForcesSingleFluid(data->m_globalParameters, data->m_fluids[index], solver->m_sphData[index]);
+	}
 };
 
 #endif
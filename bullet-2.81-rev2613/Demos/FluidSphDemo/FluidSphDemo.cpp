@@ -24,9 +24,14 @@ subject to the following restrictions:
 
 //Link to e.g. 'BulletMultiThreaded.lib' if enabling this
 //(must build Bullet with CMake to get BulletMultiThreaded library)
+//BT_NO_PROFILE must also be defined for all of Bullet, as the profiler is not thread safe;
+//premake4 --with-multithreaded-fluids defines both
 //#define ENABLE_MULTITHREADED_FLUID_SOLVER
 #ifdef ENABLE_MULTITHREADED_FLUID_SOLVER
+	#include "BulletMultiThreaded/btFluidRigidDynamicsWorldMultithreaded.h"
 	#include "BulletMultiThreaded/btFluidSphSolverMultithreaded.h"
+	#include "BulletMultiThreaded/btFluidSphRigidCollisionDetectorMultithreaded.h"
+	#include "BulletMultiThreaded/btFluidSphRigidConstraintSolverMultithreaded.h"
 	const int NUM_THREADS = 4;
 #endif //ENABLE_MULTITHREADED_FLUID_SOLVER
 
@@ -45,10 +50,14 @@ FluidSphDemo::FluidSphDemo()
 	m_fluidRenderMode = FRM_Points;
 	m_maxFluidParticles = MIN_FLUID_PARTICLES;
 	m_useFluidSolverOpenCL = false;
+	m_useSdfCache = false;
+	m_stepMicroseconds = 0;
 
 	m_fluidWorld = 0;
 	m_fluidSolverCPU = 0;
 	m_fluidSolverGPU = 0;
+	m_fluidRigidCollisionDetector = 0;
+	m_fluidRigidConstraintSolver = 0;
 	
 	m_screenSpaceRenderer = 0;
 	
@@ -91,9 +100,27 @@ void FluidSphDemo::initPhysics()
 	m_fluidSolverGPU = new btFluidSphSolverOpenCL(configCL.m_context, configCL.m_commandQueue, configCL.m_device);
 #endif
 
+#ifndef ENABLE_MULTITHREADED_FLUID_SOLVER
 	m_dynamicsWorld = new btFluidRigidDynamicsWorld(m_dispatcher, m_broadphase, m_solver, m_collisionConfiguration, m_fluidSolverCPU);
+#else
+	//Calculates SPH forces while the rigid body constraints are solved, and executes independent fluid stages concurrently
+	m_dynamicsWorld = new btFluidRigidDynamicsWorldMultithreaded(m_dispatcher, m_broadphase, m_solver, m_collisionConfiguration, 
+																m_fluidSolverCPU, "btFluidRigidWorld_threads", NUM_THREADS);
+#endif
 	m_fluidWorld = static_cast<btFluidRigidDynamicsWorld*>(m_dynamicsWorld);
 	
+#ifdef ENABLE_MULTITHREADED_FLUID_SOLVER
+	//Collides fluid particles with rigid bodies in parallel
+	m_fluidRigidCollisionDetector = new btFluidSphRigidCollisionDetectorMultithreaded(NUM_THREADS);
+	m_fluidWorld->setFluidRigidCollisionDetector(m_fluidRigidCollisionDetector);
+	
+	m_fluidRigidConstraintSolver = new btFluidSphRigidConstraintSolverMultithreaded(NUM_THREADS);
+	m_fluidWorld->setFluidRigidConstraintSolver(m_fluidRigidConstraintSolver);
+#endif
+	
+	//The world and detector are recreated by clientResetScene(), so the distance field cache toggled with 'k' is set again here
+	if(m_useSdfCache) m_fluidWorld->getFluidRigidCollisionDetector().setSdfCache(&m_sdfCache);
+	
 	//Rigid body gravity set here; fluid gravity is set separately with btFluidSph::getLocalParameters()
 	m_fluidWorld->setGravity( btVector3(0.0, -9.8, 0.0) );	
 	
@@ -186,6 +213,7 @@ void FluidSphDemo::exitPhysics()
 	}
 
 	//Delete collision shapes
+	m_sdfCache.clear();
 	for(int j = 0; j < m_collisionShapes.size(); j++)
 	{
 		btCollisionShape* shape = m_collisionShapes[j];
@@ -201,6 +229,8 @@ void FluidSphDemo::exitPhysics()
 	delete m_collisionConfiguration;
 	if(m_fluidSolverCPU) delete m_fluidSolverCPU;
 	if(m_fluidSolverGPU) delete m_fluidSolverGPU;
+	if(m_fluidRigidCollisionDetector) delete m_fluidRigidCollisionDetector;
+	if(m_fluidRigidConstraintSolver) delete m_fluidRigidConstraintSolver;
 	
 	//
 	m_fluids.clear();
@@ -214,6 +244,8 @@ void FluidSphDemo::clientMoveAndDisplay()
 	const btFluidSphParametersGlobal& FG = m_fluidWorld->getGlobalParameters();
 	if(m_fluidWorld)
 	{
+		m_stepClock.reset();
+		
 		const bool USE_SYNCRONIZED_TIME_STEP = false;	//Default: Rigid bodies == 16ms, Sph particles == 3ms time step
 		if(USE_SYNCRONIZED_TIME_STEP)
 		{
@@ -222,6 +254,8 @@ void FluidSphDemo::clientMoveAndDisplay()
 		}
 		else m_fluidWorld->stepSimulation(secondsElapsed);
 		
+		m_stepMicroseconds += m_stepClock.getTimeMicroseconds();
+		
 		if( m_demos.size() ) m_demos[m_currentDemoIndex]->stepSimulation(*m_fluidWorld, &m_fluids);
 	}
 	
@@ -232,7 +266,20 @@ void FluidSphDemo::clientMoveAndDisplay()
 			counter = 0;
 			
 			for(int i = 0; i < m_fluidWorld->getNumFluidSph(); ++i)
-				printf( "m_fluidWorld->getFluidSph(%d)->numParticles(): %d \n", i, m_fluidWorld->getFluidSph(i)->numParticles() );
+			{
+				const btFluidSph* fluid = m_fluidWorld->getFluidSph(i);
+				printf( "m_fluidWorld->getFluidSph(%d)->numParticles(): %d (%d active) \n", i, fluid->numParticles(), fluid->getNumActiveParticles() );
+			}
+			
+			//Compare with the SDF cache enabled and disabled in Demo_HollowBox and Demo_Heightfield
+			printf( "stepSimulation(): %f ms average, SDF cache: %s (%d bytes, %d bricks) \n", 
+					static_cast<double>(m_stepMicroseconds) * 0.001 / 101.0, (m_useSdfCache) ? "on" : "off", 
+					m_sdfCache.getMemoryUsage(), m_sdfCache.getNumBakedBricks() );
+			
+			//Should be 0 once the number of particles and contacts stops growing, unless rigid bodies are added;
+			//approximate, since the multithreaded solvers may allocate on several threads
+			printf( "stepSimulation(): %d heap allocations in the last step \n", m_fluidWorld->getNumHeapAllocationsLastStep() );
+			m_stepMicroseconds = 0;
 		}
 	}
 		
@@ -569,6 +616,11 @@ void FluidSphDemo::keyboardCallback(unsigned char key, int x, int y)
 			}
 			return;
 			
+		case 'k':
+			m_useSdfCache = !m_useSdfCache;
+			m_fluidWorld->getFluidRigidCollisionDetector().setSdfCache( (m_useSdfCache) ? &m_sdfCache : 0 );
+			return;
+			
 		case ' ':
 			resetCurrentDemo();
 			return;
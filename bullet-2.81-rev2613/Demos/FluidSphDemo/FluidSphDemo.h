@@ -33,6 +33,7 @@ subject to the following restrictions:
 #include "BulletFluids/Sph/btFluidSph.h"
 #include "BulletFluids/Sph/btFluidSphSolver.h"
 #include "BulletFluids/btFluidRigidCollisionConfiguration.h"
+#include "BulletFluids/Sph/btFluidSphRigidSdfCache.h"
 
 
 #include "demos.h"
@@ -116,6 +117,13 @@ class FluidSphDemo : public PlatformDemoApplication
 	bool m_useFluidSolverOpenCL;
 	btFluidSphSolver* m_fluidSolverCPU;
 	btFluidSphSolver* m_fluidSolverGPU;
+	btFluidSphRigidCollisionDetector* m_fluidRigidCollisionDetector;	//0 if the world's default detector is used
+	btFluidSphRigidConstraintSolver* m_fluidRigidConstraintSolver;		//0 if the world's default solver is used
+	
+	bool m_useSdfCache;
+	btFluidSphRigidSdfCache m_sdfCache;		//Used for the triangle mesh and heightfield demos
+	btClock m_stepClock;
+	unsigned long m_stepMicroseconds;		//Accumulated between each printf() of particle counts
 	
 	//Rendering
 	FluidRenderMode m_fluidRenderMode;
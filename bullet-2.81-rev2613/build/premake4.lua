@@ -13,6 +13,11 @@ solution "0BulletSolution"
 	  description = "Disable demos and extras"	
 	}
 
+	newoption {
+    trigger     = "with-multithreaded-fluids",
+    description = "Enable the multithreaded fluid demo; disables the profiler, which is not thread safe"
+  }
+
 	newoption {
     trigger     = "with-double-precision",
     description = "Enable double precision build"
@@ -69,6 +74,10 @@ solution "0BulletSolution"
   	defines {"BT_USE_DOUBLE_PRECISION"}
   end
   
+  if _OPTIONS["with-multithreaded-fluids"] then
+  	defines {"ENABLE_MULTITHREADED_FLUID_SOLVER", "BT_NO_PROFILE"}
+  end
+  
 	if _ACTION == "xcode4" then
 		if _OPTIONS["ios"] then
 			postfix = "ios";
@@ -0,0 +1,233 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#include "btFluidSphAdaptiveResolution.h"
+
+#include "LinearMath/btQuickprof.h"		//BT_PROFILE(name) macro
+#include "LinearMath/btRandom.h"		//GEN_rand(), GEN_RAND_MAX
+
+#include "BulletFluids/Sph/btFluidSph.h"
+
+//Returns the number of particles contained in the grid; particles appended after
+//the grid was last updated are not contained in it, and have higher indicies
+inline int getNumParticlesInGrid(const btFluidSortingGrid& grid)
+{
+	int numGridCells = grid.getNumGridCells();
+	return (numGridCells) ? grid.getGridCell(numGridCells - 1).m_lastIndex + 1 : 0;
+}
+
+void btFluidSphAdaptiveResolution::update(const btFluidSphParametersGlobal& FG, btFluidSph* fluid)
+{
+	BT_PROFILE("btFluidSphAdaptiveResolution::update()");
+
+	m_numMerged = 0;
+	m_numSplit = 0;
+
+	//The grid is invalid if particles were removed after it was updated
+	if( getNumParticlesInGrid( fluid->getGrid() ) > fluid->numParticles() ) return;
+
+	classifyParticles(FG, fluid);
+
+	int changesRemaining = m_maxChangesPerUpdate;
+	mergeParticles(FG, fluid, changesRemaining);
+	splitParticles(FG, fluid, changesRemaining);
+}
+
+void btFluidSphAdaptiveResolution::classifyParticles(const btFluidSphParametersGlobal& FG, btFluidSph* fluid)
+{
+	BT_PROFILE("btFluidSphAdaptiveResolution::classifyParticles()");
+
+	const btFluidSortingGrid& grid = fluid->getGrid();
+	const btFluidParticles& particles = fluid->getParticles();
+
+	const int numParticles = particles.size();
+	const int numGridCells = grid.getNumGridCells();
+	const int numGridParticles = getNumParticlesInGrid(grid);
+
+	m_cellsToSurface.resize(numParticles);
+	m_highDetail.resize(numParticles);
+	m_merged.resize(numParticles);
+	for(int i = 0; i < numParticles; ++i) m_cellsToSurface[i] = 0;
+	for(int i = 0; i < numParticles; ++i) m_highDetail[i] = 0;
+	for(int i = 0; i < numParticles; ++i) m_merged[i] = 0;
+
+	//Grid cells with an empty adjacent cell are at the surface
+	m_adjacentCells.resize(numGridCells);
+	for(int cell = 0; cell < numGridCells; ++cell)
+	{
+		btFluidGridIterator currentCell = grid.getGridCell(cell);
+
+		btFluidSortingGrid::FoundCells& adjacentCells = m_adjacentCells[cell];
+		grid.findCells(particles.m_pos[currentCell.m_firstIndex], adjacentCells);
+
+		int numNonemptyCells = 0;
+		for(int j = 0; j < btFluidSortingGrid::NUM_FOUND_CELLS; ++j)
+		{
+			const btFluidGridIterator& FI = adjacentCells.m_iterators[j];
+			if(FI.m_firstIndex <= FI.m_lastIndex) ++numNonemptyCells;
+		}
+
+		int distance = (numNonemptyCells < btFluidSortingGrid::NUM_FOUND_CELLS) ? 0 : m_mergeDepth;
+		for(int i = currentCell.m_firstIndex; i <= currentCell.m_lastIndex; ++i) m_cellsToSurface[i] = distance;
+	}
+
+	//Since all particles in a grid cell have the same distance,
+	//only the first particle of each cell needs to be checked
+	for(int pass = 1; pass < m_mergeDepth; ++pass)
+	{
+		for(int cell = 0; cell < numGridCells; ++cell)
+		{
+			btFluidGridIterator currentCell = grid.getGridCell(cell);
+			if( m_cellsToSurface[currentCell.m_firstIndex] < pass ) continue;
+
+			const btFluidSortingGrid::FoundCells& adjacentCells = m_adjacentCells[cell];
+			for(int j = 0; j < btFluidSortingGrid::NUM_FOUND_CELLS; ++j)
+			{
+				const btFluidGridIterator& FI = adjacentCells.m_iterators[j];
+				if( FI.m_firstIndex <= FI.m_lastIndex && m_cellsToSurface[FI.m_firstIndex] == pass - 1 )
+				{
+					for(int i = currentCell.m_firstIndex; i <= currentCell.m_lastIndex; ++i) m_cellsToSurface[i] = pass;
+					break;
+				}
+			}
+		}
+	}
+
+	//Determine particles that should be split
+	for(int i = 0; i < numGridParticles; ++i)
+		if(m_cellsToSurface[i] == 0) m_highDetail[i] = 1;
+
+	const btAlignedObjectArray<btFluidSphRigidContactGroup>& contactGroups = fluid->getRigidContacts();
+	for(int i = 0; i < contactGroups.size(); ++i)
+	{
+		const btFluidSphRigidContactGroup& contactGroup = contactGroups[i];
+		for(int n = 0; n < contactGroup.numContacts(); ++n) m_highDetail[ contactGroup.m_contacts[n].m_fluidParticleIndex ] = 1;
+	}
+
+	if( m_importancePoints.size() )
+	{
+		const btScalar importanceRadiusSquared = m_importanceRadius * m_importanceRadius;
+		for(int i = 0; i < numGridParticles; ++i)
+		{
+			for(int n = 0; n < m_importancePoints.size(); ++n)
+			{
+				if( particles.m_pos[i].distance2(m_importancePoints[n]) < importanceRadiusSquared )
+				{
+					m_highDetail[i] = 1;
+					break;
+				}
+			}
+		}
+	}
+}
+
+void btFluidSphAdaptiveResolution::mergeParticles(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, int& changesRemaining)
+{
+	BT_PROFILE("btFluidSphAdaptiveResolution::mergeParticles()");
+
+	const btFluidSortingGrid& grid = fluid->getGrid();
+	btFluidParticles& particles = fluid->internalGetParticles();
+
+	const btScalar mergeDistance = (m_mergeDistance != btScalar(0.0)) ? m_mergeDistance : fluid->getEmitterSpacing(FG);
+	const btScalar mergeDistanceSquared = mergeDistance * mergeDistance;
+
+	for(int cell = 0; cell < grid.getNumGridCells(); ++cell)
+	{
+		btFluidGridIterator FI = grid.getGridCell(cell);
+		if( m_cellsToSurface[FI.m_firstIndex] < m_mergeDepth ) continue;
+
+		for(int i = FI.m_firstIndex; i <= FI.m_lastIndex; ++i)
+		{
+			if( m_merged[i] || m_highDetail[i] ) continue;
+
+			for(int n = i + 1; n <= FI.m_lastIndex; ++n)
+			{
+				if( m_merged[n] || m_highDetail[n] ) continue;
+
+				btScalar massA = particles.m_massScale[i];
+				btScalar massB = particles.m_massScale[n];
+				btScalar combinedMass = massA + massB;
+				if( combinedMass > m_maxMassScale ) continue;
+				if( particles.m_pos[i].distance2(particles.m_pos[n]) >= mergeDistanceSquared ) continue;
+
+				//Replace particle i with the center of mass, and remove particle n
+				btScalar invCombinedMass = btScalar(1.0) / combinedMass;
+				particles.m_pos[i] = (particles.m_pos[i] * massA + particles.m_pos[n] * massB) * invCombinedMass;
+				particles.m_vel[i] = (particles.m_vel[i] * massA + particles.m_vel[n] * massB) * invCombinedMass;
+				particles.m_vel_eval[i] = (particles.m_vel_eval[i] * massA + particles.m_vel_eval[n] * massB) * invCombinedMass;
+				particles.m_accumulatedForce[i] += particles.m_accumulatedForce[n];
+				particles.m_massScale[i] = combinedMass;
+				fluid->wakeParticle(i);
+
+				fluid->markParticleForRemoval(n);
+
+				m_merged[i] = 1;
+				m_merged[n] = 1;
+				++m_numMerged;
+
+				if(--changesRemaining <= 0) return;
+				break;
+			}
+		}
+	}
+}
+
+void btFluidSphAdaptiveResolution::splitParticles(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, int& changesRemaining)
+{
+	BT_PROFILE("btFluidSphAdaptiveResolution::splitParticles()");
+
+	btFluidParticles& particles = fluid->internalGetParticles();
+
+	//Split particles are placed at a quarter of the particle spacing from the original position
+	const btScalar offsetDistance = fluid->getEmitterSpacing(FG) * btScalar(0.25);
+
+	const int numGridParticles = getNumParticlesInGrid( fluid->getGrid() );
+	for(int i = 0; i < numGridParticles; ++i)
+	{
+		if( changesRemaining <= 0 ) return;
+		if( !m_highDetail[i] || m_merged[i] ) continue;
+		if( particles.m_massScale[i] < btScalar(2.0) ) continue;
+
+		int newIndex = fluid->addParticle(particles.m_pos[i]);
+		if( newIndex == fluid->numParticles() ) return;		//Max particles reached
+
+		btVector3 direction( static_cast<btScalar>(GEN_rand()) / static_cast<btScalar>(GEN_RAND_MAX) - btScalar(0.5),
+							static_cast<btScalar>(GEN_rand()) / static_cast<btScalar>(GEN_RAND_MAX) - btScalar(0.5),
+							static_cast<btScalar>(GEN_rand()) / static_cast<btScalar>(GEN_RAND_MAX) - btScalar(0.5) );
+		if( direction.length2() < SIMD_EPSILON ) direction.setValue(0, 1, 0);
+		btVector3 offset = direction.normalized() * offsetDistance;
+
+		btScalar halfMass = particles.m_massScale[i] * btScalar(0.5);
+
+		//The new particle inherits all attributes, including age and user defined channels, except for
+		//its id, accumulated force, and contact cache entry, which are not shared with the original particle
+		int newId = particles.m_id[newIndex];
+		particles.copyParticle(newIndex, i);
+		particles.m_id[newIndex] = newId;
+		particles.m_accumulatedForce[newIndex].setValue(0,0,0);
+		particles.m_rigidContactCacheIndex[newIndex] = -1;
+		
+		particles.m_pos[newIndex] = particles.m_pos[i] - offset;
+		particles.m_massScale[newIndex] = halfMass;
+
+		particles.m_pos[i] += offset;
+		particles.m_massScale[i] = halfMass;
+
+		fluid->wakeParticle(i);
+		fluid->wakeParticle(newIndex);
+
+		++m_numSplit;
+		--changesRemaining;
+	}
+}
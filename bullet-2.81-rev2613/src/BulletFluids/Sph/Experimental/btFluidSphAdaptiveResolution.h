@@ -0,0 +1,80 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef BT_FLUID_SPH_ADAPTIVE_RESOLUTION_H
+#define BT_FLUID_SPH_ADAPTIVE_RESOLUTION_H
+
+#include "LinearMath/btVector3.h"
+#include "LinearMath/btAlignedObjectArray.h"
+
+#include "BulletFluids/Sph/btFluidSortingGrid.h"
+
+struct btFluidSphParametersGlobal;
+class btFluidSph;
+
+///@brief Merges particles in the interior of a btFluidSph, and splits them near its surface.
+///@remarks
+///Merging 2 particles replaces them with a single particle at their center of mass, with their combined
+///mass and momentum; splitting divides a particle into 2 particles with half its mass and the same velocity.
+///The mass of each particle is stored in btFluidParticles::m_massScale, as a multiple of
+///btFluidSphParametersLocal::m_particleMass and btFluidSphParametersLocal::m_sphParticleMass.
+///@par
+///The level of detail is determined per grid cell. Cells with an empty adjacent cell are considered to be at
+///the surface. Particles at the surface, in contact with a rigid body, or near an importance point(such as the camera)
+///are split, while particles that are at least m_mergeDepth cells from the surface are merged.
+///@par
+///Work in progress; the SPH smoothing radius is not changed, so merged particles produce a less smooth
+///density field. Only btFluidSphSolverDefault accounts for btFluidParticles::m_massScale.
+class btFluidSphAdaptiveResolution
+{
+public:
+	btScalar m_maxMassScale;		///<Particles are not merged if the resulting btFluidParticles::m_massScale would exceed this.
+	int m_mergeDepth;				///<Minimum distance, in grid cells, from the surface for particles to be merged; should be at least 2.
+
+	///Particles are merged only if they are closer than this; world scale; if 0.0, btFluidSph::getEmitterSpacing() is used.
+	btScalar m_mergeDistance;
+
+	int m_maxChangesPerUpdate;		///<Limits the number of merges and splits per update; reduces popping.
+
+	///Particles within m_importanceRadius of these points are split and not merged; e.g. the camera position; world scale.
+	btAlignedObjectArray<btVector3> m_importancePoints;
+	btScalar m_importanceRadius;	///<World scale.
+
+	btFluidSphAdaptiveResolution()
+	: m_maxMassScale( btScalar(4.0) ), m_mergeDepth(2), m_mergeDistance( btScalar(0.0) ),
+	m_maxChangesPerUpdate(1024), m_importanceRadius( btScalar(0.0) ), m_numMerged(0), m_numSplit(0) {}
+
+	///Automatically called at the end of each internal step of btFluidRigidDynamicsWorld,
+	///for fluids with btFluidSph::setAdaptiveResolution(), after particles are integrated.
+	///Merged particles are marked for removal, and split particles are appended, so the grid is not invalidated.
+	void update(const btFluidSphParametersGlobal& FG, btFluidSph* fluid);
+
+	int getNumMergedLastUpdate() const { return m_numMerged; }
+	int getNumSplitLastUpdate() const { return m_numSplit; }
+
+protected:
+	int m_numMerged;
+	int m_numSplit;
+
+	btAlignedObjectArray<int> m_cellsToSurface;		//Per particle; distance to the nearest surface cell, in grid cells
+	btAlignedObjectArray<int> m_highDetail;			//Per particle; nonzero if the particle should be split
+	btAlignedObjectArray<int> m_merged;				//Per particle; nonzero if the particle was merged during this update
+	btAlignedObjectArray<btFluidSortingGrid::FoundCells> m_adjacentCells;	//Per grid cell
+
+	void classifyParticles(const btFluidSphParametersGlobal& FG, btFluidSph* fluid);
+	void mergeParticles(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, int& changesRemaining);
+	void splitParticles(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, int& changesRemaining);
+};
+
+#endif
@@ -28,6 +28,7 @@ inline btScalar computePressure(btScalar restDensity, btScalar stiffness, btScal
 }
 */
 
+template<class Kernel>
 void computeViscosityForceAndDiiNeighborTableSymmetric(const btFluidSphParametersGlobal& FG, int particleIndex, 
 													btFluidParticles& particles, btFluidSphSolverIISPH::IiSphParticles& iiSphData)
 {
@@ -38,11 +39,9 @@ void computeViscosityForceAndDiiNeighborTableSymmetric(const btFluidSphParameter
 		int n = iiSphData.m_neighborTable[i].getNeighborIndex(j);
 		btScalar distance = iiSphData.m_neighborTable[i].getDistance(j);
 		
-		btScalar closeness = FG.m_sphSmoothRadius - distance;
-		
 		//Compute viscosity force
 		{
-			btScalar viscosityScalar = closeness / (iiSphData.m_density[i] * iiSphData.m_density[n]);
+			btScalar viscosityScalar = Kernel::laplacianPartial(FG, distance) / (iiSphData.m_density[i] * iiSphData.m_density[n]);
 			btVector3 viscosityForce = (particles.m_vel[n] - particles.m_vel[i]) * viscosityScalar;
 			
 			iiSphData.m_viscosityAcceleration[i] += viscosityForce;
@@ -51,15 +50,15 @@ void computeViscosityForceAndDiiNeighborTableSymmetric(const btFluidSphParameter
 		
 		//Compute d_ii
 		{
-			btScalar spikyKernelGradientScalar = closeness * closeness;
-			btVector3 simScaleNormal = (particles.m_pos[i] - particles.m_pos[n]) * (FG.m_simulationScale / distance);
-			btVector3 spikyKernelGradient_in = simScaleNormal * spikyKernelGradientScalar;
+			btVector3 simScaleDifference = (particles.m_pos[i] - particles.m_pos[n]) * FG.m_simulationScale;
+			btVector3 kernelGradient_in = simScaleDifference * Kernel::gradientPartial(FG, distance);
 			
-			iiSphData.m_d_ii[i] += spikyKernelGradient_in;
-			iiSphData.m_d_ii[n] += -spikyKernelGradient_in;
+			iiSphData.m_d_ii[i] += kernelGradient_in;
+			iiSphData.m_d_ii[n] += -kernelGradient_in;
 		}
 	}
 }
+template<class Kernel>
 void computeViscosityForceAndDiiInCellSymmetric(const btFluidSphParametersGlobal& FG, int gridCellIndex, 
 										const btFluidSortingGrid& grid, btFluidParticles& particles,
 										btFluidSphSolverIISPH::IiSphParticles& iiSphData)
@@ -69,10 +68,11 @@ void computeViscosityForceAndDiiInCellSymmetric(const btFluidSphParametersGlobal
 	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
 	for(int particleIndex = currentCell.m_firstIndex; particleIndex <= currentCell.m_lastIndex; ++particleIndex)
 	{
-		computeViscosityForceAndDiiNeighborTableSymmetric(FG, particleIndex, particles, iiSphData);
+		computeViscosityForceAndDiiNeighborTableSymmetric<Kernel>(FG, particleIndex, particles, iiSphData);
 	}
 }
 
+template<class Kernel>
 void computeDensityAdvAndAiiNeighborTableSymmetric(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, int particleIndex, 
 													btFluidParticles& particles, btFluidSphSolverIISPH::IiSphParticles& iiSphData)
 {
@@ -83,18 +83,15 @@ void computeDensityAdvAndAiiNeighborTableSymmetric(const btFluidSphParametersGlo
 		int n = iiSphData.m_neighborTable[i].getNeighborIndex(j);
 		btScalar distance = iiSphData.m_neighborTable[i].getDistance(j);
 		
-		btScalar closeness = FG.m_sphSmoothRadius - distance;
-		
-		btScalar spikyKernelGradientScalar = closeness * closeness;
-		btVector3 simScaleNormal = (particles.m_pos[i] - particles.m_pos[n]) * (FG.m_simulationScale / distance);
-		btVector3 spikyKernelGradient_in = simScaleNormal * spikyKernelGradientScalar;
+		btVector3 simScaleDifference = (particles.m_pos[i] - particles.m_pos[n]) * FG.m_simulationScale;
+		btVector3 kernelGradient_in = simScaleDifference * Kernel::gradientPartial(FG, distance);
 		
 		//Compute density_adv
 		{
 			btVector3 relativePredictedVelocity_in = (iiSphData.m_predictedVelocity[i] - iiSphData.m_predictedVelocity[n]);
 			
-			btScalar densityAdv_in = relativePredictedVelocity_in.dot(spikyKernelGradient_in);
-			//btScalar densityAdv_ni = (-relativePredictedVelocity_in).dot(-spikyKernelGradient_in);	//densityAdv_in == densityAdv_ni
+			btScalar densityAdv_in = relativePredictedVelocity_in.dot(kernelGradient_in);
+			//btScalar densityAdv_ni = (-relativePredictedVelocity_in).dot(-kernelGradient_in);	//densityAdv_in == densityAdv_ni
 			
 			iiSphData.m_density_adv[i] += densityAdv_in;
 			iiSphData.m_density_adv[n] += densityAdv_in;
@@ -102,19 +99,20 @@ void computeDensityAdvAndAiiNeighborTableSymmetric(const btFluidSphParametersGlo
 		
 		//Compute a_ii
 		{
-			btScalar d_in_ni_numerator = -FG.m_timeStep * FG.m_timeStep * FG.m_spikyKernGradCoeff * FL.m_sphParticleMass;
+			btScalar d_in_ni_numerator = -FG.m_timeStep * FG.m_timeStep * Kernel::gradientCoeff(FG) * FL.m_sphParticleMass;
 		
 			btScalar d_ni_scalar = d_in_ni_numerator / (iiSphData.m_density[i] * iiSphData.m_density[i]);
 			btScalar d_in_scalar = d_in_ni_numerator / (iiSphData.m_density[n] * iiSphData.m_density[n]);
 			
-			btVector3 d_ni = -spikyKernelGradient_in * d_ni_scalar;
-			btVector3 d_in = spikyKernelGradient_in * d_in_scalar;
+			btVector3 d_ni = -kernelGradient_in * d_ni_scalar;
+			btVector3 d_in = kernelGradient_in * d_in_scalar;
 			
-			iiSphData.m_a_ii[i] += (iiSphData.m_d_ii[i] - d_ni).dot(spikyKernelGradient_in);
-			iiSphData.m_a_ii[n] += (iiSphData.m_d_ii[n] - d_in).dot(-spikyKernelGradient_in);
+			iiSphData.m_a_ii[i] += (iiSphData.m_d_ii[i] - d_ni).dot(kernelGradient_in);
+			iiSphData.m_a_ii[n] += (iiSphData.m_d_ii[n] - d_in).dot(-kernelGradient_in);
 		}
 	}
 }
+template<class Kernel>
 void computeDensityAdvAndAiiInCellSymmetric(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL,
 										int gridCellIndex, const btFluidSortingGrid& grid, btFluidParticles& particles,
 										btFluidSphSolverIISPH::IiSphParticles& iiSphData)
@@ -124,10 +122,11 @@ void computeDensityAdvAndAiiInCellSymmetric(const btFluidSphParametersGlobal& FG
 	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
 	for(int particleIndex = currentCell.m_firstIndex; particleIndex <= currentCell.m_lastIndex; ++particleIndex)
 	{
-		computeDensityAdvAndAiiNeighborTableSymmetric(FG, FL, particleIndex, particles, iiSphData);
+		computeDensityAdvAndAiiNeighborTableSymmetric<Kernel>(FG, FL, particleIndex, particles, iiSphData);
 	}
 }
 
+template<class Kernel>
 void computeDijPjSumNeighborTableSymmetric(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, int particleIndex, 
 													btFluidParticles& particles, btFluidSphSolverIISPH::IiSphParticles& iiSphData)
 {
@@ -138,20 +137,18 @@ void computeDijPjSumNeighborTableSymmetric(const btFluidSphParametersGlobal& FG,
 		int n = iiSphData.m_neighborTable[i].getNeighborIndex(j);
 		btScalar distance = iiSphData.m_neighborTable[i].getDistance(j);
 		
-		btScalar closeness = FG.m_sphSmoothRadius - distance;
-		
-		btScalar spikyKernelGradientScalar = closeness * closeness;
-		btVector3 simScaleNormal = (particles.m_pos[i] - particles.m_pos[n]) * (FG.m_simulationScale / distance);
+		btVector3 simScaleDifference = (particles.m_pos[i] - particles.m_pos[n]) * FG.m_simulationScale;
 		
-		btVector3 spikyKernelGradient = simScaleNormal * spikyKernelGradientScalar;
+		btVector3 kernelGradient = simScaleDifference * Kernel::gradientPartial(FG, distance);
 		
 		btScalar scalar_i = iiSphData.m_pressure[n] / (iiSphData.m_density[n] * iiSphData.m_density[n]);
 		btScalar scalar_n = iiSphData.m_pressure[i] / (iiSphData.m_density[i] * iiSphData.m_density[i]);
 		
-		iiSphData.m_d_ij_pj_sum[i] += spikyKernelGradient * scalar_i;
-		iiSphData.m_d_ij_pj_sum[n] += -spikyKernelGradient * scalar_n;
+		iiSphData.m_d_ij_pj_sum[i] += kernelGradient * scalar_i;
+		iiSphData.m_d_ij_pj_sum[n] += -kernelGradient * scalar_n;
 	}
 }
+template<class Kernel>
 void computeDijPjSumInCellSymmetric(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL,
 										int gridCellIndex, const btFluidSortingGrid& grid, btFluidParticles& particles,
 										btFluidSphSolverIISPH::IiSphParticles& iiSphData)
@@ -161,11 +158,12 @@ void computeDijPjSumInCellSymmetric(const btFluidSphParametersGlobal& FG, const
 	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
 	for(int particleIndex = currentCell.m_firstIndex; particleIndex <= currentCell.m_lastIndex; ++particleIndex)
 	{
-		computeDijPjSumNeighborTableSymmetric(FG, FL, particleIndex, particles, iiSphData);
+		computeDijPjSumNeighborTableSymmetric<Kernel>(FG, FL, particleIndex, particles, iiSphData);
 	}
 }
 
 
+template<class Kernel>
 void computeEquation13SumNeighborTableSymmetric(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, int particleIndex, 
 													btFluidParticles& particles, btFluidSphSolverIISPH::IiSphParticles& iiSphData)
 {
@@ -176,18 +174,15 @@ void computeEquation13SumNeighborTableSymmetric(const btFluidSphParametersGlobal
 		int n = iiSphData.m_neighborTable[i].getNeighborIndex(j);
 		btScalar distance = iiSphData.m_neighborTable[i].getDistance(j);
 		
-		btScalar closeness = FG.m_sphSmoothRadius - distance;
+		btVector3 simScaleDifference = (particles.m_pos[i] - particles.m_pos[n]) * FG.m_simulationScale;
+		btVector3 kernelGradient_in = simScaleDifference * Kernel::gradientPartial(FG, distance);
 		
-		btScalar spikyKernelGradientScalar = closeness * closeness;
-		btVector3 simScaleNormal = (particles.m_pos[i] - particles.m_pos[n]) * (FG.m_simulationScale / distance);
-		btVector3 spikyKernelGradient_in = simScaleNormal * spikyKernelGradientScalar;
-		
-		btScalar d_in_ni_numerator = -FG.m_timeStep * FG.m_timeStep * FG.m_spikyKernGradCoeff * FL.m_sphParticleMass;
+		btScalar d_in_ni_numerator = -FG.m_timeStep * FG.m_timeStep * Kernel::gradientCoeff(FG) * FL.m_sphParticleMass;
 		btScalar d_ni_scalar = d_in_ni_numerator / (iiSphData.m_density[i] * iiSphData.m_density[i]);
 		btScalar d_in_scalar = d_in_ni_numerator / (iiSphData.m_density[n] * iiSphData.m_density[n]);
 			
-		btVector3 d_ni = -spikyKernelGradient_in * d_ni_scalar;
-		btVector3 d_in = spikyKernelGradient_in * d_in_scalar;
+		btVector3 d_ni = -kernelGradient_in * d_ni_scalar;
+		btVector3 d_in = kernelGradient_in * d_in_scalar;
 		
 		btVector3 d_ni_pi = d_ni * iiSphData.m_pressure[i];
 		btVector3 d_in_pn = d_in * iiSphData.m_pressure[n];
@@ -195,10 +190,11 @@ void computeEquation13SumNeighborTableSymmetric(const btFluidSphParametersGlobal
 		btVector3 i_term = iiSphData.m_d_ij_pj_sum[i] - iiSphData.m_d_ii[n]*iiSphData.m_pressure[n] - (iiSphData.m_d_ij_pj_sum[n] - d_ni_pi);
 		btVector3 n_term = iiSphData.m_d_ij_pj_sum[n] - iiSphData.m_d_ii[i]*iiSphData.m_pressure[i] - (iiSphData.m_d_ij_pj_sum[i] - d_in_pn);
 		
-		iiSphData.m_equation13_sum[i] += i_term.dot(spikyKernelGradient_in);
-		iiSphData.m_equation13_sum[n] += n_term.dot(-spikyKernelGradient_in);
+		iiSphData.m_equation13_sum[i] += i_term.dot(kernelGradient_in);
+		iiSphData.m_equation13_sum[n] += n_term.dot(-kernelGradient_in);
 	}
 }
+template<class Kernel>
 void computeEquation13SumInCellSymmetric(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL,
 										int gridCellIndex, const btFluidSortingGrid& grid, btFluidParticles& particles,
 										btFluidSphSolverIISPH::IiSphParticles& iiSphData)
@@ -208,10 +204,11 @@ void computeEquation13SumInCellSymmetric(const btFluidSphParametersGlobal& FG, c
 	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
 	for(int particleIndex = currentCell.m_firstIndex; particleIndex <= currentCell.m_lastIndex; ++particleIndex)
 	{
-		computeEquation13SumNeighborTableSymmetric(FG, FL, particleIndex, particles, iiSphData);
+		computeEquation13SumNeighborTableSymmetric<Kernel>(FG, FL, particleIndex, particles, iiSphData);
 	}
 }
 
+template<class Kernel>
 void computePressureForceNeighborTableSymmetric(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, int particleIndex, 
 													btFluidParticles& particles, btFluidSphSolverIISPH::IiSphParticles& iiSphData)
 {
@@ -222,24 +219,22 @@ void computePressureForceNeighborTableSymmetric(const btFluidSphParametersGlobal
 		int n = iiSphData.m_neighborTable[i].getNeighborIndex(j);
 		btScalar distance = iiSphData.m_neighborTable[i].getDistance(j);
 		
-		btScalar closeness = FG.m_sphSmoothRadius - distance;
-		
-		btScalar spikyKernelGradientScalar = closeness * closeness;
-		btVector3 simScaleNormal = (particles.m_pos[i] - particles.m_pos[n]) * (FG.m_simulationScale / distance);
-		btVector3 spikyKernelGradient = simScaleNormal * spikyKernelGradientScalar;
+		btVector3 simScaleDifference = (particles.m_pos[i] - particles.m_pos[n]) * FG.m_simulationScale;
+		btVector3 kernelGradient = simScaleDifference * Kernel::gradientPartial(FG, distance);
 		
 		btScalar pterm_i = iiSphData.m_pressure[i] / (iiSphData.m_density[i] * iiSphData.m_density[i]);
 		btScalar pterm_n = iiSphData.m_pressure[n] / (iiSphData.m_density[n] * iiSphData.m_density[n]);
 		
-		btVector3 pressureAcceleration = spikyKernelGradient * (pterm_i + pterm_n);
+		btVector3 pressureAcceleration = kernelGradient * (pterm_i + pterm_n);
 		
 		//btScalar alternatePressureScalar = btScalar(0.5) * (iiSphData.m_pressure[i] + iiSphData.m_pressure[n]) / (iiSphData.m_density[i] * iiSphData.m_density[n]);
-		//btVector3 pressureAcceleration = spikyKernelGradient * alternatePressureScalar;
+		//btVector3 pressureAcceleration = kernelGradient * alternatePressureScalar;
 		
 		iiSphData.m_pressureAcceleration[i] += pressureAcceleration;
 		iiSphData.m_pressureAcceleration[n] += -pressureAcceleration;
 	}
 }
+template<class Kernel>
 void computePressureForceInCellSymmetric(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL,
 										int gridCellIndex, const btFluidSortingGrid& grid, btFluidParticles& particles,
 										btFluidSphSolverIISPH::IiSphParticles& iiSphData)
@@ -249,216 +244,205 @@ void computePressureForceInCellSymmetric(const btFluidSphParametersGlobal& FG, c
 	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
 	for(int particleIndex = currentCell.m_firstIndex; particleIndex <= currentCell.m_lastIndex; ++particleIndex)
 	{
-		computePressureForceNeighborTableSymmetric(FG, FL, particleIndex, particles, iiSphData);
+		computePressureForceNeighborTableSymmetric<Kernel>(FG, FL, particleIndex, particles, iiSphData);
 	}
 }
 
-void btFluidSphSolverIISPH::updateGridAndCalculateSphForces(const btFluidSphParametersGlobal& FG, btFluidSph** fluids, int numFluids)
+template<class Kernel>
+void btFluidSphSolverIISPH::calculateSphForcesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
+															btFluidSphSolverIISPH::IiSphParticles& iiSphData)
 {
-	BT_PROFILE("btFluidSphSolverIISPH::updateGridAndCalculateSphForces()");
+	int numParticles = fluid->numParticles();
 	
-	//SPH data is discarded/recalculated every frame, so only 1
-	//set of arrays are needed if there is no fluid-fluid interaction.
-	if( m_iiSphdata.size() != 1 ) m_iiSphdata.resize(1);
+	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+	const btFluidSortingGrid& grid = fluid->getGrid();
+	btFluidParticles& particles = fluid->internalGetParticles();
 	
-	for(int fluidIndex = 0; fluidIndex < numFluids; ++fluidIndex)
+	fluid->insertParticlesIntoGrid();
+	
+	//Predict Advection
 	{
-		btFluidSph* fluid = fluids[fluidIndex];
-		int numParticles = fluid->numParticles();
-		if(!numParticles) continue;
-		
-		const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
-		const btFluidSortingGrid& grid = fluid->getGrid();
-		btFluidParticles& particles = fluid->internalGetParticles();
-		btFluidSphSolverIISPH::IiSphParticles& iiSphData = m_iiSphdata[0];
-		
-		if( numParticles > iiSphData.size() ) iiSphData.resize(numParticles);
-		
-		fluid->insertParticlesIntoGrid();
-		
-		//Predict Advection
+		BT_PROFILE("Predict Advection");
+	
+		//Compute current density, and build neighbor tables
 		{
-			BT_PROFILE("Predict Advection");
+			BT_PROFILE("Compute density and get neighbors");
 		
-			//Compute current density, and build neighbor tables
-			{
-				BT_PROFILE("Compute density and get neighbors");
+			const btScalar zeroDistancePartialResult = Kernel::densityPartial( FG, btScalar(0.0), btScalar(0.0) );
+			const btScalar initialSphSum = zeroDistancePartialResult * FL.m_initialSum;
+			for(int n = 0; n < numParticles; ++n) iiSphData.m_density[n] = initialSphSum;
+			for(int n = 0; n < numParticles; ++n) iiSphData.m_neighborTable[n].clear();
 			
-				const btScalar poly6ZeroDistance = FG.m_sphRadiusSquared * FG.m_sphRadiusSquared * FG.m_sphRadiusSquared;
-				const btScalar initialSphSum = poly6ZeroDistance * FL.m_initialSum;
-				for(int n = 0; n < numParticles; ++n) iiSphData.m_density[n] = initialSphSum;
-				for(int n = 0; n < numParticles; ++n) iiSphData.m_neighborTable[n].clear();
+			{
+				BT_PROFILE("compute sums");
 				
+				for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
 				{
-					BT_PROFILE("compute sums");
+					const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
+					if( !multithreadingGroup.size() ) continue;
 					
-					for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
-					{
-						const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
-						if( !multithreadingGroup.size() ) continue;
-						
-						for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
-							calculateSumsInCellSymmetric(FG, multithreadingGroup[cell], grid, particles, iiSphData);
-					}
+					for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
+						calculateSumsInCellSymmetric<Kernel>(FG, multithreadingGroup[cell], grid, particles, iiSphData);
 				}
-				
-				for(int n = 0; n < numParticles; ++n) iiSphData.m_density[n] *= FL.m_sphParticleMass * FG.m_poly6KernCoeff;
 			}
 			
-			//Predict next velocity (from viscosity, gravity, surface tension, collision forces)
-			{
-				BT_PROFILE("Predict next velocity");
-			
-				for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_viscosityAcceleration[n].setValue(0,0,0);
-				for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_d_ii[n].setValue(0,0,0);
-					
-				//Compute viscosity force and d_ii
- 				{
-					for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
-					{
-						const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
-					
-						for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
-							computeViscosityForceAndDiiInCellSymmetric(FG, multithreadingGroup[cell], grid, particles, iiSphData);
-					}
-					
-					const btScalar viscosityForceConstants = FG.m_viscosityKernLapCoeff * FL.m_viscosity * FL.m_sphParticleMass;
-					for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_viscosityAcceleration[n] *= viscosityForceConstants;
-					
-					const btScalar d_ii_constants = -FG.m_timeStep * FG.m_timeStep * FL.m_sphParticleMass * FG.m_spikyKernGradCoeff;
-					for(int n = 0; n < fluid->numParticles(); ++n) 
-						iiSphData.m_d_ii[n] *= d_ii_constants / (iiSphData.m_density[n] * iiSphData.m_density[n]);
-				}
+			for(int n = 0; n < numParticles; ++n) iiSphData.m_density[n] *= FL.m_sphParticleMass * Kernel::densityCoeff(FG);
+		}
+		
+		//Predict next velocity (from viscosity, gravity, surface tension, collision forces)
+		{
+			BT_PROFILE("Predict next velocity");
+		
+			for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_viscosityAcceleration[n].setValue(0,0,0);
+			for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_d_ii[n].setValue(0,0,0);
 				
-				for(int n = 0; n < numParticles; ++n)
+			//Compute viscosity force and d_ii
+ 				{
+				for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
 				{
-					btVector3 predictedAcceleration = iiSphData.m_viscosityAcceleration[n] + FL.m_gravity;
+					const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
 				
-					iiSphData.m_predictedVelocity[n] = particles.m_vel[n] + predictedAcceleration * FG.m_timeStep;
+					for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
+						computeViscosityForceAndDiiInCellSymmetric<Kernel>(FG, multithreadingGroup[cell], grid, particles, iiSphData);
 				}
+				
+				const btScalar viscosityForceConstants = Kernel::laplacianCoeff(FG) * FL.m_viscosity * FL.m_sphParticleMass;
+				for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_viscosityAcceleration[n] *= viscosityForceConstants;
+				
+				const btScalar d_ii_constants = -FG.m_timeStep * FG.m_timeStep * FL.m_sphParticleMass * Kernel::gradientCoeff(FG);
+				for(int n = 0; n < fluid->numParticles(); ++n) 
+					iiSphData.m_d_ii[n] *= d_ii_constants / (iiSphData.m_density[n] * iiSphData.m_density[n]);
 			}
 			
-			//Compute density_adv and a_ii
+			for(int n = 0; n < numParticles; ++n)
+			{
+				btVector3 predictedAcceleration = iiSphData.m_viscosityAcceleration[n] + FL.m_gravity;
+			
+				iiSphData.m_predictedVelocity[n] = particles.m_vel[n] + predictedAcceleration * FG.m_timeStep;
+			}
+		}
+		
+		//Compute density_adv and a_ii
+		{
+			BT_PROFILE("Compute density_adv, a_ii");
+		
+			for(int n = 0; n < numParticles; ++n) iiSphData.m_density_adv[n] = btScalar(0.0);
+			for(int n = 0; n < numParticles; ++n) iiSphData.m_a_ii[n] = btScalar(0.0);
+			
+			for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
+			{
+				const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
+				
+				for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
+					computeDensityAdvAndAiiInCellSymmetric<Kernel>(FG, FL, multithreadingGroup[cell], grid, particles, iiSphData);
+			}
+				
+			const btScalar density_adv_constants = FL.m_sphParticleMass * FG.m_timeStep * Kernel::gradientCoeff(FG);
+			for(int n = 0; n < numParticles; ++n) 
+				iiSphData.m_density_adv[n] = iiSphData.m_density[n] + iiSphData.m_density_adv[n] * density_adv_constants;
+				
+				
+			const btScalar a_ii_constants = FL.m_sphParticleMass * Kernel::gradientCoeff(FG);
+			for(int n = 0; n < numParticles; ++n) iiSphData.m_a_ii[n] *= a_ii_constants;
+		}
+		
+		
+		//Compute initial pressure
+		//for(int n = 0; n < numParticles; ++n) iiSphData.m_pressure[n] = FL.m_stiffness * (iiSphData.m_density_adv[n] - FL.m_restDensity);
+		for(int n = 0; n < numParticles; ++n) iiSphData.m_pressure[n] = btScalar(0.0);
+		//for(int n = 0; n < numParticles; ++n) iiSphData.m_pressure[n] = btScalar(0.5) * m_prevPressure[n];
+	}
+	
+	//Pressure Solve
+	if(1)
+	{
+		BT_PROFILE("Solve for pressure");
+	
+		const int MAX_ITERATIONS = 30;
+		for(int iteration = 0; iteration < MAX_ITERATIONS; ++iteration)
+		{
+			//Loop 1 - compute sum{d_ij * p_j}
 			{
-				BT_PROFILE("Compute density_adv, a_ii");
+				BT_PROFILE("Compute d_ij_pj sum");
 			
-				for(int n = 0; n < numParticles; ++n) iiSphData.m_density_adv[n] = btScalar(0.0);
-				for(int n = 0; n < numParticles; ++n) iiSphData.m_a_ii[n] = btScalar(0.0);
+				for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_d_ij_pj_sum[n].setValue(0,0,0);
 				
 				for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
 				{
 					const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
 					
 					for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
-						computeDensityAdvAndAiiInCellSymmetric(FG, FL, multithreadingGroup[cell], grid, particles, iiSphData);
+						computeDijPjSumInCellSymmetric<Kernel>(FG, FL, multithreadingGroup[cell], grid, particles, iiSphData);
 				}
-					
-				const btScalar density_adv_constants = FL.m_sphParticleMass * FG.m_timeStep * FG.m_spikyKernGradCoeff;
-				for(int n = 0; n < numParticles; ++n) 
-					iiSphData.m_density_adv[n] = iiSphData.m_density[n] + iiSphData.m_density_adv[n] * density_adv_constants;
-					
-					
-				const btScalar a_ii_constants = FL.m_sphParticleMass * FG.m_spikyKernGradCoeff;
-				for(int n = 0; n < numParticles; ++n) iiSphData.m_a_ii[n] *= a_ii_constants;
+				
+				const btScalar d_ij_pj_sum_scalar = -FG.m_timeStep * FG.m_timeStep * FL.m_sphParticleMass * Kernel::gradientCoeff(FG);
+				for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_d_ij_pj_sum[n] *= d_ij_pj_sum_scalar;
 			}
 			
-			
-			//Compute initial pressure
-			//for(int n = 0; n < numParticles; ++n) iiSphData.m_pressure[n] = FL.m_stiffness * (iiSphData.m_density_adv[n] - FL.m_restDensity);
-			for(int n = 0; n < numParticles; ++n) iiSphData.m_pressure[n] = btScalar(0.0);
-			//for(int n = 0; n < numParticles; ++n) iiSphData.m_pressure[n] = btScalar(0.5) * m_prevPressure[n];
-		}
-		
-		//Pressure Solve
-		if(1)
-		{
-			BT_PROFILE("Solve for pressure");
-		
-			const int MAX_ITERATIONS = 30;
-			for(int iteration = 0; iteration < MAX_ITERATIONS; ++iteration)
+			//Loop 2 - update pressure (equation 13)
 			{
-				//Loop 1 - compute sum{d_ij * p_j}
-				{
-					BT_PROFILE("Compute d_ij_pj sum");
+				BT_PROFILE("Update pressure");
+			
+				for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_equation13_sum[n] = btScalar(0.0);
 				
-					for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_d_ij_pj_sum[n].setValue(0,0,0);
-					
-					for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
-					{
-						const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
-						
-						for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
-							computeDijPjSumInCellSymmetric(FG, FL, multithreadingGroup[cell], grid, particles, iiSphData);
-					}
+				for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
+				{
+					const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
 					
-					const btScalar d_ij_pj_sum_scalar = -FG.m_timeStep * FG.m_timeStep * FL.m_sphParticleMass * FG.m_spikyKernGradCoeff;
-					for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_d_ij_pj_sum[n] *= d_ij_pj_sum_scalar;
+					for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
+						computeEquation13SumInCellSymmetric<Kernel>(FG, FL, multithreadingGroup[cell], grid, particles, iiSphData);
 				}
 				
-				//Loop 2 - update pressure (equation 13)
-				{
-					BT_PROFILE("Update pressure");
+				const btScalar equation13_sum_scalar = FL.m_sphParticleMass * Kernel::gradientCoeff(FG);
+				for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_equation13_sum[n] *= equation13_sum_scalar;
 				
-					for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_equation13_sum[n] = btScalar(0.0);
-					
-					for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
-					{
-						const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
-						
-						for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
-							computeEquation13SumInCellSymmetric(FG, FL, multithreadingGroup[cell], grid, particles, iiSphData);
-					}
-					
-					const btScalar equation13_sum_scalar = FL.m_sphParticleMass * FG.m_spikyKernGradCoeff;
-					for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_equation13_sum[n] *= equation13_sum_scalar;
+				//Jacobi Iteration on Pressure
+				const bool ALLOW_PRESSURE_FORCE_ATTRACTION = false;
+				const btScalar OMEGA(0.5);
+				for(int n = 0; n < fluid->numParticles(); ++n) 
+				{
+					btScalar b = FL.m_restDensity - iiSphData.m_density_adv[n];
+					if(!ALLOW_PRESSURE_FORCE_ATTRACTION) b = btMin( btScalar(0.0), b );
 					
-					//Jacobi Iteration on Pressure
-					const bool ALLOW_PRESSURE_FORCE_ATTRACTION = false;
-					const btScalar OMEGA(0.5);
-					for(int n = 0; n < fluid->numParticles(); ++n) 
-					{
-						btScalar b = FL.m_restDensity - iiSphData.m_density_adv[n];
-						if(!ALLOW_PRESSURE_FORCE_ATTRACTION) b = btMin( btScalar(0.0), b );
-						
-						iiSphData.m_pressure[n] = (btScalar(1.0) - OMEGA) * iiSphData.m_pressure[n] 
-							+ (OMEGA / iiSphData.m_a_ii[n]) * (b - iiSphData.m_equation13_sum[n]);
-					}
+					iiSphData.m_pressure[n] = (btScalar(1.0) - OMEGA) * iiSphData.m_pressure[n] 
+						+ (OMEGA / iiSphData.m_a_ii[n]) * (b - iiSphData.m_equation13_sum[n]);
 				}
 			}
 		}
+	}
+	
+	//Compute Pressure Force
+	{
+		BT_PROFILE("Compute pressure force");
+	
+		for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_pressureAcceleration[n].setValue(0,0,0);
 		
-		//Compute Pressure Force
+		for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
 		{
-			BT_PROFILE("Compute pressure force");
-		
-			for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_pressureAcceleration[n].setValue(0,0,0);
-			
-			for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
-			{
-				const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
-					
-				for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
-					computePressureForceInCellSymmetric(FG, FL, multithreadingGroup[cell], grid, particles, iiSphData);
-			}
+			const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
 				
-			const btScalar pressureAccelerationScalar = -FL.m_sphParticleMass * FG.m_spikyKernGradCoeff;
-			for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_pressureAcceleration[n] *= pressureAccelerationScalar;
+			for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
+				computePressureForceInCellSymmetric<Kernel>(FG, FL, multithreadingGroup[cell], grid, particles, iiSphData);
 		}
+			
+		const btScalar pressureAccelerationScalar = -FL.m_sphParticleMass * Kernel::gradientCoeff(FG);
+		for(int n = 0; n < fluid->numParticles(); ++n) iiSphData.m_pressureAcceleration[n] *= pressureAccelerationScalar;
+	}
 
-		//Integrate
+	//Integrate
+	{
+		//Apply SPH force to particles
+		//Gravity is applied during velocity integration(after btFluidSphSolverIISPH::updateGridAndCalculateSphForces() is called)
+		for(int n = 0; n < numParticles; ++n) 
 		{
-			//Apply SPH force to particles
-			//Gravity is applied during velocity integration(after btFluidSphSolverIISPH::updateGridAndCalculateSphForces() is called)
-			for(int n = 0; n < numParticles; ++n) 
-			{
-				btVector3 sphAcceleration = iiSphData.m_viscosityAcceleration[n] + iiSphData.m_pressureAcceleration[n];
-			
-				fluid->applyForce(n, sphAcceleration * FL.m_particleMass);
-			}
+			btVector3 sphAcceleration = iiSphData.m_viscosityAcceleration[n] + iiSphData.m_pressureAcceleration[n];
+		
+			fluid->applyForce(n, sphAcceleration * FL.m_particleMass);
 		}
 	}
 }
 
+template<class Kernel>
 void btFluidSphSolverIISPH::calculateSumsInCellSymmetric(const btFluidSphParametersGlobal& FG, int gridCellIndex, 
 														const btFluidSortingGrid& grid, btFluidParticles& particles,
 														btFluidSphSolverIISPH::IiSphParticles& sphData)
@@ -487,12 +471,12 @@ void btFluidSphSolverIISPH::calculateSumsInCellSymmetric(const btFluidSphParamet
 					
 					if(FG.m_sphRadiusSquared > distanceSquared)
 					{
-						btScalar c = FG.m_sphRadiusSquared - distanceSquared;
-						btScalar poly6KernPartialResult = c * c * c;
-						sphData.m_density[i] += poly6KernPartialResult;
-						sphData.m_density[n] += poly6KernPartialResult;
-						
 						btScalar distance = btSqrt(distanceSquared);
+						
+						btScalar densityPartialResult = Kernel::densityPartial(FG, distanceSquared, distance);
+						sphData.m_density[i] += densityPartialResult;
+						sphData.m_density[n] += densityPartialResult;
+						
 						distance = (distance < SIMD_EPSILON) ? SIMD_EPSILON : distance;
 						
 						if( !sphData.m_neighborTable[i].isFilled() ) sphData.m_neighborTable[i].addNeighbor(n, distance);
@@ -508,3 +492,37 @@ void btFluidSphSolverIISPH::calculateSumsInCellSymmetric(const btFluidSphParamet
 		}
 	}
 }
+
+void btFluidSphSolverIISPH::updateGridAndCalculateSphForces(const btFluidSphParametersGlobal& FG, btFluidSph** fluids, int numFluids)
+{
+	BT_PROFILE("btFluidSphSolverIISPH::updateGridAndCalculateSphForces()");
+	
+	//SPH data is discarded/recalculated every frame, so only 1
+	//set of arrays are needed if there is no fluid-fluid interaction.
+	if( m_iiSphdata.size() != 1 ) m_iiSphdata.resize(1);
+	
+	for(int fluidIndex = 0; fluidIndex < numFluids; ++fluidIndex)
+	{
+		btFluidSph* fluid = fluids[fluidIndex];
+		int numParticles = fluid->numParticles();
+		if(!numParticles) continue;
+		
+		btFluidSphSolverIISPH::IiSphParticles& iiSphData = m_iiSphdata[0];
+		if( numParticles > iiSphData.size() ) iiSphData.resize(numParticles);
+		
+		switch(FG.m_sphKernel)
+		{
+			case BT_FLUID_SPH_KERNEL_CUBIC_SPLINE:
+				calculateSphForcesSingleFluid<btFluidSphKernelCubicSpline>(FG, fluid, iiSphData);
+				break;
+			case BT_FLUID_SPH_KERNEL_WENDLAND_C2:
+				calculateSphForcesSingleFluid<btFluidSphKernelWendlandC2>(FG, fluid, iiSphData);
+				break;
+			
+			case BT_FLUID_SPH_KERNEL_MULLER_2003:
+			default:
+				calculateSphForcesSingleFluid<btFluidSphKernelMuller2003>(FG, fluid, iiSphData);
+				break;
+		}
+	}
+}
@@ -65,11 +65,17 @@ protected:
 	btAlignedObjectArray<btFluidSphSolverIISPH::IiSphParticles> m_iiSphdata;
 
 public:
+	///Supports all kernels of btFluidSphKernelType; see btFluidSphParametersGlobal::m_sphKernel.
 	virtual void updateGridAndCalculateSphForces(const btFluidSphParametersGlobal& FG, btFluidSph** fluids, int numFluids);
 	
+	template<class Kernel>
 	static void calculateSumsInCellSymmetric(const btFluidSphParametersGlobal& FG, int gridCellIndex, 
 											const btFluidSortingGrid& grid, btFluidParticles& particles,
 											btFluidSphSolverIISPH::IiSphParticles& sphData);
+	
+protected:
+	template<class Kernel>
+	void calculateSphForcesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, btFluidSphSolverIISPH::IiSphParticles& iiSphData);
 };
 
 #endif
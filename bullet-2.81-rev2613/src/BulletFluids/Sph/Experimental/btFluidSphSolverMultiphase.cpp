@@ -28,8 +28,8 @@ void btFluidSphSolverMultiphase::updateGridAndCalculateSphForces(const btFluidSp
 	for(int i = 0; i < numFluids; ++i) fluids[i]->insertParticlesIntoGrid();
 	
 	//Determine intersecting btFluidSph AABBs
-	btAlignedObjectArray< btAlignedObjectArray<btFluidSph*> > interactingFluids;
-	btAlignedObjectArray< btAlignedObjectArray<btFluidSphSolverDefault::SphParticles*> > interactingSphData;
+	btAlignedObjectArray< btAlignedObjectArray<btFluidSph*> >& interactingFluids = m_tempInteractingFluids;
+	btAlignedObjectArray< btAlignedObjectArray<btFluidSphSolverDefault::SphParticles*> >& interactingSphData = m_tempInteractingSphData;
 	interactingFluids.resize(numFluids);
 	interactingSphData.resize(numFluids);
 	
@@ -25,9 +25,16 @@ subject to the following restrictions:
 ///will not rise even if heavier fluid particles are on top.
 class btFluidSphSolverMultiphase : public btFluidSphSolverDefault
 {
+	//Indexed by fluid; kept between steps to avoid reallocating the nested arrays
+	btAlignedObjectArray< btAlignedObjectArray<btFluidSph*> > m_tempInteractingFluids;
+	btAlignedObjectArray< btAlignedObjectArray<btFluidSphSolverDefault::SphParticles*> > m_tempInteractingSphData;
+	
 public:
 	virtual void updateGridAndCalculateSphForces(const btFluidSphParametersGlobal& FG, btFluidSph** fluids, int numFluids);
 	
+	///The multiphase sums do not include btFluidSphRigidBoundaryParticles.
+	virtual bool usesRigidBoundaryParticles(const btFluidSph* fluid) const { return false; }
+	
 protected:
 	virtual void sphComputePressureMultiphase(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, btFluidSphSolverDefault::SphParticles& sphData,
 												btAlignedObjectArray<btFluidSph*>& interactingFluids, 
@@ -61,6 +61,7 @@ void determineNeighborsInCellSymmetric(const btFluidSphParametersGlobal& FG, int
 }
 
 #define ASSUME_REST_DENSITY_FOR_VISCOSITY_FORCE
+template<class Kernel>
 void computeViscosityForceNeighborTableSymmetric(const btFluidSphParametersGlobal& FG, int particleIndex, 
 													btFluidParticles& particles, btFluidSphSolverPCISPH::PciSphParticles& pciSphData)
 {
@@ -72,13 +73,13 @@ void computeViscosityForceNeighborTableSymmetric(const btFluidSphParametersGloba
 		btScalar distance = pciSphData.m_neighborTable[i].getDistance(j);
 		
 		if(distance >= FG.m_sphSmoothRadius) continue;
-		btScalar closeness = FG.m_sphSmoothRadius - distance;
+		btScalar laplacianPartialResult = Kernel::laplacianPartial(FG, distance);
 		
 #ifdef ASSUME_REST_DENSITY_FOR_VISCOSITY_FORCE
 		//Assume that particles are at rest density
-		btScalar viscosityScalar = closeness;	//Partial result of Laplacian of viscosity kernel
+		btScalar viscosityScalar = laplacianPartialResult;
 #else
-		btScalar viscosityScalar = closeness / pciSphData.m_density[n];
+		btScalar viscosityScalar = laplacianPartialResult / pciSphData.m_density[n];
 #endif
 	
 		btVector3 viscosityForce = (particles.m_vel_eval[n] - particles.m_vel_eval[i]) * viscosityScalar;
@@ -87,6 +88,7 @@ void computeViscosityForceNeighborTableSymmetric(const btFluidSphParametersGloba
 		pciSphData.m_viscosityForce[n] += -viscosityForce;
 	}
 }
+template<class Kernel>
 void computeViscosityForceInCellSymmetric(const btFluidSphParametersGlobal& FG, int gridCellIndex, 
 										const btFluidSortingGrid& grid, btFluidParticles& particles,
 										btFluidSphSolverPCISPH::PciSphParticles& pciSphData)
@@ -94,10 +96,11 @@ void computeViscosityForceInCellSymmetric(const btFluidSphParametersGlobal& FG,
 	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
 	for(int particleIndex = currentCell.m_firstIndex; particleIndex <= currentCell.m_lastIndex; ++particleIndex)
 	{
-		computeViscosityForceNeighborTableSymmetric(FG, particleIndex, particles, pciSphData);
+		computeViscosityForceNeighborTableSymmetric<Kernel>(FG, particleIndex, particles, pciSphData);
 	}
 }
 
+template<class Kernel>
 void computeSumsNeighborTableSymmetric(const btFluidSphParametersGlobal& FG, int particleIndex, 
 										btFluidParticles& particles, btFluidSphSolverPCISPH::PciSphParticles& pciSphData,
 										const btAlignedObjectArray<btVector3>& particlePositions)
@@ -111,17 +114,18 @@ void computeSumsNeighborTableSymmetric(const btFluidSphParametersGlobal& FG, int
 		btVector3 difference = (particlePositions[i] - particlePositions[n]) * FG.m_simulationScale;
 		
 		btScalar distanceSquared = difference.length2();
-		pciSphData.m_neighborTable[i].updateDistance( j, btSqrt(distanceSquared) );
+		btScalar distance = btSqrt(distanceSquared);
+		pciSphData.m_neighborTable[i].updateDistance(j, distance);
 		
 		if(distanceSquared >= FG.m_sphRadiusSquared) continue;
-		btScalar c = FG.m_sphRadiusSquared - distanceSquared;
 		
-		btScalar poly6KernPartialResult = c * c * c;
+		btScalar densityPartialResult = Kernel::densityPartial(FG, distanceSquared, distance);
 		
-		pciSphData.m_density[i] += poly6KernPartialResult;
-		pciSphData.m_density[n] += poly6KernPartialResult;
+		pciSphData.m_density[i] += densityPartialResult;
+		pciSphData.m_density[n] += densityPartialResult;
 	}
 }
+template<class Kernel>
 void computeSumsInCellSymmetric(const btFluidSphParametersGlobal& FG, int gridCellIndex, 
 								const btFluidSortingGrid& grid, btFluidParticles& particles,
 								btFluidSphSolverPCISPH::PciSphParticles& pciSphData,
@@ -130,11 +134,12 @@ void computeSumsInCellSymmetric(const btFluidSphParametersGlobal& FG, int gridCe
 	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
 	for(int particleIndex = currentCell.m_firstIndex; particleIndex <= currentCell.m_lastIndex; ++particleIndex)
 	{
-		computeSumsNeighborTableSymmetric(FG, particleIndex, particles, pciSphData, particlePositions);
+		computeSumsNeighborTableSymmetric<Kernel>(FG, particleIndex, particles, pciSphData, particlePositions);
 	}
 }
 
 
+template<class Kernel>
 void computePressureForceNeighborTableSymmetric(const btFluidSphParametersGlobal& FG, int particleIndex, 
 													btFluidParticles& particles, btFluidSphSolverPCISPH::PciSphParticles& pciSphData,
 													const btAlignedObjectArray<btVector3>& particlePositions)
@@ -147,23 +152,24 @@ void computePressureForceNeighborTableSymmetric(const btFluidSphParametersGlobal
 		btScalar distance = pciSphData.m_neighborTable[i].getDistance(j);
 		if(distance >= FG.m_sphSmoothRadius) continue;
 		
-		btScalar closeness = FG.m_sphSmoothRadius - distance;
+		btScalar gradientPartialResult = Kernel::gradientPartial(FG, distance);
 	
-		btScalar pressureScalar = (closeness*closeness) * (pciSphData.m_pressure[i] + pciSphData.m_pressure[n]) / pciSphData.m_density[n];
+		btScalar pressureScalar = gradientPartialResult * (pciSphData.m_pressure[i] + pciSphData.m_pressure[n]) / pciSphData.m_density[n];
 		
 		//Alternate pressure force
-		//btScalar pressureScalar = (closeness*closeness);
+		//btScalar pressureScalar = gradientPartialResult;
 		//btScalar pterm_i = pciSphData.m_pressure[i] / (pciSphData.m_density[i]*pciSphData.m_density[i]);
 		//btScalar pterm_n = pciSphData.m_pressure[n] / (pciSphData.m_density[n]*pciSphData.m_density[n]);
 		//pressureScalar *= (pterm_i + perm_n);
 		
-		btVector3 simScaleNormal = (particlePositions[i] - particlePositions[n]) * (FG.m_simulationScale / distance);
-		btVector3 pressureForce = simScaleNormal * pressureScalar;
+		btVector3 simScaleDifference = (particlePositions[i] - particlePositions[n]) * FG.m_simulationScale;
+		btVector3 pressureForce = simScaleDifference * pressureScalar;
 		
 		pciSphData.m_pressureForce[i] += pressureForce;
 		pciSphData.m_pressureForce[n] += -pressureForce;
 	}
 }
+template<class Kernel>
 void computePressureForceInCellSymmetric(const btFluidSphParametersGlobal& FG, int gridCellIndex, 
 										const btFluidSortingGrid& grid, btFluidParticles& particles,
 										btFluidSphSolverPCISPH::PciSphParticles& pciSphData,
@@ -172,7 +178,7 @@ void computePressureForceInCellSymmetric(const btFluidSphParametersGlobal& FG, i
 	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
 	for(int particleIndex = currentCell.m_firstIndex; particleIndex <= currentCell.m_lastIndex; ++particleIndex)
 	{
-		computePressureForceNeighborTableSymmetric(FG, particleIndex, particles, pciSphData, particlePositions);
+		computePressureForceNeighborTableSymmetric<Kernel>(FG, particleIndex, particles, pciSphData, particlePositions);
 	}
 }
 
@@ -303,206 +309,226 @@ btScalar computeStiffness(const btFluidSphParametersGlobal& FG, const btFluidSph
 	return deltaMin;
 }
 
-void btFluidSphSolverPCISPH::updateGridAndCalculateSphForces(const btFluidSphParametersGlobal& FG, btFluidSph** fluids, int numFluids)
+template<class Kernel>
+void btFluidSphSolverPCISPH::calculateSphForcesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
+															btFluidSphSolverPCISPH::PciSphParticles& pciSphData)
 {
-	BT_PROFILE("btFluidSphSolverPCISPH::updateGridAndCalculateSphForces()");
+	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+	const btFluidSortingGrid& grid = fluid->getGrid();
+	btFluidParticles& particles = fluid->internalGetParticles();
 	
-	//SPH data is discarded/recalculated every frame, so only 1
-	//set of arrays are needed if there is no fluid-fluid interaction.
-	if( m_pciSphData.size() != 1 ) m_pciSphData.resize(1);
+	fluid->insertParticlesIntoGrid();
 	
-	for(int i = 0; i < numFluids; ++i)
+	//Generate neighbor tables
+	for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_neighborTable[n].clear();
+	for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
 	{
-		btFluidSph* fluid = fluids[i];
-		if( !fluid->numParticles() ) continue;
-		
-		const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
-		const btFluidSortingGrid& grid = fluid->getGrid();
-		btFluidParticles& particles = fluid->internalGetParticles();
-		btFluidSphSolverPCISPH::PciSphParticles& pciSphData = m_pciSphData[0];
-		
-		if( fluid->numParticles() > pciSphData.size() ) pciSphData.resize( fluid->numParticles() );
-		
-		fluid->insertParticlesIntoGrid();
+		const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
+	
+		for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
+			determineNeighborsInCellSymmetric(FG, multithreadingGroup[cell], grid, particles, pciSphData);
+	}
+	
+
+#ifndef ASSUME_REST_DENSITY_FOR_VISCOSITY_FORCE
+	{
+		const btScalar zeroDistancePartialResult = Kernel::densityPartial( FG, btScalar(0.0), btScalar(0.0) );
+		const btScalar initialSphSum = zeroDistancePartialResult * FL.m_initialSum;
+		for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_density[n] = initialSphSum;
 		
-		//Generate neighbor tables
-		for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_neighborTable[n].clear();
 		for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
 		{
 			const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
-		
+			
 			for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
-				determineNeighborsInCellSymmetric(FG, multithreadingGroup[cell], grid, particles, pciSphData);
+				computeSumsInCellSymmetric<Kernel>(FG, multithreadingGroup[cell], grid, particles, pciSphData, particles.m_pos);
 		}
 		
-
-#ifndef ASSUME_REST_DENSITY_FOR_VISCOSITY_FORCE
-		{
-			const btScalar poly6ZeroDistance = FG.m_sphRadiusSquared * FG.m_sphRadiusSquared * FG.m_sphRadiusSquared;
-			const btScalar initialSphSum = poly6ZeroDistance * FL.m_initialSum;
-			for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_density[n] = initialSphSum;
-			
-			for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
-			{
-				const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
-				
-				for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
-					computeSumsInCellSymmetric(FG, multithreadingGroup[cell], grid, particles, pciSphData, particles.m_pos);
-			}
-			
-			for(int n = 0; n < fluid->numParticles(); ++n) 
-				pciSphData.m_density[n] *= FL.m_sphParticleMass * FG.m_poly6KernCoeff;
-		}
+		for(int n = 0; n < fluid->numParticles(); ++n) 
+			pciSphData.m_density[n] *= FL.m_sphParticleMass * Kernel::densityCoeff(FG);
+	}
 #endif			
+	
+	//Calculate viscosity force
+	//Other forces(gravity, collision) should also be included here
+	{
+		for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_viscosityForce[n].setValue(0,0,0);
 		
-		//Calculate viscosity force
-		//Other forces(gravity, collision) should also be included here
+		for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
 		{
-			for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_viscosityForce[n].setValue(0,0,0);
-			
-			for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
-			{
-				const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
-			
-				for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
-					computeViscosityForceInCellSymmetric(FG, multithreadingGroup[cell], grid, particles, pciSphData);
-			}
-			
+			const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
+		
+			for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
+				computeViscosityForceInCellSymmetric<Kernel>(FG, multithreadingGroup[cell], grid, particles, pciSphData);
+		}
+		
 
 #ifdef ASSUME_REST_DENSITY_FOR_VISCOSITY_FORCE
-			//Assume that particles are at rest density
-			const btScalar viscosityForceConstants = FG.m_viscosityKernLapCoeff * FL.m_viscosity * FL.m_particleMass / FL.m_restDensity;
+		//Assume that particles are at rest density
+		const btScalar viscosityForceConstants = Kernel::laplacianCoeff(FG) * FL.m_viscosity * FL.m_particleMass / FL.m_restDensity;
 #else
-			const btScalar viscosityForceConstants = FG.m_viscosityKernLapCoeff * FL.m_viscosity * FL.m_particleMass;
+		const btScalar viscosityForceConstants = Kernel::laplacianCoeff(FG) * FL.m_viscosity * FL.m_particleMass;
 #endif
-			for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_viscosityForce[n] *= viscosityForceConstants;
-		}
-		
-		//Initialize pressure, pressure force
-		for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_pressureForce[n].setValue(0,0,0);
-		for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_pressure[n] = btScalar(0.0);
-		
-		
-		btScalar currentDensityError(BT_LARGE_FLOAT);	//Arbitrary initial value, higher than MAX_DENSITY_ERROR
-		const btScalar MAX_DENSITY_ERROR(0.0);			//Percentage; set to 0 to keep iterating even if the fluid is below the density threshold
-		const int MIN_ITERATIONS = 4;
-		const int MAX_ITERATIONS = 4;
-		for(int j = 0; (j < MIN_ITERATIONS || currentDensityError > MAX_DENSITY_ERROR) && j < MAX_ITERATIONS; ++j)
+		for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_viscosityForce[n] *= viscosityForceConstants;
+	}
+	
+	//Initialize pressure, pressure force
+	for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_pressureForce[n].setValue(0,0,0);
+	for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_pressure[n] = btScalar(0.0);
+	
+	
+	btScalar currentDensityError(BT_LARGE_FLOAT);	//Arbitrary initial value, higher than MAX_DENSITY_ERROR
+	const btScalar MAX_DENSITY_ERROR(0.0);			//Percentage; set to 0 to keep iterating even if the fluid is below the density threshold
+	const int MIN_ITERATIONS = 4;
+	const int MAX_ITERATIONS = 4;
+	for(int j = 0; (j < MIN_ITERATIONS || currentDensityError > MAX_DENSITY_ERROR) && j < MAX_ITERATIONS; ++j)
+	{
+		//Predict velocity
+		for(int n = 0; n < fluid->numParticles(); ++n) 
 		{
-			//Predict velocity
-			for(int n = 0; n < fluid->numParticles(); ++n) 
-			{
 #ifdef ASSUME_REST_DENSITY_FOR_VISCOSITY_FORCE
-				btScalar density = (j == 0) ? FL.m_restDensity : pciSphData.m_density[n];
-				btVector3 acceleration = (pciSphData.m_viscosityForce[n] + pciSphData.m_pressureForce[n]) / density;
+			btScalar density = (j == 0) ? FL.m_restDensity : pciSphData.m_density[n];
+			btVector3 acceleration = (pciSphData.m_viscosityForce[n] + pciSphData.m_pressureForce[n]) / density;
 #else
-				//Alternate pressure force
-				//btVector3 viscosityAccel = (pciSphData.m_viscosityForce[n]) / pciSphData.m_density[n];
-				//btVector3 pressureAccel = pciSphData.m_pressureForce[n];
-				//btVector3 acceleration = viscosityAccel + pressureAccel;
+			//Alternate pressure force
+			//btVector3 viscosityAccel = (pciSphData.m_viscosityForce[n]) / pciSphData.m_density[n];
+			//btVector3 pressureAccel = pciSphData.m_pressureForce[n];
+			//btVector3 acceleration = viscosityAccel + pressureAccel;
 
-				btVector3 acceleration = (pciSphData.m_viscosityForce[n] + pciSphData.m_pressureForce[n]) / pciSphData.m_density[n];
+			btVector3 acceleration = (pciSphData.m_viscosityForce[n] + pciSphData.m_pressureForce[n]) / pciSphData.m_density[n];
 #endif
 
-				const bool CONSIDER_EXTERNAL_FORCES = false;
-				if(CONSIDER_EXTERNAL_FORCES)
-				{
-					acceleration += FL.m_gravity;
-				
-					const btScalar simScaleParticleRadius = FL.m_particleRadius * FG.m_simulationScale;
-					acceleration += determineAabbAcceleration(FG, FL, simScaleParticleRadius, particles, i);
-				}
-				
-				pciSphData.m_predictedVelocity[n] = particles.m_vel[n] + acceleration * FG.m_timeStep;	
-			}
-				
-			//Predict position
-				//Velocity is at simulation scale; divide by simulation scale to convert to world scale
-			btScalar timeStepDivSimScale = FG.m_timeStep / FG.m_simulationScale;
-			for(int n = 0; n < fluid->numParticles(); ++n) 
-				pciSphData.m_predictedPosition[n] = particles.m_pos[n] + pciSphData.m_predictedVelocity[n] * timeStepDivSimScale;
-			
-			//Predict density
+			const bool CONSIDER_EXTERNAL_FORCES = false;
+			if(CONSIDER_EXTERNAL_FORCES)
 			{
-				const btScalar poly6ZeroDistance = FG.m_sphRadiusSquared * FG.m_sphRadiusSquared * FG.m_sphRadiusSquared;
-				const btScalar initialSphSum = poly6ZeroDistance * FL.m_initialSum;
-				for(int n = 0; n < fluid->numParticles(); ++n)  pciSphData.m_density[n] = initialSphSum;
-				
-				for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
-				{
-					const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
-					
-					for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
-						computeSumsInCellSymmetric(FG, multithreadingGroup[cell], grid, particles, pciSphData, pciSphData.m_predictedPosition);
-				}
-				
-				for(int n = 0; n < fluid->numParticles(); ++n) 
-					pciSphData.m_density[n] *= FL.m_sphParticleMass * FG.m_poly6KernCoeff;
-			}
+				acceleration += FL.m_gravity;
 			
-			//Predict density variation
-			btScalar maxDensityError(0.0);
-			for(int n = 0; n < fluid->numParticles(); ++n)
-			{
-				btScalar densityError = pciSphData.m_density[n] - FL.m_restDensity;
-			
-				maxDensityError = btMax(maxDensityError, densityError);
-				pciSphData.m_densityError[n] = densityError;
-			}
-			currentDensityError = (maxDensityError / FL.m_restDensity) * btScalar(100.0);
-			
-			const bool PRINT_DENSITY_ERROR = true;
-			if( PRINT_DENSITY_ERROR && fluid->numParticles() )
-			{
-				btScalar totalPositiveDensityError(0.0);
-				for(int n = 0; n < fluid->numParticles(); ++n) totalPositiveDensityError += btMax( btScalar(0.0), pciSphData.m_densityError[n]);
-				
-				printf("iteration: %d \n", j);
-				printf("currentDensityError: %f%% (maxDensityError: %f) \n", currentDensityError, maxDensityError);
-				printf("total positive density error: %f \n", totalPositiveDensityError);
-				printf("average positive density error: %f \n", totalPositiveDensityError  / static_cast<btScalar>(fluid->numParticles()));
-				
-				//computeStiffness(FG, fluid);
-				
-				printf("\n");
+				const btScalar simScaleParticleRadius = FL.m_particleRadius * FG.m_simulationScale;
+				acceleration += determineAabbAcceleration(FG, FL, simScaleParticleRadius, particles, n);
 			}
 			
+			pciSphData.m_predictedVelocity[n] = particles.m_vel[n] + acceleration * FG.m_timeStep;	
+		}
 			
-			//Update pressure
-			btScalar stiffness = btScalar(0.7);
-			//btScalar stiffness = btScalar(0.035281);
-			for(int n = 0; n < fluid->numParticles(); ++n) 
-				pciSphData.m_pressure[n] += pciSphData.m_densityError[n] * stiffness;
+		//Predict position
+			//Velocity is at simulation scale; divide by simulation scale to convert to world scale
+		btScalar timeStepDivSimScale = FG.m_timeStep / FG.m_simulationScale;
+		for(int n = 0; n < fluid->numParticles(); ++n) 
+			pciSphData.m_predictedPosition[n] = particles.m_pos[n] + pciSphData.m_predictedVelocity[n] * timeStepDivSimScale;
+		
+		//Predict density
+		{
+			const btScalar zeroDistancePartialResult = Kernel::densityPartial( FG, btScalar(0.0), btScalar(0.0) );
+			const btScalar initialSphSum = zeroDistancePartialResult * FL.m_initialSum;
+			for(int n = 0; n < fluid->numParticles(); ++n)  pciSphData.m_density[n] = initialSphSum;
 			
-			//Compute pressure force
-			for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_pressureForce[n].setValue(0,0,0);
 			for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
 			{
 				const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
-			
+				
 				for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
-					computePressureForceInCellSymmetric(FG, multithreadingGroup[cell], grid, particles, pciSphData, pciSphData.m_predictedPosition);
+					computeSumsInCellSymmetric<Kernel>(FG, multithreadingGroup[cell], grid, particles, pciSphData, pciSphData.m_predictedPosition);
 			}
 			
-			const btScalar pressureForceConstants = btScalar(-0.5) * FG.m_spikyKernGradCoeff * FL.m_particleMass;
+			for(int n = 0; n < fluid->numParticles(); ++n) 
+				pciSphData.m_density[n] *= FL.m_sphParticleMass * Kernel::densityCoeff(FG);
+		}
+		
+		//Predict density variation
+		btScalar maxDensityError(0.0);
+		for(int n = 0; n < fluid->numParticles(); ++n)
+		{
+			btScalar densityError = pciSphData.m_density[n] - FL.m_restDensity;
+		
+			maxDensityError = btMax(maxDensityError, densityError);
+			pciSphData.m_densityError[n] = densityError;
+		}
+		currentDensityError = (maxDensityError / FL.m_restDensity) * btScalar(100.0);
+		
+		const bool PRINT_DENSITY_ERROR = true;
+		if( PRINT_DENSITY_ERROR && fluid->numParticles() )
+		{
+			btScalar totalPositiveDensityError(0.0);
+			for(int n = 0; n < fluid->numParticles(); ++n) totalPositiveDensityError += btMax( btScalar(0.0), pciSphData.m_densityError[n]);
 			
-			//Alternate pressure force
-			//const btScalar pressureForceConstants = -FG.m_spikyKernGradCoeff * FL.m_particleMass;
+			printf("iteration: %d \n", j);
+			printf("currentDensityError: %f%% (maxDensityError: %f) \n", currentDensityError, maxDensityError);
+			printf("total positive density error: %f \n", totalPositiveDensityError);
+			printf("average positive density error: %f \n", totalPositiveDensityError  / static_cast<btScalar>(fluid->numParticles()));
 			
-			for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_pressureForce[n] *= pressureForceConstants;
+			//computeStiffness(FG, fluid);
+			
+			printf("\n");
 		}
 		
-		//Apply SPH force to particles
+		
+		//Update pressure
+		btScalar stiffness = btScalar(0.7);
+		//btScalar stiffness = btScalar(0.035281);
 		for(int n = 0; n < fluid->numParticles(); ++n) 
+			pciSphData.m_pressure[n] += pciSphData.m_densityError[n] * stiffness;
+		
+		//Compute pressure force
+		for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_pressureForce[n].setValue(0,0,0);
+		for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
 		{
-			btVector3 sphAcceleration = (pciSphData.m_viscosityForce[n] + pciSphData.m_pressureForce[n]) / pciSphData.m_density[n];
+			const btAlignedObjectArray<int>& multithreadingGroup = grid.internalGetMultithreadingGroup(group);
 		
-			//Alternate pressure force
-			//btVector3 viscosityAccel = (pciSphData.m_viscosityForce[n]) / pciSphData.m_density[n];
-			//btVector3 pressureAccel = pciSphData.m_pressureForce[n];
-			//btVector3 sphAcceleration = viscosityAccel + pressureAccel;
+			for(int cell = 0; cell < multithreadingGroup.size(); ++cell)
+				computePressureForceInCellSymmetric<Kernel>(FG, multithreadingGroup[cell], grid, particles, pciSphData, pciSphData.m_predictedPosition);
+		}
+		
+		const btScalar pressureForceConstants = btScalar(-0.5) * Kernel::gradientCoeff(FG) * FL.m_particleMass;
+		
+		//Alternate pressure force
+		//const btScalar pressureForceConstants = -Kernel::gradientCoeff(FG) * FL.m_particleMass;
+		
+		for(int n = 0; n < fluid->numParticles(); ++n) pciSphData.m_pressureForce[n] *= pressureForceConstants;
+	}
+	
+	//Apply SPH force to particles
+	for(int n = 0; n < fluid->numParticles(); ++n) 
+	{
+		btVector3 sphAcceleration = (pciSphData.m_viscosityForce[n] + pciSphData.m_pressureForce[n]) / pciSphData.m_density[n];
+	
+		//Alternate pressure force
+		//btVector3 viscosityAccel = (pciSphData.m_viscosityForce[n]) / pciSphData.m_density[n];
+		//btVector3 pressureAccel = pciSphData.m_pressureForce[n];
+		//btVector3 sphAcceleration = viscosityAccel + pressureAccel;
+		
+		fluid->applyForce(n, sphAcceleration * FL.m_particleMass);
+	}
+}
+
+void btFluidSphSolverPCISPH::updateGridAndCalculateSphForces(const btFluidSphParametersGlobal& FG, btFluidSph** fluids, int numFluids)
+{
+	BT_PROFILE("btFluidSphSolverPCISPH::updateGridAndCalculateSphForces()");
+	
+	//SPH data is discarded/recalculated every frame, so only 1
+	//set of arrays are needed if there is no fluid-fluid interaction.
+	if( m_pciSphData.size() != 1 ) m_pciSphData.resize(1);
+	
+	for(int i = 0; i < numFluids; ++i)
+	{
+		btFluidSph* fluid = fluids[i];
+		if( !fluid->numParticles() ) continue;
+		
+		btFluidSphSolverPCISPH::PciSphParticles& pciSphData = m_pciSphData[0];
+		if( fluid->numParticles() > pciSphData.size() ) pciSphData.resize( fluid->numParticles() );
+		
+		switch(FG.m_sphKernel)
+		{
+			case BT_FLUID_SPH_KERNEL_CUBIC_SPLINE:
+				calculateSphForcesSingleFluid<btFluidSphKernelCubicSpline>(FG, fluid, pciSphData);
+				break;
+			case BT_FLUID_SPH_KERNEL_WENDLAND_C2:
+				calculateSphForcesSingleFluid<btFluidSphKernelWendlandC2>(FG, fluid, pciSphData);
+				break;
 			
-			fluid->applyForce(n, sphAcceleration * FL.m_particleMass);
+			case BT_FLUID_SPH_KERNEL_MULLER_2003:
+			default:
+				calculateSphForcesSingleFluid<btFluidSphKernelMuller2003>(FG, fluid, pciSphData);
+				break;
 		}
 	}
 }
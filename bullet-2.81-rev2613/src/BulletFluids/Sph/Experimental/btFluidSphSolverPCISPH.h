@@ -61,7 +61,12 @@ protected:
 	btAlignedObjectArray<btFluidSphSolverPCISPH::PciSphParticles> m_pciSphData;
 
 public:
+	///Supports all kernels of btFluidSphKernelType; see btFluidSphParametersGlobal::m_sphKernel.
 	virtual void updateGridAndCalculateSphForces(const btFluidSphParametersGlobal& FG, btFluidSph** fluids, int numFluids);
+	
+protected:
+	template<class Kernel>
+	void calculateSphForcesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, btFluidSphSolverPCISPH::PciSphParticles& pciSphData);
 };
 
 #endif
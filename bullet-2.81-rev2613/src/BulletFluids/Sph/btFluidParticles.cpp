@@ -24,7 +24,17 @@ int btFluidParticles::addParticle(const btVector3& position)
 		m_vel.push_back( btVector3() );
 		m_vel_eval.push_back( btVector3() );
 		m_accumulatedForce.push_back( btVector3() );
+		m_massScale.push_back( btScalar(1.0) );
 		m_userPointer.push_back(0);
+		m_sleepCounter.push_back(0);
+		m_sleeping.push_back(0);
+		m_rigidContactCacheIndex.push_back(-1);
+		m_id.push_back(-1);
+		m_age.push_back( btScalar(0.0) );
+		m_scalarChannels.push_back();
+		m_vectorChannels.push_back();
+		m_intChannels.push_back();
+		m_byteChannels.push_back();
 		
 		int index = size() - 1;
 		
@@ -38,6 +48,68 @@ int btFluidParticles::addParticle(const btVector3& position)
 	
 	return size();
 }
+int btFluidParticles::addParticles(const btVector3* positions, const btVector3* velocities, int count)
+{
+	int firstIndex = size();
+	int numAdded = btMin(count, m_maxParticles - firstIndex);
+	if(numAdded <= 0) return 0;
+	
+	//Scalar, pointer, and int arrays and channels are initialized to their default values
+	resize(firstIndex + numAdded);
+	
+	for(int i = 0; i < numAdded; ++i) m_pos[firstIndex + i] = positions[i];
+	
+	if(velocities)
+	{
+		for(int i = 0; i < numAdded; ++i) m_vel[firstIndex + i] = velocities[i];
+		for(int i = 0; i < numAdded; ++i) m_vel_eval[firstIndex + i] = velocities[i];
+	}
+	else
+	{
+		for(int i = firstIndex; i < size(); ++i) m_vel[i].setValue(0,0,0);
+		for(int i = firstIndex; i < size(); ++i) m_vel_eval[i].setValue(0,0,0);
+	}
+	
+	for(int i = firstIndex; i < size(); ++i) m_accumulatedForce[i].setValue(0,0,0);
+	
+	return numAdded;
+}
+void btFluidParticles::resetParticle(int index, const btVector3& position)
+{
+	m_pos[index] = position;
+	m_vel[index].setValue(0,0,0);
+	m_vel_eval[index].setValue(0,0,0);
+	m_accumulatedForce[index].setValue(0,0,0);
+	m_massScale[index] = btScalar(1.0);
+	m_userPointer[index] = 0;
+	m_sleepCounter[index] = 0;
+	m_sleeping[index] = 0;
+	m_rigidContactCacheIndex[index] = -1;
+	m_id[index] = -1;
+	m_age[index] = btScalar(0.0);
+	m_scalarChannels.resetParticle(index);
+	m_vectorChannels.resetParticle(index);
+	m_intChannels.resetParticle(index);
+	m_byteChannels.resetParticle(index);
+}
+void btFluidParticles::copyParticle(int destination, int source)
+{
+	m_pos[destination] = m_pos[source];
+	m_vel[destination] = m_vel[source];
+	m_vel_eval[destination] = m_vel_eval[source];
+	m_accumulatedForce[destination] = m_accumulatedForce[source];
+	m_massScale[destination] = m_massScale[source];
+	m_userPointer[destination] = m_userPointer[source];
+	m_sleepCounter[destination] = m_sleepCounter[source];
+	m_sleeping[destination] = m_sleeping[source];
+	m_rigidContactCacheIndex[destination] = m_rigidContactCacheIndex[source];
+	m_id[destination] = m_id[source];
+	m_age[destination] = m_age[source];
+	m_scalarChannels.copyParticle(destination, source);
+	m_vectorChannels.copyParticle(destination, source);
+	m_intChannels.copyParticle(destination, source);
+	m_byteChannels.copyParticle(destination, source);
+}
 void btFluidParticles::removeParticle(int index)
 {
 	btAssert(0 <= index);
@@ -45,19 +117,53 @@ void btFluidParticles::removeParticle(int index)
 	
 	int lastIndex = size() - 1;
 	
-	if(index < lastIndex) 
-	{
-		m_pos[index] = m_pos[lastIndex];
-		m_vel[index] = m_vel[lastIndex];
-		m_vel_eval[index] = m_vel_eval[lastIndex];
-		m_accumulatedForce[index] = m_accumulatedForce[lastIndex];
-		m_userPointer[index] = m_userPointer[lastIndex];
-	}
+	if(index < lastIndex) copyParticle(index, lastIndex);
 	m_pos.pop_back();
 	m_vel.pop_back();
 	m_vel_eval.pop_back();
 	m_accumulatedForce.pop_back();
+	m_massScale.pop_back();
 	m_userPointer.pop_back();
+	m_sleepCounter.pop_back();
+	m_sleeping.pop_back();
+	m_rigidContactCacheIndex.pop_back();
+	m_id.pop_back();
+	m_age.pop_back();
+	m_scalarChannels.pop_back();
+	m_vectorChannels.pop_back();
+	m_intChannels.pop_back();
+	m_byteChannels.pop_back();
+}
+
+//Returns true if bit (index % 32) of removalMask[index / 32] is set
+inline bool isMarkedForRemoval(const btAlignedObjectArray<unsigned int>& removalMask, int index)
+{
+	int word = index / 32;
+	return ( word < removalMask.size() && (removalMask[word] & (1u << (index % 32))) );
+}
+void btFluidParticles::removeParticles(const btAlignedObjectArray<unsigned int>& removalMask)
+{
+	int numParticles = size();
+	
+	//Particles before the first removed particle are not moved; skip 32 particles at a time
+	int firstWord = 0;
+	while( firstWord < removalMask.size() && !removalMask[firstWord] ) ++firstWord;
+	if( firstWord == removalMask.size() ) return;
+	
+	int firstRemoved = firstWord * 32;
+	while( firstRemoved < numParticles && !isMarkedForRemoval(removalMask, firstRemoved) ) ++firstRemoved;
+	if(firstRemoved >= numParticles) return;
+	
+	int newSize = firstRemoved;
+	for(int i = firstRemoved + 1; i < numParticles; ++i)
+	{
+		if( isMarkedForRemoval(removalMask, i) ) continue;
+		
+		copyParticle(newSize, i);
+		++newSize;
+	}
+	
+	resize(newSize);
 }
 
 void btFluidParticles::resize(int newSize)
@@ -68,7 +174,17 @@ void btFluidParticles::resize(int newSize)
 	m_vel.resize(newSize);
 	m_vel_eval.resize(newSize);
 	m_accumulatedForce.resize(newSize);
+	m_massScale.resize( newSize, btScalar(1.0) );
 	m_userPointer.resize(newSize);
+	m_sleepCounter.resize(newSize, 0);
+	m_sleeping.resize(newSize, 0);
+	m_rigidContactCacheIndex.resize(newSize, -1);
+	m_id.resize(newSize, -1);
+	m_age.resize( newSize, btScalar(0.0) );
+	m_scalarChannels.resize(newSize);
+	m_vectorChannels.resize(newSize);
+	m_intChannels.resize(newSize);
+	m_byteChannels.resize(newSize);
 }
 
 void btFluidParticles::setMaxParticles(int maxNumParticles)
@@ -79,5 +195,15 @@ void btFluidParticles::setMaxParticles(int maxNumParticles)
 	m_vel.reserve(maxNumParticles);
 	m_vel_eval.reserve(maxNumParticles);
 	m_accumulatedForce.reserve(maxNumParticles);
+	m_massScale.reserve(maxNumParticles);
 	m_userPointer.reserve(maxNumParticles);
+	m_sleepCounter.reserve(maxNumParticles);
+	m_sleeping.reserve(maxNumParticles);
+	m_rigidContactCacheIndex.reserve(maxNumParticles);
+	m_id.reserve(maxNumParticles);
+	m_age.reserve(maxNumParticles);
+	m_scalarChannels.reserve(maxNumParticles);
+	m_vectorChannels.reserve(maxNumParticles);
+	m_intChannels.reserve(maxNumParticles);
+	m_byteChannels.reserve(maxNumParticles);
 }
@@ -17,7 +17,59 @@ subject to the following restrictions:
 
 #include "LinearMath/btAlignedObjectArray.h"
 
-class btVector3;
+#include <cstring>	//memcpy()
+
+#include "LinearMath/btVector3.h"
+
+///Exchanges the contents of two arrays without copying their elements or allocating memory.
+template<typename T>
+inline void btFluidSwapArrays(btAlignedObjectArray<T>& a, btAlignedObjectArray<T>& b)
+{
+	const int SIZEOF_ARRAY = sizeof(btAlignedObjectArray<T>);
+	
+	char swap[SIZEOF_ARRAY];
+	
+	memcpy( static_cast<void*>(swap), static_cast<void*>(&a), SIZEOF_ARRAY );
+	memcpy( static_cast<void*>(&a), static_cast<void*>(&b), SIZEOF_ARRAY );
+	memcpy( static_cast<void*>(&b), static_cast<void*>(swap), SIZEOF_ARRAY );
+}
+
+///@brief User defined per-particle arrays of a single type, which are kept parallel to the other arrays of btFluidParticles.
+///@remarks Channels cannot be removed individually, so the index of a channel remains valid until the fluid is destroyed.
+template<typename T>
+struct btFluidParticleChannels
+{
+	btAlignedObjectArray< btAlignedObjectArray<T> > m_channels;
+	btAlignedObjectArray<T> m_defaultValues;		///<Value assigned to each channel when a particle is added.
+	
+	int size() const { return m_channels.size(); }
+	
+	btAlignedObjectArray<T>& operator[](int channel) { return m_channels[channel]; }
+	const btAlignedObjectArray<T>& operator[](int channel) const { return m_channels[channel]; }
+	
+	///Returns the index of the new channel.
+	int addChannel(int numParticles, int maxParticles, const T& defaultValue)
+	{
+		int channel = m_channels.size();
+		
+		m_channels.expand();
+		m_channels[channel].reserve(maxParticles);
+		m_channels[channel].resize(numParticles, defaultValue);
+		m_defaultValues.push_back(defaultValue);
+		
+		return channel;
+	}
+	
+	void push_back() { for(int i = 0; i < m_channels.size(); ++i) m_channels[i].push_back(m_defaultValues[i]); }
+	void pop_back() { for(int i = 0; i < m_channels.size(); ++i) m_channels[i].pop_back(); }
+	void copyParticle(int destination, int source)
+	{
+		for(int i = 0; i < m_channels.size(); ++i) m_channels[i][destination] = m_channels[i][source];
+	}
+	void resetParticle(int index) { for(int i = 0; i < m_channels.size(); ++i) m_channels[i][index] = m_defaultValues[i]; }
+	void resize(int newSize) { for(int i = 0; i < m_channels.size(); ++i) m_channels[i].resize(newSize, m_defaultValues[i]); }
+	void reserve(int capacity) { for(int i = 0; i < m_channels.size(); ++i) m_channels[i].reserve(capacity); }
+};
 
 ///@brief Coordinates the parallel arrays used to store fluid particles.
 ///@remarks
@@ -34,15 +86,47 @@ struct btFluidParticles
 	btAlignedObjectArray<btVector3> m_vel_eval;				///<Current velocity; simulation scale.
 	btAlignedObjectArray<btVector3> m_accumulatedForce;		///<Applied during stepSimulation(), then set to 0; simulation scale.
 	
+	btAlignedObjectArray<btScalar> m_massScale;				///<Multiplies btFluidSphParametersLocal::m_particleMass and m_sphParticleMass; 1.0 unless changed by btFluidSphAdaptiveResolution.
+	
 	btAlignedObjectArray<void*> m_userPointer;
 	
+	btAlignedObjectArray<int> m_sleepCounter;				///<Number of consecutive steps below the sleeping thresholds; asleep if >= btFluidSphParametersLocal::m_sleepSteps.
+	btAlignedObjectArray<int> m_sleeping;					///<If nonzero, the particle is excluded from the current simulation step.
+	
+	btAlignedObjectArray<int> m_rigidContactCacheIndex;		///<Index of the particle's entry in btFluidSph::internalGetRigidContactCache(); no entry if negative.
+	
+	btAlignedObjectArray<int> m_id;							///<Stable id of the particle; -1 unless btFluidSph::setParticleIdsEnabled() is set.
+	
+	btAlignedObjectArray<btScalar> m_age;					///<Simulated time since the particle was added; seconds; only updated if btFluidSphParametersLocal::m_particleLifetime is nonzero.
+	
+	//User defined parallel arrays; see btFluidSph::addScalarChannel(), etc.
+	btFluidParticleChannels<btScalar> m_scalarChannels;
+	btFluidParticleChannels<btVector3> m_vectorChannels;
+	btFluidParticleChannels<int> m_intChannels;
+	btFluidParticleChannels<unsigned char> m_byteChannels;
+	
 	btFluidParticles() : m_maxParticles(0) {}
 	
 	int	size() const	{ return m_pos.size(); }
 
 	int addParticle(const btVector3& position);		///<Returns size() if size() == getMaxParticles().
+	
+	///Appends up to (getMaxParticles() - size()) particles in a single pass over each array, and returns the number of particles added.
+	///@param velocities Simulation scale; may be 0, in which case the particles are not moving.
+	int addParticles(const btVector3* positions, const btVector3* velocities, int count);
+	
+	///Assigns the same values as addParticle() to an existing particle; m_id is set to -1.
+	void resetParticle(int index, const btVector3& position);
+	
+	///Copies every per-particle array, including m_id and the user defined channels, from particle source to particle destination.
+	void copyParticle(int destination, int source);
+	
 	void removeParticle(int index);					///<Swaps indicies if index does not correspond to the last index; invalidates grid.
 	
+	///Removes each particle i with bit (i % 32) of removalMask[i / 32] set, in a single pass that preserves the order of
+	///the remaining particles; invalidates grid. removalMask may contain fewer than (size() + 31) / 32 elements.
+	void removeParticles(const btAlignedObjectArray<unsigned int>& removalMask);
+	
 	void resize(int newSize);						///<Does not initialize particles if( newSize > size() ).
 	
 	void setMaxParticles(int maxNumParticles);
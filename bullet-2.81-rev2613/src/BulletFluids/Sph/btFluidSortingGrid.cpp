@@ -20,9 +20,6 @@ subject to the following restrictions:
 #include "btFluidParticles.h"
 
 #define SWAP_REARRANGED_ARRAY
-#ifdef SWAP_REARRANGED_ARRAY
-#include <cstring>	//memcpy()
-#endif
 
 template<typename T>
 void rearrangeToMatchSortedValues(const btAlignedObjectArray<btFluidGridValueIndexPair>& sortedValues, 
@@ -50,17 +47,18 @@ void rearrangeToMatchSortedValues(const btAlignedObjectArray<btFluidGridValueInd
 #ifndef SWAP_REARRANGED_ARRAY
 		out_rearranged = temp;
 #else
-		const int SIZEOF_ARRAY = sizeof(btAlignedObjectArray<T>);
-	
-		char swap[SIZEOF_ARRAY];
-		
-		memcpy(swap, &temp, SIZEOF_ARRAY);
-		memcpy(&temp, &out_rearranged, SIZEOF_ARRAY);
-		memcpy(&out_rearranged, swap, SIZEOF_ARRAY);
+		btFluidSwapArrays(temp, out_rearranged);
 #endif
 	}
 }
 
+template<typename T>
+void rearrangeChannelsToMatchSortedValues(const btAlignedObjectArray<btFluidGridValueIndexPair>& sortedValues, 
+											btAlignedObjectArray<T>& temp, btFluidParticleChannels<T>& out_rearranged)
+{
+	for(int i = 0; i < out_rearranged.size(); ++i) rearrangeToMatchSortedValues(sortedValues, temp, out_rearranged[i]);
+}
+
 struct ValueIndexPairSortPredicate 
 {
 	inline bool operator() (const btFluidGridValueIndexPair& a, const btFluidGridValueIndexPair& b) const 
@@ -69,7 +67,9 @@ struct ValueIndexPairSortPredicate
 	}
 };
 void sortParticlesByValues(btFluidParticles& particles, btAlignedObjectArray<btFluidGridValueIndexPair>& values,
-							 btAlignedObjectArray<btVector3>& tempVector, btAlignedObjectArray<void*>& tempVoid)
+							 btAlignedObjectArray<btVector3>& tempVector, btAlignedObjectArray<void*>& tempVoid,
+							 btAlignedObjectArray<btScalar>& tempScalar, btAlignedObjectArray<int>& tempInt,
+							 btAlignedObjectArray<unsigned char>& tempByte)
 {
 	{
 		BT_PROFILE("sortParticlesByValues() - quickSort");
@@ -84,7 +84,18 @@ void sortParticlesByValues(btFluidParticles& particles, btAlignedObjectArray<btF
 		rearrangeToMatchSortedValues(values, tempVector, particles.m_vel);
 		rearrangeToMatchSortedValues(values, tempVector, particles.m_vel_eval);
 		rearrangeToMatchSortedValues(values, tempVector, particles.m_accumulatedForce);
+		rearrangeToMatchSortedValues(values, tempScalar, particles.m_massScale);
 		rearrangeToMatchSortedValues(values, tempVoid, particles.m_userPointer);
+		rearrangeToMatchSortedValues(values, tempInt, particles.m_sleepCounter);
+		rearrangeToMatchSortedValues(values, tempInt, particles.m_sleeping);
+		rearrangeToMatchSortedValues(values, tempInt, particles.m_rigidContactCacheIndex);
+		rearrangeToMatchSortedValues(values, tempInt, particles.m_id);
+		rearrangeToMatchSortedValues(values, tempScalar, particles.m_age);
+		
+		rearrangeChannelsToMatchSortedValues(values, tempScalar, particles.m_scalarChannels);
+		rearrangeChannelsToMatchSortedValues(values, tempVector, particles.m_vectorChannels);
+		rearrangeChannelsToMatchSortedValues(values, tempInt, particles.m_intChannels);
+		rearrangeChannelsToMatchSortedValues(values, tempByte, particles.m_byteChannels);
 	}
 }
 
@@ -121,7 +132,7 @@ void btFluidSortingGrid::insertParticles(btFluidParticles& particles)
 	//Sort fluidSystem and values by m_value(s) in m_valueIndexPairs
 	{
 		BT_PROFILE("btFluidSortingGrid() - sort");
-		sortParticlesByValues(particles, m_valueIndexPairs, m_tempBufferVector, m_tempBufferVoid);
+		sortParticlesByValues(particles, m_valueIndexPairs, m_tempBufferVector, m_tempBufferVoid, m_tempBufferScalar, m_tempBufferInt, m_tempBufferByte);
 	}
 	
 	m_activeCells.resize(0);
@@ -209,9 +220,19 @@ void binaryRangeSearch(const btAlignedObjectArray<btFluidGridCombinedPos>& cellV
 }
 void btFluidSortingGrid::forEachGridCell(const btVector3& aabbMin, const btVector3& aabbMax, btFluidSortingGrid::AabbCallback& callback) const
 {
-	btFluidGridPosition minIndicies = getDiscretePosition(aabbMin);
-	btFluidGridPosition maxIndicies = getDiscretePosition(aabbMax);
-
+	forEachGridCellInRange( getDiscretePosition(aabbMin), getDiscretePosition(aabbMax), aabbMin, aabbMax, callback );
+}
+void btFluidSortingGrid::forEachGridCell(const btFluidGridPosition& minIndicies, const btFluidGridPosition& maxIndicies, 
+										btFluidSortingGrid::AabbCallback& callback) const
+{
+	btVector3 aabbMin( static_cast<btScalar>(minIndicies.x), static_cast<btScalar>(minIndicies.y), static_cast<btScalar>(minIndicies.z) );
+	btVector3 aabbMax( static_cast<btScalar>(maxIndicies.x + 1), static_cast<btScalar>(maxIndicies.y + 1), static_cast<btScalar>(maxIndicies.z + 1) );
+	
+	forEachGridCellInRange(minIndicies, maxIndicies, aabbMin * m_gridCellSize, aabbMax * m_gridCellSize, callback);
+}
+void btFluidSortingGrid::forEachGridCellInRange(const btFluidGridPosition& minIndicies, const btFluidGridPosition& maxIndicies, 
+												const btVector3& aabbMin, const btVector3& aabbMax, btFluidSortingGrid::AabbCallback& callback) const
+{
 	for(btFluidGridCoordinate z = minIndicies.z; z <= maxIndicies.z; ++z)
 		for(btFluidGridCoordinate y = minIndicies.y; y <= maxIndicies.y; ++y)
 		{
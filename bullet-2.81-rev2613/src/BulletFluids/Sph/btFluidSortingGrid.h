@@ -170,6 +170,9 @@ private:
 	btAlignedObjectArray<btFluidGridValueIndexPair> m_valueIndexPairs;
 	btAlignedObjectArray<btVector3> m_tempBufferVector;
 	btAlignedObjectArray<void*> m_tempBufferVoid;
+	btAlignedObjectArray<btScalar> m_tempBufferScalar;
+	btAlignedObjectArray<int> m_tempBufferInt;
+	btAlignedObjectArray<unsigned char> m_tempBufferByte;
 	
 public:
 	btFluidSortingGrid() : m_pointMin(0,0,0), m_pointMax(0,0,0), m_gridCellSize(1) {}
@@ -200,6 +203,7 @@ public:
 	
 	int getNumGridCells() const { return m_activeCells.size(); }	///<Returns the number of nonempty grid cells.
 	btFluidGridIterator getGridCell(int gridCellIndex) const { return m_cellContents[gridCellIndex]; }
+	btFluidGridCombinedPos getGridCellValue(int gridCellIndex) const { return m_activeCells[gridCellIndex]; }
 	
 	///The indicies of particles change every frame, when updating the grid; getValueIndexPairs()
 	///can be used to access the previous indicies of each particle.
@@ -215,6 +219,10 @@ public:
 		virtual bool processParticles(const btFluidGridIterator FI, const btVector3& aabbMin, const btVector3& aabbMax) = 0;
 	};
 	void forEachGridCell(const btVector3& aabbMin, const btVector3& aabbMax, btFluidSortingGrid::AabbCallback& callback) const;
+	
+	///Same as the above, with an inclusive range of grid cell coordinates instead of an AABB.
+	///The AABB passed to the callback contains the grid cells in the range.
+	void forEachGridCell(const btFluidGridPosition& minIndicies, const btFluidGridPosition& maxIndicies, btFluidSortingGrid::AabbCallback& callback) const;
 
 	btScalar getCellSize() const { return m_gridCellSize; }
 	void setCellSize(btScalar simulationScale, btScalar sphSmoothRadius) 
@@ -244,6 +252,9 @@ private:
 	void findAdjacentGridCellsSymmetric(btFluidGridPosition indicies, btFluidSortingGrid::FoundCells& out_gridCells) const;
 	
 	void generateMultithreadingGroups();
+	
+	void forEachGridCellInRange(const btFluidGridPosition& minIndicies, const btFluidGridPosition& maxIndicies, 
+								const btVector3& aabbMin, const btVector3& aabbMax, btFluidSortingGrid::AabbCallback& callback) const;
 };
 
 #endif
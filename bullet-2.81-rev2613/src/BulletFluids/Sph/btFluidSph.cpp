@@ -28,7 +28,12 @@ btFluidSph::btFluidSph(const btFluidSphParametersGlobal& FG, int maxNumParticles
 {
 	m_overrideSolver = 0;
 	m_overrideParameters = 0;
+	m_adaptiveResolution = 0;
+	m_rigidBoundaryParticles = 0;
+	m_snapshotBuffer = 0;
+	m_particleIdsEnabled = false;
 	m_solverData = 0;
+	m_broadphaseBlockCells = 0;
 
 	setMaxParticles(maxNumParticles);
 	setGridCellSize(FG);
@@ -47,6 +52,9 @@ btFluidSph::btFluidSph(const btFluidSphParametersGlobal& FG, int maxNumParticles
 }
 btFluidSph::~btFluidSph()
 {
+	//Blocks are removed by btFluidRigidDynamicsWorld::removeFluidSph() and ~btFluidRigidDynamicsWorld()
+	btAssert( !m_broadphaseBlocks.m_blocks.size() );
+	
 	//btCollisionObject
 	{
 		m_collisionShape->~btCollisionShape();
@@ -61,19 +69,115 @@ void btFluidSph::setGridCellSize(const btFluidSphParametersGlobal& FG)
 
 void btFluidSph::setMaxParticles(int maxNumParticles)
 {
-	if( maxNumParticles < m_particles.size() )m_particles.resize(maxNumParticles);
+	if( maxNumParticles < m_particles.size() )
+	{
+		if(m_particleIdsEnabled) 
+			for(int i = maxNumParticles; i < m_particles.size(); ++i) freeParticleId(m_particles.m_id[i]);
+	
+		m_particles.resize(maxNumParticles);
+	}
 	m_particles.setMaxParticles(maxNumParticles);
 }
 
 void btFluidSph::removeAllParticles()
 {
+	//The id table is kept, so that the ids of the removed particles are reused with the next generation
+	if(m_particleIdsEnabled)
+		for(int i = 0; i < numParticles(); ++i) freeParticleId(m_particles.m_id[i]);
+	
 	m_particles.resize(0);
 	
-	m_removedFluidIndicies.resize(0);
+	m_removalMask.resize(0);
 	
 	m_grid.clear();
 }
 
+void btFluidSph::internalClearRigidContacts()
+{
+	m_intersectingRigidAabb.resize(0);
+	m_intersectingRigidBlocks.resize(0);
+	m_intersectingRigidFirstBlock.resize(0);
+	
+	//Move the contact arrays out of the groups, since they are deallocated when the groups are removed
+	for(int i = 0; i < m_rigidContacts.size(); ++i)
+	{
+		btAlignedObjectArray<btFluidSphRigidContact>& contacts = m_freeRigidContactArrays.expand();
+		btFluidSwapArrays(contacts, m_rigidContacts[i].m_contacts);
+		contacts.resize(0);
+	}
+	m_rigidContacts.resize(0);
+}
+btFluidSphRigidContactGroup& btFluidSph::internalAddRigidContactGroup(const btCollisionObject* object)
+{
+	btFluidSphRigidContactGroup& contactGroup = m_rigidContacts.expand();
+	contactGroup.m_object = object;
+	
+	int lastIndex = m_freeRigidContactArrays.size() - 1;
+	if(lastIndex >= 0)
+	{
+		btFluidSwapArrays(contactGroup.m_contacts, m_freeRigidContactArrays[lastIndex]);
+		m_freeRigidContactArrays.pop_back();
+	}
+	
+	return contactGroup;
+}
+
+struct btFluidSphRigidBlockPairSortPredicate
+{
+	bool operator() (const btFluidSphRigidBlockPair& a, const btFluidSphRigidBlockPair& b) const
+	{
+		if(a.m_object != b.m_object) return (a.m_object < b.m_object);
+		return (a.m_pairIndex < b.m_pairIndex);
+	}
+};
+void btFluidSph::internalGroupIntersectingRigidBlocks()
+{
+	m_intersectingRigidFirstBlock.resize(0);
+	
+	int numPairs = m_intersectingRigidBlocks.size();
+	if(!numPairs) return;
+	
+	BT_PROFILE("btFluidSph::internalGroupIntersectingRigidBlocks()");
+	
+	//Sort a copy of the pairs by object; the objects are then appended in the order of their first pair,
+	//so that the order does not depend on pointer values
+	for(int i = 0; i < numPairs; ++i) m_intersectingRigidBlocks[i].m_pairIndex = i;
+	m_tempRigidBlocks = m_intersectingRigidBlocks;
+	m_tempRigidBlocks.quickSort( btFluidSphRigidBlockPairSortPredicate() );
+	
+	//Index of the first sorted pair of each object, at the original index of that pair
+	m_tempRigidBlockGroups.resize(numPairs);
+	for(int i = 0; i < numPairs; ++i) m_tempRigidBlockGroups[i] = -1;
+	for(int i = 0; i < numPairs; ++i)
+		if(i == 0 || m_tempRigidBlocks[i].m_object != m_tempRigidBlocks[i - 1].m_object) m_tempRigidBlockGroups[ m_tempRigidBlocks[i].m_pairIndex ] = i;
+	
+	//Objects that were reported by the fluid's own proxy have no blocks
+	for(int i = 0; i < m_intersectingRigidAabb.size(); ++i) m_intersectingRigidFirstBlock.push_back(0);
+	
+	m_intersectingRigidBlocks.resize(0);
+	for(int i = 0; i < numPairs; ++i)
+	{
+		int firstPair = m_tempRigidBlockGroups[i];
+		if(firstPair < 0) continue;
+		
+		const btCollisionObject* object = m_tempRigidBlocks[firstPair].m_object;
+		m_intersectingRigidAabb.push_back(object);
+		m_intersectingRigidFirstBlock.push_back( m_intersectingRigidBlocks.size() );
+		
+		for(int n = firstPair; n < numPairs && m_tempRigidBlocks[n].m_object == object; ++n) m_intersectingRigidBlocks.push_back(m_tempRigidBlocks[n]);
+	}
+	m_intersectingRigidFirstBlock.push_back( m_intersectingRigidBlocks.size() );
+}
+
+int btFluidSph::getNumActiveParticles() const
+{
+	int numActiveParticles = 0;
+	for(int i = 0; i < m_particles.size(); ++i) 
+		if(!m_particles.m_sleeping[i]) ++numActiveParticles;
+	
+	return numActiveParticles;
+}
+
 btScalar btFluidSph::getValue(btScalar x, btScalar y, btScalar z) const
 {
 	const btScalar worldSphRadius = m_grid.getCellSize();	//Grid cell size == sph interaction radius, at world scale
@@ -136,41 +240,31 @@ btVector3 btFluidSph::getGradient(btScalar x, btScalar y, btScalar z) const
 	return normal;
 }
 
-//Assumes that out_unique is already sorted.
-//Removes duplicates; rearranges array such that all unique values are in the range [0, uniqueSize).
-void makeUniqueInt(btAlignedObjectArray<int>& out_unique)
+void btFluidSph::removeMarkedParticles()
 {
-	int uniqueSize = 0;
-	if( out_unique.size() ) 
+	if( !m_removalMask.size() ) return;
+	
+	BT_PROFILE("btFluidSph::removeMarkedParticles()");
+	
+	if(m_particleIdsEnabled)
 	{
-		uniqueSize = 1;
-		for(int i = 1; i < out_unique.size(); ++i)
+		for(int word = 0; word < m_removalMask.size(); ++word)
 		{
-			if( out_unique[i] != out_unique[i-1] )
-			{
-				out_unique[uniqueSize] = out_unique[i];
-				++uniqueSize;
-			}
+			if( !m_removalMask[word] ) continue;
+			
+			int lastIndex = btMin( (word + 1) * 32, numParticles() ) - 1;
+			for(int i = word * 32; i <= lastIndex; ++i)
+				if( m_removalMask[word] & (1u << (i % 32)) ) freeParticleId(m_particles.m_id[i]);
 		}
 	}
 	
-	out_unique.resize(uniqueSize);
-}
-struct AscendingSortPredicate { inline bool operator() (const int& a, const int& b) const { return (a < b); } };
-void btFluidSph::removeMarkedParticles()
-{
-	//makeUnique() assumes that the array is sorted
-	//m_removedFluidIndicies.heapSort( AscendingSortPredicate() );
-	m_removedFluidIndicies.quickSort( AscendingSortPredicate() );
-	
-	//Remove duplicate indicies
-	makeUniqueInt(m_removedFluidIndicies);
+	//Compacting preserves the order of the particles, which is mostly sorted by grid cell 
+	//from the previous step, so the grid update is also faster than if particles were swapped
+	m_particles.removeParticles(m_removalMask);
 	
-	//Since removing elements from the array invalidates(higher) indicies,
-	//elements should be removed in descending order.
-	for(int i = m_removedFluidIndicies.size() - 1; i >= 0; --i) m_particles.removeParticle( m_removedFluidIndicies[i] );
+	m_removalMask.resize(0);
 	
-	m_removedFluidIndicies.resize(0);
+	internalUpdateParticleIdTable();
 }
 
 void btFluidSph::insertParticlesIntoGrid()
@@ -180,6 +274,73 @@ void btFluidSph::insertParticlesIntoGrid()
 	//
 	m_grid.clear();
 	m_grid.insertParticles(m_particles);
+	
+	internalUpdateParticleIdTable();
+}
+
+void btFluidSph::setParticleIdsEnabled(bool enable)
+{
+	if(enable == m_particleIdsEnabled) return;
+	
+	//The id table is kept, so that ids assigned before disabling do not match particles after enabling again
+	if(!enable)
+		for(int i = 0; i < numParticles(); ++i) freeParticleId(m_particles.m_id[i]);
+	
+	m_particleIdsEnabled = enable;
+	for(int i = 0; i < numParticles(); ++i) m_particles.m_id[i] = -1;
+	
+	if(enable)
+		for(int i = 0; i < numParticles(); ++i) assignParticleId(i);
+}
+void btFluidSph::internalUpdateParticleIdTable()
+{
+	if(!m_particleIdsEnabled) return;
+	
+	for(int i = 0; i < numParticles(); ++i) m_particleIdToIndex[ m_particles.m_id[i] & PARTICLE_ID_SLOT_MASK ] = i;
+}
+void btFluidSph::recycleParticle(int index, const btVector3& position)
+{
+	btAssert( 0 <= index && index < numParticles() );
+	
+	int oldId = m_particles.m_id[index];
+	m_particles.resetParticle(index, position);
+	
+	if(m_particleIdsEnabled)
+	{
+		//Assign the new id before releasing the old one, so that the old id is not immediately reused
+		assignParticleId(index);
+		freeParticleId(oldId);
+	}
+}
+void btFluidSph::assignParticleId(int index)
+{
+	int slot;
+	if( m_freeParticleIds.size() )
+	{
+		slot = m_freeParticleIds[m_freeParticleIds.size() - 1];
+		m_freeParticleIds.pop_back();
+	}
+	else
+	{
+		slot = m_particleIdToIndex.size();
+		btAssert(slot <= PARTICLE_ID_SLOT_MASK);
+		
+		m_particleIdToIndex.push_back(-1);
+		m_particleIdGenerations.push_back(0);
+	}
+	
+	m_particles.m_id[index] = (m_particleIdGenerations[slot] << PARTICLE_ID_SLOT_BITS) | slot;
+	m_particleIdToIndex[slot] = index;
+}
+void btFluidSph::freeParticleId(int id)
+{
+	int slot = id & PARTICLE_ID_SLOT_MASK;
+	btAssert( 0 <= id && slot < m_particleIdToIndex.size() );
+	btAssert( m_particleIdGenerations[slot] == (id >> PARTICLE_ID_SLOT_BITS) );
+	
+	m_particleIdToIndex[slot] = -1;
+	m_particleIdGenerations[slot] = (m_particleIdGenerations[slot] + 1) & PARTICLE_ID_GENERATION_MASK;
+	m_freeParticleIds.push_back(slot);
 }
 
 
@@ -199,37 +360,60 @@ void btFluidEmitter::emit()
 	
 	btVector3 velocity = quatRotate(rigidRotation * m_rotation, m_direction) * m_speed;
 	
+	//Allocate all particles at once, then move them into place
+	int firstIndex = m_fluid->numParticles();
+	int numAdded = ( m_positions.size() ) ? m_fluid->addParticles( &m_positions[0], 0, m_positions.size() ) : 0;
+	
 	for(int i = 0; i < m_positions.size(); ++i)
 	{
 		btVector3 position = quatRotate(m_rotation, m_positions[i]) + m_center;
 		if(m_attachTo) position = quatRotate(rigidRotation, position) + m_attachTo->getWorldTransform().getOrigin();
 		
-		int index = m_fluid->addParticle(position);
-		
-		if( index != m_fluid->numParticles() ) 
+		int index;
+		if(i < numAdded) 
 		{
-			m_fluid->setVelocity(index, velocity);
-			m_particleIndicies.push_back(index);
+			index = firstIndex + i;
+			m_fluid->setPosition(index, position);
 		}
-		else if(m_useRandomIfAllParticlesAllocated)
+		else if(m_useRandomIfAllParticlesAllocated) 
 		{
+			//The existing particle is replaced, so it is given a new id and its attributes are reset
 			index = ( m_fluid->numParticles() - 1 ) * GEN_rand() / GEN_RAND_MAX;		//Random index
-		
-			m_fluid->setPosition(index, position);
-			m_fluid->setVelocity(index, velocity);
-			m_particleIndicies.push_back(index);
+			m_fluid->recycleParticle(index, position);
 		}
+		else break;
+		
+		m_fluid->setVelocity(index, velocity);
+		m_particleIndicies.push_back(index);
 	}
 }
-void btFluidEmitter::addVolume(btFluidSph* fluid, const btVector3& min, const btVector3& max, btScalar spacing)
+int btFluidEmitter::addVolume(btFluidSph* fluid, const btVector3& min, const btVector3& max, btScalar spacing)
 {
-	for(btScalar z = max.z(); z >= min.z(); z -= spacing) 
-		for(btScalar y = min.y(); y <= max.y(); y += spacing) 
-			for(btScalar x = min.x(); x <= max.x(); x += spacing) 
-			{
-				int index = fluid->addParticle( btVector3(x,y,z) );
-				if( index == fluid->numParticles() ) return;	//Max particles reached
-			}
+	btAssert( spacing > btScalar(0.0) );
+	if( max.x() < min.x() || max.y() < min.y() || max.z() < min.z() ) return 0;
+	
+	btVector3 extent = max - min;
+	int numX = static_cast<int>( extent.x() / spacing ) + 1;
+	int numY = static_cast<int>( extent.y() / spacing ) + 1;
+	int numZ = static_cast<int>( extent.z() / spacing ) + 1;
+	
+	//Avoid generating positions that would be rejected; particles are added from max.z() to min.z()
+	int numParticles = btMin( numX * numY * numZ, fluid->getMaxParticles() - fluid->numParticles() );
+	if(numParticles <= 0) return 0;
+	
+	btAlignedObjectArray<btVector3> positions;
+	positions.resize(numParticles);
+	
+	for(int i = 0; i < numParticles; ++i)
+	{
+		int x = i % numX;
+		int y = (i / numX) % numY;
+		int z = i / (numX * numY);
+		
+		positions[i].setValue( min.x() + x * spacing, min.y() + y * spacing, max.z() - z * spacing );
+	}
+	
+	return fluid->addParticles( &positions[0], 0, numParticles );
 }
 
 
@@ -240,17 +424,16 @@ struct btFluidAbsorberCallback : public btFluidSortingGrid::AabbCallback
 {
 	btFluidSph* m_fluidSph;
 
-	const btVector3& m_min;
-	const btVector3& m_max;
+	const btFluidAbsorber& m_absorber;
 
-	btFluidAbsorberCallback(btFluidSph* fluidSph, const btVector3& min, const btVector3& max) 
-	: m_fluidSph(fluidSph), m_min(min), m_max(max) {}
+	btFluidAbsorberCallback(btFluidSph* fluidSph, const btFluidAbsorber& absorber) 
+	: m_fluidSph(fluidSph), m_absorber(absorber) {}
 	
 	virtual bool processParticles(const btFluidGridIterator FI, const btVector3& aabbMin, const btVector3& aabbMax)
 	{
 		for(int n = FI.m_firstIndex; n <= FI.m_lastIndex; ++n)
 		{
-			if( TestPointAgainstAabb2( m_min, m_max, m_fluidSph->getPosition(n) ) ) m_fluidSph->markParticleForRemoval(n);
+			if( m_absorber.containsPoint( m_fluidSph->getPosition(n) ) ) m_fluidSph->markParticleForRemoval(n);
 		}
 	
 		return true;
@@ -260,6 +443,9 @@ void btFluidAbsorber::absorb(btFluidSph* fluid)
 {
 	const btFluidSortingGrid& grid = fluid->getGrid();
 	
-	btFluidAbsorberCallback absorber(fluid, m_min, m_max);
-	grid.forEachGridCell(m_min, m_max, absorber);
+	btVector3 aabbMin, aabbMax;
+	getAabb(aabbMin, aabbMax);
+	
+	btFluidAbsorberCallback absorber(fluid, *this);
+	grid.forEachGridCell(aabbMin, aabbMax, absorber);
 }
@@ -18,11 +18,13 @@ subject to the following restrictions:
 #ifndef BT_FLUID_SPH_H
 #define BT_FLUID_SPH_H
 
+#include "LinearMath/btAabbUtil2.h"
 #include "BulletCollision/CollisionDispatch/btCollisionObject.h"
 
 #include "btFluidParticles.h"
 #include "btFluidSphParameters.h"
 #include "btFluidSortingGrid.h"
+#include "btFluidSphBroadphaseBlock.h"
 
 ///Describes a single contact between a btFluidSph particle and a btCollisionObject or btRigidBody.
 struct btFluidSphRigidContact
@@ -44,7 +46,31 @@ struct btFluidSphRigidContactGroup
 	int numContacts() const { return m_contacts.size(); }
 };
 
+///Contact between a particle and a static, kinematic, or sleeping btCollisionObject from the previous step, stored in the local space of the object.
+///@remarks Used by btFluidSphRigidCollisionDetector to skip the narrowphase for particles that are resting on the object;
+///see btFluidSphParametersLocal::m_rigidContactCacheTolerance.
+struct btFluidSphRigidCachedContact
+{
+	const btCollisionObject* m_object;		///<The entry is unused if 0.
+	
+	btVector3 m_localPosition;		///<Position of the particle when the contact was found.
+	btVector3 m_localNormal;
+	btVector3 m_localHitPoint;
+	btScalar m_distance;
+};
+
+///Reported by btFluidSphRigidCollisionAlgorithm when the AABB of a btCollisionObject intersects a btFluidSphBroadphaseBlock.
+struct btFluidSphRigidBlockPair
+{
+	const btCollisionObject* m_object;
+	btFluidGridPosition m_blockPosition;
+	int m_pairIndex;
+};
+
 class btFluidSphSolver;
+class btFluidSphAdaptiveResolution;
+class btFluidSphRigidBoundaryParticles;
+class btFluidSphSnapshotBuffer;
 
 ///@brief Main fluid class. Coordinates a set of btFluidParticles with material definition and grid broadphase.
 class btFluidSph : public btCollisionObject
@@ -56,15 +82,34 @@ protected:
 	
 	btFluidParticles 		m_particles;
 	
-	btAlignedObjectArray<int> m_removedFluidIndicies;
+	btAlignedObjectArray<unsigned int> m_removalMask;	///<Bit (i % 32) of element (i / 32) is set if particle i is marked for removal.
 
 	btAlignedObjectArray<const btCollisionObject*> m_intersectingRigidAabb;	///<Contains btCollisionObject/btRigidBody(not btSoftbody)
+	btAlignedObjectArray<btFluidSphRigidBlockPair> m_intersectingRigidBlocks;	///<Grouped by object after internalGroupIntersectingRigidBlocks()
+	btAlignedObjectArray<int> m_intersectingRigidFirstBlock;	///<Parallel to m_intersectingRigidAabb, with an additional element; index in m_intersectingRigidBlocks
+	btAlignedObjectArray<btFluidSphRigidBlockPair> m_tempRigidBlocks;
+	btAlignedObjectArray<int> m_tempRigidBlockGroups;
+	
+	int m_broadphaseBlockCells;
+	btFluidSphBroadphaseBlocks m_broadphaseBlocks;
+	
 	btAlignedObjectArray<btFluidSphRigidContactGroup> m_rigidContacts;
+	btAlignedObjectArray< btAlignedObjectArray<btFluidSphRigidContact> > m_freeRigidContactArrays;	///<Memory of cleared contact groups; reused by internalAddRigidContactGroup().
+	btAlignedObjectArray<btFluidSphRigidCachedContact> m_rigidContactCache;	///<Indexed by btFluidParticles::m_rigidContactCacheIndex
 	
 	//If either override is set, the fluid is passed separately to the solver(btFluidSph-btFluidSph interaction is disabled)
 	btFluidSphSolver* m_overrideSolver;
 	btFluidSphParametersGlobal* m_overrideParameters;
 	
+	btFluidSphAdaptiveResolution* m_adaptiveResolution;
+	btFluidSphRigidBoundaryParticles* m_rigidBoundaryParticles;
+	btFluidSphSnapshotBuffer* m_snapshotBuffer;
+	
+	bool m_particleIdsEnabled;
+	btAlignedObjectArray<int> m_particleIdToIndex;		///<Current index of the particle in each id slot; -1 if the slot is unused.
+	btAlignedObjectArray<int> m_particleIdGenerations;	///<Generation of the id in each slot; incremented when the id is freed.
+	btAlignedObjectArray<int> m_freeParticleIds;		///<Unused id slots.
+	
 	void* m_solverData;
 	
 public:
@@ -77,30 +122,173 @@ public:
 	void setMaxParticles(int maxNumParticles);	///<Removes particles if( maxNumParticles < numParticles() ).
 	
 	///Returns a particle index; creates a new particle if numParticles() < getMaxParticles(), returns numParticles() otherwise.
-	///The particle indicies change during each internal simulation step, so the returned index should be used only for initialization.
+	///The particle indicies change during each internal simulation step, so the returned index should be used only for initialization;
+	///see setParticleIdsEnabled() for tracking particles.
 	///btFluidSortingGrid::getValueIndexPairs()(see btFluidSph::getGrid()) can be used to access the previous index of each particle,
 	///but it should only be called during the post-tick callback( btFluidRigidDynamicsWorld::setInternalFluidTickCallback() ).
-	int addParticle(const btVector3& position) { return m_particles.addParticle(position); }
+	int addParticle(const btVector3& position)
+	{
+		int index = m_particles.addParticle(position);
+		if( m_particleIdsEnabled && index < numParticles() ) assignParticleId(index);
+		
+		return index;
+	}
+	
+	///Adds up to (getMaxParticles() - numParticles()) particles at once, starting at index numParticles(); returns the number of particles added.
+	///Faster than calling addParticle() for each particle when creating a large number of particles.
+	///@param velocities Simulation scale; may be 0, in which case the particles are not moving.
+	int addParticles(const btVector3* positions, const btVector3* velocities, int count)
+	{
+		int firstIndex = numParticles();
+		int numAdded = m_particles.addParticles(positions, velocities, count);
+		if(m_particleIdsEnabled)
+			for(int i = firstIndex; i < numParticles(); ++i) assignParticleId(i);
+		
+		return numAdded;
+	}
 	
-	///Duplicate indicies are ignored, so a particle may be marked twice without any issues.
-	void markParticleForRemoval(int index) { m_removedFluidIndicies.push_back(index); }
+	///Reinitializes an existing particle as if it were removed and then added at position, without changing the
+	///number of particles. All attributes, including user defined channels, are reset, and a new id is assigned if ids are enabled.
+	void recycleParticle(int index, const btVector3& position);
+	
+	///@name Stable particle ids
+	///If enabled, each particle is assigned a 32-bit id when it is added, which does not change until the particle is 
+	///removed, so that particles may be tracked across steps. The index of a particle is found in O(1) time from 
+	///a table that is updated after particles are sorted or removed.
+	///@par
+	///The lower PARTICLE_ID_SLOT_BITS of an id select a slot in the table, and the upper bits are the generation of the slot.
+	///Slots of removed particles are reused with the next generation, so the id of a removed particle does not
+	///match a new particle unless its slot has been reused 128 times since.
+	///@{
+	enum
+	{
+		PARTICLE_ID_SLOT_BITS = 24,
+		PARTICLE_ID_SLOT_MASK = (1 << PARTICLE_ID_SLOT_BITS) - 1,
+		PARTICLE_ID_GENERATION_MASK = (1 << (31 - PARTICLE_ID_SLOT_BITS)) - 1		///<Ids are never negative.
+	};
+	
+	void setParticleIdsEnabled(bool enable);	///<Assigns ids to existing particles if enabled.
+	bool areParticleIdsEnabled() const { return m_particleIdsEnabled; }
+	
+	int getParticleId(int index) const { return m_particles.m_id[index]; }
+	
+	///Returns -1 if the id does not correspond to a particle, including if the particle with that id was removed.
+	int getParticleIndex(int id) const
+	{
+		if(id < 0) return -1;
+		
+		int slot = id & PARTICLE_ID_SLOT_MASK;
+		if( slot >= m_particleIdToIndex.size() || m_particleIdGenerations[slot] != (id >> PARTICLE_ID_SLOT_BITS) ) return -1;
+		
+		return m_particleIdToIndex[slot];
+	}
+	
+	///Rebuilds the id to index table; only needs to be called if the particles are reordered outside of btFluidSph.
+	void internalUpdateParticleIdTable();
+	///@}
+	
+	///@name Per-particle attribute channels
+	///Channels are user defined arrays with an element for each particle, e.g. temperature or dye concentration,
+	///that are reordered, removed, and resized along with the other particle arrays. Each add function returns
+	///the index of the new channel, which remains valid until the fluid is destroyed. New particles are assigned defaultValue.
+	///@{
+	int addScalarChannel(btScalar defaultValue = btScalar(0.0))
+	{
+		return m_particles.m_scalarChannels.addChannel( numParticles(), getMaxParticles(), defaultValue );
+	}
+	int addVectorChannel(const btVector3& defaultValue = btVector3(0,0,0))
+	{
+		return m_particles.m_vectorChannels.addChannel( numParticles(), getMaxParticles(), defaultValue );
+	}
+	int addIntChannel(int defaultValue = 0)
+	{
+		return m_particles.m_intChannels.addChannel( numParticles(), getMaxParticles(), defaultValue );
+	}
+	int addByteChannel(unsigned char defaultValue = 0)
+	{
+		return m_particles.m_byteChannels.addChannel( numParticles(), getMaxParticles(), defaultValue );
+	}
+	
+	int getNumScalarChannels() const { return m_particles.m_scalarChannels.size(); }
+	int getNumVectorChannels() const { return m_particles.m_vectorChannels.size(); }
+	int getNumIntChannels() const { return m_particles.m_intChannels.size(); }
+	int getNumByteChannels() const { return m_particles.m_byteChannels.size(); }
+	
+	///The arrays should not be resized.
+	btAlignedObjectArray<btScalar>& getScalarChannel(int channel) { return m_particles.m_scalarChannels[channel]; }
+	btAlignedObjectArray<btVector3>& getVectorChannel(int channel) { return m_particles.m_vectorChannels[channel]; }
+	btAlignedObjectArray<int>& getIntChannel(int channel) { return m_particles.m_intChannels[channel]; }
+	btAlignedObjectArray<unsigned char>& getByteChannel(int channel) { return m_particles.m_byteChannels[channel]; }
+	const btAlignedObjectArray<btScalar>& getScalarChannel(int channel) const { return m_particles.m_scalarChannels[channel]; }
+	const btAlignedObjectArray<btVector3>& getVectorChannel(int channel) const { return m_particles.m_vectorChannels[channel]; }
+	const btAlignedObjectArray<int>& getIntChannel(int channel) const { return m_particles.m_intChannels[channel]; }
+	const btAlignedObjectArray<unsigned char>& getByteChannel(int channel) const { return m_particles.m_byteChannels[channel]; }
+	///@}
+	
+	///A particle may be marked more than once without any issues.
+	void markParticleForRemoval(int index)
+	{
+		btAssert( 0 <= index && index < numParticles() );
+		
+		int word = index / 32;
+		if( word >= m_removalMask.size() ) m_removalMask.resize(word + 1, 0);
+		m_removalMask[word] |= 1u << (index % 32);
+	}
+	
+	///Resizes the removal mask so that it contains a bit for each particle. Particles may then be marked by setting bits
+	///in internalGetRemovalMask() from several threads, if each thread processes particles in separate groups of 32.
+	void internalResizeRemovalMask() { m_removalMask.resize( (numParticles() + 31) / 32, 0 ); }
+	btAlignedObjectArray<unsigned int>& internalGetRemovalMask() { return m_removalMask; }
 	
 	void removeAllParticles();
 	void removeMarkedParticles();	///<Automatically called during btFluidRigidDynamicsWorld::stepSimulation(); invalidates grid.
 	void insertParticlesIntoGrid(); ///<Automatically called during btFluidRigidDynamicsWorld::stepSimulation(); updates the grid.
 	
 	///Avoid placing particles at the same position; particles with same position and velocity will experience identical SPH forces and not seperate.
-	void setPosition(int index, const btVector3& position) { m_particles.m_pos[index] = position; }
+	///Wakes the particle if it is sleeping.
+	void setPosition(int index, const btVector3& position) 
+	{
+		m_particles.m_pos[index] = position;
+		wakeParticle(index);
+	}
 	
-	///Sets both velocities; getVelocity() and getEvalVelocity().
+	///Sets both velocities; getVelocity() and getEvalVelocity(). Wakes the particle if it is sleeping.
 	void setVelocity(int index, const btVector3& velocity) 
 	{
 		m_particles.m_vel[index] = velocity;
 		m_particles.m_vel_eval[index] = velocity;
+		wakeParticle(index);
 	}
 	
 	///Accumulates a simulation scale force that is applied, and then set to 0 during btFluidRigidDynamicsWorld::stepSimulation().
-	void applyForce(int index, const btVector3& force) { m_particles.m_accumulatedForce[index] += force; }
+	///Wakes the particle if it is sleeping.
+	void applyForce(int index, const btVector3& force) 
+	{
+		m_particles.m_accumulatedForce[index] += force;
+		wakeParticle(index);
+	}
+	
+	///@name Particle sleeping; see btFluidSphParametersLocal::m_sleepVelocityThreshold.
+	///@{
+	///Resets the sleep counter of a particle, and includes it in the current simulation step if it was excluded.
+	void wakeParticle(int index) 
+	{
+		m_particles.m_sleepCounter[index] = 0;
+		m_particles.m_sleeping[index] = 0;
+	}
+	
+	///Returns true if the particle was excluded from the last simulation step.
+	bool isParticleSleeping(int index) const { return (m_particles.m_sleeping[index] != 0); }
+	
+	///Returns the number of particles that were not excluded from the last simulation step.
+	int getNumActiveParticles() const;
+	
+	///Returns getNumActiveParticles() / numParticles(), or 1.0 if there are no particles.
+	btScalar getActiveParticleFraction() const
+	{
+		return ( numParticles() ) ? static_cast<btScalar>( getNumActiveParticles() ) / static_cast<btScalar>( numParticles() ) : btScalar(1.0);
+	}
+	///@}
 	
 	const btVector3& getPosition(int index) const { return m_particles.m_pos[index]; }
 	const btVector3& getVelocity(int index) const { return m_particles.m_vel[index]; }			///<Returns the 'current+(1/2)*timestep' velocity.
@@ -131,6 +319,30 @@ public:
 	void setOverrideParameters(btFluidSphParametersGlobal* parameters) { m_overrideParameters = parameters; }
 	btFluidSphParametersGlobal* getOverrideParameters() const { return m_overrideParameters; }
 	
+	///If nonzero, btFluidRigidDynamicsWorld represents this fluid in the broadphase with a btFluidSphBroadphaseBlock for each 
+	///block of (numCells^3) grid cells that contains particles, instead of a single proxy with the AABB of the entire fluid.
+	///Rigid bodies are then only reported if they intersect a block, and the narrowphase only processes the grid cells of those blocks.
+	///Smaller blocks fit the fluid more closely, but add more proxies and pairs to the broadphase. Default 0.
+	void setBroadphaseBlockCells(int numCells) { m_broadphaseBlockCells = numCells; }
+	int getBroadphaseBlockCells() const { return m_broadphaseBlockCells; }
+	btFluidSphBroadphaseBlocks& internalGetBroadphaseBlocks() { return m_broadphaseBlocks; }
+	const btFluidSphBroadphaseBlocks& getBroadphaseBlocks() const { return m_broadphaseBlocks; }
+	
+	///If adaptiveResolution is not 0, particles of this fluid are merged and split at the end of each internal simulation step.
+	void setAdaptiveResolution(btFluidSphAdaptiveResolution* adaptiveResolution) { m_adaptiveResolution = adaptiveResolution; }
+	btFluidSphAdaptiveResolution* getAdaptiveResolution() const { return m_adaptiveResolution; }
+	
+	///If boundaryParticles is not 0, the objects that it contains interact with this fluid through boundary particles instead of contacts,
+	///if supported by the solver; see btFluidSphSolver::usesRigidBoundaryParticles().
+	///A btFluidSphRigidBoundaryParticles may be shared by several fluids.
+	void setRigidBoundaryParticles(btFluidSphRigidBoundaryParticles* boundaryParticles) { m_rigidBoundaryParticles = boundaryParticles; }
+	btFluidSphRigidBoundaryParticles* getRigidBoundaryParticles() const { return m_rigidBoundaryParticles; }
+	
+	///If snapshotBuffer is not 0, btFluidRigidDynamicsWorld publishes a copy of the particles to it at the end of each 
+	///stepSimulation() that performs at least one internal step, so that other threads may read them while the next step runs.
+	void setSnapshotBuffer(btFluidSphSnapshotBuffer* snapshotBuffer) { m_snapshotBuffer = snapshotBuffer; }
+	btFluidSphSnapshotBuffer* getSnapshotBuffer() const { return m_snapshotBuffer; }
+	
 	//Metablobs	
 	btScalar getValue(btScalar x, btScalar y, btScalar z) const;
 	btVector3 getGradient(btScalar x, btScalar y, btScalar z) const;
@@ -140,13 +352,32 @@ public:
 	btFluidSortingGrid& internalGetGrid() { return m_grid; }
 	
 	//btFluidSph-Rigid collisions
-	void internalClearRigidContacts()
+	void internalClearRigidContacts();	///<The memory of the contact groups is kept for the next step.
+	
+	///Appends a btFluidSphRigidContactGroup with no contacts to internalGetRigidContacts(), which reuses the
+	///contact array of a group removed by internalClearRigidContacts() if one is available.
+	btFluidSphRigidContactGroup& internalAddRigidContactGroup(const btCollisionObject* object);
+	
+	///Called after the broadphase; appends each object in internalGetIntersectingRigidBlocks() once to internalGetIntersectingRigidAabbs(),
+	///in the order that they were first reported, and groups the blocks by object.
+	void internalGroupIntersectingRigidBlocks();
+	
+	btAlignedObjectArray<btFluidSphRigidBlockPair>& internalGetIntersectingRigidBlocks() { return m_intersectingRigidBlocks; }
+	
+	///Returns the number of blocks that intersect the object at index objectIndex in getIntersectingRigidAabbs(). 
+	///If 0, the object was not reported by a block, so it may intersect any particle.
+	int getNumIntersectingRigidBlocks(int objectIndex) const
 	{
-		m_intersectingRigidAabb.clear();
-		m_rigidContacts.clear();
+		if( objectIndex + 1 >= m_intersectingRigidFirstBlock.size() ) return 0;
+		return m_intersectingRigidFirstBlock[objectIndex + 1] - m_intersectingRigidFirstBlock[objectIndex];
+	}
+	const btFluidSphRigidBlockPair& getIntersectingRigidBlock(int objectIndex, int blockIndex) const
+	{
+		return m_intersectingRigidBlocks[ m_intersectingRigidFirstBlock[objectIndex] + blockIndex ];
 	}
 	btAlignedObjectArray<const btCollisionObject*>& internalGetIntersectingRigidAabbs() { return m_intersectingRigidAabb; }
 	btAlignedObjectArray<btFluidSphRigidContactGroup>& internalGetRigidContacts() { return m_rigidContacts; }
+	btAlignedObjectArray<btFluidSphRigidCachedContact>& internalGetRigidContactCache() { return m_rigidContactCache; }
 	
 	const btAlignedObjectArray<const btCollisionObject*>& getIntersectingRigidAabbs() const { return m_intersectingRigidAabb; }
 	const btAlignedObjectArray<btFluidSphRigidContactGroup>& getRigidContacts() const { return m_rigidContacts; }
@@ -175,6 +406,10 @@ public:
 		// replace later with CO_FLUID_SPH
 		return (colObj->getInternalType() == CO_USER_TYPE) ? (btFluidSph*)colObj : 0;
 	}
+	
+private:
+	void assignParticleId(int index);
+	void freeParticleId(int id);
 };
 
 ///@brief Adds particles to a btFluidSph.
@@ -217,22 +452,78 @@ public:
 	///btFluidRigidDynamicsWorld::addSphEmitter()
 	void emit();
 
-	static void addVolume(btFluidSph* fluid, const btVector3& min, const btVector3& max, btScalar spacing);
+	///Fills an AABB with particles separated by spacing, using btFluidSph::addParticles(); returns the number of particles added.
+	///Stops when the fluid reaches btFluidSph::getMaxParticles().
+	static int addVolume(btFluidSph* fluid, const btVector3& min, const btVector3& max, btScalar spacing);
 };
 
 ///@brief Marks particles from a btFluidSph for removal; see btFluidSph::removeMarkedParticles().
+///@remarks Only the grid cells that intersect the AABB of the volume are processed.
 class btFluidAbsorber
 {
 public:
+	enum VolumeType
+	{
+		VOLUME_AABB,		///<Uses m_min and m_max.
+		VOLUME_SPHERE,		///<Uses m_center and m_radius.
+		VOLUME_OBB			///<Uses m_min and m_max in the space of m_transform.
+	};
+	
+	///If nonzero, btFluidRigidDynamicsWorld only applies this absorber to m_fluid; otherwise, it is applied to all fluids
+	btFluidSph* m_fluid;
+	
+	VolumeType m_volumeType;
+	
 	btVector3 m_min;
 	btVector3 m_max;
 	
+	btVector3 m_center;
+	btScalar m_radius;
+	
+	btTransform m_transform;
+	
 	//int m_maxParticlesRemoved;
 	//	add velocity limit / max particles removed, etc.?
 	
-	btFluidAbsorber() : m_min(0,0,0), m_max(0,0,0) {}
+	btFluidAbsorber() : m_fluid(0), m_volumeType(VOLUME_AABB), m_min(0,0,0), m_max(0,0,0), m_center(0,0,0), m_radius(0) 
+	{
+		m_transform.setIdentity();
+	}
 	
+	///This does not need to be called if the absorber is attached using
+	///btFluidRigidDynamicsWorld::addSphAbsorber()
 	void absorb(btFluidSph* fluid);
+	
+	bool containsPoint(const btVector3& point) const
+	{
+		switch(m_volumeType)
+		{
+			case VOLUME_SPHERE:
+				return ( m_center.distance2(point) <= m_radius*m_radius );
+			case VOLUME_OBB:
+				return TestPointAgainstAabb2( m_min, m_max, m_transform.invXform(point) );
+			default:
+				return TestPointAgainstAabb2(m_min, m_max, point);
+		}
+	}
+	
+	void getAabb(btVector3& out_aabbMin, btVector3& out_aabbMax) const
+	{
+		switch(m_volumeType)
+		{
+			case VOLUME_SPHERE:
+				out_aabbMin = m_center - btVector3(m_radius, m_radius, m_radius);
+				out_aabbMax = m_center + btVector3(m_radius, m_radius, m_radius);
+				break;
+			case VOLUME_OBB:
+				btTransformAabb(m_min, m_max, btScalar(0.0), m_transform, out_aabbMin, out_aabbMax);
+				break;
+			default:
+				out_aabbMin = m_min;
+				out_aabbMax = m_max;
+				break;
+		}
+	}
 };
 
 #endif
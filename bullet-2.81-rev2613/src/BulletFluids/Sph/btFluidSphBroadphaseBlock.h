@@ -0,0 +1,177 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef BT_FLUID_SPH_BROADPHASE_BLOCK_H
+#define BT_FLUID_SPH_BROADPHASE_BLOCK_H
+
+#include "LinearMath/btVector3.h"
+#include "LinearMath/btTransform.h"
+#include "LinearMath/btAabbUtil2.h"
+#include "LinearMath/btAlignedObjectArray.h"
+#include "BulletCollision/BroadphaseCollision/btOverlappingPairCache.h"
+#include "BulletCollision/CollisionShapes/btConcaveShape.h"
+#include "BulletCollision/CollisionDispatch/btCollisionObject.h"
+
+#include "btFluidSortingGrid.h"
+
+class btFluidSph;
+
+///Internal shape of btFluidSphBroadphaseBlock. It has the same shape type as btFluidSphCollisionShape,
+///so that btFluidRigidCollisionConfiguration creates a btFluidSphRigidCollisionAlgorithm for it.
+class btFluidSphBroadphaseBlockShape : public btConcaveShape
+{
+public:
+	btVector3 m_aabbMin;
+	btVector3 m_aabbMax;
+	
+	btFluidSphBroadphaseBlockShape() : m_aabbMin(0,0,0), m_aabbMax(0,0,0)
+	{
+		//	temporarily use INVALID_SHAPE_PROXYTYPE (replace later with FLUID_SPH_SHAPE_PROXYTYPE)
+		m_shapeType = INVALID_SHAPE_PROXYTYPE;
+	}
+	
+	void processAllTriangles(btTriangleCallback* callback, const btVector3& aabbMin, const btVector3& aabbMax) const {}
+	
+	virtual void getAabb(const btTransform& t, btVector3& aabbMin, btVector3& aabbMax) const
+	{
+		btTransformAabb(m_aabbMin, m_aabbMax, btScalar(0.0), t, aabbMin, aabbMax);
+	}
+	
+	virtual void setLocalScaling(const btVector3& scaling) {}
+	virtual const btVector3& getLocalScaling() const
+	{
+		static const btVector3 dummy(1,1,1);
+		return dummy;
+	}
+	virtual void calculateLocalInertia(btScalar mass, btVector3& inertia) const { btAssert(0); }
+	virtual const char* getName() const { return "FluidSphBlock"; }
+};
+
+///@brief Internal btCollisionObject that represents a cubic block of btFluidSph grid cells in the broadphase.
+///@remarks Created and removed by btFluidRigidDynamicsWorld; see btFluidSph::setBroadphaseBlockCells().
+///The AABB of a block contains the particles in its grid cells, so it is usually much smaller than the block.
+///@par
+///Blocks only have a broadphase proxy; they are not contained in btCollisionWorld::getCollisionObjectArray().
+class btFluidSphBroadphaseBlock : public btCollisionObject
+{
+	btFluidSph* m_fluid;
+	btFluidGridPosition m_blockPosition;
+	btFluidSphBroadphaseBlockShape m_blockShape;
+
+public:
+	///Value of btCollisionObject::getInternalType(); CO_USER_TYPE is used by btFluidSph.
+	enum { CO_FLUID_SPH_BLOCK = CO_USER_TYPE * 2 };
+	
+	///@param blockPosition Grid cell coordinates divided by btFluidSph::getBroadphaseBlockCells(), rounded down.
+	btFluidSphBroadphaseBlock(btFluidSph* fluid, const btFluidGridPosition& blockPosition)
+	: m_fluid(fluid), m_blockPosition(blockPosition)
+	{
+		m_worldTransform.setIdentity();
+		m_internalType = CO_FLUID_SPH_BLOCK;
+		
+		m_collisionShape = &m_blockShape;
+		m_rootCollisionShape = m_collisionShape;
+		
+		//Blocks are moved every step, and are not simulated
+		setActivationState(DISABLE_DEACTIVATION);
+		
+		//Blocks have no simulation island, so they must not merge the islands of the objects they overlap
+		m_collisionFlags |= CF_NO_CONTACT_RESPONSE;
+	}
+	
+	btFluidSph* getFluid() const { return m_fluid; }
+	const btFluidGridPosition& getBlockPosition() const { return m_blockPosition; }
+	
+	///The AABB is applied to the broadphase proxy during btCollisionWorld::updateAabbs().
+	void setAabb(const btVector3& aabbMin, const btVector3& aabbMax)
+	{
+		m_blockShape.m_aabbMin = aabbMin;
+		m_blockShape.m_aabbMax = aabbMax;
+	}
+	const btVector3& getAabbMin() const { return m_blockShape.m_aabbMin; }
+	const btVector3& getAabbMax() const { return m_blockShape.m_aabbMax; }
+	
+	///@name Used by btFluidRigidDynamicsWorld to fit the AABB to the particles in the block.
+	///@{
+	void internalClearAabb()
+	{
+		m_blockShape.m_aabbMin.setValue(BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT);
+		m_blockShape.m_aabbMax.setValue(-BT_LARGE_FLOAT, -BT_LARGE_FLOAT, -BT_LARGE_FLOAT);
+	}
+	void internalExpandAabb(const btVector3& point)
+	{
+		m_blockShape.m_aabbMin.setMin(point);
+		m_blockShape.m_aabbMax.setMax(point);
+	}
+	bool internalIsAabbEmpty() const { return ( m_blockShape.m_aabbMin.x() > m_blockShape.m_aabbMax.x() ); }
+	///@}
+	
+	//btCollisionObject
+	virtual void setCollisionShape(btCollisionShape *collisionShape) { btAssert(0); }
+	
+	static const btFluidSphBroadphaseBlock* upcast(const btCollisionObject* colObj)
+	{
+		return (colObj->getInternalType() == CO_FLUID_SPH_BLOCK) ? (const btFluidSphBroadphaseBlock*)colObj : 0;
+	}
+	static btFluidSphBroadphaseBlock* upcast(btCollisionObject* colObj)
+	{
+		return (colObj->getInternalType() == CO_FLUID_SPH_BLOCK) ? (btFluidSphBroadphaseBlock*)colObj : 0;
+	}
+};
+
+///Broadphase blocks of a single btFluidSph; managed by btFluidRigidDynamicsWorld.
+struct btFluidSphBroadphaseBlocks
+{
+	btAlignedObjectArray<btFluidSphBroadphaseBlock*> m_blocks;		///<Sorted by btFluidSphBroadphaseBlock::getBlockPosition().
+	int m_blockCells;		///<Value of btFluidSph::getBroadphaseBlockCells() when the blocks were last updated.
+	
+	///If true, the broadphase proxy of the btFluidSph is disabled, and its collision filter is stored
+	///in m_collisionFilterGroup and m_collisionFilterMask, which are used by the blocks.
+	bool m_replacesFluidProxy;
+	short int m_collisionFilterGroup;
+	short int m_collisionFilterMask;
+	
+	btFluidSphBroadphaseBlocks() : m_blockCells(0), m_replacesFluidProxy(false), m_collisionFilterGroup(0), m_collisionFilterMask(0) {}
+};
+
+///@brief Prevents pairs between btFluidSphBroadphaseBlock, which have no collision algorithm.
+///@remarks Set on the btOverlappingPairCache by btFluidRigidDynamicsWorld. The AABBs of neighboring blocks are expanded 
+///by the particle radius, so they always overlap. Other pairs use the same collision filter test as btHashedOverlappingPairCache.
+struct btFluidSphBroadphaseBlockFilterCallback : public btOverlapFilterCallback
+{
+	virtual bool needBroadphaseCollision(btBroadphaseProxy* proxy0, btBroadphaseProxy* proxy1) const
+	{
+		bool collides = (proxy0->m_collisionFilterGroup & proxy1->m_collisionFilterMask) != 0;
+		collides = collides && (proxy1->m_collisionFilterGroup & proxy0->m_collisionFilterMask);
+		if(!collides) return false;
+		
+		const btCollisionObject* object0 = static_cast<const btCollisionObject*>(proxy0->m_clientObject);
+		const btCollisionObject* object1 = static_cast<const btCollisionObject*>(proxy1->m_clientObject);
+		return !( btFluidSphBroadphaseBlock::upcast(object0) && btFluidSphBroadphaseBlock::upcast(object1) );
+	}
+};
+
+///Returns the position of the block containing the grid cell.
+inline btFluidGridPosition getFluidSphBlockPosition(const btFluidGridPosition& cellPosition, int blockCells)
+{
+	//Round down instead of towards 0, so that all blocks have the same size
+	btFluidGridPosition result = cellPosition;
+	result.x = (cellPosition.x >= 0) ? cellPosition.x / blockCells : (cellPosition.x - blockCells + 1) / blockCells;
+	result.y = (cellPosition.y >= 0) ? cellPosition.y / blockCells : (cellPosition.y - blockCells + 1) / blockCells;
+	result.z = (cellPosition.z >= 0) ? cellPosition.z / blockCells : (cellPosition.z - blockCells + 1) / blockCells;
+	
+	return result;
+}
+
+#endif
@@ -0,0 +1,123 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef BT_FLUID_SPH_KERNELS_H
+#define BT_FLUID_SPH_KERNELS_H
+
+#include "LinearMath/btScalar.h"
+
+#include "btFluidSphParameters.h"
+
+///@file
+///Kernel policies for SPH solvers that are specialized at compile time.
+///@remarks
+///Each policy splits a kernel into a partial result, evaluated for every particle pair,
+///and a coefficient that depends only on btFluidSphParametersGlobal.m_sphSmoothRadius:
+/// - W(r) = densityCoeff() * densityPartial()
+/// - gradient( W(r) ) = gradientCoeff() * gradientPartial() * r_vector
+/// - laplacian( W(r) ) = laplacianCoeff() * laplacianPartial()
+///@par
+///The partial functions may only be called if distance < btFluidSphParametersGlobal.m_sphSmoothRadius,
+///and all distances are at simulation scale. The Laplacian is only used for the viscosity force, so
+///it is chosen to be positive over the entire support radius.
+///@par
+///Policies do not contain state, so the hot loops of a solver can be instantiated once per policy;
+///btFluidSphParametersGlobal.m_sphKernel is then used to select an instantiation once per step.
+
+///Poly6, spiky, and viscosity kernels. \n
+///"Particle-Based Fluid Simulation for Interactive Applications". \n
+///M. Muller, D. Charypar, M. Gross. Proceedings of 2003 ACM SIGGRAPH Symposium on Computer Animations, p.154-159, 2003. \n
+struct btFluidSphKernelMuller2003
+{
+	static inline btScalar densityCoeff(const btFluidSphParametersGlobal& FG) { return FG.m_poly6KernCoeff; }
+	static inline btScalar densityPartial(const btFluidSphParametersGlobal& FG, btScalar distanceSquared, btScalar distance)
+	{
+		btScalar c = FG.m_sphRadiusSquared - distanceSquared;
+		return c * c * c;
+	}
+
+	static inline btScalar gradientCoeff(const btFluidSphParametersGlobal& FG) { return FG.m_spikyKernGradCoeff; }
+	static inline btScalar gradientPartial(const btFluidSphParametersGlobal& FG, btScalar distance)
+	{
+		//The spiky kernel gradient is discontinuous at 0
+		btScalar c = FG.m_sphSmoothRadius - distance;
+		return c * c / ( (distance < SIMD_EPSILON) ? SIMD_EPSILON : distance );
+	}
+
+	static inline btScalar laplacianCoeff(const btFluidSphParametersGlobal& FG) { return FG.m_viscosityKernLapCoeff; }
+	static inline btScalar laplacianPartial(const btFluidSphParametersGlobal& FG, btScalar distance) { return FG.m_sphSmoothRadius - distance; }
+};
+
+///Cubic B-spline kernel with a support radius of btFluidSphParametersGlobal.m_sphSmoothRadius. \n
+///"Smoothed particle hydrodynamics". J. J. Monaghan. Reports on Progress in Physics 68, p.1703-1759, 2005. \n
+///The Laplacian is approximated using the kernel gradient, as in: \n
+///"A method of calculating radiative heat diffusion in particle simulations". L. Brookshaw.
+///Proceedings of the Astronomical Society of Australia 6, p.207-210, 1985. \n
+struct btFluidSphKernelCubicSpline
+{
+	static inline btScalar densityCoeff(const btFluidSphParametersGlobal& FG) { return FG.m_cubicSplineKernCoeff; }
+	static inline btScalar densityPartial(const btFluidSphParametersGlobal& FG, btScalar distanceSquared, btScalar distance)
+	{
+		btScalar q = distance / FG.m_sphSmoothRadius;
+		if( q <= btScalar(0.5) ) return btScalar(6.0) * (q*q*q - q*q) + btScalar(1.0);
+
+		btScalar c = btScalar(1.0) - q;
+		return btScalar(2.0) * c * c * c;
+	}
+
+	static inline btScalar gradientCoeff(const btFluidSphParametersGlobal& FG) { return FG.m_cubicSplineKernGradCoeff; }
+	static inline btScalar gradientPartial(const btFluidSphParametersGlobal& FG, btScalar distance)
+	{
+		btScalar q = distance / FG.m_sphSmoothRadius;
+		if( q <= btScalar(0.5) ) return btScalar(3.0) * q - btScalar(2.0);
+
+		btScalar c = btScalar(1.0) - q;
+		return -c * c / q;
+	}
+
+	///laplacian(W) ~= -2 * gradient(W) . r_vector / r^2
+	static inline btScalar laplacianCoeff(const btFluidSphParametersGlobal& FG) { return btScalar(2.0) * FG.m_cubicSplineKernGradCoeff; }
+	static inline btScalar laplacianPartial(const btFluidSphParametersGlobal& FG, btScalar distance) { return -gradientPartial(FG, distance); }
+};
+
+///Wendland C2 kernel with a support radius of btFluidSphParametersGlobal.m_sphSmoothRadius. \n
+///"Piecewise polynomial, positive definite and compactly supported radial functions of minimal degree".
+///H. Wendland. Advances in Computational Mathematics 4, p.389-396, 1995. \n
+///Unlike the other kernels, it does not suffer from the pairing instability, so it remains stable with
+///larger ratios of btFluidSphParametersGlobal.m_sphSmoothRadius to btFluidSphParametersLocal.m_particleDist.
+///The Laplacian is approximated in the same way as btFluidSphKernelCubicSpline.
+struct btFluidSphKernelWendlandC2
+{
+	static inline btScalar densityCoeff(const btFluidSphParametersGlobal& FG) { return FG.m_wendlandKernCoeff; }
+	static inline btScalar densityPartial(const btFluidSphParametersGlobal& FG, btScalar distanceSquared, btScalar distance)
+	{
+		btScalar q = distance / FG.m_sphSmoothRadius;
+		btScalar c = btScalar(1.0) - q;
+		btScalar c2 = c * c;
+		return c2 * c2 * (btScalar(1.0) + btScalar(4.0) * q);
+	}
+
+	static inline btScalar gradientCoeff(const btFluidSphParametersGlobal& FG) { return FG.m_wendlandKernGradCoeff; }
+	static inline btScalar gradientPartial(const btFluidSphParametersGlobal& FG, btScalar distance)
+	{
+		btScalar c = btScalar(1.0) - distance / FG.m_sphSmoothRadius;
+		return c * c * c;
+	}
+
+	///laplacian(W) ~= -2 * gradient(W) . r_vector / r^2
+	static inline btScalar laplacianCoeff(const btFluidSphParametersGlobal& FG) { return btScalar(-2.0) * FG.m_wendlandKernGradCoeff; }
+	static inline btScalar laplacianPartial(const btFluidSphParametersGlobal& FG, btScalar distance) { return gradientPartial(FG, distance); }
+};
+
+#endif
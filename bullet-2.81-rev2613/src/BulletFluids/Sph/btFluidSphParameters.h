@@ -19,6 +19,13 @@ subject to the following restrictions:
 	
 #include "LinearMath/btVector3.h"
 
+///Selects the SPH kernel functions; see btFluidSphKernels.h.
+enum btFluidSphKernelType
+{
+	BT_FLUID_SPH_KERNEL_MULLER_2003 = 0,	///<Poly6 density, spiky gradient, and viscosity Laplacian kernels.
+	BT_FLUID_SPH_KERNEL_CUBIC_SPLINE,		///<Cubic B-spline kernel.
+	BT_FLUID_SPH_KERNEL_WENDLAND_C2			///<Wendland C2 kernel.
+};
 
 ///@brief Contains characteristics shared by all btFluidSph inside a btFluidRigidDynamicsWorld.
 struct btFluidSphParametersGlobal
@@ -44,6 +51,21 @@ struct btFluidSphParametersGlobal
 	btScalar m_viscosityKernLapCoeff;	///<Coefficient of the Laplacian of the viscosity kernel; for viscosity force calculation.
 	///@}
 	
+	///Value of btFluidSphKernelType; determines the kernels used by btFluidSphSolverDefault, btFluidSphSolverPCISPH, 
+	///and btFluidSphSolverIISPH. Default BT_FLUID_SPH_KERNEL_MULLER_2003. To use a different kernel for a single fluid, 
+	///set this in the parameters passed to btFluidSph::setOverrideParameters().
+	///@remarks BT_FLUID_SPH_KERNEL_WENDLAND_C2 remains stable with larger ratios of m_sphSmoothRadius to particle spacing,
+	///so fewer particles(and neighbors) may be used, at a given smoothing radius, than with the other kernels.
+	int m_sphKernel;
+	
+	///@name Coefficients of the alternative kernels; dependent on m_sphSmoothRadius; use setSphInteractionRadius() to set these.
+	///@{
+	btScalar m_cubicSplineKernCoeff;		///<8 / (pi h^3)
+	btScalar m_cubicSplineKernGradCoeff;	///<48 / (pi h^5); for gradient(W) = coeff * partial * r_vector.
+	btScalar m_wendlandKernCoeff;			///<21 / (2 pi h^3)
+	btScalar m_wendlandKernGradCoeff;		///<-210 / (pi h^5); for gradient(W) = coeff * partial * r_vector.
+	///@}
+	
 	btFluidSphParametersGlobal() { setDefaultParameters(); }
 	void setDefaultParameters()
 	{
@@ -52,6 +74,7 @@ struct btFluidSphParametersGlobal
 		m_simulationScale 	 = btScalar(0.004);
 		m_speedLimit 		 = btScalar(200.0);	
 		
+		m_sphKernel = BT_FLUID_SPH_KERNEL_MULLER_2003;
 		setSphInteractionRadius( btScalar(0.01) );
 	}
 	
@@ -69,6 +92,14 @@ struct btFluidSphParametersGlobal
 		
 		//Laplacian of viscocity (denominator): PI h^6
 		m_viscosityKernLapCoeff = btScalar(45.0) / ( SIMD_PI * btPow(m_sphSmoothRadius, 6) );
+		
+		//Cubic spline - 2005 Monaghan, "Smoothed particle hydrodynamics", p.1715
+		m_cubicSplineKernCoeff = btScalar(8.0) / ( SIMD_PI * btPow(m_sphSmoothRadius, 3) );
+		m_cubicSplineKernGradCoeff = btScalar(48.0) / ( SIMD_PI * btPow(m_sphSmoothRadius, 5) );
+		
+		//Wendland C2 - 1995 Wendland, 3D normalization
+		m_wendlandKernCoeff = btScalar(21.0) / ( btScalar(2.0) * SIMD_PI * btPow(m_sphSmoothRadius, 3) );
+		m_wendlandKernGradCoeff = btScalar(-210.0) / ( SIMD_PI * btPow(m_sphSmoothRadius, 5) );
 	}
 };
 
@@ -113,6 +144,30 @@ struct btFluidSphParametersLocal
 	btScalar m_boundaryErp;				///<Fraction of penetration to remove per frame; [0.0, 1.0]; higher values more unstable.
 	///@}
 	
+	///@name Parameters for particle sleeping; currently only used by btFluidSphSolverDefault.
+	///@{
+	btScalar m_sleepVelocityThreshold;		///<Particles slower than this may fall asleep; sleeping is disabled if 0.0; simulation scale; meters/second.
+	btScalar m_sleepDensityErrorThreshold;	///<Particles may fall asleep if |density - m_restDensity| < m_restDensity * this value; range [0.0, 1.0].
+	int m_sleepSteps;						///<Number of consecutive simulation steps below both thresholds before a particle falls asleep.
+	///@}
+	
+	///Particles that are in contact with a single static, kinematic, or sleeping object reuse the contact from the previous step if they
+	///have moved less than this distance relative to the object, instead of performing the narrowphase again. The contact 
+	///distance and point are extrapolated along the previous surface normal, so larger values are less accurate on curved
+	///surfaces and edges. The cache is disabled if 0.0; default 0.0; world scale; meters.
+	btScalar m_rigidContactCacheTolerance;
+	
+	///If nonzero, penetrating contacts with dynamic btRigidBody are clustered by blocks of this many grid cells per axis
+	///when impulses are used. Each particle still receives its own impulse, but the effective mass of the object is
+	///computed once per cluster, and shared by the particles in the cluster; the reaction of the cluster is applied to the
+	///object at the average contact point. This reduces the work per contact, and prevents large numbers of light 
+	///particles from overshooting the response of a light object. Disabled if 0; default 0.
+	int m_rigidContactReductionCells;
+	
+	///Particles are marked for removal during integration once btFluidParticles::m_age reaches this value;
+	///particles do not expire if 0.0; default 0.0; seconds.
+	btScalar m_particleLifetime;
+	
 	btFluidSphParametersLocal() { setDefaultParameters(); }
 	void setDefaultParameters()
 	{
@@ -140,6 +195,15 @@ struct btFluidSphParametersLocal
 		m_boundaryFriction 	= btScalar(0.0);
 		m_boundaryRestitution = btScalar(0.0);
 		m_boundaryErp = btScalar(0.25);
+		
+		m_sleepVelocityThreshold = btScalar(0.0);
+		m_sleepDensityErrorThreshold = btScalar(0.01);
+		m_sleepSteps = 60;
+		
+		m_rigidContactCacheTolerance = btScalar(0.0);
+		m_rigidContactReductionCells = 0;
+		
+		m_particleLifetime = btScalar(0.0);
 	}
 };
 
@@ -0,0 +1,285 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#include "btFluidSphRigidBoundaryParticles.h"
+
+#include "LinearMath/btQuickprof.h"
+#include "BulletCollision/CollisionShapes/btCompoundShape.h"
+#include "BulletDynamics/Dynamics/btRigidBody.h"
+
+#include "btFluidSphParameters.h"
+#include "btFluidSphKernels.h"
+#include "btFluidSphRigidShapeColliders.h"
+
+void btFluidSphRigidBoundaryParticles::addObject(btCollisionObject* object, const btAlignedObjectArray<btVector3>& localPoints)
+{
+	btAssert( !containsObject(object) );
+	
+	BoundaryObject boundaryObject;
+	boundaryObject.m_object = object;
+	boundaryObject.m_firstLocalPoint = m_localPoints.size();
+	boundaryObject.m_numLocalPoints = localPoints.size();
+	
+	int objectIndex = m_objects.size();
+	m_objects.push_back(boundaryObject);
+	
+	for(int i = 0; i < localPoints.size(); ++i) 
+	{
+		m_localPoints.push_back(localPoints[i]);
+		m_localPointObjects.push_back(objectIndex);
+	}
+}
+void btFluidSphRigidBoundaryParticles::removeObject(btCollisionObject* object)
+{
+	int removedIndex = -1;
+	for(int i = 0; i < m_objects.size(); ++i)
+	{
+		if(m_objects[i].m_object == object)
+		{
+			removedIndex = i;
+			break;
+		}
+	}
+	if(removedIndex == -1) return;
+	
+	//Preserve the order of objects, so that the local points remain ordered by object
+	const BoundaryObject removed = m_objects[removedIndex];
+	for(int i = removed.m_firstLocalPoint + removed.m_numLocalPoints; i < m_localPoints.size(); ++i)
+	{
+		m_localPoints[i - removed.m_numLocalPoints] = m_localPoints[i];
+		m_localPointObjects[i - removed.m_numLocalPoints] = m_localPointObjects[i] - 1;
+	}
+	m_localPoints.resize(m_localPoints.size() - removed.m_numLocalPoints);
+	m_localPointObjects.resize(m_localPointObjects.size() - removed.m_numLocalPoints);
+	
+	for(int i = removedIndex + 1; i < m_objects.size(); ++i)
+	{
+		m_objects[i - 1] = m_objects[i];
+		m_objects[i - 1].m_firstLocalPoint -= removed.m_numLocalPoints;
+	}
+	m_objects.pop_back();
+	
+	//Boundary particles refer to the removed object until the next update()
+	m_particles.resize(0);
+	m_grid.clear();
+}
+bool btFluidSphRigidBoundaryParticles::containsObject(const btCollisionObject* object) const
+{
+	for(int i = 0; i < m_objects.size(); ++i)
+		if(m_objects[i].m_object == object) return true;
+	
+	return false;
+}
+
+template<class Collider>
+static void sampleSurfaceWithCollider(const Collider& collider, const btCollisionShape* shape, const btTransform& transform, 
+								btScalar spacing, btAlignedObjectArray<btVector3>& out_localPoints)
+{
+	btVector3 aabbMin;
+	btVector3 aabbMax;
+	shape->getAabb( btTransform::getIdentity(), aabbMin, aabbMax );
+	aabbMin -= btVector3(spacing, spacing, spacing);
+	aabbMax += btVector3(spacing, spacing, spacing);
+	
+	int numX = static_cast<int>( (aabbMax.x() - aabbMin.x()) / spacing ) + 1;
+	int numY = static_cast<int>( (aabbMax.y() - aabbMin.y()) / spacing ) + 1;
+	int numZ = static_cast<int>( (aabbMax.z() - aabbMin.z()) / spacing ) + 1;
+	
+	//Project lattice points that are within half of the spacing from the surface onto it
+	const btScalar maxDistance = spacing * btScalar(0.5);
+	for(int z = 0; z < numZ; ++z)
+		for(int y = 0; y < numY; ++y)
+			for(int x = 0; x < numX; ++x)
+			{
+				btVector3 latticePoint = aabbMin + btVector3( static_cast<btScalar>(x), static_cast<btScalar>(y), static_cast<btScalar>(z) ) * spacing;
+				
+				btVector3 normal;
+				btVector3 surfacePoint;
+				btScalar distance = collider.getClosestPoint(latticePoint, normal, surfacePoint);
+				if( btFabs(distance) <= maxDistance ) out_localPoints.push_back( transform(surfacePoint) );
+			}
+}
+static bool sampleShapeSurfaceRecursive(const btCollisionShape* shape, const btTransform& transform, btScalar spacing, btAlignedObjectArray<btVector3>& out_localPoints)
+{
+	switch( shape->getShapeType() )
+	{
+		case BOX_SHAPE_PROXYTYPE:
+			sampleSurfaceWithCollider( btFluidSphBoxCollider( static_cast<const btBoxShape*>(shape) ), shape, transform, spacing, out_localPoints );
+			return true;
+		case SPHERE_SHAPE_PROXYTYPE:
+			sampleSurfaceWithCollider( btFluidSphSphereCollider( static_cast<const btSphereShape*>(shape) ), shape, transform, spacing, out_localPoints );
+			return true;
+		case CAPSULE_SHAPE_PROXYTYPE:
+			sampleSurfaceWithCollider( btFluidSphCapsuleCollider( static_cast<const btCapsuleShape*>(shape) ), shape, transform, spacing, out_localPoints );
+			return true;
+		case CYLINDER_SHAPE_PROXYTYPE:
+			sampleSurfaceWithCollider( btFluidSphCylinderCollider( static_cast<const btCylinderShape*>(shape) ), shape, transform, spacing, out_localPoints );
+			return true;
+		case CONE_SHAPE_PROXYTYPE:
+			sampleSurfaceWithCollider( btFluidSphConeCollider( static_cast<const btConeShape*>(shape) ), shape, transform, spacing, out_localPoints );
+			return true;
+		case CONVEX_HULL_SHAPE_PROXYTYPE:
+		{
+			const btConvexHullShape* hullShape = static_cast<const btConvexHullShape*>(shape);
+			if( !btFluidSphConvexHullCollider::isSupported(hullShape) ) return false;
+			
+			sampleSurfaceWithCollider( btFluidSphConvexHullCollider(hullShape), shape, transform, spacing, out_localPoints );
+			return true;
+		}
+		case COMPOUND_SHAPE_PROXYTYPE:
+		{
+			const btCompoundShape* compoundShape = static_cast<const btCompoundShape*>(shape);
+			
+			bool allChildrenSupported = true;
+			for(int i = 0; i < compoundShape->getNumChildShapes(); ++i)
+			{
+				bool isSupported = sampleShapeSurfaceRecursive( compoundShape->getChildShape(i), transform * compoundShape->getChildTransform(i), 
+																spacing, out_localPoints );
+				allChildrenSupported = allChildrenSupported && isSupported;
+			}
+			
+			return allChildrenSupported;
+		}
+		
+		default:
+			return false;
+	}
+}
+bool btFluidSphRigidBoundaryParticles::sampleShapeSurface(const btCollisionShape* shape, btScalar spacing, btAlignedObjectArray<btVector3>& out_localPoints)
+{
+	btAssert( spacing > btScalar(0.0) );
+	return sampleShapeSurfaceRecursive(shape, btTransform::getIdentity(), spacing, out_localPoints);
+}
+
+template<class Kernel>
+static void computeBoundaryVolumes(const btFluidSphParametersGlobal& FG, const btFluidSortingGrid& grid, const btFluidParticles& particles, 
+							btAlignedObjectArray<btScalar>& out_volume)
+{
+	const btScalar densityCoeff = Kernel::densityCoeff(FG);
+	const btScalar selfDensityPartial = Kernel::densityPartial( FG, btScalar(0.0), btScalar(0.0) );
+	
+	for(int cell = 0; cell < grid.getNumGridCells(); ++cell)
+	{
+		btFluidGridIterator currentCell = grid.getGridCell(cell);
+		
+		btFluidSortingGrid::FoundCells foundCells;
+		grid.findCells(particles.m_pos[currentCell.m_firstIndex], foundCells);
+		
+		for(int i = currentCell.m_firstIndex; i <= currentCell.m_lastIndex; ++i)
+		{
+			btScalar sum = selfDensityPartial;
+			
+			for(int j = 0; j < btFluidSortingGrid::NUM_FOUND_CELLS; ++j)
+			{
+				const btFluidGridIterator& FI = foundCells.m_iterators[j];
+				for(int n = FI.m_firstIndex; n <= FI.m_lastIndex; ++n)
+				{
+					if(n == i) continue;
+					
+					btScalar distanceSquared = ( (particles.m_pos[i] - particles.m_pos[n]) * FG.m_simulationScale ).length2();
+					if(FG.m_sphRadiusSquared > distanceSquared) sum += Kernel::densityPartial( FG, distanceSquared, btSqrt(distanceSquared) );
+				}
+			}
+			
+			out_volume[i] = btScalar(1.0) / (sum * densityCoeff);
+		}
+	}
+}
+
+void btFluidSphRigidBoundaryParticles::update(const btFluidSphParametersGlobal& FG)
+{
+	BT_PROFILE("btFluidSphRigidBoundaryParticles::update()");
+	
+	m_accumulatedForces.resize( m_objects.size() );
+	m_accumulatedTorques.resize( m_objects.size() );
+	for(int i = 0; i < m_objects.size(); ++i) m_accumulatedForces[i].setValue(0, 0, 0);
+	for(int i = 0; i < m_objects.size(); ++i) m_accumulatedTorques[i].setValue(0, 0, 0);
+	
+	const int numBoundaryParticles = m_localPoints.size();
+	m_particles.resize(numBoundaryParticles);
+	
+	for(int i = 0; i < m_objects.size(); ++i)
+	{
+		const BoundaryObject& current = m_objects[i];
+		const btTransform& transform = current.m_object->getWorldTransform();
+		
+		for(int n = current.m_firstLocalPoint; n < current.m_firstLocalPoint + current.m_numLocalPoints; ++n)
+			m_particles.m_pos[n] = transform(m_localPoints[n]);
+	}
+	
+	m_grid.setCellSize(FG.m_simulationScale, FG.m_sphSmoothRadius);
+	m_grid.insertParticles(m_particles);
+	
+	//m_particles is sorted by the grid; m_index contains the index before sorting, which is the index of the local point 
+	const btAlignedObjectArray<btFluidGridValueIndexPair>& valueIndexPairs = m_grid.getValueIndexPairs();
+	
+	m_objectIndex.resize(numBoundaryParticles);
+	m_volume.resize(numBoundaryParticles);
+	m_velocity.resize(numBoundaryParticles);
+	for(int i = 0; i < numBoundaryParticles; ++i)
+	{
+		int objectIndex = m_localPointObjects[ valueIndexPairs[i].m_index ];
+		m_objectIndex[i] = objectIndex;
+		
+		const btCollisionObject* object = m_objects[objectIndex].m_object;
+		const btRigidBody* rigidBody = btRigidBody::upcast(object);
+		
+		btVector3 relativePosition = m_particles.m_pos[i] - object->getWorldTransform().getOrigin();
+		m_velocity[i] = (rigidBody) ? rigidBody->getVelocityInLocalPoint(relativePosition) * FG.m_simulationScale : btVector3(0, 0, 0);
+	}
+	
+	switch(FG.m_sphKernel)
+	{
+		case BT_FLUID_SPH_KERNEL_CUBIC_SPLINE:
+			computeBoundaryVolumes<btFluidSphKernelCubicSpline>(FG, m_grid, m_particles, m_volume);
+			break;
+		case BT_FLUID_SPH_KERNEL_WENDLAND_C2:
+			computeBoundaryVolumes<btFluidSphKernelWendlandC2>(FG, m_grid, m_particles, m_volume);
+			break;
+		
+		case BT_FLUID_SPH_KERNEL_MULLER_2003:
+		default:
+			computeBoundaryVolumes<btFluidSphKernelMuller2003>(FG, m_grid, m_particles, m_volume);
+			break;
+	}
+}
+
+void btFluidSphRigidBoundaryParticles::applyForcesToRigidBodies(const btFluidSphParametersGlobal& FG)
+{
+	const btScalar timeStep = FG.m_timeStep;
+	for(int i = 0; i < m_accumulatedForces.size(); ++i)
+	{
+		btRigidBody* rigidBody = btRigidBody::upcast(m_objects[i].m_object);
+		if( rigidBody && rigidBody->getInvMass() != btScalar(0.0) && !m_accumulatedForces[i].isZero() )
+		{
+			rigidBody->activate(true);
+			
+			btVector3 linearVelocity = rigidBody->getLinearVelocity();
+			btVector3 angularVelocity = rigidBody->getAngularVelocity();
+			
+			linearVelocity += m_accumulatedForces[i] * rigidBody->getLinearFactor() * (rigidBody->getInvMass() * timeStep);
+			angularVelocity += rigidBody->getInvInertiaTensorWorld() * (m_accumulatedTorques[i] * rigidBody->getAngularFactor()) * timeStep;
+			
+			const btScalar MAX_ANGVEL = SIMD_HALF_PI;
+			btScalar angVel = angularVelocity.length();
+			if(angVel*timeStep > MAX_ANGVEL) angularVelocity *= (MAX_ANGVEL/timeStep) / angVel;
+			
+			rigidBody->setLinearVelocity(linearVelocity);
+			rigidBody->setAngularVelocity(angularVelocity);
+		}
+		
+		m_accumulatedForces[i].setValue(0, 0, 0);
+		m_accumulatedTorques[i].setValue(0, 0, 0);
+	}
+}
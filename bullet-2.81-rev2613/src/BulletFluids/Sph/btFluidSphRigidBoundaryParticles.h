@@ -0,0 +1,119 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef BT_FLUID_SPH_RIGID_BOUNDARY_PARTICLES_H
+#define BT_FLUID_SPH_RIGID_BOUNDARY_PARTICLES_H
+
+#include "LinearMath/btVector3.h"
+#include "LinearMath/btTransform.h"
+#include "LinearMath/btAlignedObjectArray.h"
+#include "BulletCollision/CollisionDispatch/btCollisionObject.h"
+
+#include "btFluidParticles.h"
+#include "btFluidSortingGrid.h"
+
+struct btFluidSphParametersGlobal;
+class btCollisionShape;
+
+///@brief Samples rigid bodies with boundary particles that contribute to the SPH density and pressure force of fluid particles.
+///@remarks
+///This is an alternative to btFluidSphRigidContact and btFluidSphRigidConstraintSolver; objects that are added
+///to a btFluidSphRigidBoundaryParticles, which is set with btFluidSph::setRigidBoundaryParticles(), are excluded from
+///the narrowphase of that fluid if btFluidSphSolver::usesRigidBoundaryParticles() is true for it. The pressure and viscosity forces from boundary particles are applied in reverse
+///to the rigid bodies, producing buoyancy and drag.
+///@par
+///Each boundary particle b has a volume V_b = 1 / sum_k( W(x_b - x_k) ), summed over nearby boundary particles,
+///and contributes restDensity * V_b * W(x_i - x_b) to the density of fluid particle i. This compensates for
+///irregular sampling, so boundary particles do not need to be evenly spaced. \n
+///"Versatile Rigid-Fluid Coupling for Incompressible SPH". N. Akinci, M. Ihmsen, G. Akinci, B. Solenthaler, M. Teschner.
+///ACM Transactions on Graphics 31(4), 2012. \n
+///@par
+///Boundary particles are stored in a btFluidSortingGrid with the same cell size as the fluid grid, so the
+///boundary sums in btFluidSphSolverDefault access them in the same way as fluid neighbors.
+///Only btFluidSphSolverDefault(and its subclasses, except btFluidSphSolverMultiphase) use boundary particles. 
+///Fluids that use other solvers, or btFluidSphParametersGlobal overrides with a different SPH radius, 
+///collide with the objects through contacts instead.
+///@par
+///Boundary particles do not prevent penetration as strictly as contacts, since the force is smooth;
+///the boundary should be sampled at most at btFluidSphParametersLocal::m_particleDist.
+///Sleeping fluid particles are not woken by moving boundary particles. Objects are not owned, and must be
+///removed with removeObject() before they are deleted.
+class btFluidSphRigidBoundaryParticles
+{
+	struct BoundaryObject
+	{
+		btCollisionObject* m_object;
+		int m_firstLocalPoint;
+		int m_numLocalPoints;
+	};
+
+	btAlignedObjectArray<BoundaryObject> m_objects;
+	btAlignedObjectArray<btVector3> m_localPoints;		//Ordered by object; local space of the object
+	btAlignedObjectArray<int> m_localPointObjects;		//Index of the object in m_objects, for each local point
+
+	btFluidParticles m_particles;		//Only btFluidParticles::m_pos is used
+	btFluidSortingGrid m_grid;
+
+	//Parallel arrays with m_particles; in grid order
+	btAlignedObjectArray<int> m_objectIndex;
+	btAlignedObjectArray<btScalar> m_volume;			//Simulation scale
+	btAlignedObjectArray<btVector3> m_velocity;		//Simulation scale
+
+	//Per object; world scale
+	btAlignedObjectArray<btVector3> m_accumulatedForces;
+	btAlignedObjectArray<btVector3> m_accumulatedTorques;
+
+public:
+	///@param localPoints Positions of boundary particles, in the local space of the object.
+	void addObject(btCollisionObject* object, const btAlignedObjectArray<btVector3>& localPoints);
+	void removeObject(btCollisionObject* object);
+	bool containsObject(const btCollisionObject* object) const;
+	int getNumObjects() const { return m_objects.size(); }
+
+	///Places boundary particles on the surface of a shape, with approximately the given spacing.
+	///@remarks Supports the shapes in btFluidSphRigidShapeColliders.h, except btStaticPlaneShape,
+	///and btCompoundShape containing them; other shapes should be sampled by the user.
+	///@return False if the shape, or a child shape, is not supported; points from supported shapes are still added.
+	static bool sampleShapeSurface(const btCollisionShape* shape, btScalar spacing, btAlignedObjectArray<btVector3>& out_localPoints);
+
+	///Automatically called by btFluidRigidDynamicsWorld after rigid bodies are moved, before SPH forces are calculated.
+	///Moves the boundary particles with their objects and recomputes their volumes.
+	void update(const btFluidSphParametersGlobal& FG);
+
+	///Automatically called by btFluidRigidDynamicsWorld after SPH forces are calculated.
+	///Applies the forces accumulated with accumulateReaction() to dynamic rigid bodies, then clears them.
+	void applyForcesToRigidBodies(const btFluidSphParametersGlobal& FG);
+
+	///@name Internal functions used by btFluidSphSolverDefault.
+	///@{
+	const btFluidSortingGrid& getGrid() const { return m_grid; }
+	const btFluidParticles& getParticles() const { return m_particles; }
+	int numParticles() const { return m_particles.size(); }
+
+	btScalar getVolume(int boundaryIndex) const { return m_volume[boundaryIndex]; }
+	const btVector3& getVelocity(int boundaryIndex) const { return m_velocity[boundaryIndex]; }
+
+	///@param worldScaleForce Force applied to the object by the fluid particle, at the position of the boundary particle.
+	void accumulateReaction(int boundaryIndex, const btVector3& worldScaleForce)
+	{
+		int objectIndex = m_objectIndex[boundaryIndex];
+		btVector3 relativePosition = m_particles.m_pos[boundaryIndex] - m_objects[objectIndex].m_object->getWorldTransform().getOrigin();
+
+		m_accumulatedForces[objectIndex] += worldScaleForce;
+		m_accumulatedTorques[objectIndex] += relativePosition.cross(worldScaleForce);
+	}
+	///@}
+};
+
+#endif
@@ -45,10 +45,22 @@ public:
 		const btCollisionObjectWrapper* fluidWrap = (m_isSwapped) ? body1Wrap : body0Wrap;
 		const btCollisionObjectWrapper* rigidWrap = (m_isSwapped) ? body0Wrap : body1Wrap;
 		
+		//Use batched contect detection after reporting AABB intersections here
+		const btFluidSphBroadphaseBlock* block = btFluidSphBroadphaseBlock::upcast( fluidWrap->getCollisionObject() );
+		if(block)
+		{
+			btFluidSphRigidBlockPair pair;
+			pair.m_object = rigidWrap->getCollisionObject();
+			pair.m_blockPosition = block->getBlockPosition();
+			pair.m_pairIndex = 0;
+			
+			block->getFluid()->internalGetIntersectingRigidBlocks().push_back(pair);
+			return;
+		}
+		
 		const btFluidSph* constFluid = static_cast<const btFluidSph*>( fluidWrap->getCollisionObject() );
 		btFluidSph* fluid = const_cast<btFluidSph*>(constFluid);
 		
-		//Use batched contect detection after reporting AABB intersections here
 		fluid->internalGetIntersectingRigidAabbs().push_back( rigidWrap->getCollisionObject() );
 	}
 
@@ -16,14 +16,22 @@ subject to the following restrictions:
 
 #include "LinearMath/btVector3.h"
 #include "LinearMath/btAlignedObjectArray.h"
-#include "LinearMath/btAabbUtil2.h"		//TestPointAgainstAabb2()
+#include "LinearMath/btAabbUtil2.h"		//TestPointAgainstAabb2(), TestAabbAgainstAabb2(), TestTriangleAgainstAabb2()
 #include "BulletCollision/CollisionShapes/btSphereShape.h"
+#include "BulletCollision/CollisionShapes/btConcaveShape.h"
+#include "BulletCollision/CollisionShapes/btCompoundShape.h"
+#include "BulletCollision/BroadphaseCollision/btDbvt.h"
+#include "BulletCollision/CollisionShapes/btTriangleCallback.h"
+#include "BulletCollision/NarrowPhaseCollision/btRaycastCallback.h"		//btTriangleConvexcastCallback
 #include "BulletCollision/CollisionDispatch/btManifoldResult.h"
 #include "BulletCollision/CollisionDispatch/btCollisionWorld.h"
 #include "BulletCollision/BroadphaseCollision/btCollisionAlgorithm.h"
 #include "BulletCollision/BroadphaseCollision/btDispatcher.h"
 
 #include "btFluidSph.h"
+#include "btFluidSphRigidShapeColliders.h"
+#include "btFluidSphRigidSdfCache.h"
+#include "btFluidSphRigidBoundaryParticles.h"
 
 
 
@@ -79,113 +87,926 @@ struct btFluidSphRigidContactResult : public btManifoldResult
 
 
 
-///Adds contacts to a btFluidSphRigidContactGroup
-struct btFluidSphRigidNarrowphaseCallback : public btFluidSortingGrid::AabbCallback
+///Contains the data shared by all narrowphase callbacks for a single btFluidSph-btCollisionObject pair
+struct btFluidSphRigidNarrowphaseInfo
 {
-	//All members must be set
-	btDispatcher* m_dispatcher;
-	const btDispatcherInfo* m_dispatchInfo;
-	
 	btFluidSphRigidContactGroup* m_contactGroup;
 	
 	const btFluidSphParametersGlobal* m_globalParameters;
-	btFluidSph* m_fluid;
+	const btFluidSph* m_fluid;
 	
-	btCollisionObject* m_particleObject;
 	const btCollisionObject* m_rigidObject;
 	
 	btVector3 m_expandedRigidAabbMin;
 	btVector3 m_expandedRigidAabbMax;
 
-	bool m_enableCcd;
+	//If nonzero, particles with (m_resolvedObject[particleIndex] == m_objectIndex) 
+	//have a continuous or cached contact with the object and are not tested again
+	const int* m_resolvedObject;
+	int m_objectIndex;
+	
+	btFluidSphRigidNarrowphaseInfo(const btFluidSphParametersGlobal& FG, const btFluidSph* fluid, const btCollisionObject* rigidObject,
+									int objectIndex, const int* resolvedObject, btFluidSphRigidContactGroup* contactGroup)
+	: m_contactGroup(contactGroup), m_globalParameters(&FG), m_fluid(fluid), m_rigidObject(rigidObject), 
+	m_resolvedObject(resolvedObject), m_objectIndex(objectIndex)
+	{
+		const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+		btScalar particleRadius = FL.m_particleRadius + FL.m_particleRadiusExpansion;
+		
+		//Add particle radius to rigid AABB to avoid calculating particle AABB; use point-AABB test instead of AABB-AABB
+		const btVector3 fluidRadius(particleRadius, particleRadius, particleRadius);
+		m_expandedRigidAabbMin = rigidObject->getBroadphaseHandle()->m_aabbMin - fluidRadius;
+		m_expandedRigidAabbMax = rigidObject->getBroadphaseHandle()->m_aabbMax + fluidRadius;
+	}
+	
+	bool isResolved(int particleIndex) const { return m_resolvedObject && m_resolvedObject[particleIndex] == m_objectIndex; }
+};
+
+///Collides a single particle with the shape of rigidWrap, which may be a child shape of the object, using the btDispatcher.
+static void collideParticleWithDispatcher(const btFluidSphRigidNarrowphaseInfo& info, btDispatcher* dispatcher, const btDispatcherInfo& dispatchInfo,
+											btCollisionObject* particleObject, const btCollisionObjectWrapper& rigidWrap, int particleIndex)
+{
+	btTransform& particleTransform = particleObject->getWorldTransform();
+	particleTransform.setOrigin( info.m_fluid->getPosition(particleIndex) );
 	
-	btFluidSphRigidNarrowphaseCallback() {}
+	btCollisionObjectWrapper particleWrap( 0, particleObject->getCollisionShape(), particleObject, particleTransform );
+	
+	btCollisionAlgorithm* algorithm = dispatcher->findAlgorithm(&particleWrap, &rigidWrap);
+	if(algorithm)
+	{
+		btFluidSphRigidContactResult result(&particleWrap, &rigidWrap, info.m_fluid->getLocalParameters(), 
+											*info.m_contactGroup, particleObject, particleIndex);
+		
+		{
+			//BT_PROFILE("algorithm->processCollision()");
+			algorithm->processCollision(&particleWrap, &rigidWrap, dispatchInfo, &result);
+		}
+		algorithm->~btCollisionAlgorithm();
+		dispatcher->freeCollisionAlgorithm(algorithm);
+	}
+}
+
+///Adds contacts to a btFluidSphRigidContactGroup; uses the btDispatcher, so any btCollisionShape is supported
+struct btFluidSphRigidNarrowphaseCallback : public btFluidSortingGrid::AabbCallback
+{
+	const btFluidSphRigidNarrowphaseInfo& m_info;
+	
+	btDispatcher* m_dispatcher;
+	const btDispatcherInfo* m_dispatchInfo;
+	
+	btCollisionObject* m_particleObject;
+	
+	//If both are nonzero, the distance field is used instead of the btDispatcher where it is available
+	btFluidSphRigidSdfCache* m_sdfCache;
+	btFluidSphRigidSdf* m_sdf;
+	
+	btFluidSphRigidNarrowphaseCallback(const btFluidSphRigidNarrowphaseInfo& info, btDispatcher* dispatcher, 
+										const btDispatcherInfo* dispatchInfo, btCollisionObject* particleObject,
+										btFluidSphRigidSdfCache* sdfCache, btFluidSphRigidSdf* sdf) 
+	: m_info(info), m_dispatcher(dispatcher), m_dispatchInfo(dispatchInfo), m_particleObject(particleObject),
+	m_sdfCache(sdfCache), m_sdf(sdf) {}
 	
 	virtual bool processParticles(const btFluidGridIterator FI, const btVector3& aabbMin, const btVector3& aabbMax)
 	{
-		const btFluidSphParametersLocal& FL = m_fluid->getLocalParameters();
+		const btFluidSph* fluid = m_info.m_fluid;
+		const btCollisionObject* rigidObject = m_info.m_rigidObject;
+		const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
 		
-		btTransform& particleTransform = m_particleObject->getWorldTransform();
+		const btTransform& rigidTransform = rigidObject->getWorldTransform();
 		
-		//Divide by simulation scale to convert fluid velocity from simulation scale to world scale
-		const btScalar timeStepDivSimScale = m_globalParameters->m_timeStep / m_globalParameters->m_simulationScale;
-		const btScalar squaredCcdThreshold = m_fluid->getCcdSquareMotionThreshold();
+		const btScalar expandedParticleRadius = FL.m_particleRadius + FL.m_particleRadiusExpansion;
+		
+		btCollisionObjectWrapper rigidWrap( 0, rigidObject->getCollisionShape(), rigidObject, rigidTransform );
 			
 		for(int n = FI.m_firstIndex; n <= FI.m_lastIndex; ++n)
 		{
-			const btVector3& fluidPos = m_fluid->getPosition(n);
-			btVector3 fluidNextPos = fluidPos + m_fluid->getVelocity(n)*timeStepDivSimScale;
-			btVector3 motion = fluidNextPos - fluidPos;
+			if( m_info.isResolved(n) ) continue;
 			
-			if( m_enableCcd && squaredCcdThreshold != btScalar(0.0) && motion.length2() > squaredCcdThreshold )
+			const btVector3& fluidPos = fluid->getPosition(n);
+			if( TestPointAgainstAabb2(m_info.m_expandedRigidAabbMin, m_info.m_expandedRigidAabbMax, fluidPos) )
 			{
-				btCollisionWorld::ClosestRayResultCallback result(fluidPos, fluidNextPos);
-				
-				btTransform rayStart( btQuaternion::getIdentity(), fluidPos );
-				btTransform rayEnd( btQuaternion::getIdentity(), fluidNextPos );
-				btCollisionWorld::rayTestSingle( rayStart, rayEnd, const_cast<btCollisionObject*>(m_rigidObject), 
-													m_rigidObject->getCollisionShape(), m_rigidObject->getWorldTransform(), result);
-				
-				if( result.hasHit() && result.m_closestHitFraction < btScalar(1.0) )
+				if(m_sdf)
 				{
-					btScalar distanceMoved = result.m_rayFromWorld.distance(result.m_rayToWorld);
-					btScalar distanceCollided = result.m_rayFromWorld.distance(result.m_hitPointWorld);
-			
-					btScalar distance = distanceCollided - distanceMoved;
-					
-					
-					btFluidSphRigidContact contact;
-					contact.m_fluidParticleIndex = n;
-					contact.m_distance = distance;
-					contact.m_normalOnObject = result.m_hitNormalWorld;
-					contact.m_hitPointWorldOnObject = result.m_hitPointWorld;
-					m_contactGroup->addContact(contact);
-					
-					//Move the particle to a position that almost penetrates the rigid.
-					//Otherwise, the particle would appear to react to the collsion before actually contacting the rigid.
-					//That is, there would be a visible gap between the particle and rigid when its velocity is changed.
-					btVector3 lastValidPosition = fluidNextPos + (-motion.normalized())*(-distance + FL.m_particleRadius);
-					m_fluid->setPosition(n, lastValidPosition);
-					
-					continue;
+					btScalar distance;
+					btVector3 localNormal;
+					if( m_sdfCache->getDistance(m_dispatcher, *m_dispatchInfo, rigidObject, m_sdf, 
+												rigidTransform.invXform(fluidPos), distance, localNormal) )
+					{
+						if(distance < expandedParticleRadius)
+						{
+							btFluidSphRigidContact contact;
+							contact.m_fluidParticleIndex = n;
+							contact.m_distance = distance - FL.m_particleRadius;
+							contact.m_normalOnObject = rigidTransform.getBasis() * localNormal;
+							contact.m_hitPointWorldOnObject = fluidPos - contact.m_normalOnObject * distance;
+							m_info.m_contactGroup->addContact(contact);
+						}
+						
+						continue;
+					}
 				}
+			
+				collideParticleWithDispatcher(m_info, m_dispatcher, *m_dispatchInfo, m_particleObject, rigidWrap, n);
+			}
+		}
+		
+		return true;
+	}
+
+};
+
+///Adds a contact if the expanded particle sphere intersects the shape; same as the btDispatcher path.
+///Collider is one of the structs in btFluidSphRigidShapeColliders.h.
+template<class Collider>
+inline void collideParticleWithShape(const btFluidSphRigidNarrowphaseInfo& info, const Collider& collider, 
+									const btTransform& shapeTransform, int particleIndex)
+{
+	const btFluidSphParametersLocal& FL = info.m_fluid->getLocalParameters();
+	const btScalar expandedParticleRadius = FL.m_particleRadius + FL.m_particleRadiusExpansion;
+	
+	const btVector3& fluidPos = info.m_fluid->getPosition(particleIndex);
+	
+	btVector3 localNormal;
+	btVector3 localPoint;
+	btScalar distance = collider.getClosestPoint( shapeTransform.invXform(fluidPos), localNormal, localPoint );
+	
+	if(distance < expandedParticleRadius)
+	{
+		btFluidSphRigidContact contact;
+		contact.m_fluidParticleIndex = particleIndex;
+		contact.m_distance = distance - FL.m_particleRadius;
+		contact.m_normalOnObject = shapeTransform.getBasis() * localNormal;
+		contact.m_hitPointWorldOnObject = shapeTransform(localPoint);
+		info.m_contactGroup->addContact(contact);
+	}
+}
+
+///Adds contacts to a btFluidSphRigidContactGroup; Collider is one of the structs in btFluidSphRigidShapeColliders.h.
+///Entire grid cells are processed without using the btDispatcher, so no collision algorithms are allocated.
+template<class Collider>
+struct btFluidSphRigidShapeNarrowphaseCallback : public btFluidSortingGrid::AabbCallback
+{
+	const btFluidSphRigidNarrowphaseInfo& m_info;
+	const Collider& m_collider;
+	
+	btFluidSphRigidShapeNarrowphaseCallback(const btFluidSphRigidNarrowphaseInfo& info, const Collider& collider) 
+	: m_info(info), m_collider(collider) {}
+	
+	virtual bool processParticles(const btFluidGridIterator FI, const btVector3& aabbMin, const btVector3& aabbMax)
+	{
+		const btFluidSph* fluid = m_info.m_fluid;
+		const btTransform& rigidTransform = m_info.m_rigidObject->getWorldTransform();
+		
+		for(int n = FI.m_firstIndex; n <= FI.m_lastIndex; ++n)
+		{
+			if( m_info.isResolved(n) ) continue;
+			
+			if( TestPointAgainstAabb2(m_info.m_expandedRigidAabbMin, m_info.m_expandedRigidAabbMax, fluid->getPosition(n)) )
+				collideParticleWithShape(m_info, m_collider, rigidTransform, n);
+		}
+		
+		return true;
+	}
+};
+
+void processGridCellsIntersectingAabb(const btFluidSortingGrid& grid, const btVector3& aabbMin, const btVector3& aabbMax, 
+										btFluidSortingGrid::AabbCallback& callback)
+{
+	btFluidGridPosition minIndicies = grid.getDiscretePosition(aabbMin);
+	btFluidGridPosition maxIndicies = grid.getDiscretePosition(aabbMax);
+		
+	int numCellsIntersectingRigid = (1 + maxIndicies.x - minIndicies.x) * (1 + maxIndicies.y - minIndicies.y) * (1 + maxIndicies.z - minIndicies.z);
+	
+	//btFluidSortingGrid::forEachGridCell() performs a binary search for each grid cell
+	//that the AABB intersects. Since the grid is sparse, a search will performed even for
+	//grid cells that have no particles in them. If the rigid's AABB is too large relative
+	//to the grid cell size, then the search will be much slower.
+	const int MAX_CELL_THRESHOLD = 1000;	//Arbitrary value
+	if(numCellsIntersectingRigid > MAX_CELL_THRESHOLD)
+	{
+		for(int i = 0; i < grid.getNumGridCells(); ++i)
+		{
+			const btFluidGridIterator& FI = grid.getGridCell(i);
+			callback.processParticles( FI, btVector3(), btVector3() );
+		}
+	}
+	else grid.forEachGridCell(aabbMin, aabbMax, callback);
+}
+
+///If the object was reported by btFluidSphBroadphaseBlock, only the grid cells of the blocks that it intersects are processed
+void processGridCellsIntersectingObject(const btFluidSph* fluid, int objectIndex, const btVector3& aabbMin, const btVector3& aabbMax, 
+										btFluidSortingGrid::AabbCallback& callback)
+{
+	const btFluidSortingGrid& grid = fluid->getGrid();
+	
+	int numBlocks = fluid->getNumIntersectingRigidBlocks(objectIndex);
+	if(!numBlocks)
+	{
+		processGridCellsIntersectingAabb(grid, aabbMin, aabbMax, callback);
+		return;
+	}
+	
+	const int blockCells = fluid->getBroadphaseBlocks().m_blockCells;
+	
+	btFluidGridPosition minIndicies = grid.getDiscretePosition(aabbMin);
+	btFluidGridPosition maxIndicies = grid.getDiscretePosition(aabbMax);
+	for(int i = 0; i < numBlocks; ++i)
+	{
+		const btFluidGridPosition& block = fluid->getIntersectingRigidBlock(objectIndex, i).m_blockPosition;
+		
+		//Blocks do not overlap, so each grid cell is processed at most once
+		btFluidGridPosition blockMin = minIndicies;
+		btFluidGridPosition blockMax = maxIndicies;
+		blockMin.x = btMax(minIndicies.x, block.x * blockCells);
+		blockMin.y = btMax(minIndicies.y, block.y * blockCells);
+		blockMin.z = btMax(minIndicies.z, block.z * blockCells);
+		blockMax.x = btMin(maxIndicies.x, block.x * blockCells + blockCells - 1);
+		blockMax.y = btMin(maxIndicies.y, block.y * blockCells + blockCells - 1);
+		blockMax.z = btMin(maxIndicies.z, block.z * blockCells + blockCells - 1);
+		
+		if(blockMin.x <= blockMax.x && blockMin.y <= blockMax.y && blockMin.z <= blockMax.z) grid.forEachGridCell(blockMin, blockMax, callback);
+	}
+}
+
+///Stores the grid cells that intersect an AABB, so that they can be divided into work items
+struct btFluidSphGridCellGatherer : public btFluidSortingGrid::AabbCallback
+{
+	btAlignedObjectArray<btFluidGridIterator>& m_cells;
+	
+	btFluidSphGridCellGatherer(btAlignedObjectArray<btFluidGridIterator>& cells) : m_cells(cells) {}
+	
+	virtual bool processParticles(const btFluidGridIterator FI, const btVector3& aabbMin, const btVector3& aabbMax)
+	{
+		m_cells.push_back(FI);
+		return true;
+	}
+};
+
+///Returns true if the shape is collided with a struct from btFluidSphRigidShapeColliders.h
+static bool hasSpecializedCollider(const btCollisionShape* shape)
+{
+	switch( shape->getShapeType() )
+	{
+		case BOX_SHAPE_PROXYTYPE:
+		case SPHERE_SHAPE_PROXYTYPE:
+		case CAPSULE_SHAPE_PROXYTYPE:
+		case CYLINDER_SHAPE_PROXYTYPE:
+		case CONE_SHAPE_PROXYTYPE:
+		case STATIC_PLANE_PROXYTYPE:
+			return true;
+		
+		case CONVEX_HULL_SHAPE_PROXYTYPE:
+			return btFluidSphConvexHullCollider::isSupported( static_cast<const btConvexHullShape*>(shape) );
+		
+		default:
+			return false;
+	}
+}
+
+template<class Collider>
+void collideCellsWithShape(const btFluidSphRigidNarrowphaseInfo& info, const Collider& collider, const btFluidGridIterator* cells, int numCells)
+{
+	btFluidSphRigidShapeNarrowphaseCallback<Collider> callback(info, collider);
+	for(int i = 0; i < numCells; ++i) callback.processParticles( cells[i], btVector3(), btVector3() );
+}
+
+template<class Collider>
+void collideParticlesWithShape(const btFluidSphRigidNarrowphaseInfo& info, const Collider& collider, const btTransform& shapeTransform,
+								const int* particles, int numParticles)
+{
+	for(int i = 0; i < numParticles; ++i) collideParticleWithShape(info, collider, shapeTransform, particles[i]);
+}
+
+///Returns false, without adding contacts, if hasSpecializedCollider() is false for the shape.
+static bool collideParticlesWithSpecializedShape(const btFluidSphRigidNarrowphaseInfo& info, const btCollisionShape* shape, 
+												const btTransform& shapeTransform, const int* particles, int numParticles)
+{
+	if( !hasSpecializedCollider(shape) ) return false;
+
+	switch( shape->getShapeType() )
+	{
+		case BOX_SHAPE_PROXYTYPE:
+			collideParticlesWithShape( info, btFluidSphBoxCollider( static_cast<const btBoxShape*>(shape) ), shapeTransform, particles, numParticles );
+			break;
+		case SPHERE_SHAPE_PROXYTYPE:
+			collideParticlesWithShape( info, btFluidSphSphereCollider( static_cast<const btSphereShape*>(shape) ), shapeTransform, particles, numParticles );
+			break;
+		case CAPSULE_SHAPE_PROXYTYPE:
+			collideParticlesWithShape( info, btFluidSphCapsuleCollider( static_cast<const btCapsuleShape*>(shape) ), shapeTransform, particles, numParticles );
+			break;
+		case CYLINDER_SHAPE_PROXYTYPE:
+			collideParticlesWithShape( info, btFluidSphCylinderCollider( static_cast<const btCylinderShape*>(shape) ), shapeTransform, particles, numParticles );
+			break;
+		case CONE_SHAPE_PROXYTYPE:
+			collideParticlesWithShape( info, btFluidSphConeCollider( static_cast<const btConeShape*>(shape) ), shapeTransform, particles, numParticles );
+			break;
+		case STATIC_PLANE_PROXYTYPE:
+			collideParticlesWithShape( info, btFluidSphStaticPlaneCollider( static_cast<const btStaticPlaneShape*>(shape) ), shapeTransform, particles, numParticles );
+			break;
+		case CONVEX_HULL_SHAPE_PROXYTYPE:
+			collideParticlesWithShape( info, btFluidSphConvexHullCollider( static_cast<const btConvexHullShape*>(shape) ), shapeTransform, particles, numParticles );
+			break;
+	}
+	
+	return true;
+}
+
+///Stores the triangles of a btConcaveShape that overlap an AABB
+struct btFluidSphTriangleGatherer : public btTriangleCallback
+{
+	btAlignedObjectArray<btVector3>& m_vertices;
+	
+	btFluidSphTriangleGatherer(btAlignedObjectArray<btVector3>& vertices) : m_vertices(vertices) {}
+	
+	virtual void processTriangle(btVector3* triangle, int partId, int triangleIndex)
+	{
+		for(int i = 0; i < 3; ++i) m_vertices.push_back(triangle[i]);
+	}
+};
+
+///Stores the indicies of the btCompoundShape children that overlap an AABB
+struct btFluidSphCompoundChildGatherer : public btDbvt::ICollide
+{
+	btAlignedObjectArray<int>& m_children;
+	
+	btFluidSphCompoundChildGatherer(btAlignedObjectArray<int>& children) : m_children(children) {}
+	
+	virtual void Process(const btDbvtNode* leaf) { m_children.push_back(leaf->dataAsInt); }
+};
+
+///Adds contacts to a btFluidSphRigidContactGroup for btConcaveShape(e.g. btBvhTriangleMeshShape) and btCompoundShape.
+///@remarks Colliding each particle using the btDispatcher traverses the BVH of the mesh, or the btDbvt of the 
+///compound children, once per particle. Instead, the triangles or children that overlap the particles in each 
+///grid cell are gathered once, and only those are tested against the particles in the cell.
+///@par
+///Children that do not have a specialized collider, and are not concave, are collided using the btDispatcher.
+struct btFluidSphRigidCellNarrowphaseCallback : public btFluidSortingGrid::AabbCallback
+{
+	const btFluidSphRigidNarrowphaseInfo& m_info;
+	
+	btDispatcher* m_dispatcher;
+	const btDispatcherInfo* m_dispatchInfo;
+	
+	btCollisionObject* m_particleObject;
+	
+	//Reused for each grid cell
+	btAlignedObjectArray<int>& m_cellParticles;
+	btAlignedObjectArray<btVector3>& m_triangleVertices;
+	btAlignedObjectArray<int>& m_children;
+	
+	btFluidSphRigidCellNarrowphaseCallback(const btFluidSphRigidNarrowphaseInfo& info, btDispatcher* dispatcher, 
+											const btDispatcherInfo* dispatchInfo, btCollisionObject* particleObject,
+											btAlignedObjectArray<int>& cellParticles, btAlignedObjectArray<btVector3>& triangleVertices, 
+											btAlignedObjectArray<int>& children) 
+	: m_info(info), m_dispatcher(dispatcher), m_dispatchInfo(dispatchInfo), m_particleObject(particleObject),
+	m_cellParticles(cellParticles), m_triangleVertices(triangleVertices), m_children(children) {}
+	
+	virtual bool processParticles(const btFluidGridIterator FI, const btVector3& aabbMin, const btVector3& aabbMax)
+	{
+		const btFluidSph* fluid = m_info.m_fluid;
+		const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+		
+		//The AABB of the particles is used instead of the grid cell AABB, since it is smaller
+		//and the grid cell AABB is not provided if all grid cells are processed
+		m_cellParticles.resize(0);
+		btVector3 cellMin(BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT);
+		btVector3 cellMax(-BT_LARGE_FLOAT, -BT_LARGE_FLOAT, -BT_LARGE_FLOAT);
+		for(int n = FI.m_firstIndex; n <= FI.m_lastIndex; ++n)
+		{
+			if( m_info.isResolved(n) ) continue;
+			
+			const btVector3& fluidPos = fluid->getPosition(n);
+			if( TestPointAgainstAabb2(m_info.m_expandedRigidAabbMin, m_info.m_expandedRigidAabbMax, fluidPos) )
+			{
+				m_cellParticles.push_back(n);
+				cellMin.setMin(fluidPos);
+				cellMax.setMax(fluidPos);
+			}
+		}
+		if( !m_cellParticles.size() ) return true;
+		
+		btScalar particleRadius = FL.m_particleRadius + FL.m_particleRadiusExpansion;
+		const btVector3 fluidRadius(particleRadius, particleRadius, particleRadius);
+		cellMin -= fluidRadius;
+		cellMax += fluidRadius;
+		
+		const btCollisionShape* rigidShape = m_info.m_rigidObject->getCollisionShape();
+		const btTransform& rigidTransform = m_info.m_rigidObject->getWorldTransform();
+		if( rigidShape->isCompound() ) collideCellWithCompound(static_cast<const btCompoundShape*>(rigidShape), rigidTransform, cellMin, cellMax);
+		else collideCellWithConcave(static_cast<const btConcaveShape*>(rigidShape), rigidTransform, cellMin, cellMax);
+		
+		return true;
+	}
+	
+	void collideCellWithConcave(const btConcaveShape* shape, const btTransform& shapeTransform, const btVector3& cellMin, const btVector3& cellMax)
+	{
+		btVector3 localMin, localMax;
+		btTransformAabb( cellMin, cellMax, btScalar(0.0), shapeTransform.inverse(), localMin, localMax );
+		
+		m_triangleVertices.resize(0);
+		btFluidSphTriangleGatherer gatherer(m_triangleVertices);
+		shape->processAllTriangles(&gatherer, localMin, localMax);
+		if( !m_triangleVertices.size() ) return;
+		
+		btFluidSphTriangleListCollider collider( &m_triangleVertices[0], m_triangleVertices.size() / 3 );
+		collideParticlesWithShape( m_info, collider, shapeTransform, &m_cellParticles[0], m_cellParticles.size() );
+	}
+	
+	void collideCellWithCompound(const btCompoundShape* shape, const btTransform& shapeTransform, const btVector3& cellMin, const btVector3& cellMax)
+	{
+		btVector3 localMin, localMax;
+		btTransformAabb( cellMin, cellMax, btScalar(0.0), shapeTransform.inverse(), localMin, localMax );
+		
+		m_children.resize(0);
+		const btDbvt* tree = shape->getDynamicAabbTree();
+		if(tree)
+		{
+			btFluidSphCompoundChildGatherer gatherer(m_children);
+			tree->collideTV( tree->m_root, btDbvtVolume::FromMM(localMin, localMax), gatherer );
+		}
+		else
+		{
+			for(int i = 0; i < shape->getNumChildShapes(); ++i)
+			{
+				btVector3 childMin, childMax;
+				shape->getChildShape(i)->getAabb(shape->getChildTransform(i), childMin, childMax);
+				if( TestAabbAgainstAabb2(localMin, localMax, childMin, childMax) ) m_children.push_back(i);
 			}
+		}
+		
+		for(int i = 0; i < m_children.size(); ++i)
+		{
+			const btCollisionShape* childShape = shape->getChildShape(m_children[i]);
+			btTransform childTransform = shapeTransform * shape->getChildTransform(m_children[i]);
+			
+			if( collideParticlesWithSpecializedShape(m_info, childShape, childTransform, &m_cellParticles[0], m_cellParticles.size()) ) continue;
 			
-			if( TestPointAgainstAabb2(m_expandedRigidAabbMin, m_expandedRigidAabbMax, fluidPos) )
+			if( childShape->isConcave() ) collideCellWithConcave(static_cast<const btConcaveShape*>(childShape), childTransform, cellMin, cellMax);
+			else
 			{
-				particleTransform.setOrigin(fluidPos);
+				const btCollisionObject* rigidObject = m_info.m_rigidObject;
+				btCollisionObjectWrapper rigidWrap( 0, rigidObject->getCollisionShape(), rigidObject, rigidObject->getWorldTransform() );
+				btCollisionObjectWrapper childWrap( &rigidWrap, childShape, rigidObject, childTransform );
 				
-				btCollisionObjectWrapper particleWrap( 0, m_particleObject->getCollisionShape(), m_particleObject, particleTransform );
-				btCollisionObjectWrapper rigidWrap( 0, m_rigidObject->getCollisionShape(), m_rigidObject, m_rigidObject->getWorldTransform() );
+				for(int n = 0; n < m_cellParticles.size(); ++n)
+					collideParticleWithDispatcher(m_info, m_dispatcher, *m_dispatchInfo, m_particleObject, childWrap, m_cellParticles[n]);
+			}
+		}
+	}
+};
+
+void btFluidSphRigidCollisionDetector::processNarrowphaseWorkItem(const btFluidSphRigidNarrowphaseWorkItems& workItems, int index)
+{
+	const btFluidSphRigidNarrowphaseWorkItem& item = workItems.m_items[index];
+	if(item.m_firstCell > item.m_lastCell) return;
+	
+	btFluidSphRigidNarrowphaseInfo info(*workItems.m_globalParameters, workItems.m_fluid, item.m_rigidObject, 
+										item.m_objectIndex, workItems.m_resolvedObject, &workItems.m_contacts[index]);
+	
+	const btFluidGridIterator* cells = &workItems.m_cells[item.m_firstCell];
+	int numCells = item.m_lastCell - item.m_firstCell + 1;
+	
+	const btCollisionShape* rigidShape = item.m_rigidObject->getCollisionShape();
+	switch( rigidShape->getShapeType() )
+	{
+		case BOX_SHAPE_PROXYTYPE:
+			collideCellsWithShape( info, btFluidSphBoxCollider( static_cast<const btBoxShape*>(rigidShape) ), cells, numCells );
+			break;
+		case SPHERE_SHAPE_PROXYTYPE:
+			collideCellsWithShape( info, btFluidSphSphereCollider( static_cast<const btSphereShape*>(rigidShape) ), cells, numCells );
+			break;
+		case CAPSULE_SHAPE_PROXYTYPE:
+			collideCellsWithShape( info, btFluidSphCapsuleCollider( static_cast<const btCapsuleShape*>(rigidShape) ), cells, numCells );
+			break;
+		case CYLINDER_SHAPE_PROXYTYPE:
+			collideCellsWithShape( info, btFluidSphCylinderCollider( static_cast<const btCylinderShape*>(rigidShape) ), cells, numCells );
+			break;
+		case CONE_SHAPE_PROXYTYPE:
+			collideCellsWithShape( info, btFluidSphConeCollider( static_cast<const btConeShape*>(rigidShape) ), cells, numCells );
+			break;
+		case STATIC_PLANE_PROXYTYPE:
+			collideCellsWithShape( info, btFluidSphStaticPlaneCollider( static_cast<const btStaticPlaneShape*>(rigidShape) ), cells, numCells );
+			break;
+		case CONVEX_HULL_SHAPE_PROXYTYPE:
+			collideCellsWithShape( info, btFluidSphConvexHullCollider( static_cast<const btConvexHullShape*>(rigidShape) ), cells, numCells );
+			break;
+		
+		default:
+			btAssert(0);	//Only shapes with hasSpecializedCollider() are divided into work items
+			break;
+	}
+}
+
+btFluidSphRigidContactGroup& btFluidSphRigidCollisionDetector::addWorkItem(const btCollisionObject* rigidObject, int objectIndex, int firstCell, int lastCell)
+{
+	btFluidSphRigidNarrowphaseWorkItem& item = m_workItems.expandNonInitializing();
+	item.m_rigidObject = rigidObject;
+	item.m_objectIndex = objectIndex;
+	item.m_firstCell = firstCell;
+	item.m_lastCell = lastCell;
+	
+	if( m_workItemContacts.size() < m_workItems.size() ) m_workItemContacts.expand();
+	
+	btFluidSphRigidContactGroup& contactGroup = m_workItemContacts[m_workItems.size() - 1];
+	contactGroup.m_object = rigidObject;
+	contactGroup.m_contacts.resize(0);
+	
+	return contactGroup;
+}
+
+///Records the earliest hit of a swept particle against the triangles of a concave shape
+struct btFluidSphCcdTriangleSweepCallback : public btTriangleConvexcastCallback
+{
+	btVector3 m_normalOnObject;
+	btVector3 m_hitPointWorldOnObject;
+	
+	btFluidSphCcdTriangleSweepCallback(const btConvexShape* particleShape, const btTransform& from, const btTransform& to,
+										const btTransform& rigidTransform, btScalar triangleMargin)
+	: btTriangleConvexcastCallback(particleShape, from, to, rigidTransform, triangleMargin)
+	{
+		m_allowedPenetration = btScalar(0.0);
+	}
+	
+	//Since the triangles are transformed by rigidTransform, the normal and point are in world space
+	virtual btScalar reportHit(const btVector3& hitNormalLocal, const btVector3& hitPointLocal, btScalar hitFraction, int partId, int triangleIndex)
+	{
+		if(hitFraction < m_hitFraction)
+		{
+			m_hitFraction = hitFraction;
+			m_normalOnObject = hitNormalLocal;
+			m_hitPointWorldOnObject = hitPointLocal;
+		}
+		
+		return hitFraction;
+	}
+};
+
+///Stores the triangles of a concave shape that overlap a btFluidSphRigidCcdBatches batch, so that the BVH is traversed once per batch
+struct btFluidSphCcdTriangleGatherer : public btTriangleCallback
+{
+	//Limits the stack space used; if a batch overlaps more triangles, each sweep in the batch traverses the BVH separately
+	enum { MAX_TRIANGLES = 64 };
+
+	btVector3 m_vertices[MAX_TRIANGLES][3];
+	int m_partIds[MAX_TRIANGLES];
+	int m_triangleIndicies[MAX_TRIANGLES];
+	
+	int m_numTriangles;
+	bool m_overflow;
+	
+	btFluidSphCcdTriangleGatherer() : m_numTriangles(0), m_overflow(false) {}
+	
+	virtual void processTriangle(btVector3* triangle, int partId, int triangleIndex)
+	{
+		if(m_numTriangles == MAX_TRIANGLES)
+		{
+			m_overflow = true;
+			return;
+		}
+		
+		for(int i = 0; i < 3; ++i) m_vertices[m_numTriangles][i] = triangle[i];
+		m_partIds[m_numTriangles] = partId;
+		m_triangleIndicies[m_numTriangles] = triangleIndex;
+		++m_numTriangles;
+	}
+};
+
+void btFluidSphRigidCollisionDetector::testCcdBatch(btFluidSphRigidCcdBatches& batches, int batchIndex)
+{
+	const btCollisionObject* rigidObject = batches.m_rigidObject;
+	const btCollisionShape* rigidShape = rigidObject->getCollisionShape();
+	const btTransform& rigidTransform = rigidObject->getWorldTransform();
+	
+	int firstSweep = batchIndex * batches.m_batchSize;
+	int lastSweep = btMin(firstSweep + batches.m_batchSize, batches.m_numSweeps) - 1;
+	
+	btSphereShape particleShape(batches.m_particleRadius);
+	const btVector3 particleRadius(batches.m_particleRadius, batches.m_particleRadius, batches.m_particleRadius);
+	
+	for(int i = firstSweep; i <= lastSweep; ++i) batches.m_sweeps[i].m_hitFraction = btScalar(1.0);
+	
+	if( rigidShape->isConcave() )
+	{
+		//Gather the triangles that overlap the swept AABB of the entire batch, in the local space of the shape
+		btVector3 batchMin(BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT);
+		btVector3 batchMax(-BT_LARGE_FLOAT, -BT_LARGE_FLOAT, -BT_LARGE_FLOAT);
+		for(int i = firstSweep; i <= lastSweep; ++i)
+		{
+			const btFluidSphRigidCcdSweep& sweep = batches.m_sweeps[i];
+			btVector3 localFrom = rigidTransform.invXform(sweep.m_from);
+			btVector3 localTo = rigidTransform.invXform(sweep.m_to);
+			
+			batchMin.setMin(localFrom);
+			batchMin.setMin(localTo);
+			batchMax.setMax(localFrom);
+			batchMax.setMax(localTo);
+		}
+		batchMin -= particleRadius;
+		batchMax += particleRadius;
+		
+		btFluidSphCcdTriangleGatherer triangles;
+		static_cast<const btConcaveShape*>(rigidShape)->processAllTriangles(&triangles, batchMin, batchMax);
+		
+		if(!triangles.m_overflow)
+		{
+			for(int i = firstSweep; i <= lastSweep; ++i)
+			{
+				btFluidSphRigidCcdSweep& sweep = batches.m_sweeps[i];
+				
+				btVector3 localFrom = rigidTransform.invXform(sweep.m_from);
+				btVector3 localTo = rigidTransform.invXform(sweep.m_to);
+				btVector3 sweepMin = localFrom;
+				btVector3 sweepMax = localFrom;
+				sweepMin.setMin(localTo);
+				sweepMax.setMax(localTo);
+				sweepMin -= particleRadius;
+				sweepMax += particleRadius;
+				
+				btTransform from( btQuaternion::getIdentity(), sweep.m_from );
+				btTransform to( btQuaternion::getIdentity(), sweep.m_to );
+				btFluidSphCcdTriangleSweepCallback callback(&particleShape, from, to, rigidTransform, rigidShape->getMargin());
 				
-				btCollisionAlgorithm* algorithm = m_dispatcher->findAlgorithm(&particleWrap, &rigidWrap);
-				if(algorithm)
+				for(int n = 0; n < triangles.m_numTriangles; ++n)
 				{
-					btFluidSphRigidContactResult result(&particleWrap, &rigidWrap, FL, *m_contactGroup, m_particleObject, n);
+					if( !TestTriangleAgainstAabb2(triangles.m_vertices[n], sweepMin, sweepMax) ) continue;
 					
-					{
-						//BT_PROFILE("algorithm->processCollision()");
-						algorithm->processCollision(&particleWrap, &rigidWrap, *m_dispatchInfo, &result);
-					}
-					algorithm->~btCollisionAlgorithm();
-					m_dispatcher->freeCollisionAlgorithm(algorithm);
+					//processTriangle() takes a non-const pointer
+					btVector3 vertices[3] = { triangles.m_vertices[n][0], triangles.m_vertices[n][1], triangles.m_vertices[n][2] };
+					callback.processTriangle(vertices, triangles.m_partIds[n], triangles.m_triangleIndicies[n]);
+				}
+				
+				if( callback.m_hitFraction < btScalar(1.0) )
+				{
+					sweep.m_hitFraction = callback.m_hitFraction;
+					sweep.m_normalOnObject = callback.m_normalOnObject;
+					sweep.m_hitPointWorldOnObject = callback.m_hitPointWorldOnObject;
 				}
-					
 			}
+			
+			return;
 		}
+	}
+	
+	//Convex and compound shapes, and batches that overlap too many triangles
+	for(int i = firstSweep; i <= lastSweep; ++i)
+	{
+		btFluidSphRigidCcdSweep& sweep = batches.m_sweeps[i];
+	
+		btTransform from( btQuaternion::getIdentity(), sweep.m_from );
+		btTransform to( btQuaternion::getIdentity(), sweep.m_to );
 		
-		return true;
+		btCollisionWorld::ClosestConvexResultCallback result(sweep.m_from, sweep.m_to);
+		btCollisionWorld::objectQuerySingle( &particleShape, from, to, const_cast<btCollisionObject*>(rigidObject), 
+											rigidShape, rigidTransform, result, btScalar(0.0) );
+		
+		if( result.hasHit() )
+		{
+			sweep.m_hitFraction = result.m_closestHitFraction;
+			sweep.m_normalOnObject = result.m_hitNormalWorld;
+			sweep.m_hitPointWorldOnObject = result.m_hitPointWorld;
+		}
+	}
+}
+
+void btFluidSphRigidCollisionDetector::resolveContinuousCollisions(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
+																	int objectIndex, btFluidSphRigidContactGroup& contactGroup)
+{
+	BT_PROFILE("FluidSphRigid - resolveContinuousCollisions()");
+
+	const btCollisionObject* rigidObject = contactGroup.m_object;
+	const btScalar radius = fluid->getLocalParameters().m_particleRadius;
+	
+	//Divide by simulation scale to convert fluid velocity from simulation scale to world scale
+	const btScalar timeStepDivSimScale = FG.m_timeStep / FG.m_simulationScale;
+	
+	const btVector3 particleRadius(radius, radius, radius);
+	const btVector3 expandedRigidAabbMin = rigidObject->getBroadphaseHandle()->m_aabbMin - particleRadius;
+	const btVector3 expandedRigidAabbMax = rigidObject->getBroadphaseHandle()->m_aabbMax + particleRadius;
+	
+	//Positions are read here instead of in performNarrowphase(), since CCD with a previous object may have moved the particle
+	m_ccdSweeps.resize(0);
+	for(int i = 0; i < m_fastParticles.size(); ++i)
+	{
+		int n = m_fastParticles[i];
+		
+		const btVector3& fluidPos = fluid->getPosition(n);
+		btVector3 fluidNextPos = fluidPos + fluid->getVelocity(n)*timeStepDivSimScale;
+		
+		btVector3 sweepMin = fluidPos;
+		btVector3 sweepMax = fluidPos;
+		sweepMin.setMin(fluidNextPos);
+		sweepMax.setMax(fluidNextPos);
+		
+		if( TestAabbAgainstAabb2(sweepMin, sweepMax, expandedRigidAabbMin, expandedRigidAabbMax) )
+		{
+			btFluidSphRigidCcdSweep& sweep = m_ccdSweeps.expandNonInitializing();
+			sweep.m_fluidParticleIndex = n;
+			sweep.m_from = fluidPos;
+			sweep.m_to = fluidNextPos;
+		}
+	}
+	if( !m_ccdSweeps.size() ) return;
+	
+	const int SWEEPS_PER_BATCH = 32;
+	
+	btFluidSphRigidCcdBatches batches;
+	batches.m_rigidObject = rigidObject;
+	batches.m_particleRadius = radius;
+	batches.m_sweeps = &m_ccdSweeps[0];
+	batches.m_numSweeps = m_ccdSweeps.size();
+	batches.m_batchSize = SWEEPS_PER_BATCH;
+	testCcdBatches(batches);
+	
+	for(int i = 0; i < m_ccdSweeps.size(); ++i)
+	{
+		const btFluidSphRigidCcdSweep& sweep = m_ccdSweeps[i];
+		if( !(sweep.m_hitFraction < btScalar(1.0)) ) continue;
+		
+		//Particles that are already in contact and moving along the surface are handled by the discrete test
+		btVector3 motion = sweep.m_to - sweep.m_from;
+		if( motion.dot(sweep.m_normalOnObject) >= btScalar(0.0) ) continue;
+		
+		//Distance that the particle would have moved past the point of impact
+		btScalar distance = -motion.length() * (btScalar(1.0) - sweep.m_hitFraction);
+		
+		btFluidSphRigidContact contact;
+		contact.m_fluidParticleIndex = sweep.m_fluidParticleIndex;
+		contact.m_distance = distance;
+		contact.m_normalOnObject = sweep.m_normalOnObject;
+		contact.m_hitPointWorldOnObject = sweep.m_hitPointWorldOnObject;
+		contactGroup.addContact(contact);
+		
+		//Move the particle to the point of impact.
+		//Otherwise, the particle would appear to react to the collsion before actually contacting the rigid.
+		//That is, there would be a visible gap between the particle and rigid when its velocity is changed.
+		fluid->setPosition(sweep.m_fluidParticleIndex, sweep.m_from + motion * sweep.m_hitFraction);
+		
+		m_resolvedObject[sweep.m_fluidParticleIndex] = objectIndex;
 	}
+}
 
+struct btFluidSphRigidCollisionDetector::CacheableObjectSortPredicate
+{
+	bool operator() (const CacheableObject& a, const CacheableObject& b) const { return a.m_object < b.m_object; }
 };
+struct btFluidSphRigidCollisionDetector::CachedContactHitSortPredicate
+{
+	bool operator() (const CachedContactHit& a, const CachedContactHit& b) const
+	{
+		if(a.m_objectIndex != b.m_objectIndex) return a.m_objectIndex < b.m_objectIndex;
+		return a.m_contact.m_fluidParticleIndex < b.m_contact.m_fluidParticleIndex;
+	}
+};
+
+///Cached contacts are stored in the local space of the object, so static and kinematic objects may still be moved.
+///Dynamic objects are only cached while sleeping, since the particles would otherwise move relative to them every step.
+bool isContactCacheable(const btCollisionObject* object) { return object->isStaticOrKinematicObject() || !object->isActive(); }
+
+void btFluidSphRigidCollisionDetector::findCachedContacts(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, btScalar squaredCcdThreshold,
+															const btFluidSphRigidBoundaryParticles* boundaryParticles)
+{
+	BT_PROFILE("FluidSphRigid - findCachedContacts()");
+	
+	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+	const btFluidParticles& particles = fluid->getParticles();
+	const btAlignedObjectArray<btFluidSphRigidCachedContact>& cache = fluid->internalGetRigidContactCache();
+	
+	if( !cache.size() ) return;
+	
+	//Objects that are not in the AABB of the fluid in this step are ignored, so deleted objects are never accessed
+	m_cacheableObjects.resize(0);
+	const btAlignedObjectArray<const btCollisionObject*>& intersectingRigidAabbs = fluid->internalGetIntersectingRigidAabbs();
+	for(int i = 0; i < intersectingRigidAabbs.size(); ++i)
+	{
+		const btCollisionObject* rigidObject = intersectingRigidAabbs[i];
+		if( !isContactCacheable(rigidObject) ) continue;
+		if( boundaryParticles && boundaryParticles->containsObject(rigidObject) ) continue;
+		
+		CacheableObject& object = m_cacheableObjects.expandNonInitializing();
+		object.m_object = rigidObject;
+		object.m_objectIndex = i;
+	}
+	if( !m_cacheableObjects.size() ) return;
+	m_cacheableObjects.quickSort( CacheableObjectSortPredicate() );
+	
+	const btScalar squaredTolerance = FL.m_rigidContactCacheTolerance * FL.m_rigidContactCacheTolerance;
+	
+	//Divide by simulation scale to convert fluid velocity from simulation scale to world scale
+	const btScalar timeStepDivSimScale = FG.m_timeStep / FG.m_simulationScale;
+	
+	for(int n = 0; n < fluid->numParticles(); ++n)
+	{
+		int cacheIndex = particles.m_rigidContactCacheIndex[n];
+		if( cacheIndex < 0 || cacheIndex >= cache.size() || !cache[cacheIndex].m_object ) continue;
+		
+		const btFluidSphRigidCachedContact& cached = cache[cacheIndex];
+		
+		int first = 0;
+		int last = m_cacheableObjects.size() - 1;
+		while(first < last)
+		{
+			int middle = (first + last) / 2;
+			if(m_cacheableObjects[middle].m_object < cached.m_object) first = middle + 1;
+			else last = middle;
+		}
+		if(m_cacheableObjects[first].m_object != cached.m_object) continue;
+		
+		++m_numCacheLookups;
+		
+		//Particles that are swept against objects are not resting
+		if( squaredCcdThreshold != btScalar(0.0) 
+			&& (fluid->getVelocity(n) * timeStepDivSimScale).length2() > squaredCcdThreshold ) continue;
+		
+		const btTransform& rigidTransform = cached.m_object->getWorldTransform();
+		btVector3 displacement = rigidTransform.invXform( fluid->getPosition(n) ) - cached.m_localPosition;
+		if( displacement.length2() > squaredTolerance ) continue;
+		
+		++m_numCacheHits;
+		
+		//Treat the closest feature as a plane, and slide the contact point along it
+		btScalar normalDisplacement = displacement.dot(cached.m_localNormal);
+		btVector3 localHitPoint = cached.m_localHitPoint + displacement - cached.m_localNormal * normalDisplacement;
+		
+		CachedContactHit& hit = m_cacheHits.expandNonInitializing();
+		hit.m_objectIndex = m_cacheableObjects[first].m_objectIndex;
+		hit.m_cacheIndex = cacheIndex;
+		hit.m_contact.m_fluidParticleIndex = n;
+		hit.m_contact.m_distance = cached.m_distance + normalDisplacement;
+		hit.m_contact.m_normalOnObject = rigidTransform.getBasis() * cached.m_localNormal;
+		hit.m_contact.m_hitPointWorldOnObject = rigidTransform(localHitPoint);
+	}
+	
+	if( m_cacheHits.size() > 1 ) m_cacheHits.quickSort( CachedContactHitSortPredicate() );
+}
+
+void btFluidSphRigidCollisionDetector::updateContactCache(btFluidSph* fluid, int firstContactGroup)
+{
+	BT_PROFILE("FluidSphRigid - updateContactCache()");
+	
+	btFluidParticles& particles = fluid->internalGetParticles();
+	btAlignedObjectArray<btFluidSphRigidCachedContact>& cache = fluid->internalGetRigidContactCache();
+	const btAlignedObjectArray<btFluidSphRigidContactGroup>& rigidContacts = fluid->internalGetRigidContacts();
+	
+	//Both are negative, so the particle has no entry in the next step
+	const int NO_ENTRY = -1;
+	const int NOT_CACHED = -2;		//Prevents an entry from being created during this step
+	
+	for(int n = 0; n < fluid->numParticles(); ++n) particles.m_rigidContactCacheIndex[n] = NO_ENTRY;
+	
+	//Continuous contacts depend on the motion of the particle
+	for(int i = 0; i < m_fastParticles.size(); ++i) particles.m_rigidContactCacheIndex[ m_fastParticles[i] ] = NOT_CACHED;
+	
+	//Reused entries are copied instead of being replaced by the extrapolated contact, so that the error does not accumulate
+	m_nextContactCache.resize(0);
+	for(int i = 0; i < m_cacheHits.size(); ++i)
+	{
+		particles.m_rigidContactCacheIndex[ m_cacheHits[i].m_contact.m_fluidParticleIndex ] = m_nextContactCache.size();
+		m_nextContactCache.push_back( cache[ m_cacheHits[i].m_cacheIndex ] );
+	}
+	const int numReusedEntries = m_nextContactCache.size();
+	
+	for(int i = firstContactGroup; i < rigidContacts.size(); ++i)
+	{
+		const btFluidSphRigidContactGroup& contactGroup = rigidContacts[i];
+		const btCollisionObject* rigidObject = contactGroup.m_object;
+		if( !isContactCacheable(rigidObject) ) continue;
+		
+		const btTransform& rigidTransform = rigidObject->getWorldTransform();
+		for(int c = 0; c < contactGroup.numContacts(); ++c)
+		{
+			const btFluidSphRigidContact& contact = contactGroup.m_contacts[c];
+			int& cacheIndex = particles.m_rigidContactCacheIndex[contact.m_fluidParticleIndex];
+			
+			if(cacheIndex == NO_ENTRY)
+			{
+				cacheIndex = m_nextContactCache.size();
+				
+				btFluidSphRigidCachedContact& entry = m_nextContactCache.expandNonInitializing();
+				entry.m_object = rigidObject;
+				entry.m_localPosition = rigidTransform.invXform( fluid->getPosition(contact.m_fluidParticleIndex) );
+				entry.m_localNormal = rigidTransform.getBasis().transpose() * contact.m_normalOnObject;
+				entry.m_localHitPoint = rigidTransform.invXform(contact.m_hitPointWorldOnObject);
+				entry.m_distance = contact.m_distance;
+			}
+			else if( cacheIndex >= numReusedEntries && m_nextContactCache[cacheIndex].m_object == rigidObject )
+			{
+				//Several contacts with the same object(e.g. at an edge of a triangle mesh) cannot be replaced by a single cached contact
+				m_nextContactCache[cacheIndex].m_object = 0;
+				cacheIndex = NOT_CACHED;
+			}
+		}
+	}
+	
+	cache = m_nextContactCache;
+}
 
 void btFluidSphRigidCollisionDetector::performNarrowphase(btDispatcher* dispatcher, const btDispatcherInfo& dispatchInfo, 
-															const btFluidSphParametersGlobal&FG, btFluidSph* fluid)
+															const btFluidSphParametersGlobal&FG, btFluidSph* fluid,
+															const btFluidSphRigidBoundaryParticles* boundaryParticles)
 {
 	BT_PROFILE("FluidSphRigid - performNarrowphase()");
 	
 	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
-	const btFluidSortingGrid& grid = fluid->getGrid();
 	btAlignedObjectArray<btFluidSphRigidContactGroup>& rigidContacts = fluid->internalGetRigidContacts();
 	
 	btScalar particleRadius = FL.m_particleRadius + FL.m_particleRadiusExpansion;
@@ -197,52 +1018,196 @@ void btFluidSphRigidCollisionDetector::performNarrowphase(btDispatcher* dispatch
 	btTransform& particleTransform = particleObject.getWorldTransform();
 	particleTransform.setRotation( btQuaternion::getIdentity() );
 	
+	const bool useContactCache = ( FL.m_rigidContactCacheTolerance > btScalar(0.0) );
+	const int firstContactGroup = rigidContacts.size();
+	
+	//Gather particles that move far enough to pass through objects during this step
+	m_fastParticles.resize(0);
+	const btScalar squaredCcdThreshold = (dispatchInfo.m_useContinuous) ? fluid->getCcdSquareMotionThreshold() : btScalar(0.0);
+	if( squaredCcdThreshold != btScalar(0.0) )
+	{
+		//Divide by simulation scale to convert fluid velocity from simulation scale to world scale
+		const btScalar timeStepDivSimScale = FG.m_timeStep / FG.m_simulationScale;
+	
+		for(int n = 0; n < fluid->numParticles(); ++n)
+		{
+			btVector3 motion = fluid->getVelocity(n) * timeStepDivSimScale;
+			if( motion.length2() > squaredCcdThreshold ) m_fastParticles.push_back(n);
+		}
+	}
+	
+	//Particles resting on static, kinematic, or sleeping objects reuse their contact from the previous step
+	m_cacheHits.resize(0);
+	if(useContactCache) findCachedContacts(FG, fluid, squaredCcdThreshold, boundaryParticles);
+	else fluid->internalGetRigidContactCache().resize(0);
+	
+	const bool hasResolvedParticles = ( m_fastParticles.size() || m_cacheHits.size() );
+	if(hasResolvedParticles)
+	{
+		m_resolvedObject.resize( fluid->numParticles() );
+		for(int n = 0; n < fluid->numParticles(); ++n) m_resolvedObject[n] = -1;
+		for(int i = 0; i < m_cacheHits.size(); ++i) m_resolvedObject[ m_cacheHits[i].m_contact.m_fluidParticleIndex ] = m_cacheHits[i].m_objectIndex;
+	}
+	
+	const int* resolvedObject = (hasResolvedParticles) ? &m_resolvedObject[0] : 0;
+	
 	const btAlignedObjectArray<const btCollisionObject*>& intersectingRigidAabbs = fluid->internalGetIntersectingRigidAabbs();
+	
+	//Continuous collisions move particles, so they are resolved for all objects before any discrete test
+	if( m_fastParticles.size() )
+	{
+		if( m_ccdContacts.size() < intersectingRigidAabbs.size() ) m_ccdContacts.resize( intersectingRigidAabbs.size() );
+		
+		for(int i = 0; i < intersectingRigidAabbs.size(); ++i)
+		{
+			const btCollisionObject* rigidObject = intersectingRigidAabbs[i];
+			
+			btFluidSphRigidContactGroup& ccdContacts = m_ccdContacts[i];
+			ccdContacts.m_object = rigidObject;
+			ccdContacts.m_contacts.resize(0);
+			
+			if( boundaryParticles && boundaryParticles->containsObject(rigidObject) ) continue;
+			
+			resolveContinuousCollisions(FG, fluid, i, ccdContacts);
+		}
+	}
+	
+	//Objects with a specialized collider are divided into work items of up to CELLS_PER_WORK_ITEM grid cells,
+	//which are processed by processNarrowphaseWorkItems(). Other objects use the btDispatcher, which is not
+	//thread safe, so they are processed here. In both cases, the continuous and cached contacts are placed
+	//in a work item with no cells.
+	const int CELLS_PER_WORK_ITEM = 16;
+	
+	m_workItems.resize(0);
+	m_workItemCells.resize(0);
+	
+	int nextCacheHit = 0;
+	
 	for(int i = 0; i < intersectingRigidAabbs.size(); ++i)
 	{
 		const btCollisionObject* rigidObject = intersectingRigidAabbs[i];
 		
-		btFluidSphRigidContactGroup contactGroup;
-		contactGroup.m_object = rigidObject;
+		//Objects sampled with boundary particles interact with the fluid through the SPH solver
+		if( boundaryParticles && boundaryParticles->containsObject(rigidObject) ) continue;
 		
-		//Add particle radius to rigid AABB to avoid calculating particle AABB; use point-AABB test instead of AABB-AABB
-		const btVector3 fluidRadius(particleRadius, particleRadius, particleRadius);
-		const btVector3 rigidMin = rigidObject->getBroadphaseHandle()->m_aabbMin - fluidRadius;
-		const btVector3 rigidMax = rigidObject->getBroadphaseHandle()->m_aabbMax + fluidRadius;
-		
-		btFluidSphRigidNarrowphaseCallback particleRigidCollider;
-		particleRigidCollider.m_dispatcher = dispatcher;
-		particleRigidCollider.m_dispatchInfo = &dispatchInfo;
-		particleRigidCollider.m_contactGroup = &contactGroup;
-		particleRigidCollider.m_globalParameters = &FG;
-		particleRigidCollider.m_fluid = fluid;
-		particleRigidCollider.m_particleObject = &particleObject;
-		particleRigidCollider.m_rigidObject = rigidObject;
-		particleRigidCollider.m_expandedRigidAabbMin = rigidMin;
-		particleRigidCollider.m_expandedRigidAabbMax = rigidMax;
-		particleRigidCollider.m_enableCcd = dispatchInfo.m_useContinuous;
-		
-		btFluidGridPosition minIndicies = grid.getDiscretePosition(rigidMin);
-		btFluidGridPosition maxIndicies = grid.getDiscretePosition(rigidMax);
-			
-		int numCellsIntersectingRigid = (1 + maxIndicies.x - minIndicies.x) * (1 + maxIndicies.y - minIndicies.y) * (1 + maxIndicies.z - minIndicies.z);
-		
-		//btFluidSortingGrid::forEachGridCell() performs a binary search for each grid cell
-		//that the AABB intersects. Since the grid is sparse, a search will performed even for
-		//grid cells that have no particles in them. If the rigid's AABB is too large relative
-		//to the grid cell size, then the search will be much slower.
-		const int MAX_CELL_THRESHOLD = 1000;	//Arbitrary value
-		if(numCellsIntersectingRigid > MAX_CELL_THRESHOLD)
-		{
-			for(int i = 0; i < grid.getNumGridCells(); ++i)
+		const btCollisionShape* rigidShape = rigidObject->getCollisionShape();
+		bool isSpecialized = hasSpecializedCollider(rigidShape);
+		
+		int firstCacheHit = nextCacheHit;
+		while( nextCacheHit < m_cacheHits.size() && m_cacheHits[nextCacheHit].m_objectIndex == i ) ++nextCacheHit;
+		
+		btFluidSphRigidContactGroup* serialContacts = 0;
+		if( m_fastParticles.size() || !isSpecialized || nextCacheHit > firstCacheHit ) 
+		{
+			serialContacts = &addWorkItem(rigidObject, i, 0, -1);
+			
+			//Particles that have moved away from the cached feature have no contact, but are still not tested again
+			for(int h = firstCacheHit; h < nextCacheHit; ++h)
+				if(m_cacheHits[h].m_contact.m_distance < FL.m_particleRadiusExpansion) serialContacts->addContact(m_cacheHits[h].m_contact);
+			
+			if( m_fastParticles.size() )
 			{
-				const btFluidGridIterator& FI = grid.getGridCell(i);
-				particleRigidCollider.processParticles( FI, btVector3(), btVector3() );
+				const btAlignedObjectArray<btFluidSphRigidContact>& ccdContacts = m_ccdContacts[i].m_contacts;
+				for(int n = 0; n < ccdContacts.size(); ++n) serialContacts->addContact(ccdContacts[n]);
 			}
 		}
-		else grid.forEachGridCell(rigidMin, rigidMax, particleRigidCollider);
 		
+		btFluidSphRigidNarrowphaseInfo info(FG, fluid, rigidObject, i, resolvedObject, serialContacts);
+		if(isSpecialized)
+		{
+			int firstCell = m_workItemCells.size();
+			
+			btFluidSphGridCellGatherer gatherer(m_workItemCells);
+			processGridCellsIntersectingObject(fluid, i, info.m_expandedRigidAabbMin, info.m_expandedRigidAabbMax, gatherer);
+			
+			for(int cell = firstCell; cell < m_workItemCells.size(); cell += CELLS_PER_WORK_ITEM)
+				addWorkItem( rigidObject, i, cell, btMin(cell + CELLS_PER_WORK_ITEM, m_workItemCells.size()) - 1 );
+		}
+		else
+		{
+			btFluidSphRigidSdf* sdf = (m_sdfCache) ? m_sdfCache->findOrCreateSdf(rigidShape, particleRadius) : 0;
+			
+			if( !sdf && (rigidShape->isConcave() || rigidShape->isCompound()) )
+			{
+				btFluidSphRigidCellNarrowphaseCallback cellRigidCollider(info, dispatcher, &dispatchInfo, &particleObject, 
+																		m_cellParticles, m_cellTriangleVertices, m_cellChildren);
+				processGridCellsIntersectingObject(fluid, i, info.m_expandedRigidAabbMin, info.m_expandedRigidAabbMax, cellRigidCollider);
+			}
+			else
+			{
+				btFluidSphRigidNarrowphaseCallback particleRigidCollider(info, dispatcher, &dispatchInfo, &particleObject, m_sdfCache, sdf);
+				processGridCellsIntersectingObject(fluid, i, info.m_expandedRigidAabbMin, info.m_expandedRigidAabbMax, particleRigidCollider);
+			}
+		}
+	}
+	if( !m_workItems.size() )
+	{
+		if(useContactCache) updateContactCache(fluid, firstContactGroup);
+		return;
+	}
+	
+	{
+		BT_PROFILE("FluidSphRigid - processNarrowphaseWorkItems()");
+	
+		btFluidSphRigidNarrowphaseWorkItems workItems;
+		workItems.m_globalParameters = &FG;
+		workItems.m_fluid = fluid;
+		workItems.m_resolvedObject = resolvedObject;
+		workItems.m_items = &m_workItems[0];
+		workItems.m_cells = ( m_workItemCells.size() ) ? &m_workItemCells[0] : 0;
+		workItems.m_contacts = &m_workItemContacts[0];
+		workItems.m_numItems = m_workItems.size();
+		processNarrowphaseWorkItems(workItems);
+	}
+	
+	//Merge the contacts of each object into a single btFluidSphRigidContactGroup; the work items of an object are consecutive.
+	//Each group is created in place, so that its contact array is not copied again.
+	int numObjectsWithContacts = 0;
+	bool objectHasContacts = false;
+	for(int i = 0; i < m_workItems.size(); ++i)
+	{
+		if( m_workItemContacts[i].numContacts() ) objectHasContacts = true;
+		
+		bool isLastItemOfObject = ( i + 1 == m_workItems.size() || m_workItems[i + 1].m_objectIndex != m_workItems[i].m_objectIndex );
+		if(isLastItemOfObject)
+		{
+			if(objectHasContacts) ++numObjectsWithContacts;
+			objectHasContacts = false;
+		}
+	}
+	rigidContacts.reserve(rigidContacts.size() + numObjectsWithContacts);
+	
+	for(int firstItem = 0; firstItem < m_workItems.size(); )
+	{
+		const btCollisionObject* rigidObject = m_workItems[firstItem].m_rigidObject;
+		
+		int lastItem = firstItem;
+		int numContacts = m_workItemContacts[firstItem].numContacts();
+		while( lastItem + 1 < m_workItems.size() && m_workItems[lastItem + 1].m_objectIndex == m_workItems[firstItem].m_objectIndex )
+		{
+			++lastItem;
+			numContacts += m_workItemContacts[lastItem].numContacts();
+		}
+		
+		if(numContacts)
+		{
+			btFluidSphRigidContactGroup& contactGroup = fluid->internalAddRigidContactGroup(rigidObject);
+			contactGroup.m_contacts.reserve(numContacts);
+			for(int i = firstItem; i <= lastItem; ++i)
+			{
+				const btAlignedObjectArray<btFluidSphRigidContact>& contacts = m_workItemContacts[i].m_contacts;
+				for(int n = 0; n < contacts.size(); ++n) contactGroup.m_contacts.push_back(contacts[n]);
+			}
+			
+			//Moving objects wake the particles that they contact
+			if( FL.m_sleepVelocityThreshold != btScalar(0.0) && !rigidObject->isStaticObject() && rigidObject->isActive() )
+			{
+				for(int n = 0; n < contactGroup.numContacts(); ++n) fluid->wakeParticle(contactGroup.m_contacts[n].m_fluidParticleIndex);
+			}
+		}
 		
-		if( contactGroup.numContacts() ) rigidContacts.push_back(contactGroup);
+		firstItem = lastItem + 1;
 	}
+	
+	if(useContactCache) updateContactCache(fluid, firstContactGroup);
 }
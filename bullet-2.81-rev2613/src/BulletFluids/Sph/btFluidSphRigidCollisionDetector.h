@@ -15,19 +15,190 @@ subject to the following restrictions:
 #ifndef BT_FLUID_SPH_RIGID_COLLISION_DETECTOR_H
 #define BT_FLUID_SPH_RIGID_COLLISION_DETECTOR_H
 
+#include "LinearMath/btVector3.h"
+#include "LinearMath/btAlignedObjectArray.h"
+
+#include "btFluidSph.h"
+
 class btDispatcher;
 struct btDispatcherInfo;
+class btCollisionObject;
+
+class btFluidSphRigidSdfCache;
+class btFluidSphRigidBoundaryParticles;
+
+///Swept sphere of a single fast moving particle, tested against a single btCollisionObject.
+struct btFluidSphRigidCcdSweep
+{
+	int m_fluidParticleIndex;
+	
+	btVector3 m_from;		///<Position of the particle at the start of the step.
+	btVector3 m_to;			///<Position of the particle at the end of the step, if it does not collide.
+	
+	//Results; only valid if m_hitFraction < 1.0
+	btScalar m_hitFraction;
+	btVector3 m_normalOnObject;
+	btVector3 m_hitPointWorldOnObject;
+};
+
+///Contains the swept spheres of all fast particles that may collide with a single btCollisionObject.
+///@remarks Sweeps are ordered by particle index, so consecutive sweeps are close to each other;
+///each batch contains up to m_batchSize consecutive sweeps.
+struct btFluidSphRigidCcdBatches
+{
+	const btCollisionObject* m_rigidObject;
+	btScalar m_particleRadius;
+	
+	btFluidSphRigidCcdSweep* m_sweeps;
+	int m_numSweeps;
+	int m_batchSize;
+	
+	int getNumBatches() const { return (m_numSweeps + m_batchSize - 1) / m_batchSize; }
+};
+
+///A range of grid cells that intersect the AABB of a single btCollisionObject.
+struct btFluidSphRigidNarrowphaseWorkItem
+{
+	const btCollisionObject* m_rigidObject;
+	int m_objectIndex;		///<Index of the object in btFluidSph::internalGetIntersectingRigidAabbs().
+	
+	///Range in btFluidSphRigidNarrowphaseWorkItems::m_cells; empty if the contacts were already found by performNarrowphase().
+	int m_firstCell;
+	int m_lastCell;
+};
 
-struct btFluidSphParametersGlobal;
-class btFluidSph;
+///Contains all narrowphase work items of a single btFluidSph; each work item adds contacts to its own btFluidSphRigidContactGroup.
+struct btFluidSphRigidNarrowphaseWorkItems
+{
+	const btFluidSphParametersGlobal* m_globalParameters;
+	const btFluidSph* m_fluid;
+	const int* m_resolvedObject;		///<Particles that already have a continuous or cached contact with an object; 0 if there are none.
+	
+	const btFluidSphRigidNarrowphaseWorkItem* m_items;
+	const btFluidGridIterator* m_cells;
+	btFluidSphRigidContactGroup* m_contacts;		///<Parallel array with m_items.
+	int m_numItems;
+};
 
 ///Detects collisions(midphase/narrowphase) between btFluidSph and btCollisionObject / btRigidBody.
 class btFluidSphRigidCollisionDetector
 {
+	btFluidSphRigidSdfCache* m_sdfCache;
+	
+	btAlignedObjectArray<int> m_fastParticles;					//Particles that are tested for continuous collisions
+	btAlignedObjectArray<btFluidSphRigidCcdSweep> m_ccdSweeps;
+	btAlignedObjectArray<btFluidSphRigidContactGroup> m_ccdContacts;			//Per object in btFluidSph::internalGetIntersectingRigidAabbs(); not shrunk
+	btAlignedObjectArray<int> m_resolvedObject;					//Per particle; index of the last object that the particle collided with using CCD or the cache
+	
+	btAlignedObjectArray<btFluidSphRigidNarrowphaseWorkItem> m_workItems;
+	btAlignedObjectArray<btFluidGridIterator> m_workItemCells;
+	btAlignedObjectArray<btFluidSphRigidContactGroup> m_workItemContacts;	//Not shrunk, so that the contact arrays are reused in the next step
+	
+	//Used to collide each grid cell with btConcaveShape and btCompoundShape
+	btAlignedObjectArray<int> m_cellParticles;
+	btAlignedObjectArray<btVector3> m_cellTriangleVertices;
+	btAlignedObjectArray<int> m_cellChildren;
+	
+	struct CacheableObject
+	{
+		const btCollisionObject* m_object;
+		int m_objectIndex;
+	};
+	struct CachedContactHit
+	{
+		int m_objectIndex;
+		int m_cacheIndex;		//Index in btFluidSph::internalGetRigidContactCache() from the previous step
+		btFluidSphRigidContact m_contact;
+	};
+	
+	struct CacheableObjectSortPredicate;
+	struct CachedContactHitSortPredicate;
+	
+	btAlignedObjectArray<CacheableObject> m_cacheableObjects;		//Sorted by pointer
+	btAlignedObjectArray<CachedContactHit> m_cacheHits;				//Sorted by object index, then particle index
+	btAlignedObjectArray<btFluidSphRigidCachedContact> m_nextContactCache;
+	
+	int m_numCacheLookups;
+	int m_numCacheHits;
+
 public:
+	btFluidSphRigidCollisionDetector() : m_sdfCache(0), m_numCacheLookups(0), m_numCacheHits(0) {}
+	virtual ~btFluidSphRigidCollisionDetector() {}
+
 	///Collides individual btCollisionObjects against several fluid particles using btFluidSortingGrid broadphase
+	///@remarks Boxes, spheres, capsules, cylinders, cones, static planes, and btConvexHullShape with
+	///btPolyhedralConvexShape::initializePolyhedralFeatures() are collided without the btDispatcher;
+	///see btFluidSphRigidShapeColliders.h. Other shapes use the btFluidSphRigidSdfCache, if it is set,
+	///or the btCollisionAlgorithm from the btDispatcher.
+	///@par
+	///Without a distance field, btConcaveShape(triangle meshes and heightfields) and btCompoundShape are collided
+	///one grid cell at a time; the triangles or child shapes near the particles of each cell are gathered once, and 
+	///each particle contacts the closest triangle.
+	///@par
+	///If btDispatcherInfo::m_useContinuous is set, particles that move farther than
+	///btCollisionObject::getCcdMotionThreshold() of the btFluidSph in a step are first swept against all objects;
+	///particles that would pass into an object are moved to the point of impact and excluded from the discrete test with that object.
+	///@par
+	///If btFluidSphParametersLocal::m_rigidContactCacheTolerance is nonzero, contacts with static and sleeping objects
+	///are stored in the btFluidSph and reused in the next step by particles that have not moved relative to the object.
+	///@param boundaryParticles Objects sampled by these boundary particles are skipped, since they interact with the fluid
+	///through the SPH forces; should be 0 unless btFluidSphSolver::usesRigidBoundaryParticles() is true for the fluid.
 	void performNarrowphase(btDispatcher* dispatcher, const btDispatcherInfo& dispatchInfo, 
-							const btFluidSphParametersGlobal& FG, btFluidSph* fluid);
+							const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
+							const btFluidSphRigidBoundaryParticles* boundaryParticles = 0);
+	
+	///The cache is not owned by btFluidSphRigidCollisionDetector; set to 0 to disable.
+	void setSdfCache(btFluidSphRigidSdfCache* cache) { m_sdfCache = cache; }
+	btFluidSphRigidSdfCache* getSdfCache() const { return m_sdfCache; }
+	
+	///@name Contact cache statistics, accumulated over all calls to performNarrowphase() until reset.
+	///A lookup occurs for each particle that had a cached contact with a static, kinematic, or sleeping object in the AABB of the fluid;
+	///the lookup is a hit if the narrowphase for that particle and object was skipped.
+	///@{
+	int getNumContactCacheLookups() const { return m_numCacheLookups; }
+	int getNumContactCacheHits() const { return m_numCacheHits; }
+	void resetContactCacheCounters() { m_numCacheLookups = 0; m_numCacheHits = 0; }
+	///@}
+	
+	///Calls processNarrowphaseWorkItem() for each work item; work items do not share any data,
+	///so this may be overridden to process them in parallel.
+	virtual void processNarrowphaseWorkItems(const btFluidSphRigidNarrowphaseWorkItems& workItems)
+	{
+		for(int i = 0; i < workItems.m_numItems; ++i) btFluidSphRigidCollisionDetector::processNarrowphaseWorkItem(workItems, i);
+	}
+	
+	///Collides the particles in the grid cells of a work item with its object.
+	///@remarks Only objects with a collider from btFluidSphRigidShapeColliders.h are divided into work items, 
+	///since the btDispatcher and btFluidSphRigidSdfCache are not thread safe.
+	static void processNarrowphaseWorkItem(const btFluidSphRigidNarrowphaseWorkItems& workItems, int index);
+	
+	///Calls testCcdBatch() for each batch; batches do not share any data, 
+	///so this may be overridden to process them in parallel.
+	///@remarks Batches of a btGImpactMeshShape should still be processed serially, since the shape is modified when it is queried.
+	virtual void testCcdBatches(btFluidSphRigidCcdBatches& batches)
+	{
+		for(int i = 0; i < batches.getNumBatches(); ++i) btFluidSphRigidCollisionDetector::testCcdBatch(batches, i);
+	}
+	
+	///Sets the results of the btFluidSphRigidCcdSweep in a batch.
+	///@remarks For concave shapes(e.g. btBvhTriangleMeshShape), the triangles overlapping
+	///the entire batch are gathered once, using the shape's BVH, and reused for each sweep in the batch.
+	static void testCcdBatch(btFluidSphRigidCcdBatches& batches, int batchIndex);
+	
+protected:
+	///Adds contacts for particles that collide with the object during the step, and moves them to the point of impact.
+	void resolveContinuousCollisions(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
+									int objectIndex, btFluidSphRigidContactGroup& contactGroup);
+	
+	///Finds particles that can reuse their cached contact, and marks them in m_resolvedObject.
+	void findCachedContacts(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, btScalar squaredCcdThreshold,
+							const btFluidSphRigidBoundaryParticles* boundaryParticles);
+	
+	///Replaces the contact cache of the fluid with the contacts in btFluidSph::internalGetRigidContacts(), starting from firstContactGroup.
+	void updateContactCache(btFluidSph* fluid, int firstContactGroup);
+	
+	///Returns the contact group of the new work item, which is valid until the next call to addWorkItem().
+	btFluidSphRigidContactGroup& addWorkItem(const btCollisionObject* rigidObject, int objectIndex, int firstCell, int lastCell);
 };
 
 
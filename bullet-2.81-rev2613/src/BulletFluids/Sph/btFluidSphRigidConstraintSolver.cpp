@@ -36,16 +36,7 @@ void btFluidSphRigidConstraintSolver::resolveCollisionsForce(const btFluidSphPar
 		btFluidSphRigidConstraintSolver::applyAabbForcesSingleFluid(FG, fluid);
 	
 	//Accumulate forces on rigid bodies, apply forces to fluid particles
-	for(int i = 0; i < contactGroups.size(); ++i)
-	{
-		const btFluidSphRigidContactGroup& current = contactGroups[i];
-	
-		for(int n = 0; n < current.numContacts(); ++n)
-		{
-			resolveContactPenaltyForce(FG, fluid, const_cast<btCollisionObject*>(current.m_object),
-										 current.m_contacts[n], m_accumulatedRigidForces[i], m_accumulatedRigidTorques[i]);
-		}
-	}
+	resolveContacts(FG, fluid, false, ALL_CONTACTS);
 	
 	//Apply forces to rigid bodies
 	const btScalar timeStep = FG.m_timeStep;
@@ -72,7 +63,7 @@ void btFluidSphRigidConstraintSolver::resolveCollisionsForce(const btFluidSphPar
 	}
 }
 
-void btFluidSphRigidConstraintSolver::resolveCollisionsImpulse(const btFluidSphParametersGlobal& FG, btFluidSph *fluid)
+void btFluidSphRigidConstraintSolver::resolveCollisionsImpulse(const btFluidSphParametersGlobal& FG, btFluidSph *fluid, bool applyAabbImpulses)
 {
 	BT_PROFILE("resolveCollisionsImpulse()");
 	
@@ -88,27 +79,13 @@ void btFluidSphRigidConstraintSolver::resolveCollisionsImpulse(const btFluidSphP
 	for(int i = 0; i < m_accumulatedRigidForces.size(); ++i) m_accumulatedRigidForces[i].setValue(0,0,0);
 	for(int i = 0; i < m_accumulatedRigidTorques.size(); ++i) m_accumulatedRigidTorques[i].setValue(0,0,0);
 	
-	if(!SEPARATE_STATIC_AND_DYNAMIC_RESPONSE && FL.m_enableAabbBoundary) 
+	m_reducedContacts.resize(0);
+	
+	if(!SEPARATE_STATIC_AND_DYNAMIC_RESPONSE && applyAabbImpulses && FL.m_enableAabbBoundary) 
 		btFluidSphRigidConstraintSolver::applyAabbImpulsesSingleFluid(FG, fluid);
 	
 	//Accumulate forces on rigid bodies, impulses on fluids
-	for(int i = 0; i < contactGroups.size(); ++i)
-	{
-		const btFluidSphRigidContactGroup& current = contactGroups[i];
-		
-		if(SEPARATE_STATIC_AND_DYNAMIC_RESPONSE)
-		{
-			const btRigidBody* rigidBody = btRigidBody::upcast(current.m_object);
-			bool isDynamicRigidBody = ( rigidBody && rigidBody->getInvMass() != btScalar(0.0) );
-			if(!isDynamicRigidBody) continue;
-		}
-		
-		for(int n = 0; n < current.numContacts(); ++n)
-		{
-			resolveContactImpulse(FG, fluid, const_cast<btCollisionObject*>(current.m_object), current.m_contacts[n], 
-									m_accumulatedRigidForces[i], m_accumulatedRigidTorques[i]);
-		}
-	}
+	resolveContacts(FG, fluid, true, (SEPARATE_STATIC_AND_DYNAMIC_RESPONSE) ? DYNAMIC_CONTACTS : ALL_CONTACTS);
 	
 	//Apply forces to rigid bodies
 	const btScalar timeStep = FG.m_timeStep;
@@ -135,38 +112,261 @@ void btFluidSphRigidConstraintSolver::resolveCollisionsImpulse(const btFluidSphP
 	}
 	
 	//Apply impulses to fluid particles
-	btFluidParticles& particles = fluid->internalGetParticles();
-	
 	if(SEPARATE_STATIC_AND_DYNAMIC_RESPONSE)
 	{
 		//Accumulate impulses from static objects on fluid particles
-		for(int i = 0; i < contactGroups.size(); ++i)
-		{
-			const btFluidSphRigidContactGroup& current = contactGroups[i];
+		resolveContacts(FG, fluid, true, STATIC_CONTACTS);
+		
+		//Apply AABB impulses last
+		if(applyAabbImpulses && FL.m_enableAabbBoundary)
+			btFluidSphRigidConstraintSolver::applyAabbImpulsesSingleFluid(FG, fluid);
+	}
+}
+///Sorts by particle, then by the order of the contact in btFluidSph::internalGetRigidContacts()
+struct btFluidSphRigidSortedContactPredicate
+{
+	bool operator() (const btFluidSphRigidSortedContact& a, const btFluidSphRigidSortedContact& b) const
+	{
+		if(a.m_fluidParticleIndex != b.m_fluidParticleIndex) return a.m_fluidParticleIndex < b.m_fluidParticleIndex;
+		return a.m_reactionIndex < b.m_reactionIndex;
+	}
+};
 
+void btFluidSphRigidConstraintSolver::resolveContacts(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, bool useImpulses, ContactSelection selection)
+{
+	const btAlignedObjectArray<btFluidSphRigidContactGroup>& contactGroups = fluid->internalGetRigidContacts();
+	
+	//Reactions are stored per contact, in the same order as contactGroups
+	int numContacts = 0;
+	m_firstReactionIndex.resize( contactGroups.size() );
+	for(int i = 0; i < contactGroups.size(); ++i)
+	{
+		m_firstReactionIndex[i] = numContacts;
+		numContacts += contactGroups[i].numContacts();
+	}
+	m_contactRigidForces.resize(numContacts);
+	m_contactRigidTorques.resize(numContacts);
+	
+	//
+	m_sortedContacts.resize(0);
+	for(int i = 0; i < contactGroups.size(); ++i)
+	{
+		const btFluidSphRigidContactGroup& current = contactGroups[i];
+		
+		if(selection != ALL_CONTACTS)
+		{
 			const btRigidBody* rigidBody = btRigidBody::upcast(current.m_object);
 			bool isDynamicRigidBody = ( rigidBody && rigidBody->getInvMass() != btScalar(0.0) );
-			if(isDynamicRigidBody) continue;
+			if( isDynamicRigidBody != (selection == DYNAMIC_CONTACTS) ) continue;
+		}
+		
+		for(int n = 0; n < current.numContacts(); ++n)
+		{
+			btFluidSphRigidSortedContact& contact = m_sortedContacts.expandNonInitializing();
+			contact.m_fluidParticleIndex = current.m_contacts[n].m_fluidParticleIndex;
+			contact.m_groupIndex = i;
+			contact.m_contactIndex = n;
+			contact.m_reactionIndex = m_firstReactionIndex[i] + n;
+			contact.m_reducedContactIndex = -1;
+		}
+	}
+	
+	//Only contacts with dynamic objects are reduced, since there is no reaction otherwise
+	const int reductionCells = fluid->getLocalParameters().m_rigidContactReductionCells;
+	const bool isReduced = (useImpulses && selection == DYNAMIC_CONTACTS && reductionCells > 0);
+	if(isReduced) reduceContacts(fluid, reductionCells);
+	
+	if( !m_sortedContacts.size() ) return;
+	
+	m_sortedContacts.quickSort( btFluidSphRigidSortedContactPredicate() );
+	
+	//Divide into ranges of at least CONTACTS_PER_RANGE contacts, without separating the contacts of a particle
+	const int CONTACTS_PER_RANGE = 256;
+	
+	m_rangeFirstContact.resize(0);
+	for(int first = 0; first < m_sortedContacts.size(); )
+	{
+		m_rangeFirstContact.push_back(first);
+		
+		int last = btMin(first + CONTACTS_PER_RANGE, m_sortedContacts.size()) - 1;
+		while( last + 1 < m_sortedContacts.size() 
+			&& m_sortedContacts[last + 1].m_fluidParticleIndex == m_sortedContacts[last].m_fluidParticleIndex ) ++last;
+		
+		first = last + 1;
+	}
+	m_rangeFirstContact.push_back( m_sortedContacts.size() );
+	
+	{
+		BT_PROFILE("resolveContactRanges()");
+	
+		btFluidSphRigidSortedContacts contacts;
+		contacts.m_globalParameters = &FG;
+		contacts.m_fluid = fluid;
+		contacts.m_useImpulses = useImpulses;
+		contacts.m_contacts = &m_sortedContacts[0];
+		contacts.m_rangeFirstContact = &m_rangeFirstContact[0];
+		contacts.m_numRanges = m_rangeFirstContact.size() - 1;
+		contacts.m_reducedContacts = ( isReduced && m_reducedContacts.size() ) ? &m_reducedContacts[0] : 0;
+		contacts.m_rigidForces = &m_contactRigidForces[0];
+		contacts.m_rigidTorques = &m_contactRigidTorques[0];
+		resolveContactRanges(contacts);
+	}
+	
+	//Sum the reactions in the same order as resolving the contacts serially
+	for(int i = 0; i < contactGroups.size(); ++i)
+	{
+		if(selection != ALL_CONTACTS)
+		{
+			const btRigidBody* rigidBody = btRigidBody::upcast(contactGroups[i].m_object);
+			bool isDynamicRigidBody = ( rigidBody && rigidBody->getInvMass() != btScalar(0.0) );
+			if( isDynamicRigidBody != (selection == DYNAMIC_CONTACTS) ) continue;
+		}
+		
+		int firstReaction = m_firstReactionIndex[i];
+		for(int n = 0; n < contactGroups[i].numContacts(); ++n)
+		{
+			m_accumulatedRigidForces[i] += m_contactRigidForces[firstReaction + n];
+			m_accumulatedRigidTorques[i] += m_contactRigidTorques[firstReaction + n];
+		}
+	}
+	
+	//Apply the torque of each reduced contact at its average contact point
+	if( isReduced && m_reducedContacts.size() )
+	{
+		m_reducedContactForces.resize( m_reducedContacts.size() );
+		for(int i = 0; i < m_reducedContactForces.size(); ++i) m_reducedContactForces[i].setValue(0,0,0);
+		
+		for(int i = 0; i < m_sortedContacts.size(); ++i)
+		{
+			const btFluidSphRigidSortedContact& contact = m_sortedContacts[i];
+			if(contact.m_reducedContactIndex >= 0) m_reducedContactForces[contact.m_reducedContactIndex] += m_contactRigidForces[contact.m_reactionIndex];
+		}
+		
+		for(int i = 0; i < m_reducedContacts.size(); ++i)
+		{
+			const btFluidSphRigidReducedContact& reducedContact = m_reducedContacts[i];
+			const btRigidBody* rigidBody = btRigidBody::upcast(contactGroups[reducedContact.m_groupIndex].m_object);
 			
-			for(int n = 0; n < current.numContacts(); ++n)
-			{
-				resolveContactImpulse(FG, fluid, const_cast<btCollisionObject*>(current.m_object), current.m_contacts[n], 
-										m_accumulatedRigidForces[i], m_accumulatedRigidTorques[i]);
-			}
+			btVector3 rigidLocalHitPoint = reducedContact.m_hitPointWorldOnObject - rigidBody->getWorldTransform().getOrigin();
+			m_accumulatedRigidTorques[reducedContact.m_groupIndex] += rigidLocalHitPoint.cross(m_reducedContactForces[i]) * rigidBody->getAngularFactor();
 		}
+	}
+}
+
+struct btFluidSphRigidConstraintSolver::ReductionKeySortPredicate
+{
+	bool operator() (const ReductionKey& a, const ReductionKey& b) const
+	{
+		if(a.m_groupIndex != b.m_groupIndex) return a.m_groupIndex < b.m_groupIndex;
+		if(a.m_block != b.m_block) return a.m_block < b.m_block;
+		return a.m_sortedContactIndex < b.m_sortedContactIndex;
+	}
+};
+void btFluidSphRigidConstraintSolver::reduceContacts(btFluidSph* fluid, int blockCells)
+{
+	BT_PROFILE("reduceContacts()");
+	
+	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+	const btFluidSortingGrid& grid = fluid->getGrid();
+	const btAlignedObjectArray<btFluidSphRigidContactGroup>& contactGroups = fluid->internalGetRigidContacts();
+	
+	m_reducedContacts.resize(0);
+	
+	//Contacts that do not penetrate, or are with sleeping particles, have no impulse
+	m_reductionKeys.resize(0);
+	for(int i = 0; i < m_sortedContacts.size(); ++i)
+	{
+		const btFluidSphRigidSortedContact& sortedContact = m_sortedContacts[i];
+		const btFluidSphRigidContact& contact = contactGroups[sortedContact.m_groupIndex].m_contacts[sortedContact.m_contactIndex];
+		if( contact.m_distance >= btScalar(0.0) || fluid->isParticleSleeping(contact.m_fluidParticleIndex) ) continue;
 		
-		//Apply AABB impulses last
-		if(FL.m_enableAabbBoundary)
-			btFluidSphRigidConstraintSolver::applyAabbImpulsesSingleFluid(FG, fluid);
+		ReductionKey& key = m_reductionKeys.expandNonInitializing();
+		key.m_groupIndex = sortedContact.m_groupIndex;
+		key.m_block = getFluidSphBlockPosition( grid.getDiscretePosition( fluid->getPosition(contact.m_fluidParticleIndex) ), blockCells );
+		key.m_sortedContactIndex = i;
+	}
+	
+	m_reductionKeys.quickSort( ReductionKeySortPredicate() );
+	
+	for(int i = 0; i < m_reductionKeys.size(); ++i)
+	{
+		const ReductionKey& key = m_reductionKeys[i];
+		if( i == 0 || key.m_groupIndex != m_reductionKeys[i - 1].m_groupIndex || key.m_block != m_reductionKeys[i - 1].m_block )
+		{
+			btFluidSphRigidReducedContact& reducedContact = m_reducedContacts.expandNonInitializing();
+			reducedContact.m_hitPointWorldOnObject.setValue(0,0,0);
+			reducedContact.m_normalOnObject.setValue(0,0,0);
+			reducedContact.m_mass = btScalar(0.0);
+			reducedContact.m_groupIndex = key.m_groupIndex;
+			reducedContact.m_numContacts = 0;
+		}
+		
+		btFluidSphRigidSortedContact& sortedContact = m_sortedContacts[key.m_sortedContactIndex];
+		const btFluidSphRigidContact& contact = contactGroups[sortedContact.m_groupIndex].m_contacts[sortedContact.m_contactIndex];
+		
+		btFluidSphRigidReducedContact& reducedContact = m_reducedContacts[m_reducedContacts.size() - 1];
+		reducedContact.m_hitPointWorldOnObject += contact.m_hitPointWorldOnObject;
+		reducedContact.m_normalOnObject += contact.m_normalOnObject;
+		reducedContact.m_mass += FL.m_particleMass * fluid->getParticles().m_massScale[contact.m_fluidParticleIndex];
+		++reducedContact.m_numContacts;
+		
+		sortedContact.m_reducedContactIndex = m_reducedContacts.size() - 1;
+	}
+	
+	for(int i = 0; i < m_reducedContacts.size(); ++i)
+	{
+		btFluidSphRigidReducedContact& reducedContact = m_reducedContacts[i];
+		const btRigidBody* rigidBody = btRigidBody::upcast(contactGroups[reducedContact.m_groupIndex].m_object);
+		
+		reducedContact.m_hitPointWorldOnObject /= static_cast<btScalar>(reducedContact.m_numContacts);
+		
+		//Opposing normals cancel out; the inverse mass along any direction is a reasonable estimate in that case
+		btScalar normalLength = reducedContact.m_normalOnObject.length();
+		if(normalLength > SIMD_EPSILON) reducedContact.m_normalOnObject /= normalLength;
+		else reducedContact.m_normalOnObject.setValue(0, 1, 0);
+		
+		btVector3 rigidLocalHitPoint = reducedContact.m_hitPointWorldOnObject - rigidBody->getWorldTransform().getOrigin();
+		btVector3 relPosCrossNormal = rigidLocalHitPoint.cross(reducedContact.m_normalOnObject);
+		reducedContact.m_rigidInverseMass = rigidBody->getInvMass() + ( relPosCrossNormal * rigidBody->getInvInertiaTensorWorld() ).dot(relPosCrossNormal);
+	}
+}
+
+void btFluidSphRigidConstraintSolver::resolveContactRange(const btFluidSphRigidSortedContacts& contacts, int rangeIndex)
+{
+	const btFluidSphParametersGlobal& FG = *contacts.m_globalParameters;
+	btFluidSph* fluid = contacts.m_fluid;
+	const btAlignedObjectArray<btFluidSphRigidContactGroup>& contactGroups = fluid->internalGetRigidContacts();
+	
+	for(int i = contacts.m_rangeFirstContact[rangeIndex]; i < contacts.m_rangeFirstContact[rangeIndex + 1]; ++i)
+	{
+		const btFluidSphRigidSortedContact& sortedContact = contacts.m_contacts[i];
+		const btFluidSphRigidContactGroup& group = contactGroups[sortedContact.m_groupIndex];
+		btCollisionObject* object = const_cast<btCollisionObject*>(group.m_object);
+		
+		btVector3& rigidForce = contacts.m_rigidForces[sortedContact.m_reactionIndex];
+		btVector3& rigidTorque = contacts.m_rigidTorques[sortedContact.m_reactionIndex];
+		rigidForce.setValue(0,0,0);
+		rigidTorque.setValue(0,0,0);
+		
+		if(contacts.m_useImpulses) 
+		{
+			const btFluidSphRigidReducedContact* reducedContact = (sortedContact.m_reducedContactIndex >= 0) 
+																? &contacts.m_reducedContacts[sortedContact.m_reducedContactIndex] : 0;
+			
+			resolveContactImpulse(FG, fluid, object, group.m_contacts[sortedContact.m_contactIndex], reducedContact, rigidForce, rigidTorque);
+		}
+		else 
+			resolveContactPenaltyForce(FG, fluid, object, group.m_contacts[sortedContact.m_contactIndex], rigidForce, rigidTorque);
 	}
 }
+
 void btFluidSphRigidConstraintSolver::resolveContactPenaltyForce(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
 																btCollisionObject *object, const btFluidSphRigidContact& contact,
 																btVector3 &accumulatedRigidForce, btVector3 &accumulatedRigidTorque)
 {
 	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
 	
-	if( contact.m_distance < btScalar(0.0) )
+	if( contact.m_distance < btScalar(0.0) && !fluid->isParticleSleeping(contact.m_fluidParticleIndex) )
 	{
 		btRigidBody* rigidBody = btRigidBody::upcast(object);
 		bool isDynamicRigidBody = ( rigidBody && rigidBody->getInvMass() != btScalar(0.0) );
@@ -196,7 +396,7 @@ void btFluidSphRigidConstraintSolver::resolveContactPenaltyForce(const btFluidSp
 			acceleration -= relativeTangentialVelocity * tangentRemovedPerFrame;
 		}
 		
-		btVector3 force = acceleration * FL.m_particleMass;
+		btVector3 force = acceleration * ( FL.m_particleMass * fluid->getParticles().m_massScale[contact.m_fluidParticleIndex] );
 		
 		if(isDynamicRigidBody)
 		{
@@ -208,17 +408,18 @@ void btFluidSphRigidConstraintSolver::resolveContactPenaltyForce(const btFluidSp
 		}
 		
 		//if acceleration is very high, the fluid simulation will explode
-		fluid->applyForce(contact.m_fluidParticleIndex, force);
+		fluid->internalGetParticles().m_accumulatedForce[contact.m_fluidParticleIndex] += force;
 	}
 }
 
 void btFluidSphRigidConstraintSolver::resolveContactImpulse(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
 																btCollisionObject *object, const btFluidSphRigidContact& contact,
+																const btFluidSphRigidReducedContact* reducedContact,
 																btVector3 &accumulatedRigidForce, btVector3 &accumulatedRigidTorque)
 {
 	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
 	
-	if( contact.m_distance < btScalar(0.0) )
+	if( contact.m_distance < btScalar(0.0) && !fluid->isParticleSleeping(contact.m_fluidParticleIndex) )
 	{
 		int i = contact.m_fluidParticleIndex;
 		btFluidParticles& particles = fluid->internalGetParticles();
@@ -249,19 +450,28 @@ void btFluidSphRigidConstraintSolver::resolveContactImpulse(const btFluidSphPara
 		
 		if(isDynamicRigidBody)
 		{
-			btScalar inertiaParticle = btScalar(1.0) / FL.m_particleMass;
+			btScalar inertiaParticle = btScalar(1.0) / (FL.m_particleMass * particles.m_massScale[i]);
 			
-			btVector3 relPosCrossNormal = rigidLocalHitPoint.cross(contact.m_normalOnObject);
-			btScalar inertiaRigid = rigidBody->getInvMass() + ( relPosCrossNormal * rigidBody->getInvInertiaTensorWorld() ).dot(relPosCrossNormal);
-			
-			particleImpulse *= btScalar(1.0) / (inertiaParticle + inertiaRigid);
+			if(!reducedContact)
+			{
+				btVector3 relPosCrossNormal = rigidLocalHitPoint.cross(contact.m_normalOnObject);
+				btScalar inertiaRigid = rigidBody->getInvMass() + ( relPosCrossNormal * rigidBody->getInvInertiaTensorWorld() ).dot(relPosCrossNormal);
+				
+				particleImpulse *= btScalar(1.0) / (inertiaParticle + inertiaRigid);
+			}
+			else
+			{
+				//The particles of the cluster push against the object together, so each receives the 
+				//fraction of its velocity change that the entire cluster would receive
+				particleImpulse *= btScalar(1.0) / ( inertiaParticle * (btScalar(1.0) + reducedContact->m_mass * reducedContact->m_rigidInverseMass) );
+			}
 			
 			btVector3 worldScaleImpulse = -particleImpulse / FG.m_simulationScale;
 			worldScaleImpulse /= FG.m_timeStep;		//Impulse is accumulated as force
 			
 			const btVector3& linearFactor = rigidBody->getLinearFactor();
 			accumulatedRigidForce += worldScaleImpulse * linearFactor;
-			accumulatedRigidTorque += rigidLocalHitPoint.cross(worldScaleImpulse * linearFactor) * rigidBody->getAngularFactor();
+			if(!reducedContact) accumulatedRigidTorque += rigidLocalHitPoint.cross(worldScaleImpulse * linearFactor) * rigidBody->getAngularFactor();
 			
 			particleImpulse *= inertiaParticle;
 		}
@@ -309,7 +519,7 @@ void applyBoundaryForceToParticle(const btFluidSphParametersGlobal& FG, const bt
 	resolveAabbCollision( FL, vel, &acceleration, btVector3(0.0, 0.0,  1.0), ( pos.z() - min.z() )*simScale - radius );
 	resolveAabbCollision( FL, vel, &acceleration, btVector3(0.0, 0.0, -1.0), ( max.z() - pos.z() )*simScale - radius );
 	
-	particles.m_accumulatedForce[i] += acceleration * FL.m_particleMass;
+	particles.m_accumulatedForce[i] += acceleration * (FL.m_particleMass * particles.m_massScale[i]);
 }
 void btFluidSphRigidConstraintSolver::applyAabbForcesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid)
 {
@@ -320,51 +530,11 @@ void btFluidSphRigidConstraintSolver::applyAabbForcesSingleFluid(const btFluidSp
 	
 	const btScalar simScaleParticleRadius = FL.m_particleRadius * FG.m_simulationScale;
 
-	for(int i = 0; i < particles.size(); ++i) applyBoundaryForceToParticle(FG, FL, simScaleParticleRadius, particles, i);
+	for(int i = 0; i < particles.size(); ++i) 
+		if( !particles.m_sleeping[i] ) applyBoundaryForceToParticle(FG, FL, simScaleParticleRadius, particles, i);
 }
 
 
-inline void resolveAabbCollision_impulse(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, const btVector3& velocity, 
-										const btVector3& normal, btScalar distance, btVector3& out_impulse)
-{
-	if( distance < btScalar(0.0) )	//Negative distance indicates penetration
-	{
-		btScalar penetratingMagnitude = velocity.dot(-normal);
-		if( penetratingMagnitude < btScalar(0.0) ) penetratingMagnitude = btScalar(0.0);
-		
-		btVector3 penetratingVelocity = -normal * penetratingMagnitude;
-		btVector3 tangentialVelocity = velocity - penetratingVelocity;
-		
-		penetratingVelocity *= btScalar(1.0) + FL.m_boundaryRestitution;
-		
-		btScalar positionError = (-distance) * (FG.m_simulationScale/FG.m_timeStep) * FL.m_boundaryErp;
-		
-		out_impulse += -( penetratingVelocity + (-normal*positionError) + tangentialVelocity * FL.m_boundaryFriction );
-	}
-}
-void accumulateBoundaryImpulse(const btFluidSphParametersGlobal& FG, btScalar simScaleParticleRadius,
-								const btFluidSphParametersLocal& FL, btFluidParticles& particles, int particleIndex,
-								btVector3& out_accumulatedImpulse)
-{
-	int i = particleIndex;
-	
-	const btScalar radius = simScaleParticleRadius;
-	const btScalar simScale = FG.m_simulationScale;
-	
-	const btVector3& boundaryMin = FL.m_aabbBoundaryMin;
-	const btVector3& boundaryMax = FL.m_aabbBoundaryMax;
-	
-	const btVector3& pos = particles.m_pos[i];
-	const btVector3& vel = particles.m_vel[i];
-	
-	btVector3& impulse = out_accumulatedImpulse;
-	resolveAabbCollision_impulse( FG, FL, vel, btVector3( 1.0, 0.0, 0.0), ( pos.x() - boundaryMin.x() )*simScale - radius, impulse );
-	resolveAabbCollision_impulse( FG, FL, vel, btVector3(-1.0, 0.0, 0.0), ( boundaryMax.x() - pos.x() )*simScale - radius, impulse );
-	resolveAabbCollision_impulse( FG, FL, vel, btVector3(0.0,  1.0, 0.0), ( pos.y() - boundaryMin.y() )*simScale - radius, impulse );
-	resolveAabbCollision_impulse( FG, FL, vel, btVector3(0.0, -1.0, 0.0), ( boundaryMax.y() - pos.y() )*simScale - radius, impulse );
-	resolveAabbCollision_impulse( FG, FL, vel, btVector3(0.0, 0.0,  1.0), ( pos.z() - boundaryMin.z() )*simScale - radius, impulse );
-	resolveAabbCollision_impulse( FG, FL, vel, btVector3(0.0, 0.0, -1.0), ( boundaryMax.z() - pos.z() )*simScale - radius, impulse );
-}
 void btFluidSphRigidConstraintSolver::applyAabbImpulsesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid)
 {
 	BT_PROFILE("applyAabbImpulsesSingleFluid()");
@@ -376,8 +546,10 @@ void btFluidSphRigidConstraintSolver::applyAabbImpulsesSingleFluid(const btFluid
 	
 	for(int i = 0; i < particles.size(); ++i)
 	{
+		if( particles.m_sleeping[i] ) continue;
+		
 		btVector3 aabbImpulse(0, 0, 0);
-		accumulateBoundaryImpulse(FG, simScaleParticleRadius, FL, particles, i, aabbImpulse);
+		accumulateAabbImpulse(FG, FL, simScaleParticleRadius, particles.m_pos[i], particles.m_vel[i], aabbImpulse);
 		
 		btVector3& vel = particles.m_vel[i];
 		
@@ -15,34 +15,165 @@ subject to the following restrictions:
 #ifndef BT_FLUID_SPH_RIGID_CONSTRAINT_SOLVER_H
 #define BT_FLUID_SPH_RIGID_CONSTRAINT_SOLVER_H
 
+#include "LinearMath/btVector3.h"
 #include "LinearMath/btAlignedObjectArray.h"
 
-class btVector3;
+#include "btFluidSphParameters.h"
+#include "btFluidSortingGrid.h"
+
 class btCollisionObject;
-struct btFluidSphParametersGlobal;
 struct btFluidSphRigidContact;
 class btFluidSph;
 
+///Refers to a btFluidSphRigidContact in btFluidSph::internalGetRigidContacts().
+struct btFluidSphRigidSortedContact
+{
+	int m_fluidParticleIndex;
+	int m_groupIndex;
+	int m_contactIndex;
+	int m_reactionIndex;		///<Index of the force and torque on the object in btFluidSphRigidSortedContacts::m_rigidForces/Torques.
+	int m_reducedContactIndex;	///<Index in btFluidSphRigidSortedContacts::m_reducedContacts; -1 if the contact is not reduced.
+};
+
+///Aggregate of the penetrating contacts between a dynamic btRigidBody and the particles in a block of grid cells;
+///see btFluidSphParametersLocal::m_rigidContactReductionCells.
+struct btFluidSphRigidReducedContact
+{
+	btVector3 m_hitPointWorldOnObject;		///<Average of the contacts.
+	btVector3 m_normalOnObject;				///<Normalized sum of the contact normals.
+	btScalar m_mass;						///<Sum of the particle masses.
+	btScalar m_rigidInverseMass;			///<Inverse effective mass of the object at m_hitPointWorldOnObject, along m_normalOnObject.
+	int m_groupIndex;						///<Index of the btFluidSphRigidContactGroup in btFluidSph::internalGetRigidContacts().
+	int m_numContacts;
+};
+
+///Contacts of a single btFluidSph, sorted by particle and divided into ranges.
+///@remarks All contacts of a particle are in the same range, and are in the same order as in btFluidSph::internalGetRigidContacts(),
+///so each range can be resolved in parallel with the same result as resolving all contacts serially.
+struct btFluidSphRigidSortedContacts
+{
+	const btFluidSphParametersGlobal* m_globalParameters;
+	btFluidSph* m_fluid;
+	bool m_useImpulses;		///<Penalty forces are used if false.
+	
+	const btFluidSphRigidSortedContact* m_contacts;
+	const int* m_rangeFirstContact;		///<Contains (m_numRanges + 1) elements; the last element is the number of contacts.
+	int m_numRanges;
+	
+	const btFluidSphRigidReducedContact* m_reducedContacts;		///<0 if there are no reduced contacts.
+	
+	//Force and torque on the object from each contact, at world scale; the torque of reduced contacts is not included
+	btVector3* m_rigidForces;
+	btVector3* m_rigidTorques;
+};
+
 ///Resolves collisions between btFluidSph and btCollisionObject / btRigidBody.
 class btFluidSphRigidConstraintSolver
 {
 	btAlignedObjectArray<btVector3> m_accumulatedRigidForces;	//Each element corresponds to a btCollisionObject / btRigidBody
 	btAlignedObjectArray<btVector3> m_accumulatedRigidTorques;
+	
+	btAlignedObjectArray<int> m_firstReactionIndex;				//Per btFluidSphRigidContactGroup
+	btAlignedObjectArray<btVector3> m_contactRigidForces;		//Per btFluidSphRigidContact
+	btAlignedObjectArray<btVector3> m_contactRigidTorques;
+	
+	btAlignedObjectArray<btFluidSphRigidSortedContact> m_sortedContacts;
+	btAlignedObjectArray<int> m_rangeFirstContact;
+	
+	struct ReductionKey
+	{
+		int m_groupIndex;
+		btFluidGridPosition m_block;
+		int m_sortedContactIndex;
+	};
+	struct ReductionKeySortPredicate;
+	
+	btAlignedObjectArray<ReductionKey> m_reductionKeys;
+	btAlignedObjectArray<btFluidSphRigidReducedContact> m_reducedContacts;
+	btAlignedObjectArray<btVector3> m_reducedContactForces;
 
 public:
+	virtual ~btFluidSphRigidConstraintSolver() {}
+
 	void resolveCollisionsForce(const btFluidSphParametersGlobal& FG, btFluidSph *fluid);
-	void resolveCollisionsImpulse(const btFluidSphParametersGlobal& FG, btFluidSph *fluid);
+	
+	///@param applyAabbImpulses If false, the AABB boundary is not resolved; used if btFluidSphSolver::integrateSingleFluid() applies it.
+	void resolveCollisionsImpulse(const btFluidSphParametersGlobal& FG, btFluidSph *fluid, bool applyAabbImpulses = true);
 	
 	static void applyAabbForcesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid);
 	static void applyAabbImpulsesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid);
 	
+	///Adds the change in velocity(simulation scale) from btFluidSphParametersLocal::m_aabbBoundaryMin/Max to out_impulse.
+	static inline void accumulateAabbImpulse(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, btScalar simScaleParticleRadius,
+											const btVector3& pos, const btVector3& vel, btVector3& out_impulse)
+	{
+		const btScalar radius = simScaleParticleRadius;
+		const btScalar simScale = FG.m_simulationScale;
+		
+		const btVector3& boundaryMin = FL.m_aabbBoundaryMin;
+		const btVector3& boundaryMax = FL.m_aabbBoundaryMax;
+		
+		resolveAabbCollisionImpulse( FG, FL, vel, btVector3( 1.0, 0.0, 0.0), ( pos.x() - boundaryMin.x() )*simScale - radius, out_impulse );
+		resolveAabbCollisionImpulse( FG, FL, vel, btVector3(-1.0, 0.0, 0.0), ( boundaryMax.x() - pos.x() )*simScale - radius, out_impulse );
+		resolveAabbCollisionImpulse( FG, FL, vel, btVector3(0.0,  1.0, 0.0), ( pos.y() - boundaryMin.y() )*simScale - radius, out_impulse );
+		resolveAabbCollisionImpulse( FG, FL, vel, btVector3(0.0, -1.0, 0.0), ( boundaryMax.y() - pos.y() )*simScale - radius, out_impulse );
+		resolveAabbCollisionImpulse( FG, FL, vel, btVector3(0.0, 0.0,  1.0), ( pos.z() - boundaryMin.z() )*simScale - radius, out_impulse );
+		resolveAabbCollisionImpulse( FG, FL, vel, btVector3(0.0, 0.0, -1.0), ( boundaryMax.z() - pos.z() )*simScale - radius, out_impulse );
+	}
+	
+	///Calls resolveContactRange() for each range; ranges do not modify the same particles,
+	///so this may be overridden to resolve them in parallel.
+	virtual void resolveContactRanges(const btFluidSphRigidSortedContacts& contacts)
+	{
+		for(int i = 0; i < contacts.m_numRanges; ++i) btFluidSphRigidConstraintSolver::resolveContactRange(contacts, i);
+	}
+	
+	static void resolveContactRange(const btFluidSphRigidSortedContacts& contacts, int rangeIndex);
+	
+	///Number of btFluidSphRigidReducedContact created by the last call to resolveCollisionsImpulse().
+	int getNumReducedContacts() const { return m_reducedContacts.size(); }
+	
 private:
-	void resolveContactPenaltyForce(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
+	enum ContactSelection
+	{
+		ALL_CONTACTS,
+		DYNAMIC_CONTACTS,		///<Contacts with btRigidBody that have nonzero mass.
+		STATIC_CONTACTS
+	};
+	
+	///Resolves the selected contacts, and adds their reactions to m_accumulatedRigidForces/Torques.
+	void resolveContacts(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, bool useImpulses, ContactSelection selection);
+	
+	///Clusters the penetrating contacts in m_sortedContacts into m_reducedContacts, and sets their m_reducedContactIndex.
+	void reduceContacts(btFluidSph* fluid, int blockCells);
+
+	static inline void resolveAabbCollisionImpulse(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, const btVector3& velocity, 
+													const btVector3& normal, btScalar distance, btVector3& out_impulse)
+	{
+		if( distance < btScalar(0.0) )	//Negative distance indicates penetration
+		{
+			btScalar penetratingMagnitude = velocity.dot(-normal);
+			if( penetratingMagnitude < btScalar(0.0) ) penetratingMagnitude = btScalar(0.0);
+			
+			btVector3 penetratingVelocity = -normal * penetratingMagnitude;
+			btVector3 tangentialVelocity = velocity - penetratingVelocity;
+			
+			penetratingVelocity *= btScalar(1.0) + FL.m_boundaryRestitution;
+			
+			btScalar positionError = (-distance) * (FG.m_simulationScale/FG.m_timeStep) * FL.m_boundaryErp;
+			
+			out_impulse += -( penetratingVelocity + (-normal*positionError) + tangentialVelocity * FL.m_boundaryFriction );
+		}
+	}
+	
+	static void resolveContactPenaltyForce(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
 									btCollisionObject *object, const btFluidSphRigidContact& contact,
 									btVector3& accumulatedRigidForce, btVector3& accumulatedRigidTorque);
 									
-	void resolveContactImpulse(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
+	///@param reducedContact If nonzero, its effective mass is used, and no torque is accumulated.
+	static void resolveContactImpulse(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
 									btCollisionObject *object, const btFluidSphRigidContact& contact,
+									const btFluidSphRigidReducedContact* reducedContact,
 									btVector3& accumulatedRigidForce, btVector3& accumulatedRigidTorque);
 };
 
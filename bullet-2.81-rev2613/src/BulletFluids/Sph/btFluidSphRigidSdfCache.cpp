@@ -0,0 +1,270 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#include "btFluidSphRigidSdfCache.h"
+
+#include "LinearMath/btQuickprof.h"
+#include "LinearMath/btTransform.h"
+#include "BulletCollision/CollisionShapes/btSphereShape.h"
+#include "BulletCollision/CollisionDispatch/btCollisionObject.h"
+#include "BulletCollision/CollisionDispatch/btManifoldResult.h"
+#include "BulletCollision/BroadphaseCollision/btCollisionAlgorithm.h"
+#include "BulletCollision/BroadphaseCollision/btDispatcher.h"
+
+///Records the deepest contact reported by a btCollisionAlgorithm
+struct btFluidSphSdfProbeResult : public btManifoldResult
+{
+	btScalar m_minDistance;
+	
+	btFluidSphSdfProbeResult(const btCollisionObjectWrapper* obj0Wrap, const btCollisionObjectWrapper* obj1Wrap)
+	: btManifoldResult(obj0Wrap, obj1Wrap), m_minDistance( btScalar(0.0) ) {}
+	
+	virtual void addContactPoint(const btVector3& normalOnBInWorld, const btVector3& pointBInWorld, btScalar distance)
+	{
+		if(distance < m_minDistance) m_minDistance = distance;
+	}
+};
+
+///Returns the distance from localPos to the surface of the rigid object's shape, clamped to maxDistance.
+///The distance is measured by colliding a sphere of radius maxDistance, centered at localPos, with the shape.
+static btScalar probeShapeDistance(btDispatcher* dispatcher, const btDispatcherInfo& dispatchInfo, const btCollisionObject* rigidObject,
+							const btVector3& localPos, btScalar maxDistance)
+{
+	btSphereShape probeShape(maxDistance);
+	
+	btCollisionObject probeObject;
+	probeObject.setCollisionShape(&probeShape);
+	probeObject.getWorldTransform() = btTransform( btQuaternion::getIdentity(), localPos );
+	
+	btCollisionObjectWrapper probeWrap( 0, &probeShape, &probeObject, probeObject.getWorldTransform() );
+	btCollisionObjectWrapper rigidWrap( 0, rigidObject->getCollisionShape(), rigidObject, btTransform::getIdentity() );
+	
+	btScalar distance = maxDistance;
+	
+	btCollisionAlgorithm* algorithm = dispatcher->findAlgorithm(&probeWrap, &rigidWrap);
+	if(algorithm)
+	{
+		//Contacts are reported relative to the surface of the probe sphere
+		btFluidSphSdfProbeResult result(&probeWrap, &rigidWrap);
+		algorithm->processCollision(&probeWrap, &rigidWrap, dispatchInfo, &result);
+		distance = result.m_minDistance + maxDistance;
+		
+		algorithm->~btCollisionAlgorithm();
+		dispatcher->freeCollisionAlgorithm(algorithm);
+	}
+	
+	return btMin(distance, maxDistance);
+}
+
+btFluidSphRigidSdf* btFluidSphRigidSdfCache::findOrCreateSdf(const btCollisionShape* shape, btScalar particleRadius)
+{
+	btFluidSphRigidSdf** existingSdf = m_sdfs.find( btHashPtr(shape) );
+	if(existingSdf) 
+	{
+		btFluidSphRigidSdf* sdf = *existingSdf;
+		return (sdf && particleRadius < sdf->m_bandWidth) ? sdf : 0;
+	}
+	
+	const btScalar cellSize = (m_cellSize != btScalar(0.0)) ? m_cellSize : particleRadius;
+	const btScalar bandWidth = (m_bandWidth != btScalar(0.0)) ? m_bandWidth : particleRadius * btScalar(4.0);
+	if( cellSize <= btScalar(0.0) || particleRadius >= bandWidth ) return 0;
+	
+	//Expand the AABB by the band width, so that all points outside of the bricks are farther than m_bandWidth from the surface
+	btVector3 aabbMin;
+	btVector3 aabbMax;
+	shape->getAabb( btTransform::getIdentity(), aabbMin, aabbMax );
+	aabbMin -= btVector3(bandWidth, bandWidth, bandWidth);
+	aabbMax += btVector3(bandWidth, bandWidth, bandWidth);
+	
+	const btScalar brickSize = cellSize * static_cast<btScalar>(btFluidSphRigidSdf::BRICK_CELLS);
+	btVector3 numBricks = (aabbMax - aabbMin) / brickSize;
+	numBricks.setValue( ceil( numBricks.x() ), ceil( numBricks.y() ), ceil( numBricks.z() ) );
+	
+	//Use btScalar to avoid integer overflow for very large shapes
+	btScalar tableBytes = numBricks.x() * numBricks.y() * numBricks.z() * static_cast<btScalar>( sizeof(int) );
+	if( static_cast<btScalar>(m_bytesUsed) + tableBytes > static_cast<btScalar>(m_maxBytes) )
+	{
+		m_sdfs.insert( btHashPtr(shape), 0 );
+		return 0;
+	}
+	
+	btFluidSphRigidSdf* sdf = new btFluidSphRigidSdf;
+	sdf->m_origin = aabbMin;
+	sdf->m_cellSize = cellSize;
+	sdf->m_bandWidth = bandWidth;
+	sdf->m_numBricksX = static_cast<int>( numBricks.x() );
+	sdf->m_numBricksY = static_cast<int>( numBricks.y() );
+	sdf->m_numBricksZ = static_cast<int>( numBricks.z() );
+	sdf->m_brickSampleIndicies.resize(sdf->m_numBricksX * sdf->m_numBricksY * sdf->m_numBricksZ, btFluidSphRigidSdf::BRICK_UNBAKED);
+	
+	m_bytesUsed += getMemoryUsage(sdf);
+	m_sdfs.insert( btHashPtr(shape), sdf );
+	
+	return sdf;
+}
+
+bool btFluidSphRigidSdfCache::getDistance(btDispatcher* dispatcher, const btDispatcherInfo& dispatchInfo, const btCollisionObject* rigidObject,
+											btFluidSphRigidSdf* sdf, const btVector3& localPos, btScalar& out_distance, btVector3& out_normal)
+{
+	const int BRICK_CELLS = btFluidSphRigidSdf::BRICK_CELLS;
+	const int SAMPLES_PER_AXIS = btFluidSphRigidSdf::BRICK_SAMPLES_PER_AXIS;
+	
+	btVector3 gridPos = (localPos - sdf->m_origin) / sdf->m_cellSize;
+	int cellX = static_cast<int>( floor( gridPos.x() ) );
+	int cellY = static_cast<int>( floor( gridPos.y() ) );
+	int cellZ = static_cast<int>( floor( gridPos.z() ) );
+	
+	//Points outside of all bricks are farther than m_bandWidth from the surface
+	if( cellX < 0 || cellY < 0 || cellZ < 0 
+	 || cellX >= sdf->m_numBricksX * BRICK_CELLS || cellY >= sdf->m_numBricksY * BRICK_CELLS || cellZ >= sdf->m_numBricksZ * BRICK_CELLS )
+	{
+		out_distance = sdf->m_bandWidth;
+		out_normal.setValue(0, 1, 0);
+		return true;
+	}
+	
+	int brickX = cellX / BRICK_CELLS;
+	int brickY = cellY / BRICK_CELLS;
+	int brickZ = cellZ / BRICK_CELLS;
+	int brickIndex = sdf->getBrickIndex(brickX, brickY, brickZ);
+	
+	if( sdf->m_brickSampleIndicies[brickIndex] == btFluidSphRigidSdf::BRICK_UNBAKED 
+		&& !bakeBrick(dispatcher, dispatchInfo, rigidObject, sdf, brickX, brickY, brickZ) ) return false;
+	
+	int firstSample = sdf->m_brickSampleIndicies[brickIndex];
+	if(firstSample == btFluidSphRigidSdf::BRICK_EMPTY)
+	{
+		out_distance = sdf->m_bandWidth;
+		out_normal.setValue(0, 1, 0);
+		return true;
+	}
+	
+	//Trilinear interpolation within the brick
+	btScalar fx = gridPos.x() - static_cast<btScalar>(cellX);
+	btScalar fy = gridPos.y() - static_cast<btScalar>(cellY);
+	btScalar fz = gridPos.z() - static_cast<btScalar>(cellZ);
+	
+	int localX = cellX - brickX * BRICK_CELLS;
+	int localY = cellY - brickY * BRICK_CELLS;
+	int localZ = cellZ - brickZ * BRICK_CELLS;
+	const btScalar* s = &sdf->m_samples[ firstSample + localX + localY*SAMPLES_PER_AXIS + localZ*SAMPLES_PER_AXIS*SAMPLES_PER_AXIS ];
+	
+	const int DY = SAMPLES_PER_AXIS;
+	const int DZ = SAMPLES_PER_AXIS * SAMPLES_PER_AXIS;
+	btScalar s000 = s[0];
+	btScalar s100 = s[1];
+	btScalar s010 = s[DY];
+	btScalar s110 = s[DY + 1];
+	btScalar s001 = s[DZ];
+	btScalar s101 = s[DZ + 1];
+	btScalar s011 = s[DZ + DY];
+	btScalar s111 = s[DZ + DY + 1];
+	
+	btScalar gx = btScalar(1.0) - fx;
+	btScalar gy = btScalar(1.0) - fy;
+	btScalar gz = btScalar(1.0) - fz;
+	
+	out_distance = gz * ( gy * (gx*s000 + fx*s100) + fy * (gx*s010 + fx*s110) )
+				 + fz * ( gy * (gx*s001 + fx*s101) + fy * (gx*s011 + fx*s111) );
+	
+	//Analytic gradient of the trilinear interpolation
+	btVector3 gradient( gz * ( gy*(s100 - s000) + fy*(s110 - s010) ) + fz * ( gy*(s101 - s001) + fy*(s111 - s011) ),
+						gz * ( gx*(s010 - s000) + fx*(s110 - s100) ) + fz * ( gx*(s011 - s001) + fx*(s111 - s101) ),
+						gy * ( gx*(s001 - s000) + fx*(s101 - s100) ) + fy * ( gx*(s011 - s010) + fx*(s111 - s110) ) );
+	
+	btScalar gradientLength = gradient.length();
+	out_normal = (gradientLength > SIMD_EPSILON) ? gradient / gradientLength : btVector3(0, 1, 0);
+	
+	return true;
+}
+
+void btFluidSphRigidSdfCache::removeShape(const btCollisionShape* shape)
+{
+	btFluidSphRigidSdf** sdf = m_sdfs.find( btHashPtr(shape) );
+	if(sdf)
+	{
+		if(*sdf)
+		{
+			m_bytesUsed -= getMemoryUsage(*sdf);
+			m_numBakedBricks -= (*sdf)->m_samples.size() / btFluidSphRigidSdf::BRICK_SAMPLES;
+			delete *sdf;
+		}
+		
+		m_sdfs.remove( btHashPtr(shape) );
+	}
+}
+
+void btFluidSphRigidSdfCache::clear()
+{
+	for(int i = 0; i < m_sdfs.size(); ++i)
+	{
+		btFluidSphRigidSdf** sdf = m_sdfs.getAtIndex(i);
+		if(sdf && *sdf) delete *sdf;
+	}
+	
+	m_sdfs.clear();
+	m_bytesUsed = 0;
+	m_numBakedBricks = 0;
+}
+
+bool btFluidSphRigidSdfCache::bakeBrick(btDispatcher* dispatcher, const btDispatcherInfo& dispatchInfo, const btCollisionObject* rigidObject,
+										btFluidSphRigidSdf* sdf, int brickX, int brickY, int brickZ)
+{
+	BT_PROFILE("btFluidSphRigidSdfCache::bakeBrick()");
+	
+	const int SAMPLES_PER_AXIS = btFluidSphRigidSdf::BRICK_SAMPLES_PER_AXIS;
+	
+	const btScalar brickSize = sdf->m_cellSize * static_cast<btScalar>(btFluidSphRigidSdf::BRICK_CELLS);
+	const btVector3 brickMin = sdf->m_origin + btVector3( static_cast<btScalar>(brickX), static_cast<btScalar>(brickY), static_cast<btScalar>(brickZ) ) * brickSize;
+	
+	int brickIndex = sdf->getBrickIndex(brickX, brickY, brickZ);
+	
+	//If the surface is not within m_bandWidth of the brick's bounding sphere, all samples would be clamped
+	const btScalar halfBrickDiagonal = brickSize * btScalar(0.5) * btSqrt( btScalar(3.0) );
+	const btScalar emptyDistance = halfBrickDiagonal + sdf->m_bandWidth;
+	
+	btVector3 brickCenter = brickMin + btVector3(brickSize, brickSize, brickSize) * btScalar(0.5);
+	if( probeShapeDistance(dispatcher, dispatchInfo, rigidObject, brickCenter, emptyDistance) >= emptyDistance )
+	{
+		sdf->m_brickSampleIndicies[brickIndex] = btFluidSphRigidSdf::BRICK_EMPTY;
+		return true;
+	}
+	
+	const int brickBytes = btFluidSphRigidSdf::BRICK_SAMPLES * sizeof(btScalar);
+	if(m_bytesUsed + brickBytes > m_maxBytes) return false;
+	
+	int firstSample = sdf->m_samples.size();
+	sdf->m_samples.resize(firstSample + btFluidSphRigidSdf::BRICK_SAMPLES);
+	
+	for(int z = 0; z < SAMPLES_PER_AXIS; ++z)
+		for(int y = 0; y < SAMPLES_PER_AXIS; ++y)
+			for(int x = 0; x < SAMPLES_PER_AXIS; ++x)
+			{
+				btVector3 samplePos = brickMin + btVector3( static_cast<btScalar>(x), static_cast<btScalar>(y), static_cast<btScalar>(z) ) * sdf->m_cellSize;
+				
+				int sampleIndex = firstSample + x + y*SAMPLES_PER_AXIS + z*SAMPLES_PER_AXIS*SAMPLES_PER_AXIS;
+				sdf->m_samples[sampleIndex] = probeShapeDistance(dispatcher, dispatchInfo, rigidObject, samplePos, sdf->m_bandWidth);
+			}
+	
+	sdf->m_brickSampleIndicies[brickIndex] = firstSample;
+	m_bytesUsed += brickBytes;
+	++m_numBakedBricks;
+	
+	return true;
+}
+
+int btFluidSphRigidSdfCache::getMemoryUsage(const btFluidSphRigidSdf* sdf)
+{
+	return sdf->m_brickSampleIndicies.size() * sizeof(int) + sdf->m_samples.size() * sizeof(btScalar);
+}
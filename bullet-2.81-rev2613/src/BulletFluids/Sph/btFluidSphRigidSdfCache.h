@@ -0,0 +1,121 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef BT_FLUID_SPH_RIGID_SDF_CACHE_H
+#define BT_FLUID_SPH_RIGID_SDF_CACHE_H
+
+#include "LinearMath/btVector3.h"
+#include "LinearMath/btAlignedObjectArray.h"
+#include "LinearMath/btHashMap.h"
+
+class btDispatcher;
+struct btDispatcherInfo;
+class btCollisionObject;
+class btCollisionShape;
+
+///@brief Narrow band distance field of a single btCollisionShape, sampled in the local space of the shape.
+///@remarks
+///Samples are grouped into bricks of BRICK_CELLS^3 cells; bricks are baked on first access, and only
+///bricks that are within m_bandWidth of the surface store samples. Adjacent bricks duplicate the
+///samples on their shared faces, so that each brick can be interpolated independently.
+struct btFluidSphRigidSdf
+{
+	BT_DECLARE_ALIGNED_ALLOCATOR();
+
+	enum
+	{
+		BRICK_CELLS = 8,
+		BRICK_SAMPLES_PER_AXIS = BRICK_CELLS + 1,
+		BRICK_SAMPLES = BRICK_SAMPLES_PER_AXIS * BRICK_SAMPLES_PER_AXIS * BRICK_SAMPLES_PER_AXIS
+	};
+
+	enum BrickState
+	{
+		BRICK_UNBAKED = -1,		///<The brick has not been accessed yet.
+		BRICK_EMPTY = -2		///<All points in the brick are farther than m_bandWidth from the surface.
+	};
+
+	btVector3 m_origin;			///<Minimum corner of the sampled region; shape local space.
+	btScalar m_cellSize;		///<Distance between samples.
+	btScalar m_bandWidth;		///<Sampled distances are clamped to this value.
+
+	int m_numBricksX;
+	int m_numBricksY;
+	int m_numBricksZ;
+
+	btAlignedObjectArray<int> m_brickSampleIndicies;	///<Per brick; index of the brick's first sample in m_samples, or a BrickState.
+	btAlignedObjectArray<btScalar> m_samples;			///<Distance from the surface; negative inside convex shapes.
+
+	int getBrickIndex(int x, int y, int z) const { return x + y*m_numBricksX + z*m_numBricksX*m_numBricksY; }
+};
+
+///@brief Caches distance fields for rigid shapes, so that particle contacts become an interpolation instead of a narrowphase query.
+///@remarks
+///Distance fields are keyed by btCollisionShape pointer and are stored in the local space of the shape,
+///so they remain valid while the btCollisionObject moves; this is intended for static and kinematic
+///triangle meshes and heightfields, but also works for dynamic bodies. Samples are computed using the
+///btDispatcher, so any shape that collides with a btSphereShape is supported.
+///@par
+///If a shape is deleted, or modified(e.g. by btCollisionShape::setLocalScaling() or a mesh refit),
+///removeShape() must be called before the next step.
+///@par
+///Distances are interpolated from the samples, so features smaller than m_cellSize are smoothed out.
+///For triangle meshes, distances are unsigned, so particles that pass through the surface are not pushed back.
+class btFluidSphRigidSdfCache
+{
+public:
+	///Distance between samples; world scale; if 0.0, the (expanded) particle radius of the first fluid to contact the shape is used.
+	btScalar m_cellSize;
+
+	///Distances are only stored within this distance from the surface; world scale; if 0.0, 4 times the (expanded) particle radius
+	///of the first fluid to contact the shape is used. Fluids with larger particles collide with the shape using the btDispatcher.
+	btScalar m_bandWidth;
+
+	///Limits the memory used by all distance fields, in bytes. Parts of a shape that would exceed it are collided using the btDispatcher.
+	int m_maxBytes;
+
+	btFluidSphRigidSdfCache() : m_cellSize( btScalar(0.0) ), m_bandWidth( btScalar(0.0) ), m_maxBytes(64 * 1024 * 1024), m_bytesUsed(0), m_numBakedBricks(0) {}
+	~btFluidSphRigidSdfCache() { clear(); }
+
+	///Returns the distance field of the shape, creating it if necessary.
+	///Returns 0 if the distance field would exceed the memory budget, or if its band is too narrow for the particle.
+	///@param particleRadius btFluidSphParametersLocal::m_particleRadius + btFluidSphParametersLocal::m_particleRadiusExpansion.
+	btFluidSphRigidSdf* findOrCreateSdf(const btCollisionShape* shape, btScalar particleRadius);
+
+	///Interpolates the distance and surface normal at localPos, baking the brick containing it if necessary.
+	///@param rigidObject Used only for baking; must use the shape that the distance field was created for.
+	///@param localPos Position in the local space of the shape.
+	///@return False if localPos is in a brick that cannot be baked within the memory budget; the results are not set.
+	///If localPos is farther than btFluidSphRigidSdf::m_bandWidth from the surface, out_distance is at least m_bandWidth.
+	bool getDistance(btDispatcher* dispatcher, const btDispatcherInfo& dispatchInfo, const btCollisionObject* rigidObject,
+					btFluidSphRigidSdf* sdf, const btVector3& localPos, btScalar& out_distance, btVector3& out_normal);
+
+	void removeShape(const btCollisionShape* shape);
+	void clear();
+
+	int getMemoryUsage() const { return m_bytesUsed; }
+	int getNumBakedBricks() const { return m_numBakedBricks; }
+
+protected:
+	btHashMap<btHashPtr, btFluidSphRigidSdf*> m_sdfs;		//Value is 0 if the shape cannot be cached
+	int m_bytesUsed;
+	int m_numBakedBricks;
+
+	bool bakeBrick(btDispatcher* dispatcher, const btDispatcherInfo& dispatchInfo, const btCollisionObject* rigidObject,
+					btFluidSphRigidSdf* sdf, int brickX, int brickY, int brickZ);
+
+	static int getMemoryUsage(const btFluidSphRigidSdf* sdf);
+};
+
+#endif
@@ -0,0 +1,385 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef BT_FLUID_SPH_RIGID_SHAPE_COLLIDERS_H
+#define BT_FLUID_SPH_RIGID_SHAPE_COLLIDERS_H
+
+#include "LinearMath/btVector3.h"
+#include "LinearMath/btTransform.h"
+
+#include "BulletCollision/CollisionShapes/btBoxShape.h"
+#include "BulletCollision/CollisionShapes/btSphereShape.h"
+#include "BulletCollision/CollisionShapes/btCapsuleShape.h"
+#include "BulletCollision/CollisionShapes/btCylinderShape.h"
+#include "BulletCollision/CollisionShapes/btConeShape.h"
+#include "BulletCollision/CollisionShapes/btConvexHullShape.h"
+#include "BulletCollision/CollisionShapes/btStaticPlaneShape.h"
+
+///@file
+///Point-shape distance queries used to collide fluid particles against rigid bodies without the btDispatcher.
+///@remarks
+///Each collider is constructed once per rigid body and narrowphase, and then queried for every particle near the body.
+///getClosestPoint() takes a position in the local frame of the shape, and returns the signed distance from the
+///surface of the shape(including its collision margin), which is negative if the point is inside the shape.
+///out_normal is the outward surface normal, and out_point the closest point on the surface, also in the local frame.
+
+///Returns a unit vector perpendicular to the axis with index upAxis.
+inline btVector3 btFluidSphGetPerpendicularAxis(int upAxis)
+{
+	btVector3 axis(0, 0, 0);
+	axis[(upAxis + 1) % 3] = btScalar(1.0);
+	return axis;
+}
+
+struct btFluidSphBoxCollider
+{
+	btVector3 m_halfExtents;
+
+	btFluidSphBoxCollider(const btBoxShape* shape) : m_halfExtents( shape->getHalfExtentsWithMargin() ) {}
+
+	inline btScalar getClosestPoint(const btVector3& pos, btVector3& out_normal, btVector3& out_point) const
+	{
+		btVector3 clamped = pos;
+		clamped.setMax(-m_halfExtents);
+		clamped.setMin(m_halfExtents);
+
+		btVector3 outside = pos - clamped;
+		btScalar outsideDistanceSquared = outside.length2();
+		if( outsideDistanceSquared > SIMD_EPSILON*SIMD_EPSILON )
+		{
+			btScalar distance = btSqrt(outsideDistanceSquared);
+			out_normal = outside / distance;
+			out_point = clamped;
+			return distance;
+		}
+
+		//Inside; the closest face is the one with the least penetration
+		btVector3 faceDistances = pos.absolute() - m_halfExtents;
+		int axis = faceDistances.maxAxis();
+		btScalar sign = (pos[axis] < btScalar(0.0)) ? btScalar(-1.0) : btScalar(1.0);
+
+		out_normal.setValue(0, 0, 0);
+		out_normal[axis] = sign;
+		out_point = pos;
+		out_point[axis] = sign * m_halfExtents[axis];
+		return faceDistances[axis];
+	}
+};
+
+struct btFluidSphSphereCollider
+{
+	btScalar m_radius;
+
+	btFluidSphSphereCollider(const btSphereShape* shape) : m_radius( shape->getRadius() ) {}
+
+	inline btScalar getClosestPoint(const btVector3& pos, btVector3& out_normal, btVector3& out_point) const
+	{
+		btScalar length = pos.length();
+		out_normal = (length > SIMD_EPSILON) ? pos / length : btVector3(0, 1, 0);
+		out_point = out_normal * m_radius;
+		return length - m_radius;
+	}
+};
+
+struct btFluidSphCapsuleCollider
+{
+	int m_upAxis;
+	btScalar m_radius;
+	btScalar m_halfHeight;
+
+	btFluidSphCapsuleCollider(const btCapsuleShape* shape)
+	: m_upAxis( shape->getUpAxis() ), m_radius( shape->getRadius() ), m_halfHeight( shape->getHalfHeight() ) {}
+
+	inline btScalar getClosestPoint(const btVector3& pos, btVector3& out_normal, btVector3& out_point) const
+	{
+		btVector3 segmentPoint(0, 0, 0);
+		segmentPoint[m_upAxis] = btMax( -m_halfHeight, btMin(pos[m_upAxis], m_halfHeight) );
+
+		btVector3 fromSegment = pos - segmentPoint;
+		btScalar length = fromSegment.length();
+		out_normal = (length > SIMD_EPSILON) ? fromSegment / length : btFluidSphGetPerpendicularAxis(m_upAxis);
+		out_point = segmentPoint + out_normal * m_radius;
+		return length - m_radius;
+	}
+};
+
+struct btFluidSphCylinderCollider
+{
+	int m_upAxis;
+	btScalar m_radius;
+	btScalar m_halfHeight;
+
+	btFluidSphCylinderCollider(const btCylinderShape* shape)
+	: m_upAxis( shape->getUpAxis() ), m_radius( shape->getRadius() ), m_halfHeight( shape->getHalfExtentsWithMargin()[shape->getUpAxis()] ) {}
+
+	inline btScalar getClosestPoint(const btVector3& pos, btVector3& out_normal, btVector3& out_point) const
+	{
+		btScalar height = pos[m_upAxis];
+		btVector3 radial = pos;
+		radial[m_upAxis] = btScalar(0.0);
+
+		btScalar radialLength = radial.length();
+		btVector3 radialDirection = (radialLength > SIMD_EPSILON) ? radial / radialLength : btFluidSphGetPerpendicularAxis(m_upAxis);
+
+		btScalar sideDistance = radialLength - m_radius;
+		btScalar capDistance = btFabs(height) - m_halfHeight;
+		btScalar capSign = (height < btScalar(0.0)) ? btScalar(-1.0) : btScalar(1.0);
+
+		if( sideDistance <= btScalar(0.0) && capDistance <= btScalar(0.0) )
+		{
+			if(sideDistance > capDistance)
+			{
+				out_normal = radialDirection;
+				out_point = radialDirection * m_radius;
+				out_point[m_upAxis] = height;
+				return sideDistance;
+			}
+
+			out_normal.setValue(0, 0, 0);
+			out_normal[m_upAxis] = capSign;
+			out_point = pos;
+			out_point[m_upAxis] = capSign * m_halfHeight;
+			return capDistance;
+		}
+
+		out_point = radialDirection * btMin(radialLength, m_radius);
+		out_point[m_upAxis] = btMax( -m_halfHeight, btMin(height, m_halfHeight) );
+
+		btVector3 outside = pos - out_point;
+		btScalar distance = outside.length();
+		out_normal = (distance > SIMD_EPSILON) ? outside / distance : radialDirection;
+		return distance;
+	}
+};
+
+///The apex of the cone is at (height / 2) along the up axis, and the base at -(height / 2).
+struct btFluidSphConeCollider
+{
+	int m_upAxis;
+	btScalar m_radius;
+	btScalar m_halfHeight;
+	btScalar m_margin;
+
+	btScalar m_slantLength;
+	btScalar m_slantNormalRadial;	//Outward normal of the slanted surface, in (radial, up) coordinates
+	btScalar m_slantNormalUp;
+
+	btFluidSphConeCollider(const btConeShape* shape)
+	: m_upAxis( shape->getConeUpIndex() ), m_radius( shape->getRadius() ), m_halfHeight( shape->getHeight() * btScalar(0.5) ),
+	m_margin( shape->getMargin() )
+	{
+		m_slantLength = btSqrt(m_radius*m_radius + btScalar(4.0)*m_halfHeight*m_halfHeight);
+		m_slantNormalRadial = btScalar(2.0) * m_halfHeight / m_slantLength;
+		m_slantNormalUp = m_radius / m_slantLength;
+	}
+
+	inline btScalar getClosestPoint(const btVector3& pos, btVector3& out_normal, btVector3& out_point) const
+	{
+		btScalar height = pos[m_upAxis];
+		btVector3 radial = pos;
+		radial[m_upAxis] = btScalar(0.0);
+
+		btScalar radialLength = radial.length();
+		btVector3 radialDirection = (radialLength > SIMD_EPSILON) ? radial / radialLength : btFluidSphGetPerpendicularAxis(m_upAxis);
+
+		//Closest point on the base disc, in (radial, up) coordinates
+		btScalar baseRadial = btMin(radialLength, m_radius);
+		btScalar baseUp = -m_halfHeight;
+		btScalar baseDistanceSquared = (radialLength - baseRadial)*(radialLength - baseRadial) + (height - baseUp)*(height - baseUp);
+
+		//Closest point on the slanted line, from the base rim (m_radius, -m_halfHeight) to the apex (0, m_halfHeight)
+		btScalar directionRadial = -m_radius / m_slantLength;
+		btScalar directionUp = btScalar(2.0) * m_halfHeight / m_slantLength;
+		btScalar t = (radialLength - m_radius)*directionRadial + (height + m_halfHeight)*directionUp;
+		t = btMax( btScalar(0.0), btMin(t, m_slantLength) );
+		btScalar slantRadial = m_radius + directionRadial * t;
+		btScalar slantUp = -m_halfHeight + directionUp * t;
+		btScalar slantDistanceSquared = (radialLength - slantRadial)*(radialLength - slantRadial) + (height - slantUp)*(height - slantUp);
+
+		bool isInside = ( height >= -m_halfHeight
+						&& (radialLength - m_radius)*m_slantNormalRadial + (height + m_halfHeight)*m_slantNormalUp <= btScalar(0.0) );
+
+		btScalar closestRadial, closestUp, faceNormalRadial, faceNormalUp, distanceSquared;
+		if(baseDistanceSquared < slantDistanceSquared)
+		{
+			closestRadial = baseRadial;
+			closestUp = baseUp;
+			faceNormalRadial = btScalar(0.0);
+			faceNormalUp = btScalar(-1.0);
+			distanceSquared = baseDistanceSquared;
+		}
+		else
+		{
+			closestRadial = slantRadial;
+			closestUp = slantUp;
+			faceNormalRadial = m_slantNormalRadial;
+			faceNormalUp = m_slantNormalUp;
+			distanceSquared = slantDistanceSquared;
+		}
+
+		btScalar distance = btSqrt(distanceSquared);
+		if( isInside || distance <= SIMD_EPSILON )
+		{
+			out_normal = radialDirection * faceNormalRadial;
+			out_normal[m_upAxis] = faceNormalUp;
+			if(isInside) distance = -distance;
+		}
+		else
+		{
+			out_normal = radialDirection * ( (radialLength - closestRadial) / distance );
+			out_normal[m_upAxis] = (height - closestUp) / distance;
+		}
+
+		out_point = radialDirection * closestRadial;
+		out_point[m_upAxis] = closestUp;
+		out_point += out_normal * m_margin;
+		return distance - m_margin;
+	}
+};
+
+///Requires btPolyhedralConvexShape::initializePolyhedralFeatures(); the distance is exact inside the hull,
+///while outside the hull it is the distance to the furthest face plane, which underestimates the distance near edges and vertices.
+struct btFluidSphConvexHullCollider
+{
+	const btConvexPolyhedron* m_polyhedron;
+	btScalar m_margin;
+
+	btFluidSphConvexHullCollider(const btConvexHullShape* shape) : m_polyhedron( shape->getConvexPolyhedron() ), m_margin( shape->getMargin() ) {}
+
+	static bool isSupported(const btConvexHullShape* shape)
+	{
+		return ( shape->getConvexPolyhedron() && shape->getConvexPolyhedron()->m_faces.size() );
+	}
+
+	inline btScalar getClosestPoint(const btVector3& pos, btVector3& out_normal, btVector3& out_point) const
+	{
+		const btAlignedObjectArray<btFace>& faces = m_polyhedron->m_faces;
+
+		int closestFace = 0;
+		btScalar maxPlaneDistance = -BT_LARGE_FLOAT;
+		for(int i = 0; i < faces.size(); ++i)
+		{
+			const btScalar* plane = faces[i].m_plane;
+			btScalar planeDistance = pos.x()*plane[0] + pos.y()*plane[1] + pos.z()*plane[2] + plane[3];
+
+			if(planeDistance > maxPlaneDistance)
+			{
+				maxPlaneDistance = planeDistance;
+				closestFace = i;
+			}
+		}
+
+		const btScalar* plane = faces[closestFace].m_plane;
+		btScalar distance = maxPlaneDistance - m_margin;
+
+		out_normal.setValue(plane[0], plane[1], plane[2]);
+		out_point = pos - out_normal * distance;
+		return distance;
+	}
+};
+
+///Returns the point on the triangle that is closest to pos.
+///"Real-Time Collision Detection". C. Ericson. 2005. Section 5.1.5.
+inline btVector3 btFluidSphGetClosestPointOnTriangle(const btVector3& pos, const btVector3& a, const btVector3& b, const btVector3& c)
+{
+	btVector3 ab = b - a;
+	btVector3 ac = c - a;
+
+	btVector3 ap = pos - a;
+	btScalar d1 = ab.dot(ap);
+	btScalar d2 = ac.dot(ap);
+	if( d1 <= btScalar(0.0) && d2 <= btScalar(0.0) ) return a;
+
+	btVector3 bp = pos - b;
+	btScalar d3 = ab.dot(bp);
+	btScalar d4 = ac.dot(bp);
+	if( d3 >= btScalar(0.0) && d4 <= d3 ) return b;
+
+	btScalar vc = d1*d4 - d3*d2;
+	if( vc <= btScalar(0.0) && d1 >= btScalar(0.0) && d3 <= btScalar(0.0) ) return a + ab * ( d1 / (d1 - d3) );
+
+	btVector3 cp = pos - c;
+	btScalar d5 = ab.dot(cp);
+	btScalar d6 = ac.dot(cp);
+	if( d6 >= btScalar(0.0) && d5 <= d6 ) return c;
+
+	btScalar vb = d5*d2 - d1*d6;
+	if( vb <= btScalar(0.0) && d2 >= btScalar(0.0) && d6 <= btScalar(0.0) ) return a + ac * ( d2 / (d2 - d6) );
+
+	btScalar va = d3*d6 - d5*d4;
+	if( va <= btScalar(0.0) && (d4 - d3) >= btScalar(0.0) && (d5 - d6) >= btScalar(0.0) )
+		return b + (c - b) * ( (d4 - d3) / ((d4 - d3) + (d5 - d6)) );
+
+	btScalar denominator = btScalar(1.0) / (va + vb + vc);
+	return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+///Triangles are two sided and have no thickness, as with btSphereTriangleCollisionAlgorithm, so the distance is never negative.
+///The closest of several triangles(e.g. those from btConcaveShape::processAllTriangles()) is returned.
+struct btFluidSphTriangleListCollider
+{
+	const btVector3* m_vertices;	///<3 per triangle.
+	int m_numTriangles;
+
+	btFluidSphTriangleListCollider(const btVector3* vertices, int numTriangles) : m_vertices(vertices), m_numTriangles(numTriangles) {}
+
+	inline btScalar getClosestPoint(const btVector3& pos, btVector3& out_normal, btVector3& out_point) const
+	{
+		int closestTriangle = 0;
+		btScalar minDistanceSquared = BT_LARGE_FLOAT;
+		for(int i = 0; i < m_numTriangles; ++i)
+		{
+			const btVector3* triangle = &m_vertices[i * 3];
+			btVector3 point = btFluidSphGetClosestPointOnTriangle(pos, triangle[0], triangle[1], triangle[2]);
+
+			btScalar distanceSquared = pos.distance2(point);
+			if(distanceSquared < minDistanceSquared)
+			{
+				minDistanceSquared = distanceSquared;
+				closestTriangle = i;
+				out_point = point;
+			}
+		}
+
+		btScalar distance = btSqrt(minDistanceSquared);
+		if(distance > SIMD_EPSILON) out_normal = (pos - out_point) / distance;
+		else
+		{
+			const btVector3* triangle = &m_vertices[closestTriangle * 3];
+			out_normal = (triangle[1] - triangle[0]).cross(triangle[2] - triangle[0]);
+			out_normal = (out_normal.length2() > SIMD_EPSILON*SIMD_EPSILON) ? out_normal.normalized() : btVector3(0, 1, 0);
+		}
+
+		return distance;
+	}
+};
+
+struct btFluidSphStaticPlaneCollider
+{
+	btVector3 m_normal;
+	btScalar m_constant;
+
+	btFluidSphStaticPlaneCollider(const btStaticPlaneShape* shape) : m_normal( shape->getPlaneNormal() ), m_constant( shape->getPlaneConstant() ) {}
+
+	inline btScalar getClosestPoint(const btVector3& pos, btVector3& out_normal, btVector3& out_point) const
+	{
+		btScalar distance = m_normal.dot(pos) - m_constant;
+
+		out_normal = m_normal;
+		out_point = pos - m_normal * distance;
+		return distance;
+	}
+};
+
+#endif
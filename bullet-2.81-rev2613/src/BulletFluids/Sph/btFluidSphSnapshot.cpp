@@ -0,0 +1,47 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#include "btFluidSphSnapshot.h"
+
+#include "LinearMath/btQuickprof.h"
+
+#include "btFluidSph.h"
+
+void btFluidSphSnapshot::copyFrom(const btFluidSph* fluid)
+{
+	BT_PROFILE("btFluidSphSnapshot::copyFrom()");
+	
+	const btFluidParticles& particles = fluid->getParticles();
+	const btFluidSortingGrid& grid = fluid->getGrid();
+	
+	//Assignment reuses the capacity of the arrays, so this does not allocate once the snapshot is large enough
+	m_pos = particles.m_pos;
+	m_vel = particles.m_vel_eval;
+	
+	if( fluid->areParticleIdsEnabled() ) m_id = particles.m_id;
+	else m_id.resize(0);
+	
+	grid.getPointAabb(m_pointAabbMin, m_pointAabbMax);
+	
+	m_gridCellSize = grid.getCellSize();
+	
+	int numGridCells = grid.getNumGridCells();
+	m_gridCellValues.resize(numGridCells);
+	m_gridCellContents.resize(numGridCells);
+	for(int i = 0; i < numGridCells; ++i)
+	{
+		m_gridCellValues[i] = grid.getGridCellValue(i);
+		m_gridCellContents[i] = grid.getGridCell(i);
+	}
+}
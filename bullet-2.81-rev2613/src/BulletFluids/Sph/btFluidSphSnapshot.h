@@ -0,0 +1,117 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef BT_FLUID_SPH_SNAPSHOT_H
+#define BT_FLUID_SPH_SNAPSHOT_H
+
+#if defined(_MSC_VER)
+#include <intrin.h>		//_InterlockedExchange()
+#endif
+
+#include "LinearMath/btVector3.h"
+#include "LinearMath/btAlignedObjectArray.h"
+
+#include "btFluidSortingGrid.h"
+
+class btFluidSph;
+
+///@brief Copy of the particle state of a btFluidSph at the end of a btFluidRigidDynamicsWorld::stepSimulation().
+///@remarks Particles in a grid cell are contiguous, as in btFluidSortingGrid; the particles of
+///cell m_gridCellValues[i] are in the range given by m_gridCellContents[i]. The grid is updated before 
+///the particles are integrated, and particles appended after the grid update are not contained in any cell.
+struct btFluidSphSnapshot
+{
+	int m_sequenceNumber;		///<Number of snapshots published before this one; may be used to detect whether the snapshot has changed.
+	
+	btAlignedObjectArray<btVector3> m_pos;		///<Position; world scale.
+	btAlignedObjectArray<btVector3> m_vel;		///<Velocity(btFluidParticles::m_vel_eval); simulation scale.
+	btAlignedObjectArray<int> m_id;				///<Stable particle ids; empty unless btFluidSph::areParticleIdsEnabled().
+	
+	btVector3 m_pointAabbMin;		///<AABB of particle centers.
+	btVector3 m_pointAabbMax;
+	
+	btScalar m_gridCellSize;
+	btAlignedObjectArray<btFluidGridCombinedPos> m_gridCellValues;
+	btAlignedObjectArray<btFluidGridIterator> m_gridCellContents;
+	
+	btFluidSphSnapshot() : m_sequenceNumber(0), m_pointAabbMin(0,0,0), m_pointAabbMax(0,0,0), m_gridCellSize( btScalar(0.0) ) {}
+	
+	int numParticles() const { return m_pos.size(); }
+	
+	void copyFrom(const btFluidSph* fluid);
+};
+
+///Atomically replaces the value of target, and returns its previous value; also acts as a full memory barrier.
+inline int btFluidAtomicExchange(volatile int* target, int value)
+{
+#if defined(_MSC_VER)
+	return _InterlockedExchange( reinterpret_cast<volatile long*>(target), value );
+#elif defined(__GNUC__)
+	int previous;
+	do { previous = *target; } while( !__sync_bool_compare_and_swap(target, previous, value) );
+	return previous;
+#else
+	//Not thread safe; snapshots may only be read on the simulation thread
+	int previous = *target;
+	*target = value;
+	return previous;
+#endif
+}
+
+///@brief Triple buffered btFluidSphSnapshot, which allows a single reading thread to access the particles without locks.
+///@remarks The simulation thread calls publish() after each step, while the reading thread calls acquireLatest().
+///The two threads never access the same snapshot, since publish() only writes to the snapshot not owned by either thread.
+///@par
+///Only one thread may call acquireLatest(); use a separate btFluidSphSnapshotBuffer for each reading thread.
+class btFluidSphSnapshotBuffer
+{
+	enum { NUM_SNAPSHOTS = 3, INDEX_MASK = 3, NEW_SNAPSHOT_FLAG = 4 };
+	
+	btFluidSphSnapshot m_snapshots[NUM_SNAPSHOTS];
+	
+	int m_writeIndex;				//Owned by the simulation thread
+	int m_readIndex;				//Owned by the reading thread
+	volatile int m_sharedIndex;		//Snapshot owned by neither thread; NEW_SNAPSHOT_FLAG is set if it is newer than m_readIndex
+	
+	int m_numPublished;
+
+public:
+	btFluidSphSnapshotBuffer() : m_writeIndex(0), m_readIndex(1), m_sharedIndex(2), m_numPublished(0) {}
+	
+	///Copies the state of the fluid into a snapshot, and makes it available to acquireLatest(); called from the simulation thread.
+	void publish(const btFluidSph* fluid)
+	{
+		btFluidSphSnapshot& snapshot = m_snapshots[m_writeIndex];
+		snapshot.copyFrom(fluid);
+		snapshot.m_sequenceNumber = m_numPublished++;
+		
+		int previous = btFluidAtomicExchange(&m_sharedIndex, m_writeIndex | NEW_SNAPSHOT_FLAG);
+		m_writeIndex = previous & INDEX_MASK;
+	}
+	
+	///Returns the most recently published snapshot; called from the reading thread.
+	///The snapshot remains valid and unchanged until the next call to acquireLatest().
+	const btFluidSphSnapshot& acquireLatest()
+	{
+		if(m_sharedIndex & NEW_SNAPSHOT_FLAG)
+		{
+			int previous = btFluidAtomicExchange(&m_sharedIndex, m_readIndex);
+			m_readIndex = previous & INDEX_MASK;
+		}
+		
+		return m_snapshots[m_readIndex];
+	}
+};
+
+#endif
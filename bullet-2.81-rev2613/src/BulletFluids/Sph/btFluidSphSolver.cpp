@@ -17,30 +17,41 @@ subject to the following restrictions:
 #include "btFluidSphSolver.h"
 
 #include "btFluidSortingGrid.h"
+#include "btFluidSphRigidConstraintSolver.h"
+#include "btFluidSphRigidBoundaryParticles.h"
 
-void btFluidSphSolver::applyForcesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid)
+template<bool SLEEPING>
+void applyForcesSingleFluidSpecialized(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, btFluidParticles& particles)
 {
-	BT_PROFILE("btFluidSphSolver::applyForcesSingleFluid()");
-
-	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
-	btFluidParticles& particles = fluid->internalGetParticles();
-	
 	const btScalar invParticleMass = btScalar(1.0) / FL.m_particleMass;
 	
 	for(int i = 0; i < particles.size(); ++i)
 	{
+		btVector3 force = particles.m_accumulatedForce[i];
+		particles.m_accumulatedForce[i].setValue(0, 0, 0);
+		
+		if( SLEEPING && particles.m_sleeping[i] ) continue;
+		
 		btVector3& vel = particles.m_vel[i];
 		btVector3& vel_eval = particles.m_vel_eval[i];
 	
-		btVector3 acceleration = FL.m_gravity + (particles.m_accumulatedForce[i] * invParticleMass);
+		btVector3 acceleration = FL.m_gravity + (force * (invParticleMass / particles.m_massScale[i]));
 
 		//Leapfrog integration
 		btVector3 vnext = vel + acceleration * FG.m_timeStep;	//v(t+1/2) = v(t-1/2) + a(t) dt	
 		vel_eval = (vel + vnext) * btScalar(0.5);				//v(t+1) = [v(t-1/2) + v(t+1/2)] * 0.5		used to compute (sph)forces later
 		vel = vnext;
 	}
+}
+void btFluidSphSolver::applyForcesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid)
+{
+	BT_PROFILE("btFluidSphSolver::applyForcesSingleFluid()");
+
+	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+	btFluidParticles& particles = fluid->internalGetParticles();
 	
-	for(int i = 0; i < particles.size(); ++i) particles.m_accumulatedForce[i].setValue(0, 0, 0);
+	if( FL.m_sleepVelocityThreshold != btScalar(0.0) ) applyForcesSingleFluidSpecialized<true>(FG, FL, particles);
+	else applyForcesSingleFluidSpecialized<false>(FG, FL, particles);
 }
 void btFluidSphSolver::integratePositionsSingleFluid(const btFluidSphParametersGlobal& FG, btFluidParticles& particles)
 {
@@ -51,7 +62,314 @@ void btFluidSphSolver::integratePositionsSingleFluid(const btFluidSphParametersG
 	
 	//Leapfrog integration
 	//p(t+1) = p(t) + v(t+1/2)*dt
-	for(int i = 0; i < particles.size(); ++i) particles.m_pos[i] += particles.m_vel[i] * timeStepDivSimScale;
+	for(int i = 0; i < particles.size(); ++i) 
+		if( !particles.m_sleeping[i] ) particles.m_pos[i] += particles.m_vel[i] * timeStepDivSimScale;
+}
+
+///If SLEEPING is false, btFluidParticles::m_sleeping is assumed to be 0 for all particles.
+///If removalMask is not 0, particles are aged, and marked for removal once they reach btFluidSphParametersLocal::m_particleLifetime.
+template<bool SLEEPING, bool APPLY_FORCES, bool AABB_BOUNDARY>
+void integrateParticlesSpecialized(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, btFluidParticles& particles,
+									unsigned int* removalMask, int firstIndex, int lastIndex, btVector3& out_pointMin, btVector3& out_pointMax)
+{
+	const btScalar invParticleMass = btScalar(1.0) / FL.m_particleMass;
+	const btScalar simScaleParticleRadius = FL.m_particleRadius * FG.m_simulationScale;
+	
+	//Velocity is at simulation scale; divide by simulation scale to convert to world scale
+	const btScalar timeStepDivSimScale = FG.m_timeStep / FG.m_simulationScale;
+	
+	btVector3 pointMin(BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT);
+	btVector3 pointMax(-BT_LARGE_FLOAT, -BT_LARGE_FLOAT, -BT_LARGE_FLOAT);
+	for(int i = firstIndex; i <= lastIndex; ++i)
+	{
+		btVector3& pos = particles.m_pos[i];
+		
+		if( !SLEEPING || !particles.m_sleeping[i] )
+		{
+			btVector3& vel = particles.m_vel[i];
+			
+			if(APPLY_FORCES)
+			{
+				btVector3 acceleration = FL.m_gravity + (particles.m_accumulatedForce[i] * (invParticleMass / particles.m_massScale[i]));
+				
+				//Leapfrog integration
+				btVector3 vnext = vel + acceleration * FG.m_timeStep;		//v(t+1/2) = v(t-1/2) + a(t) dt	
+				particles.m_vel_eval[i] = (vel + vnext) * btScalar(0.5);	//v(t+1) = [v(t-1/2) + v(t+1/2)] * 0.5		used to compute (sph)forces later
+				vel = vnext;
+			}
+			
+			if(AABB_BOUNDARY)
+			{
+				btVector3 aabbImpulse(0, 0, 0);
+				btFluidSphRigidConstraintSolver::accumulateAabbImpulse(FG, FL, simScaleParticleRadius, pos, vel, aabbImpulse);
+				vel += aabbImpulse;
+			}
+			
+			//p(t+1) = p(t) + v(t+1/2)*dt
+			pos += vel * timeStepDivSimScale;
+		}
+		
+		if(APPLY_FORCES) particles.m_accumulatedForce[i].setValue(0, 0, 0);
+		
+		if(removalMask)
+		{
+			particles.m_age[i] += FG.m_timeStep;
+			if(particles.m_age[i] >= FL.m_particleLifetime) removalMask[i / 32] |= 1u << (i % 32);
+		}
+		
+		pointMin.setMin(pos);
+		pointMax.setMax(pos);
+	}
+	
+	out_pointMin = pointMin;
+	out_pointMax = pointMax;
+}
+template<bool SLEEPING>
+void integrateParticlesSelectBoundary(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, btFluidParticles& particles,
+									unsigned int* removalMask, bool applyForces, int firstIndex, int lastIndex, 
+									btVector3& out_pointMin, btVector3& out_pointMax)
+{
+	if(applyForces)
+	{
+		if(FL.m_enableAabbBoundary) integrateParticlesSpecialized<SLEEPING, true, true>(FG, FL, particles, removalMask, firstIndex, lastIndex, out_pointMin, out_pointMax);
+		else integrateParticlesSpecialized<SLEEPING, true, false>(FG, FL, particles, removalMask, firstIndex, lastIndex, out_pointMin, out_pointMax);
+	}
+	else
+	{
+		if(FL.m_enableAabbBoundary) integrateParticlesSpecialized<SLEEPING, false, true>(FG, FL, particles, removalMask, firstIndex, lastIndex, out_pointMin, out_pointMax);
+		else integrateParticlesSpecialized<SLEEPING, false, false>(FG, FL, particles, removalMask, firstIndex, lastIndex, out_pointMin, out_pointMax);
+	}
+}
+void btFluidSphSolver::integrateParticles(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, bool applyForces, 
+											int firstIndex, int lastIndex, btVector3& out_pointMin, btVector3& out_pointMax)
+{
+	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+	btFluidParticles& particles = fluid->internalGetParticles();
+	
+	//Expired particles are marked in the same pass; the removal mask is resized by integrateSingleFluid()
+	unsigned int* removalMask = 0;
+	if( FL.m_particleLifetime > btScalar(0.0) )
+	{
+		btAlignedObjectArray<unsigned int>& mask = fluid->internalGetRemovalMask();
+		btAssert( mask.size() * 32 > lastIndex );
+		removalMask = &mask[0];
+	}
+	
+	if( FL.m_sleepVelocityThreshold != btScalar(0.0) ) 
+		integrateParticlesSelectBoundary<true>(FG, FL, particles, removalMask, applyForces, firstIndex, lastIndex, out_pointMin, out_pointMax);
+	else 
+		integrateParticlesSelectBoundary<false>(FG, FL, particles, removalMask, applyForces, firstIndex, lastIndex, out_pointMin, out_pointMax);
+}
+void btFluidSphSolver::integrateSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, bool applyForces)
+{
+	BT_PROFILE("btFluidSphSolver::integrateSingleFluid()");
+	
+	if( fluid->getLocalParameters().m_particleLifetime > btScalar(0.0) ) fluid->internalResizeRemovalMask();
+	
+	btFluidSortingGrid& grid = fluid->internalGetGrid();
+	
+	if( fluid->numParticles() ) 
+		integrateParticles(FG, fluid, applyForces, 0, fluid->numParticles() - 1, grid.internalGetPointAabbMin(), grid.internalGetPointAabbMax());
+	else
+	{
+		grid.internalGetPointAabbMin().setValue(0, 0, 0);
+		grid.internalGetPointAabbMax().setValue(0, 0, 0);
+	}
+}
+
+template<class Kernel>
+void selectKernelSpecializations(const btFluidSphParametersGlobal& FG, bool variableMass, btFluidSphSolverDefault::SphParticles& sphData)
+{
+	if(variableMass)
+	{
+		sphData.m_calculateSumsInCell = &btFluidSphSolverDefault::calculateSumsInCellSymmetricSpecialized<Kernel, true>;
+		sphData.m_calculateForcesInCell = &btFluidSphSolverDefault::calculateForcesInCellSymmetricSpecialized<Kernel, true>;
+	}
+	else
+	{
+		sphData.m_calculateSumsInCell = &btFluidSphSolverDefault::calculateSumsInCellSymmetricSpecialized<Kernel, false>;
+		sphData.m_calculateForcesInCell = &btFluidSphSolverDefault::calculateForcesInCellSymmetricSpecialized<Kernel, false>;
+	}
+	
+	sphData.m_calculateBoundarySumsInCell = &btFluidSphSolverDefault::calculateBoundarySumsInCellSpecialized<Kernel>;
+	sphData.m_calculateBoundaryForcesInCell = &btFluidSphSolverDefault::calculateBoundaryForcesInCellSpecialized<Kernel>;
+	
+	sphData.m_densityKernCoeff = Kernel::densityCoeff(FG);
+	sphData.m_selfDensityPartial = Kernel::densityPartial( FG, btScalar(0.0), btScalar(0.0) );
+	sphData.m_laplacianKernCoeff = Kernel::laplacianCoeff(FG);
+}
+void btFluidSphSolverDefault::selectSpecializations(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
+													btFluidSphSolverDefault::SphParticles& sphData)
+{
+	const btFluidParticles& particles = fluid->getParticles();
+	
+	//Particles only have differing masses if btFluidSphAdaptiveResolution is used
+	bool variableMass = false;
+	for(int i = 0; i < particles.size(); ++i)
+	{
+		if( particles.m_massScale[i] != btScalar(1.0) )
+		{
+			variableMass = true;
+			break;
+		}
+	}
+	
+	switch(FG.m_sphKernel)
+	{
+		case BT_FLUID_SPH_KERNEL_CUBIC_SPLINE:
+			selectKernelSpecializations<btFluidSphKernelCubicSpline>(FG, variableMass, sphData);
+			break;
+		case BT_FLUID_SPH_KERNEL_WENDLAND_C2:
+			selectKernelSpecializations<btFluidSphKernelWendlandC2>(FG, variableMass, sphData);
+			break;
+		
+		case BT_FLUID_SPH_KERNEL_MULLER_2003:
+		default:
+			selectKernelSpecializations<btFluidSphKernelMuller2003>(FG, variableMass, sphData);
+			break;
+	}
+}
+
+void btFluidSphSolverDefault::updateSleepingParticles(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
+														btFluidSphSolverDefault::SphParticles& sphData)
+{
+	BT_PROFILE("btFluidSphSolverDefault::updateSleepingParticles()");
+	
+	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+	const btFluidSortingGrid& grid = fluid->getGrid();
+	btFluidParticles& particles = fluid->internalGetParticles();
+	
+	const int numParticles = particles.size();
+	const int numGridCells = grid.getNumGridCells();
+	
+	sphData.m_excludeSleepingCells = false;
+	for(int i = 0; i < numParticles; ++i) particles.m_sleeping[i] = 0;
+	
+	if( FL.m_sleepVelocityThreshold == btScalar(0.0) ) return;
+	
+	//Distance, in grid cells, to the nearest cell containing an awake particle.
+	//	0 - Cell contains an awake particle.
+	//	1 - Particles are simulated normally, as they may interact with awake particles.
+	//	2 - Density is required to compute the force on simulated particles.
+	//	3 - Particle pairs are required to compute the density of cells with distance 2.
+	const int MAX_DISTANCE = 4;
+	
+	bool allCellsAwake = true;
+	for(int cell = 0; cell < numGridCells; ++cell)
+	{
+		btFluidGridIterator currentCell = grid.getGridCell(cell);
+		
+		int distance = MAX_DISTANCE;
+		for(int i = currentCell.m_firstIndex; i <= currentCell.m_lastIndex; ++i)
+		{
+			if( particles.m_sleepCounter[i] < FL.m_sleepSteps )
+			{
+				distance = 0;
+				break;
+			}
+		}
+		
+		if(distance != 0) allCellsAwake = false;
+		for(int i = currentCell.m_firstIndex; i <= currentCell.m_lastIndex; ++i) sphData.m_cellsToAwakeParticle[i] = distance;
+	}
+	
+	if(allCellsAwake) return;
+	
+	{
+		BT_PROFILE("updateSleepingParticles() - find adjacent cells");
+		
+		sphData.m_adjacentCells.resize(numGridCells);
+		for(int cell = 0; cell < numGridCells; ++cell) 
+			grid.findCells( particles.m_pos[grid.getGridCell(cell).m_firstIndex], sphData.m_adjacentCells[cell] );
+	}
+	
+	//Since all particles in a grid cell have the same distance, 
+	//only the first particle of each cell needs to be checked
+	for(int pass = 1; pass < MAX_DISTANCE; ++pass)
+	{
+		for(int cell = 0; cell < numGridCells; ++cell)
+		{
+			btFluidGridIterator currentCell = grid.getGridCell(cell);
+			if( sphData.m_cellsToAwakeParticle[currentCell.m_firstIndex] < pass ) continue;
+			
+			const btFluidSortingGrid::FoundCells& adjacentCells = sphData.m_adjacentCells[cell];
+			for(int j = 0; j < btFluidSortingGrid::NUM_FOUND_CELLS; ++j) 
+			{
+				const btFluidGridIterator& FI = adjacentCells.m_iterators[j];
+				if( FI.m_firstIndex <= FI.m_lastIndex && sphData.m_cellsToAwakeParticle[FI.m_firstIndex] == pass - 1 )
+				{
+					for(int i = currentCell.m_firstIndex; i <= currentCell.m_lastIndex; ++i) sphData.m_cellsToAwakeParticle[i] = pass;
+					break;
+				}
+			}
+		}
+	}
+	
+	//Exclude particles that cannot interact with awake particles
+	for(int i = 0; i < numParticles; ++i)
+	{
+		if( sphData.m_cellsToAwakeParticle[i] > 1 )
+		{
+			particles.m_sleeping[i] = 1;
+			particles.m_vel[i].setValue(0, 0, 0);
+			particles.m_vel_eval[i].setValue(0, 0, 0);
+		}
+	}
+	
+	sphData.m_excludeSleepingCells = true;
+	for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
+	{
+		const btAlignedObjectArray<int>& currentGroup = grid.internalGetMultithreadingGroup(group);
+		btAlignedObjectArray<int>& sumCells = sphData.m_sumCellGroups[group];
+		btAlignedObjectArray<int>& forceCells = sphData.m_forceCellGroups[group];
+		
+		sumCells.resize(0);
+		forceCells.resize(0);
+		for(int j = 0; j < currentGroup.size(); ++j)
+		{
+			int distance = sphData.m_cellsToAwakeParticle[ grid.getGridCell(currentGroup[j]).m_firstIndex ];
+			if(distance <= 3) sumCells.push_back(currentGroup[j]);
+			if(distance <= 2) forceCells.push_back(currentGroup[j]);
+		}
+	}
+}
+void btFluidSphSolverDefault::updateSleepCounters(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
+													btFluidSphSolverDefault::SphParticles& sphData)
+{
+	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+	if( FL.m_sleepVelocityThreshold == btScalar(0.0) ) return;
+	
+	BT_PROFILE("btFluidSphSolverDefault::updateSleepCounters()");
+	
+	btFluidParticles& particles = fluid->internalGetParticles();
+	
+	const btScalar speedThresholdSquared = FL.m_sleepVelocityThreshold * FL.m_sleepVelocityThreshold;
+	const btScalar densityErrorThreshold = FL.m_restDensity * FL.m_sleepDensityErrorThreshold;
+	for(int i = 0; i < particles.size(); ++i)
+	{
+		if( particles.m_sleeping[i] ) continue;
+		
+		btScalar densityError = btFabs( btScalar(1.0) / sphData.m_invDensity[i] - FL.m_restDensity );
+		if( particles.m_vel_eval[i].length2() < speedThresholdSquared && densityError < densityErrorThreshold )
+		{
+			if( particles.m_sleepCounter[i] < FL.m_sleepSteps ) ++particles.m_sleepCounter[i];
+		}
+		else particles.m_sleepCounter[i] = 0;
+	}
+}
+
+//Returns 0 if the fluid has no boundary particles, or if they were sorted with a different grid cell size
+static btFluidSphRigidBoundaryParticles* getUsableRigidBoundaryParticles(const btFluidSph* fluid)
+{
+	btFluidSphRigidBoundaryParticles* boundary = fluid->getRigidBoundaryParticles();
+	if( !boundary || !boundary->numParticles() ) return 0;
+	
+	return ( boundary->getGrid().getCellSize() == fluid->getGrid().getCellSize() ) ? boundary : 0;
+}
+
+bool btFluidSphSolverDefault::usesRigidBoundaryParticles(const btFluidSph* fluid) const
+{
+	return ( getUsableRigidBoundaryParticles(fluid) != 0 );
 }
 
 void btFluidSphSolverDefault::sphComputePressure(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, btFluidSphSolverDefault::SphParticles& sphData)
@@ -67,9 +385,8 @@ void btFluidSphSolverDefault::sphComputePressure(const btFluidSphParametersGloba
 	{
 		BT_PROFILE("sphComputePressure() - reset sums, clear table");
 		
-		const btScalar poly6ZeroDistance = FG.m_sphRadiusSquared * FG.m_sphRadiusSquared * FG.m_sphRadiusSquared;
-		const btScalar initialSphSum = poly6ZeroDistance * FL.m_initialSum;
-		for(int i = 0; i < numParticles; ++i) sphData.m_invDensity[i] = initialSphSum;
+		const btScalar initialSphSum = sphData.m_selfDensityPartial * FL.m_initialSum;
+		for(int i = 0; i < numParticles; ++i) sphData.m_invDensity[i] = initialSphSum * particles.m_massScale[i];
 		for(int i = 0; i < numParticles; ++i) sphData.m_neighborTable[i].clear();
 	}
 	
@@ -78,19 +395,33 @@ void btFluidSphSolverDefault::sphComputePressure(const btFluidSphParametersGloba
 		
 		for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
 		{
-			const btAlignedObjectArray<int>& currentGroup = grid.internalGetMultithreadingGroup(group);
+			const btAlignedObjectArray<int>& currentGroup = sphData.getSumCellGroup(grid, group);
 			if( !currentGroup.size() ) continue;
 			
 			computeSumsInMultithreadingGroup(FG, currentGroup, grid, particles, sphData);
 		}
 	}
 	
+	btFluidSphRigidBoundaryParticles* boundary = getUsableRigidBoundaryParticles(fluid);
+	if(boundary)
+	{
+		BT_PROFILE("sphComputePressure() - boundary sums");
+		
+		//Only the fluid particle of each pair is modified, so the grid cells may be processed in any order
+		for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
+		{
+			const btAlignedObjectArray<int>& currentGroup = sphData.getSumCellGroup(grid, group);
+			for(int cell = 0; cell < currentGroup.size(); ++cell)
+				sphData.m_calculateBoundarySumsInCell(FG, FL, currentGroup[cell], grid, particles, *boundary, sphData);
+		}
+	}
+	
 	{
 		BT_PROFILE("sphComputePressure() - compute pressure/density");
 		
 		for(int i = 0; i < numParticles; ++i)
 		{
-			btScalar density = sphData.m_invDensity[i] * FL.m_sphParticleMass * FG.m_poly6KernCoeff;
+			btScalar density = sphData.m_invDensity[i] * FL.m_sphParticleMass * sphData.m_densityKernCoeff;
 			sphData.m_pressure[i] = (density - FL.m_restDensity) * FL.m_stiffness;
 			sphData.m_invDensity[i] = btScalar(1.0) / density;
 		}
@@ -105,26 +436,39 @@ void btFluidSphSolverDefault::sphComputeForce(const btFluidSphParametersGlobal&
 	const btFluidSortingGrid& grid = fluid->getGrid();
 	btFluidParticles& particles = fluid->internalGetParticles();
 	
-	btScalar vterm = FG.m_viscosityKernLapCoeff * FL.m_viscosity;
+	btScalar vterm = sphData.m_laplacianKernCoeff * FL.m_viscosity;
 	
 	for(int i = 0; i < particles.size(); ++i)sphData.m_sphForce[i].setValue(0, 0, 0);
 	
 	for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
 	{
-		const btAlignedObjectArray<int>& currentGroup = grid.internalGetMultithreadingGroup(group);
+		const btAlignedObjectArray<int>& currentGroup = sphData.getForceCellGroup(grid, group);
 		if( !currentGroup.size() ) continue;
 		
 		computeForcesInMultithreadingGroup(FG, vterm, currentGroup, grid, particles, sphData);
 	}
 	
 	for(int i = 0; i < particles.size(); ++i)sphData.m_sphForce[i] *= FL.m_sphParticleMass;
+	
+	btFluidSphRigidBoundaryParticles* boundary = getUsableRigidBoundaryParticles(fluid);
+	if(boundary)
+	{
+		BT_PROFILE("sphComputeForce() - boundary forces");
+		
+		for(int group = 0; group < btFluidSortingGrid::NUM_MULTITHREADING_GROUPS; ++group)
+		{
+			const btAlignedObjectArray<int>& currentGroup = sphData.getForceCellGroup(grid, group);
+			for(int cell = 0; cell < currentGroup.size(); ++cell)
+				sphData.m_calculateBoundaryForcesInCell(FG, FL, vterm, currentGroup[cell], grid, particles, *boundary, sphData);
+		}
+	}
 }
 
-void btFluidSphSolverDefault::calculateSumsInCellSymmetric(const btFluidSphParametersGlobal& FG, int gridCellIndex, 
-															const btFluidSortingGrid& grid, btFluidParticles& particles,
-															btFluidSphSolverDefault::SphParticles& sphData)
+template<class Kernel, bool VARIABLE_MASS>
+void btFluidSphSolverDefault::calculateSumsInCellSymmetricSpecialized(const btFluidSphParametersGlobal& FG, int gridCellIndex, 
+																	const btFluidSortingGrid& grid, btFluidParticles& particles,
+																	btFluidSphSolverDefault::SphParticles& sphData)
 {
-	
 	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
 	if(currentCell.m_firstIndex <= currentCell.m_lastIndex)	//if cell is not empty
 	{
@@ -148,12 +492,20 @@ void btFluidSphSolverDefault::calculateSumsInCellSymmetric(const btFluidSphParam
 					
 					if(FG.m_sphRadiusSquared > distanceSquared)
 					{
-						btScalar c = FG.m_sphRadiusSquared - distanceSquared;
-						btScalar poly6KernPartialResult = c * c * c;
-						sphData.m_invDensity[i] += poly6KernPartialResult;
-						sphData.m_invDensity[n] += poly6KernPartialResult;
-						
 						btScalar distance = btSqrt(distanceSquared);
+						
+						btScalar densityKernPartialResult = Kernel::densityPartial(FG, distanceSquared, distance);
+						if(VARIABLE_MASS)
+						{
+							sphData.m_invDensity[i] += densityKernPartialResult * particles.m_massScale[n];
+							sphData.m_invDensity[n] += densityKernPartialResult * particles.m_massScale[i];
+						}
+						else
+						{
+							sphData.m_invDensity[i] += densityKernPartialResult;
+							sphData.m_invDensity[n] += densityKernPartialResult;
+						}
+						
 						if( !sphData.m_neighborTable[i].isFilled() ) sphData.m_neighborTable[i].addNeighbor(n, distance);
 						else if( !sphData.m_neighborTable[n].isFilled() ) sphData.m_neighborTable[n].addNeighbor(i, distance);
 						else 
@@ -168,9 +520,12 @@ void btFluidSphSolverDefault::calculateSumsInCellSymmetric(const btFluidSphParam
 	}
 }
 
+template<class Kernel, bool VARIABLE_MASS>
 void computeForceNeighborTableSymmetric(const btFluidSphParametersGlobal& FG, const btScalar vterm, int particleIndex, 
 										btFluidParticles& particles, btFluidSphSolverDefault::SphParticles& sphData)
 {
+	const btScalar pressureTermCoeff = btScalar(-0.5) * Kernel::gradientCoeff(FG);
+	
 	int i = particleIndex;
 	
 	for(int j = 0; j < sphData.m_neighborTable[i].numNeighbors(); j++ ) 
@@ -180,27 +535,133 @@ void computeForceNeighborTableSymmetric(const btFluidSphParametersGlobal& FG, co
 		btVector3 difference = (particles.m_pos[i] - particles.m_pos[n]) * FG.m_simulationScale;		//Simulation-scale distance
 		btScalar distance = sphData.m_neighborTable[i].getDistance(j);
 		
-		btScalar c = FG.m_sphSmoothRadius - distance;
-		btScalar pterm = btScalar(-0.5) * c * FG.m_spikyKernGradCoeff * (sphData.m_pressure[i] + sphData.m_pressure[n]);
-		pterm /= (distance < SIMD_EPSILON) ? SIMD_EPSILON : distance;
+		btScalar pterm = pressureTermCoeff * Kernel::gradientPartial(FG, distance) * (sphData.m_pressure[i] + sphData.m_pressure[n]);
+		btScalar lterm = vterm * Kernel::laplacianPartial(FG, distance);
 		
-		btScalar dterm = c * sphData.m_invDensity[i] * sphData.m_invDensity[n];
+		btScalar dterm = sphData.m_invDensity[i] * sphData.m_invDensity[n];
 
-		btVector3 force(  (pterm * difference.x() + vterm * (particles.m_vel_eval[n].x() - particles.m_vel_eval[i].x())) * dterm,
-						  (pterm * difference.y() + vterm * (particles.m_vel_eval[n].y() - particles.m_vel_eval[i].y())) * dterm,
-						  (pterm * difference.z() + vterm * (particles.m_vel_eval[n].z() - particles.m_vel_eval[i].z())) * dterm );
+		btVector3 force(  (pterm * difference.x() + lterm * (particles.m_vel_eval[n].x() - particles.m_vel_eval[i].x())) * dterm,
+						  (pterm * difference.y() + lterm * (particles.m_vel_eval[n].y() - particles.m_vel_eval[i].y())) * dterm,
+						  (pterm * difference.z() + lterm * (particles.m_vel_eval[n].z() - particles.m_vel_eval[i].z())) * dterm );
 		
-		sphData.m_sphForce[i] += force;
-		sphData.m_sphForce[n] += -force;
+		if(VARIABLE_MASS)
+		{
+			sphData.m_sphForce[i] += force * particles.m_massScale[n];
+			sphData.m_sphForce[n] += -force * particles.m_massScale[i];
+		}
+		else
+		{
+			sphData.m_sphForce[i] += force;
+			sphData.m_sphForce[n] += -force;
+		}
+	}
+}
+template<class Kernel, bool VARIABLE_MASS>
+void btFluidSphSolverDefault::calculateForcesInCellSymmetricSpecialized(const btFluidSphParametersGlobal& FG, const btScalar vterm,
+																		int gridCellIndex, const btFluidSortingGrid& grid, btFluidParticles& particles,
+																		btFluidSphSolverDefault::SphParticles& sphData)
+{
+	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
+	for(int i = currentCell.m_firstIndex; i <= currentCell.m_lastIndex; ++i)
+	{
+		computeForceNeighborTableSymmetric<Kernel, VARIABLE_MASS>(FG, vterm, i, particles, sphData);
 	}
 }
-void btFluidSphSolverDefault::calculateForcesInCellSymmetric(const btFluidSphParametersGlobal& FG, const btScalar vterm,
-															int gridCellIndex, const btFluidSortingGrid& grid, btFluidParticles& particles,
-															btFluidSphSolverDefault::SphParticles& sphData)
+
+template<class Kernel>
+void btFluidSphSolverDefault::calculateBoundarySumsInCellSpecialized(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, 
+																	int gridCellIndex, const btFluidSortingGrid& grid, btFluidParticles& particles,
+																	const btFluidSphRigidBoundaryParticles& boundary, 
+																	btFluidSphSolverDefault::SphParticles& sphData)
 {
 	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
+	if(currentCell.m_firstIndex > currentCell.m_lastIndex) return;
+	
+	const btFluidParticles& boundaryParticles = boundary.getParticles();
+	
+	//The boundary grid has the same cell size as the fluid grid, so the adjacent cells of both grids cover the same region
+	btFluidSortingGrid::FoundCells foundCells;
+	boundary.getGrid().findCells(particles.m_pos[currentCell.m_firstIndex], foundCells);
+	
+	//Boundary particles have a mass of (restDensity * volume); divide by the particle mass since it is multiplied in later
+	const btScalar boundaryMassScale = FL.m_restDensity / FL.m_sphParticleMass;
+	
 	for(int i = currentCell.m_firstIndex; i <= currentCell.m_lastIndex; ++i)
 	{
-		computeForceNeighborTableSymmetric(FG, vterm, i, particles, sphData);
+		btScalar sum = btScalar(0.0);
+		
+		for(int cell = 0; cell < btFluidSortingGrid::NUM_FOUND_CELLS; ++cell)
+		{
+			const btFluidGridIterator& FI = foundCells.m_iterators[cell];
+			for(int b = FI.m_firstIndex; b <= FI.m_lastIndex; ++b)
+			{
+				btVector3 difference = (particles.m_pos[i] - boundaryParticles.m_pos[b]) * FG.m_simulationScale;
+				btScalar distanceSquared = difference.length2();
+				
+				if(FG.m_sphRadiusSquared > distanceSquared)
+					sum += Kernel::densityPartial( FG, distanceSquared, btSqrt(distanceSquared) ) * boundary.getVolume(b);
+			}
+		}
+		
+		sphData.m_invDensity[i] += sum * boundaryMassScale;
+	}
+}
+
+template<class Kernel>
+void btFluidSphSolverDefault::calculateBoundaryForcesInCellSpecialized(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, 
+																		const btScalar vterm, int gridCellIndex, const btFluidSortingGrid& grid, 
+																		btFluidParticles& particles, btFluidSphRigidBoundaryParticles& boundary, 
+																		btFluidSphSolverDefault::SphParticles& sphData)
+{
+	btFluidGridIterator currentCell = grid.getGridCell(gridCellIndex);
+	if(currentCell.m_firstIndex > currentCell.m_lastIndex) return;
+	
+	const btFluidParticles& boundaryParticles = boundary.getParticles();
+	
+	btFluidSortingGrid::FoundCells foundCells;
+	boundary.getGrid().findCells(particles.m_pos[currentCell.m_firstIndex], foundCells);
+	
+	const btScalar gradientCoeff = Kernel::gradientCoeff(FG);
+	
+	for(int i = currentCell.m_firstIndex; i <= currentCell.m_lastIndex; ++i)
+	{
+		if( particles.m_sleeping[i] ) continue;
+		
+		//Negative pressure is ignored, so that fluid particles do not stick to the boundary
+		btScalar pressure = btMax( sphData.m_pressure[i], btScalar(0.0) );
+		btScalar invDensity = sphData.m_invDensity[i];
+		
+		//Pressure: -restDensity * volume * (pressure / density^2) * gradient(W)
+		//Viscosity: viscosity * (volume / density) * laplacian(W) * (boundaryVelocity - velocity)
+		btScalar pressureTerm = -FL.m_restDensity * pressure * invDensity * invDensity * gradientCoeff;
+		btScalar viscosityTerm = vterm * invDensity;
+		
+		//Convert the simulation scale acceleration of the fluid particle into a world scale force on the rigid body
+		btScalar reactionScale = -(FL.m_particleMass * particles.m_massScale[i]) / FG.m_simulationScale;
+		
+		btVector3 acceleration(0, 0, 0);
+		for(int cell = 0; cell < btFluidSortingGrid::NUM_FOUND_CELLS; ++cell)
+		{
+			const btFluidGridIterator& FI = foundCells.m_iterators[cell];
+			for(int b = FI.m_firstIndex; b <= FI.m_lastIndex; ++b)
+			{
+				btVector3 difference = (particles.m_pos[i] - boundaryParticles.m_pos[b]) * FG.m_simulationScale;
+				btScalar distanceSquared = difference.length2();
+				
+				if(FG.m_sphRadiusSquared > distanceSquared)
+				{
+					btScalar distance = btSqrt(distanceSquared);
+					btScalar volume = boundary.getVolume(b);
+					
+					btVector3 boundaryAcceleration = difference * (pressureTerm * Kernel::gradientPartial(FG, distance) * volume)
+						+ (boundary.getVelocity(b) - particles.m_vel_eval[i]) * (viscosityTerm * Kernel::laplacianPartial(FG, distance) * volume);
+					
+					acceleration += boundaryAcceleration;
+					boundary.accumulateReaction(b, boundaryAcceleration * reactionScale);
+				}
+			}
+		}
+		
+		sphData.m_sphForce[i] += acceleration;
 	}
 }
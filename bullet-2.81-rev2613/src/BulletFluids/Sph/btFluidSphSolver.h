@@ -20,8 +20,11 @@ subject to the following restrictions:
 #include "LinearMath/btQuickprof.h"		//BT_PROFILE(name) macro
 
 #include "btFluidSph.h"
+#include "btFluidSphKernels.h"
 #include "btFluidSphSurfaceTensionForce.h"
 
+class btFluidSphRigidBoundaryParticles;
+
 ///@brief Interface for particle motion computation. 
 ///@remarks
 ///Determines how the positions and velocities of fluid particles change from 
@@ -34,26 +37,58 @@ public:
 	///Internal function; position based solvers integrate position first, then velocity
 	virtual bool isPositionBasedSolver() const { return false; }
 	
+	///Returns true if the SPH forces of the fluid include its btFluidSph::getRigidBoundaryParticles(); if false, 
+	///the objects sampled by the boundary particles are collided with the fluid by btFluidSphRigidCollisionDetector instead.
+	virtual bool usesRigidBoundaryParticles(const btFluidSph* fluid) const { return false; }
+	
 	static void applyForcesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid);
 	static void integratePositionsSingleFluid(const btFluidSphParametersGlobal& FG, btFluidParticles& particles);
 	
+	///@brief Applies forces, the AABB boundary, and integrates positions in a single pass over the particles.
+	///@remarks
+	///Equivalent to calling applyForcesSingleFluid(), btFluidSphRigidConstraintSolver::applyAabbImpulsesSingleFluid(),
+	///and integratePositionsSingleFluid(). Also updates the point AABB of the grid from the integrated positions, 
+	///so that btFluidSph::getAabb() is current when the broadphase is updated.
+	///@param applyForces If false, applyForcesSingleFluid() should be called before this; this is used if 
+	///rigid body contacts must be resolved between the velocity and position update.
+	virtual void integrateSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, bool applyForces);
+	
+	///Processes particles with indicies [firstIndex, lastIndex] for integrateSingleFluid(), 
+	///and returns the point AABB of the processed particles. Ranges may be processed in parallel if 
+	///firstIndex is a multiple of 32, and btFluidSph::internalResizeRemovalMask() is called beforehand.
+	static void integrateParticles(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, bool applyForces, 
+									int firstIndex, int lastIndex, btVector3& out_pointMin, btVector3& out_pointMax);
+	
 	
 protected:
 	static void applySphForce(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, const btAlignedObjectArray<btVector3>& sphForce)
 	{
 		BT_PROFILE("applySphForce()");
 		
+		if( fluid->getLocalParameters().m_sleepVelocityThreshold != btScalar(0.0) ) applySphForceSpecialized<true>(FG, fluid, sphForce);
+		else applySphForceSpecialized<false>(FG, fluid, sphForce);
+	}
+	
+	///If SLEEPING is false, btFluidParticles::m_sleeping is assumed to be 0 for all particles.
+	template<bool SLEEPING>
+	static void applySphForceSpecialized(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, const btAlignedObjectArray<btVector3>& sphForce)
+	{
 		const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+		btFluidParticles& particles = fluid->internalGetParticles();
+		
 		btScalar speedLimitSquared = FG.m_speedLimit*FG.m_speedLimit;
 		for(int n = 0; n < fluid->numParticles(); ++n) 
 		{
+			if( SLEEPING && particles.m_sleeping[n] ) continue;
+			
 			btVector3 acceleration = sphForce[n];
 					
 			//Limit speed
 			btScalar speedSquared = acceleration.length2();
 			if(speedSquared > speedLimitSquared) acceleration *= FG.m_speedLimit / btSqrt(speedSquared);
-					
-			fluid->applyForce(n, acceleration * FL.m_particleMass);
+			
+			//btFluidSph::applyForce() is not used as it wakes the particle
+			particles.m_accumulatedForce[n] += acceleration * (FL.m_particleMass * particles.m_massScale[n]);
 		}
 	}
 };
@@ -103,6 +138,17 @@ public:
 ///Surface tension forces are computed and applied only if btFluidSphLocalParameters.m_surfaceTension
 ///is nonzero. Fluid-fluid interaction is not implemented.
 ///@par
+///The kernel functions are selected by btFluidSphParametersGlobal.m_sphKernel. The pair loops are compiled 
+///once for each kernel in btFluidSphKernels.h, and once with and without btFluidParticles::m_massScale; 
+///the specialization is selected once per fluid per step, so the pair loops do not contain feature branches.
+///@par
+///If btFluidSph::getRigidBoundaryParticles() is set, boundary particles are included in the density and force calculations.
+///@par
+///If btFluidSphParametersLocal.m_sleepVelocityThreshold is nonzero, particles that remain slow and near the rest density 
+///for btFluidSphParametersLocal.m_sleepSteps are put to sleep. Grid cells that are not within 1 cell of an awake particle
+///are excluded from integration, and the density and force calculations are restricted to the cells that affect the
+///remaining particles.
+///@par
 ///A short introduction to SPH fluids may be found in: \n
 ///"Particle-Based Fluid Simulation for Interactive Applications". \n
 ///M. Muller, D. Charypar, M. Gross. Proceedings of 2003 ACM SIGGRAPH Symposium on Computer Animations, p.154-159, 2003. \n
@@ -116,12 +162,52 @@ public:
 	///Contains parallel arrays that 'extend' btFluidParticles with SPH specific data
 	struct SphParticles
 	{
+		typedef void (*CalculateSumsInCellFunction)(const btFluidSphParametersGlobal& FG, int gridCellIndex, const btFluidSortingGrid& grid, 
+													btFluidParticles& particles, SphParticles& sphData);
+		typedef void (*CalculateForcesInCellFunction)(const btFluidSphParametersGlobal& FG, const btScalar vterm, int gridCellIndex, 
+														const btFluidSortingGrid& grid, btFluidParticles& particles, SphParticles& sphData);
+		typedef void (*CalculateBoundarySumsInCellFunction)(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, int gridCellIndex,
+															const btFluidSortingGrid& grid, btFluidParticles& particles,
+															const btFluidSphRigidBoundaryParticles& boundary, SphParticles& sphData);
+		typedef void (*CalculateBoundaryForcesInCellFunction)(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, const btScalar vterm,
+															int gridCellIndex, const btFluidSortingGrid& grid, btFluidParticles& particles,
+															btFluidSphRigidBoundaryParticles& boundary, SphParticles& sphData);
+	
 		btAlignedObjectArray<btVector3> m_sphForce;		///<Sum of pressure and viscosity forces; simulation scale.
 		btAlignedObjectArray<btScalar> m_pressure;		///<Value of the pressure scalar field at the particle's position.
 		btAlignedObjectArray<btScalar> m_invDensity;	///<Inverted value of the density scalar field at the particle's position.
 		
 		btAlignedObjectArray<btFluidSphNeighbors> m_neighborTable;
 		
+		///Used if btFluidSphParametersLocal.m_surfaceTension is nonzero; separate for each fluid, so that fluids may be processed in parallel.
+		btFluidSphSurfaceTensionForce m_surfaceTensionComputer;
+		
+		///@name Particle sleeping; only used if btFluidSphParametersLocal.m_sleepVelocityThreshold is nonzero.
+		///@{
+		btAlignedObjectArray<int> m_cellsToAwakeParticle;	///<Distance, in grid cells, to the nearest cell containing an awake particle; capped.
+		btAlignedObjectArray<btFluidSortingGrid::FoundCells> m_adjacentCells;	///<Per grid cell; results of btFluidSortingGrid::findCells().
+		
+		///If true, m_sumCellGroups and m_forceCellGroups are used instead of btFluidSortingGrid::internalGetMultithreadingGroup().
+		bool m_excludeSleepingCells;
+		btAlignedObjectArray<int> m_sumCellGroups[btFluidSortingGrid::NUM_MULTITHREADING_GROUPS];	///<Grid cells processed during density calculation.
+		btAlignedObjectArray<int> m_forceCellGroups[btFluidSortingGrid::NUM_MULTITHREADING_GROUPS];	///<Grid cells processed during force calculation.
+		///@}
+		
+		///@name Specialized kernels; set by btFluidSphSolverDefault::selectSpecializations() once per step.
+		///@{
+		CalculateSumsInCellFunction m_calculateSumsInCell;
+		CalculateForcesInCellFunction m_calculateForcesInCell;
+		CalculateBoundarySumsInCellFunction m_calculateBoundarySumsInCell;		///<Used if btFluidSph::getRigidBoundaryParticles() is set.
+		CalculateBoundaryForcesInCellFunction m_calculateBoundaryForcesInCell;
+		btScalar m_densityKernCoeff;		///<Converts the sums computed by m_calculateSumsInCell into density.
+		btScalar m_selfDensityPartial;		///<Partial result of the density kernel at distance 0.
+		btScalar m_laplacianKernCoeff;		///<Coefficient of the Laplacian used for the viscosity force.
+		///@}
+		
+		SphParticles() : m_excludeSleepingCells(false), m_calculateSumsInCell(0), m_calculateForcesInCell(0),
+						m_calculateBoundarySumsInCell(0), m_calculateBoundaryForcesInCell(0),
+						m_densityKernCoeff( btScalar(0.0) ), m_selfDensityPartial( btScalar(0.0) ), m_laplacianKernCoeff( btScalar(0.0) ) {}
+		
 		int size() const { return m_sphForce.size(); }
 		void resize(int newSize)
 		{
@@ -130,47 +216,76 @@ public:
 			m_invDensity.resize(newSize);
 			
 			m_neighborTable.resize(newSize);
+			
+			m_cellsToAwakeParticle.resize(newSize);
+		}
+		
+		const btAlignedObjectArray<int>& getSumCellGroup(const btFluidSortingGrid& grid, int group) const
+		{
+			return (m_excludeSleepingCells) ? m_sumCellGroups[group] : grid.internalGetMultithreadingGroup(group);
+		}
+		const btAlignedObjectArray<int>& getForceCellGroup(const btFluidSortingGrid& grid, int group) const
+		{
+			return (m_excludeSleepingCells) ? m_forceCellGroups[group] : grid.internalGetMultithreadingGroup(group);
 		}
 	};
 
 protected:
 	btAlignedObjectArray<btFluidSphSolverDefault::SphParticles> m_sphData;
-
-	btFluidSphSurfaceTensionForce m_surfaceTensionComputer;
 	
 public:
+	virtual bool usesRigidBoundaryParticles(const btFluidSph* fluid) const;
+	
 	virtual void updateGridAndCalculateSphForces(const btFluidSphParametersGlobal& FG, btFluidSph** fluids, int numFluids)
 	{
 		BT_PROFILE("btFluidSphSolverDefault::updateGridAndCalculateSphForces()");
 		
 		if( m_sphData.size() < numFluids ) m_sphData.resize(numFluids);
 		
-		for(int i = 0; i < numFluids; ++i) 
+		for(int i = 0; i < numFluids; ++i) updateGridAndCalculateSphForcesSingleFluid(FG, fluids[i], m_sphData[i]);
+	}
+	
+protected:
+	///@brief Updates the grid and applies SPH forces for a single fluid.
+	///@remarks Only accesses the fluid and its sphData(and the btFluidSphRigidBoundaryParticles of the fluid, if any), 
+	///so fluids that do not share boundary particles may be processed in parallel.
+	virtual void updateGridAndCalculateSphForcesSingleFluid(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, 
+															btFluidSphSolverDefault::SphParticles& sphData)
+	{
+		if( fluid->numParticles() > sphData.size() ) sphData.resize( fluid->numParticles() );
+		
+		fluid->internalSetSolverData(&sphData);
+		
+		fluid->insertParticlesIntoGrid();
+		
+		selectSpecializations(FG, fluid, sphData);
+		
+		updateSleepingParticles(FG, fluid, sphData);
+		
+		sphComputePressure(FG, fluid, sphData);
+		
+		updateSleepCounters(FG, fluid, sphData);
+		
+		sphComputeForce(FG, fluid, sphData);
+		
+		const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+		if( FL.m_surfaceTension != btScalar(0.0) )
 		{
-			btFluidSph* fluid = fluids[i];
-			btFluidSphSolverDefault::SphParticles& sphData = m_sphData[i];
-			if( fluid->numParticles() > sphData.size() ) sphData.resize( fluid->numParticles() );
-			
-			fluid->internalSetSolverData(&sphData);
-			
-			fluid->insertParticlesIntoGrid();
-			
-			sphComputePressure(FG, fluid, sphData);
-			
-			sphComputeForce(FG, fluid, sphData);
-			
-			const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
-			if( FL.m_surfaceTension != btScalar(0.0) )
-			{
-				m_surfaceTensionComputer.computeAndApplySurfaceTensionForce(FG, fluid, sphData.m_neighborTable, 
-																			sphData.m_invDensity, sphData.m_sphForce);
-			}
-			
-			applySphForce(FG, fluid, sphData.m_sphForce);
+			sphData.m_surfaceTensionComputer.computeAndApplySurfaceTensionForce(FG, fluid, sphData.m_neighborTable, 
+																				sphData.m_invDensity, sphData.m_sphForce);
 		}
+		
+		applySphForce(FG, fluid, sphData.m_sphForce);
 	}
 	
-protected:
+	///Selects the kernel functions and pair loops used for this step; see btFluidSphParametersGlobal.m_sphKernel.
+	virtual void selectSpecializations(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, btFluidSphSolverDefault::SphParticles& sphData);
+	
+	///Determines which particles are excluded from the current step, and which grid cells must be processed for the remaining particles.
+	virtual void updateSleepingParticles(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, btFluidSphSolverDefault::SphParticles& sphData);
+	///Advances or resets the sleep counter of each particle that is not excluded; requires the density computed by sphComputePressure().
+	virtual void updateSleepCounters(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, btFluidSphSolverDefault::SphParticles& sphData);
+	
 	virtual void sphComputePressure(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, btFluidSphSolverDefault::SphParticles& sphData);
 	virtual void sphComputeForce(const btFluidSphParametersGlobal& FG, btFluidSph* fluid, btFluidSphSolverDefault::SphParticles& sphData);
 	
@@ -191,11 +306,43 @@ protected:
 	}
 	
 public:
+	///Calls the specialization selected for this step; sphData.m_calculateSumsInCell.
 	static void calculateSumsInCellSymmetric(const btFluidSphParametersGlobal& FG, int gridCellIndex, const btFluidSortingGrid& grid, 
-											btFluidParticles& particles, btFluidSphSolverDefault::SphParticles& sphData);
+											btFluidParticles& particles, btFluidSphSolverDefault::SphParticles& sphData)
+	{
+		sphData.m_calculateSumsInCell(FG, gridCellIndex, grid, particles, sphData);
+	}
+	///Calls the specialization selected for this step; sphData.m_calculateForcesInCell.
 	static void calculateForcesInCellSymmetric(const btFluidSphParametersGlobal& FG, const btScalar vterm,
 											int gridCellIndex, const btFluidSortingGrid& grid, btFluidParticles& particles,
-											btFluidSphSolverDefault::SphParticles& sphData);
+											btFluidSphSolverDefault::SphParticles& sphData)
+	{
+		sphData.m_calculateForcesInCell(FG, vterm, gridCellIndex, grid, particles, sphData);
+	}
+	
+	///@name Specializations; Kernel is a policy from btFluidSphKernels.h, and if VARIABLE_MASS is false
+	///btFluidParticles::m_massScale is assumed to be 1.0 for all particles.
+	///@{
+	template<class Kernel, bool VARIABLE_MASS>
+	static void calculateSumsInCellSymmetricSpecialized(const btFluidSphParametersGlobal& FG, int gridCellIndex, const btFluidSortingGrid& grid, 
+														btFluidParticles& particles, btFluidSphSolverDefault::SphParticles& sphData);
+	template<class Kernel, bool VARIABLE_MASS>
+	static void calculateForcesInCellSymmetricSpecialized(const btFluidSphParametersGlobal& FG, const btScalar vterm,
+														int gridCellIndex, const btFluidSortingGrid& grid, btFluidParticles& particles,
+														btFluidSphSolverDefault::SphParticles& sphData);
+	
+	///Adds the density contribution of btFluidSphRigidBoundaryParticles to the fluid particles in a grid cell.
+	template<class Kernel>
+	static void calculateBoundarySumsInCellSpecialized(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, int gridCellIndex,
+														const btFluidSortingGrid& grid, btFluidParticles& particles,
+														const btFluidSphRigidBoundaryParticles& boundary, btFluidSphSolverDefault::SphParticles& sphData);
+	///Adds the pressure and viscosity forces of btFluidSphRigidBoundaryParticles to the fluid particles in a grid cell,
+	///and accumulates the opposite forces on the rigid bodies.
+	template<class Kernel>
+	static void calculateBoundaryForcesInCellSpecialized(const btFluidSphParametersGlobal& FG, const btFluidSphParametersLocal& FL, const btScalar vterm,
+														int gridCellIndex, const btFluidSortingGrid& grid, btFluidParticles& particles,
+														btFluidSphRigidBoundaryParticles& boundary, btFluidSphSolverDefault::SphParticles& sphData);
+	///@}
 };
 
 #endif
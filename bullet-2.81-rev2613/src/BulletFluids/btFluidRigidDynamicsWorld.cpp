@@ -15,19 +15,39 @@ subject to the following restrictions:
 #include "btFluidRigidDynamicsWorld.h"
 
 #include "LinearMath/btIDebugDraw.h"
+#include "BulletCollision/BroadphaseCollision/btOverlappingPairCache.h"
 
 #include "Sph/btFluidSph.h"
+#include "Sph/btFluidSphBroadphaseBlock.h"
 #include "Sph/btFluidSphSolver.h"
+#include "Sph/btFluidSphRigidBoundaryParticles.h"
+#include "Sph/btFluidSphSnapshot.h"
+#include "Sph/Experimental/btFluidSphAdaptiveResolution.h"
+
+extern int gNumAlignedAllocs;	//Incremented by btAlignedAlloc(); defined in LinearMath/btAlignedAllocator.cpp
 
 btFluidRigidDynamicsWorld::btFluidRigidDynamicsWorld(btDispatcher* dispatcher, btBroadphaseInterface* pairCache, 
 													btConstraintSolver* constraintSolver, btCollisionConfiguration* collisionConfiguration, 
 													btFluidSphSolver* fluidSolver) 
 : 	btDiscreteDynamicsWorld(dispatcher, pairCache, constraintSolver, collisionConfiguration), 
-	m_fluidSolver(fluidSolver),
-	m_internalFluidPreTickCallback(0), m_internalFluidPostTickCallback(0), m_internalFluidMidTickCallback(0) {}
+	m_sphForcesPending(false), m_numHeapAllocationsLastStep(0), m_fluidSolver(fluidSolver), m_fluidRigidCollisionDetector(&m_defaultFluidRigidCollisionDetector),
+	m_fluidRigidConstraintSolver(&m_defaultFluidRigidConstraintSolver),
+	m_internalFluidPreTickCallback(0), m_internalFluidPostTickCallback(0), m_internalFluidMidTickCallback(0) 
+{
+	//Replaces any btOverlapFilterCallback set by the user; a user callback should also reject pairs of btFluidSphBroadphaseBlock
+	m_broadphasePairCache->getOverlappingPairCache()->setOverlapFilterCallback(&m_broadphaseBlockFilterCallback);
+}
 								
+btFluidRigidDynamicsWorld::~btFluidRigidDynamicsWorld()
+{
+	//Blocks are not in m_collisionObjects, so their proxies must be destroyed before the broadphase
+	for(int i = 0; i < m_fluids.size(); ++i) removeFluidBroadphaseBlocks(m_fluids[i], false);
+}
+
 int btFluidRigidDynamicsWorld::stepSimulation(btScalar timeStep, int maxSubSteps, btScalar fixedTimeStep)
 {
+	int numAllocsBeforeStep = gNumAlignedAllocs;
+	
 	m_tempOverrideFluids.resize(0);
 	m_tempDefaultFluids.resize(0);
 	for(int i = 0; i < m_fluids.size(); ++i)
@@ -39,7 +59,20 @@ int btFluidRigidDynamicsWorld::stepSimulation(btScalar timeStep, int maxSubSteps
 	}
 
 	//
-	return btDiscreteDynamicsWorld::stepSimulation(timeStep, maxSubSteps, fixedTimeStep);
+	int numSimulationSubSteps = btDiscreteDynamicsWorld::stepSimulation(timeStep, maxSubSteps, fixedTimeStep);
+	
+	if(numSimulationSubSteps)
+	{
+		for(int i = 0; i < m_fluids.size(); ++i)
+		{
+			btFluidSphSnapshotBuffer* snapshotBuffer = m_fluids[i]->getSnapshotBuffer();
+			if(snapshotBuffer) snapshotBuffer->publish(m_fluids[i]);
+		}
+	}
+	
+	m_numHeapAllocationsLastStep = gNumAlignedAllocs - numAllocsBeforeStep;
+	
+	return numSimulationSubSteps;
 }
 
 void btFluidRigidDynamicsWorld::addFluidSph(btFluidSph* fluid, short int collisionFilterGroup, short int collisionFilterMask)
@@ -52,21 +85,38 @@ void btFluidRigidDynamicsWorld::addFluidSph(btFluidSph* fluid, short int collisi
 }
 void btFluidRigidDynamicsWorld::removeFluidSph(btFluidSph* fluid)
 {
+	removeFluidBroadphaseBlocks(fluid, false);
+
 	m_fluids.remove(fluid);  //Swaps elements if fluid is not the last
 	btCollisionWorld::removeCollisionObject(fluid);
 }
 void btFluidRigidDynamicsWorld::addCollisionObject(btCollisionObject* collisionObject, 
 													short int collisionFilterGroup, short int collisionFilterMask)
 {
+	btAssert( !btFluidSphBroadphaseBlock::upcast(collisionObject) );	//Blocks are managed by the world
+	
 	btFluidSph* fluid = btFluidSph::upcast(collisionObject);
 	if(fluid) addFluidSph(fluid, collisionFilterGroup, collisionFilterMask);
 	else btDiscreteDynamicsWorld::addCollisionObject(collisionObject, collisionFilterGroup, collisionFilterMask);
 }
 void btFluidRigidDynamicsWorld::removeCollisionObject(btCollisionObject* collisionObject)
 {
+	btAssert( !btFluidSphBroadphaseBlock::upcast(collisionObject) );
+	
 	btFluidSph* fluid = btFluidSph::upcast(collisionObject);
 	if(fluid) removeFluidSph(fluid);
-	else btDiscreteDynamicsWorld::removeCollisionObject(collisionObject);
+	else 
+	{
+		//A new object may be allocated at the same address, so it should not use the cached contacts of this object
+		for(int i = 0; i < m_fluids.size(); ++i)
+		{
+			btAlignedObjectArray<btFluidSphRigidCachedContact>& cache = m_fluids[i]->internalGetRigidContactCache();
+			for(int n = 0; n < cache.size(); ++n)
+				if(cache[n].m_object == collisionObject) cache[n].m_object = 0;
+		}
+	
+		btDiscreteDynamicsWorld::removeCollisionObject(collisionObject);
+	}
 }
 
 void btFluidRigidDynamicsWorld::addSphEmitter(btFluidEmitter* emitter)
@@ -77,6 +127,222 @@ void btFluidRigidDynamicsWorld::removeSphEmitter(btFluidEmitter* emitter)
 {
 	m_emitters.remove(emitter);
 }
+void btFluidRigidDynamicsWorld::addSphAbsorber(btFluidAbsorber* absorber)
+{
+	m_absorbers.push_back(absorber);
+}
+void btFluidRigidDynamicsWorld::removeSphAbsorber(btFluidAbsorber* absorber)
+{
+	m_absorbers.remove(absorber);
+}
+
+void btFluidRigidDynamicsWorld::solveConstraints(btContactSolverInfo& solverInfo)
+{
+	if(!m_sphForcesPending)
+	{
+		btDiscreteDynamicsWorld::solveConstraints(solverInfo);
+		return;
+	}
+	m_sphForcesPending = false;
+	
+	//Collision detection has already been performed
+	for(int i = 0; i < m_fluids.size(); ++i) m_fluids[i]->removeMarkedParticles();
+	
+	solveConstraintsAndCalculateSphForces(solverInfo);
+}
+void btFluidRigidDynamicsWorld::calculateSphForces(bool boundaryFluids)
+{
+	BT_PROFILE("FluidRigidWorld - calculateSphForces()");
+	
+	m_tempSphForceFluids.resize(0);
+	for(int i = 0; i < m_tempDefaultFluids.size(); ++i)
+	{
+		bool hasBoundary = ( m_tempDefaultFluids[i]->getRigidBoundaryParticles() != 0 );
+		if(hasBoundary == boundaryFluids) m_tempSphForceFluids.push_back(m_tempDefaultFluids[i]);
+	}
+	
+	int numDefaultSolverFluids = m_tempSphForceFluids.size();
+	if(numDefaultSolverFluids)
+	{
+		m_fluidSolver->updateGridAndCalculateSphForces(m_globalParameters, &m_tempSphForceFluids[0], numDefaultSolverFluids);
+	}
+	
+	for(int i = 0; i < m_tempOverrideFluids.size(); ++i)
+	{
+		btFluidSph* fluid = m_tempOverrideFluids[i];
+		
+		bool hasBoundary = ( fluid->getRigidBoundaryParticles() != 0 );
+		if(hasBoundary != boundaryFluids) continue;
+	
+		btFluidSphSolver* overrideSolver = fluid->getOverrideSolver();
+		btFluidSphParametersGlobal* overrideParameters = fluid->getOverrideParameters();
+		
+		btFluidSphSolver* usedSolver = (overrideSolver) ? overrideSolver : m_fluidSolver;
+		btFluidSphParametersGlobal* usedGlobalParameters = (overrideParameters) ? overrideParameters : &m_globalParameters;
+		
+		usedSolver->updateGridAndCalculateSphForces( *usedGlobalParameters, &fluid, 1 );
+	}
+}
+
+static int findBroadphaseBlock(const btAlignedObjectArray<btFluidSphBroadphaseBlock*>& blocks, const btFluidGridPosition& blockPosition)
+{
+	int first = 0;
+	int last = blocks.size() - 1;
+	while(first <= last)
+	{
+		int middle = (first + last) / 2;
+		const btFluidGridPosition& middlePosition = blocks[middle]->getBlockPosition();
+		
+		if(middlePosition < blockPosition) first = middle + 1;
+		else if(blockPosition < middlePosition) last = middle - 1;
+		else return middle;
+	}
+	
+	return -(first + 1);	//Negative if not found; -(index + 1) is the insertion index
+}
+//Blocks are not added to m_collisionObjects, so that they are never accessed or deleted by the user through
+//getCollisionObjectArray(); their broadphase proxies are created and destroyed here instead
+static void createBroadphaseBlockProxy(btBroadphaseInterface* broadphase, btDispatcher* dispatcher, btFluidSphBroadphaseBlock* block,
+								short int collisionFilterGroup, short int collisionFilterMask)
+{
+	int shapeType = block->getCollisionShape()->getShapeType();
+	btBroadphaseProxy* proxy = broadphase->createProxy(block->getAabbMin(), block->getAabbMax(), shapeType, block, 
+														collisionFilterGroup, collisionFilterMask, dispatcher, 0);
+	block->setBroadphaseHandle(proxy);
+}
+static void destroyBroadphaseBlock(btBroadphaseInterface* broadphase, btDispatcher* dispatcher, btFluidSphBroadphaseBlock* block)
+{
+	btBroadphaseProxy* proxy = block->getBroadphaseHandle();
+	if(proxy)
+	{
+		broadphase->getOverlappingPairCache()->cleanProxyFromPairs(proxy, dispatcher);
+		broadphase->destroyProxy(proxy, dispatcher);
+		block->setBroadphaseHandle(0);
+	}
+	
+	block->~btFluidSphBroadphaseBlock();
+	btAlignedFree(block);
+}
+void btFluidRigidDynamicsWorld::updateFluidBroadphaseBlocks(btFluidSph* fluid)
+{
+	btFluidSphBroadphaseBlocks& broadphaseBlocks = fluid->internalGetBroadphaseBlocks();
+	btAlignedObjectArray<btFluidSphBroadphaseBlock*>& blocks = broadphaseBlocks.m_blocks;
+	
+	//Block positions depend on the block size, so all blocks are recreated if it changes
+	const int blockCells = fluid->getBroadphaseBlockCells();
+	if( blockCells != broadphaseBlocks.m_blockCells ) removeFluidBroadphaseBlocks( fluid, (blockCells <= 0) );
+	if(blockCells <= 0) return;
+	
+	BT_PROFILE("FluidRigidWorld - updateFluidBroadphaseBlocks()");
+	
+	//Change the collision filter of the fluid's proxy so that it does not overlap anything, and remove its existing pairs.
+	//The proxy is kept, since removing and adding the fluid would change its position in m_collisionObjects.
+	if(!broadphaseBlocks.m_replacesFluidProxy)
+	{
+		btBroadphaseProxy* fluidProxy = fluid->getBroadphaseHandle();
+		broadphaseBlocks.m_collisionFilterGroup = fluidProxy->m_collisionFilterGroup;
+		broadphaseBlocks.m_collisionFilterMask = fluidProxy->m_collisionFilterMask;
+		broadphaseBlocks.m_replacesFluidProxy = true;
+		
+		fluidProxy->m_collisionFilterGroup = 0;
+		fluidProxy->m_collisionFilterMask = 0;
+		m_broadphasePairCache->getOverlappingPairCache()->cleanProxyFromPairs(fluidProxy, m_dispatcher1);
+	}
+	broadphaseBlocks.m_blockCells = blockCells;
+	
+	//Particles are sorted by grid cell from the previous step, so consecutive particles are usually in the same block
+	for(int i = 0; i < blocks.size(); ++i) blocks[i]->internalClearAabb();
+	
+	const btFluidSortingGrid& grid = fluid->getGrid();
+	int currentBlock = -1;
+	btFluidGridPosition currentBlockPosition;
+	for(int n = 0; n < fluid->numParticles(); ++n)
+	{
+		const btVector3& position = fluid->getPosition(n);
+		btFluidGridPosition blockPosition = getFluidSphBlockPosition( grid.getDiscretePosition(position), blockCells );
+		
+		if(currentBlock < 0 || blockPosition != currentBlockPosition)
+		{
+			currentBlock = findBroadphaseBlock(blocks, blockPosition);
+			if(currentBlock < 0)
+			{
+				//The proxy of the block is created below, once its AABB is known
+				currentBlock = -(currentBlock + 1);
+				
+				void* ptr = btAlignedAlloc( sizeof(btFluidSphBroadphaseBlock), 16 );
+				btFluidSphBroadphaseBlock* block = new(ptr) btFluidSphBroadphaseBlock(fluid, blockPosition);
+				block->internalClearAabb();
+				
+				blocks.push_back(block);
+				for(int i = blocks.size() - 1; i > currentBlock; --i) blocks[i] = blocks[i - 1];
+				blocks[currentBlock] = block;
+			}
+			
+			currentBlockPosition = blockPosition;
+		}
+		
+		blocks[currentBlock]->internalExpandAabb(position);
+	}
+	
+	//Same radius as btFluidSph::getAabb()
+	const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+	btScalar radius = FL.m_particleRadius + FL.m_particleRadiusExpansion;
+	btVector3 extent(radius, radius, radius);
+	
+	int numRemainingBlocks = 0;
+	for(int i = 0; i < blocks.size(); ++i)
+	{
+		btFluidSphBroadphaseBlock* block = blocks[i];
+		
+		if( block->internalIsAabbEmpty() )
+		{
+			destroyBroadphaseBlock(m_broadphasePairCache, m_dispatcher1, block);
+			continue;
+		}
+		
+		block->setAabb(block->getAabbMin() - extent, block->getAabbMax() + extent);
+		if( !block->getBroadphaseHandle() ) 
+		{
+			createBroadphaseBlockProxy(m_broadphasePairCache, m_dispatcher1, block, 
+										broadphaseBlocks.m_collisionFilterGroup, broadphaseBlocks.m_collisionFilterMask);
+		}
+		else m_broadphasePairCache->setAabb(block->getBroadphaseHandle(), block->getAabbMin(), block->getAabbMax(), m_dispatcher1);
+		
+		blocks[numRemainingBlocks++] = block;
+	}
+	blocks.resize(numRemainingBlocks);
+}
+void btFluidRigidDynamicsWorld::removeFluidBroadphaseBlocks(btFluidSph* fluid, bool restoreFluidProxy)
+{
+	btFluidSphBroadphaseBlocks& broadphaseBlocks = fluid->internalGetBroadphaseBlocks();
+	btAlignedObjectArray<btFluidSphBroadphaseBlock*>& blocks = broadphaseBlocks.m_blocks;
+	
+	for(int i = 0; i < blocks.size(); ++i) destroyBroadphaseBlock(m_broadphasePairCache, m_dispatcher1, blocks[i]);
+	blocks.resize(0);
+	broadphaseBlocks.m_blockCells = 0;
+	
+	if(broadphaseBlocks.m_replacesFluidProxy)
+	{
+		broadphaseBlocks.m_replacesFluidProxy = false;
+		
+		//The broadphase only adds pairs when a proxy is created or moved, so restoring the filter
+		//of the existing proxy would not find its overlaps; the proxy is recreated instead
+		if(restoreFluidProxy)
+		{
+			btBroadphaseProxy* fluidProxy = fluid->getBroadphaseHandle();
+			m_broadphasePairCache->getOverlappingPairCache()->cleanProxyFromPairs(fluidProxy, m_dispatcher1);
+			m_broadphasePairCache->destroyProxy(fluidProxy, m_dispatcher1);
+			
+			btVector3 aabbMin, aabbMax;
+			fluid->getCollisionShape()->getAabb(fluid->getWorldTransform(), aabbMin, aabbMax);
+			
+			int shapeType = fluid->getCollisionShape()->getShapeType();
+			fluidProxy = m_broadphasePairCache->createProxy(aabbMin, aabbMax, shapeType, fluid, broadphaseBlocks.m_collisionFilterGroup, 
+															broadphaseBlocks.m_collisionFilterMask, m_dispatcher1, 0);
+			fluid->setBroadphaseHandle(fluidProxy);
+		}
+	}
+}
 
 void btFluidRigidDynamicsWorld::debugDrawWorld()
 {
@@ -127,17 +393,24 @@ void btFluidRigidDynamicsWorld::debugDrawWorld()
 	}
 }
 
+//Position based solvers are not yet handled by the collision and integration passes
+bool usesPositionBasedSolver(btFluidSph* fluid, btFluidSphSolver* defaultSolver)
+{
+	btFluidSphSolver* overrideSolver = fluid->getOverrideSolver();
+	return (overrideSolver) ? overrideSolver->isPositionBasedSolver() : defaultSolver->isPositionBasedSolver();
+}
+
 void btFluidRigidDynamicsWorld::internalSingleStepSimulation(btScalar timeStep) 
 {
 	BT_PROFILE("FluidRigidWorld - singleStepSimulation()");
 	
-	//Use emitters and absorbers
+	//Use emitters; those of fluids that are not in the world have no node in the step graph
 	for(int i = 0; i < m_emitters.size(); ++i)
 	{
 		btFluidEmitter* emitter = m_emitters[i];
-		emitter->emit();
+		if( m_fluids.findLinearSearch(emitter->m_fluid) == m_fluids.size() ) emitter->emit();
 	}
-	//
+	executeStepGraph(true, timeStep);
 	
 	if(m_internalFluidPreTickCallback) m_internalFluidPreTickCallback(this, timeStep);
 	
@@ -145,74 +418,316 @@ void btFluidRigidDynamicsWorld::internalSingleStepSimulation(btScalar timeStep)
 	//	does not require a btFluidSolverSph to be specified in its constructor.
 	if(!m_fluidSolver)
 	{
+		btAssert( !m_fluids.size() );
+		
 		btDiscreteDynamicsWorld::internalSingleStepSimulation(timeStep);
+		executeStepGraph(false, timeStep);
 		return;
 	}
 	
-	for(int i = 0; i < m_fluids.size(); ++i) m_fluids[i]->internalClearRigidContacts();
+	for(int i = 0; i < m_fluids.size(); ++i) 
+	{
+		updateFluidBroadphaseBlocks(m_fluids[i]);
+		m_fluids[i]->internalClearRigidContacts();
+	}
 	
 	//btFluidSph-btRigidBody/btCollisionObject AABB intersections are 
 	//detected here(not midphase/narrowphase), so calling removeMarkedParticles() 
-	//below does not invalidate the collisions.
+	//afterwards does not invalidate the collisions. SPH forces of fluids without 
+	//boundary particles are calculated in solveConstraints(), so that they may
+	//be calculated while the rigid body constraints are solved.
+	m_sphForcesPending = true;
 	btDiscreteDynamicsWorld::internalSingleStepSimulation(timeStep);
 	
-	for(int i = 0; i < m_fluids.size(); ++i) m_fluids[i]->removeMarkedParticles();
+	//solveConstraints() is not called if it is overridden by a derived class
+	if(m_sphForcesPending)
+	{
+		m_sphForcesPending = false;
+		
+		for(int i = 0; i < m_fluids.size(); ++i) m_fluids[i]->removeMarkedParticles();
+		calculateSphForces(false);
+	}
+	
+	//SPH forces of fluids with boundary particles, then collisions and integration of each fluid
+	executeStepGraph(false, timeStep);
 	
-	//SPH forces
+	//Merge and split particles; the grid remains valid since particles are only marked for removal or appended
+	for(int i = 0; i < m_fluids.size(); ++i) 
 	{
-		int numDefaultSolverFluids = m_tempDefaultFluids.size();
-		if(numDefaultSolverFluids)
+		btFluidSph* fluid = m_fluids[i];
+		
+		btFluidSphAdaptiveResolution* adaptiveResolution = fluid->getAdaptiveResolution();
+		if(adaptiveResolution) 
 		{
-			m_fluidSolver->updateGridAndCalculateSphForces(m_globalParameters, &m_tempDefaultFluids[0], numDefaultSolverFluids);
+			btFluidSphParametersGlobal* overrideParameters = fluid->getOverrideParameters();
+			adaptiveResolution->update( (overrideParameters) ? *overrideParameters : m_globalParameters, fluid );
 		}
+	}
+	
+	if(m_internalFluidPostTickCallback) m_internalFluidPostTickCallback(this, timeStep);
+}
+
+//Stages attached to FLUID_STAGE_EMIT are executed before the rigid body step, and all others after it
+bool isExecutedBeforeRigidStep(const btFluidStepStage* stage) { return stage->getExecuteAfter() == FLUID_STAGE_EMIT; }
+
+//Appends the stage to orderedStages after the stages it depends on that are executed on the same side of the rigid body step
+void appendStepStageAfterDependencies(btFluidStepStage* stage, const btAlignedObjectArray<btFluidStepStage*>& stages,
+										btAlignedObjectArray<btFluidStepStage*>& orderedStages, int depth)
+{
+	if( orderedStages.findLinearSearch(stage) != orderedStages.size() ) return;
+	
+	//The dependency chain cannot be longer than the number of stages unless there is a cycle
+	btAssert( depth <= stages.size() );
+	if( depth > stages.size() ) return;
+	
+	for(int i = 0; i < stage->getNumDependencies(); ++i)
+	{
+		btFluidStepStage* dependency = stage->getDependency(i);
+		btAssert( stages.findLinearSearch(dependency) != stages.size() );
+		btAssert( dependency->getExecuteAfter() <= stage->getExecuteAfter() );
+		
+		if( isExecutedBeforeRigidStep(dependency) == isExecutedBeforeRigidStep(stage) ) 
+			appendStepStageAfterDependencies(dependency, stages, orderedStages, depth + 1);
+	}
+	
+	orderedStages.push_back(stage);
+}
+void btFluidRigidDynamicsWorld::buildStepGraph(btFluidStepGraph& graph, bool beforeRigidStep)
+{
+	m_tempOrderedStepStages.resize(0);
+	for(int i = 0; i < m_stepStages.size(); ++i)
+	{
+		btFluidStepStage* stage = m_stepStages[i];
+		if( isExecutedBeforeRigidStep(stage) == beforeRigidStep ) appendStepStageAfterDependencies(stage, m_stepStages, m_tempOrderedStepStages, 0);
+	}
+	
+	//Each stage has a begin() node, followed by a processFluid() node for each fluid
+	const int numFluids = m_fluids.size();
+	const int numStages = m_tempOrderedStepStages.size();
+	const int stageStride = numFluids + 1;
+	
+	m_tempStepStageNodes.resize(numStages * stageStride);
+	for(int i = 0; i < m_tempStepStageNodes.size(); ++i) m_tempStepStageNodes[i] = -1;
+	
+	for(int s = 0; s < numStages; ++s)
+	{
+		btFluidStepStage* stage = m_tempOrderedStepStages[s];
+		m_tempStepStageNodes[s * stageStride] = graph.addNode(FLUID_STEP_NODE_STAGE_BEGIN, 0, stage, 0, true);
 		
-		for(int i = 0; i < m_tempOverrideFluids.size(); ++i)
+		for(int d = 0; d < stage->getNumDependencies(); ++d)
 		{
-			btFluidSph* fluid = m_tempOverrideFluids[i];
+			int dependency = m_tempOrderedStepStages.findLinearSearch( stage->getDependency(d) );
+			if(dependency < numStages) graph.addDependency( m_tempStepStageNodes[dependency * stageStride] );
+		}
+	}
+	
+	//The solver may couple fluids, so the SPH forces of all fluids with boundary particles are calculated in a single node
+	int sphForcesNode = -1;
+	if(!beforeRigidStep && numFluids) sphForcesNode = graph.addNode(FLUID_STAGE_SPH_FORCES, 0, 0, 0, true);
+	
+	//The collision detector and constraint solver are shared by all fluids, and the constraint solver activates rigid bodies,
+	//which changes the contacts cached by the detector; so the narrowphase and response of each fluid are executed in sequence.
+	//The emitters share the random number generator, and btFluidSphSolver only has to process one fluid at a time.
+	int previousCollisionNode = -1;
+	int previousEmitNode = -1;
+	m_tempIntegrateNodes.resize(numFluids);
+	
+	const int firstStageType = (beforeRigidStep) ? FLUID_STAGE_EMIT : FLUID_STAGE_SPH_FORCES;
+	const int lastStageType = (beforeRigidStep) ? FLUID_STAGE_EMIT : FLUID_STAGE_INTEGRATE;
+	for(int i = 0; i < numFluids; ++i)
+	{
+		btFluidSph* fluid = m_fluids[i];
+		m_tempIntegrateNodes[i] = -1;
 		
-			btFluidSphSolver* overrideSolver = fluid->getOverrideSolver();
-			btFluidSphParametersGlobal* overrideParameters = fluid->getOverrideParameters();
-			
-			btFluidSphSolver* usedSolver = (overrideSolver) ? overrideSolver : m_fluidSolver;
-			btFluidSphParametersGlobal* usedGlobalParameters = (overrideParameters) ? overrideParameters : &m_globalParameters;
+		//Nodes of position based fluids are still added, so that the user stages are ordered the same way
+		bool isPositionBased = ( !beforeRigidStep && usesPositionBasedSolver(fluid, m_fluidSolver) );
+		
+		int builtInNode = -1;
+		for(int stageType = firstStageType; stageType <= lastStageType; ++stageType)
+		{
+			if(stageType == FLUID_STAGE_SPH_FORCES) builtInNode = sphForcesNode;
+			else
+			{
+				bool exclusive = ( stageType == FLUID_STAGE_NARROWPHASE && m_internalFluidMidTickCallback );
+				int previousBuiltInNode = builtInNode;
+				builtInNode = graph.addNode(stageType, fluid, 0, 0, exclusive);
+				
+				//After the previous built-in stage of the fluid, and the user stages attached to it
+				graph.addDependency(previousBuiltInNode);
+				for(int s = 0; s < numStages; ++s)
+					if( m_tempOrderedStepStages[s]->getExecuteAfter() == stageType - 1 ) graph.addDependency( m_tempStepStageNodes[s * stageStride + 1 + i] );
+				
+				if(stageType == FLUID_STAGE_EMIT)
+				{
+					graph.addDependency(previousEmitNode);
+					previousEmitNode = builtInNode;
+				}
+				else if( !isPositionBased && (stageType == FLUID_STAGE_NARROWPHASE || stageType == FLUID_STAGE_RESPONSE) )
+				{
+					graph.addDependency(previousCollisionNode);
+					previousCollisionNode = builtInNode;
+				}
+				else if(!isPositionBased && stageType == FLUID_STAGE_INTEGRATE)
+				{
+					btFluidSphSolver* solver = ( fluid->getOverrideSolver() ) ? fluid->getOverrideSolver() : m_fluidSolver;
+					for(int j = i - 1; j >= 0; --j)
+					{
+						btFluidSphSolver* otherSolver = ( m_fluids[j]->getOverrideSolver() ) ? m_fluids[j]->getOverrideSolver() : m_fluidSolver;
+						if(m_tempIntegrateNodes[j] >= 0 && otherSolver == solver)
+						{
+							graph.addDependency(m_tempIntegrateNodes[j]);
+							break;
+						}
+					}
+					
+					m_tempIntegrateNodes[i] = builtInNode;
+				}
+			}
 			
-			usedSolver->updateGridAndCalculateSphForces( *usedGlobalParameters, &fluid, 1 );
+			for(int s = 0; s < numStages; ++s)
+			{
+				btFluidStepStage* stage = m_tempOrderedStepStages[s];
+				if(stage->getExecuteAfter() != stageType) continue;
+				
+				int stageNode = graph.addNode( FLUID_STEP_NODE_STAGE_PROCESS_FLUID, fluid, stage, 0, !stage->isParallel() );
+				graph.addDependency(builtInNode);
+				graph.addDependency( m_tempStepStageNodes[s * stageStride] );
+				for(int d = 0; d < stage->getNumDependencies(); ++d)
+				{
+					int dependency = m_tempOrderedStepStages.findLinearSearch( stage->getDependency(d) );
+					if(dependency < numStages) graph.addDependency( m_tempStepStageNodes[dependency * stageStride + 1 + i] );
+				}
+				
+				m_tempStepStageNodes[s * stageStride + 1 + i] = stageNode;
+			}
 		}
 	}
+}
+void btFluidRigidDynamicsWorld::executeStepGraph(bool beforeRigidStep, btScalar timeStep)
+{
+	BT_PROFILE("FluidRigidWorld - executeStepGraph()");
 	
-	//Detect and resolve collisions, integrate
-	{
-		const bool USE_IMPULSE_BOUNDARY = 1; 	//Penalty force otherwise
+	m_stepGraph.clear();
+	buildStepGraph(m_stepGraph, beforeRigidStep);
+	m_stepGraph.sortNodesByLevel();
 	
-		for(int i = 0; i < m_fluids.size(); ++i) 
+	for(int i = 0; i < m_stepGraph.getNumLevels(); ++i) executeStepGraphLevel(m_stepGraph, i, timeStep);
+}
+void btFluidRigidDynamicsWorld::executeStepNode(const btFluidStepNode& node, btScalar timeStep)
+{
+	const bool USE_IMPULSE_BOUNDARY = 1; 	//Penalty force otherwise
+	
+	btFluidSph* fluid = node.m_fluid;
+	switch(node.m_type)
+	{
+		case FLUID_STAGE_EMIT:
 		{
-			btFluidSph* fluid = m_fluids[i];
-			const btFluidSphParametersLocal& FL = fluid->getLocalParameters();
+			for(int i = 0; i < m_emitters.size(); ++i)
+				if(m_emitters[i]->m_fluid == fluid) m_emitters[i]->emit();
+			break;
+		}
+		
+		case FLUID_STAGE_SPH_FORCES:
+		{
+			for(int i = 0; i < m_fluids.size(); ++i) m_fluids[i]->internalGroupIntersectingRigidBlocks();
+			
+			//Move boundary particles with the rigid bodies; each is updated once, even if it is shared by several fluids
+			m_tempRigidBoundaries.resize(0);
+			for(int i = 0; i < m_fluids.size(); ++i)
+			{
+				btFluidSphRigidBoundaryParticles* boundary = m_fluids[i]->getRigidBoundaryParticles();
+				if( boundary && m_tempRigidBoundaries.findLinearSearch(boundary) == m_tempRigidBoundaries.size() ) 
+				{
+					boundary->update(m_globalParameters);
+					m_tempRigidBoundaries.push_back(boundary);
+				}
+			}
+			
+			if( m_tempRigidBoundaries.size() )
+			{
+				calculateSphForces(true);
+				
+				for(int i = 0; i < m_tempRigidBoundaries.size(); ++i) m_tempRigidBoundaries[i]->applyForcesToRigidBodies(m_globalParameters);
+			}
+			break;
+		}
+		
+		//Executed after the response of the previous fluid, which may activate rigid bodies and so invalidate cached contacts
+		case FLUID_STAGE_NARROWPHASE:
+		{
+			if( usesPositionBasedSolver(fluid, m_fluidSolver) ) break;
 			
 			btFluidSphSolver* overrideSolver = fluid->getOverrideSolver();
 			btFluidSphSolver* usedSolver = (overrideSolver) ? overrideSolver : m_fluidSolver;
+			btFluidSphRigidBoundaryParticles* boundaryParticles = ( usedSolver->usesRigidBoundaryParticles(fluid) ) ? fluid->getRigidBoundaryParticles() : 0;
 			
-			if( !usedSolver->isPositionBasedSolver() )
+			m_fluidRigidCollisionDetector->performNarrowphase(m_dispatcher1, m_dispatchInfo, m_globalParameters, fluid, boundaryParticles);
+			if(m_internalFluidMidTickCallback) m_internalFluidMidTickCallback(this, timeStep);
+			break;
+		}
+		
+		case FLUID_STAGE_RESPONSE:
+		{
+			if( usesPositionBasedSolver(fluid, m_fluidSolver) ) break;
+			
+			if(!USE_IMPULSE_BOUNDARY)
+			{
+				m_fluidRigidConstraintSolver->resolveCollisionsForce(m_globalParameters, fluid);
+			}
+			else
 			{
-				m_fluidRigidCollisionDetector.performNarrowphase(m_dispatcher1, m_dispatchInfo, m_globalParameters, m_fluids[i]);
-				if(m_internalFluidMidTickCallback) m_internalFluidMidTickCallback(this, timeStep);
+				//Rigid contact impulses are applied between the velocity and position update;
+				//if there are no contacts, forces are applied in the same pass as the AABB boundary and positions
+				if( fluid->getRigidContacts().size() )
+				{
+					btFluidSphSolver::applyForcesSingleFluid(m_globalParameters, fluid);
+					
+					const bool APPLY_AABB_IMPULSES = false;
+					m_fluidRigidConstraintSolver->resolveCollisionsImpulse(m_globalParameters, fluid, APPLY_AABB_IMPULSES);
+				}
+			}
+			break;
+		}
+		
+		case FLUID_STAGE_INTEGRATE:
+		{
+			if( usesPositionBasedSolver(fluid, m_fluidSolver) ) break;
 			
-				if(!USE_IMPULSE_BOUNDARY)
-					m_fluidRigidConstraintSolver.resolveCollisionsForce(m_globalParameters, m_fluids[i]);
-				
+			if(!USE_IMPULSE_BOUNDARY)
+			{
 				btFluidSphSolver::applyForcesSingleFluid(m_globalParameters, fluid);
-				
-				if(USE_IMPULSE_BOUNDARY) 
-					m_fluidRigidConstraintSolver.resolveCollisionsImpulse(m_globalParameters, m_fluids[i]);
-				
 				btFluidSphSolver::integratePositionsSingleFluid( m_globalParameters, fluid->internalGetParticles() );
 			}
 			else
 			{
+				bool hasRigidContacts = ( fluid->getRigidContacts().size() != 0 );
 				
+				btFluidSphSolver* overrideSolver = fluid->getOverrideSolver();
+				btFluidSphSolver* usedSolver = (overrideSolver) ? overrideSolver : m_fluidSolver;
+				usedSolver->integrateSingleFluid(m_globalParameters, fluid, !hasRigidContacts);
+			}
+			
+			//Particles are only marked here, and removed before the grid is updated during the next step.
+			//The grid is not updated after integration, so particles that have moved into the volume
+			//from a grid cell outside of it may be absorbed one step later.
+			for(int i = 0; i < m_absorbers.size(); ++i)
+			{
+				btFluidAbsorber* absorber = m_absorbers[i];
+				if(!absorber->m_fluid || absorber->m_fluid == fluid) absorber->absorb(fluid);
 			}
+			break;
 		}
+		
+		case FLUID_STEP_NODE_STAGE_BEGIN:
+			node.m_stage->begin(this, timeStep);
+			break;
+		
+		case FLUID_STEP_NODE_STAGE_PROCESS_FLUID:
+			node.m_stage->processFluid(this, fluid, timeStep);
+			break;
+		
+		default:
+			btAssert(0);	//Nodes added by a derived world should be executed by it
+			break;
 	}
-	
-	if(m_internalFluidPostTickCallback) m_internalFluidPostTickCallback(this, timeStep);
 }
@@ -21,7 +21,10 @@ subject to the following restrictions:
 #include "Sph/btFluidSphRigidCollisionDetector.h"
 #include "Sph/btFluidSphRigidConstraintSolver.h"
 
+#include "btFluidStepStage.h"
+
 class btFluidSph;
+class btFluidSphRigidBoundaryParticles;
 class btFluidSphSolver;
 class btFluidRigidDynamicsWorld;
 
@@ -39,24 +42,40 @@ protected:
 	btAlignedObjectArray<btFluidSph*> m_fluids;
 	btAlignedObjectArray<btFluidSph*> m_tempOverrideFluids;	//Contains the subset of m_fluids with (getOverrideSolver/Parameters() != 0)
 	btAlignedObjectArray<btFluidSph*> m_tempDefaultFluids;	//Contains the subset of m_fluids with no override set
+	btAlignedObjectArray<btFluidSphRigidBoundaryParticles*> m_tempRigidBoundaries;	//Contains each unique btFluidSph::getRigidBoundaryParticles()
+	btAlignedObjectArray<btFluidSph*> m_tempSphForceFluids;	//Subset of m_tempDefaultFluids passed to the solver by calculateSphForces()
+	
+	btFluidSphBroadphaseBlockFilterCallback m_broadphaseBlockFilterCallback;
+	
+	bool m_sphForcesPending;		//True during the rigid body step if calculateSphForces() has not been called for fluids without boundary particles
+	
+	int m_numHeapAllocationsLastStep;
 	
 	btFluidSphSolver* m_fluidSolver;
 	
-	btFluidSphRigidCollisionDetector m_fluidRigidCollisionDetector;
-	btFluidSphRigidConstraintSolver m_fluidRigidConstraintSolver;
+	btFluidSphRigidCollisionDetector m_defaultFluidRigidCollisionDetector;
+	btFluidSphRigidCollisionDetector* m_fluidRigidCollisionDetector;		//Either &m_defaultFluidRigidCollisionDetector or set by the user
+	btFluidSphRigidConstraintSolver m_defaultFluidRigidConstraintSolver;
+	btFluidSphRigidConstraintSolver* m_fluidRigidConstraintSolver;		//Either &m_defaultFluidRigidConstraintSolver or set by the user
 	
 	btInternalFluidTickCallback m_internalFluidPreTickCallback;
 	btInternalFluidTickCallback m_internalFluidPostTickCallback;
 	btInternalFluidTickCallback m_internalFluidMidTickCallback;
 	
 	btAlignedObjectArray<btFluidEmitter*> m_emitters;
-	//btAlignedObjectArray<btFluidAbsorber*> m_absorbers;
+	btAlignedObjectArray<btFluidAbsorber*> m_absorbers;
+	
+	btAlignedObjectArray<btFluidStepStage*> m_stepStages;
+	btAlignedObjectArray<btFluidStepStage*> m_tempOrderedStepStages;	//Stages executed before or after the rigid body step, sorted by dependency
+	btAlignedObjectArray<int> m_tempStepStageNodes;		//Per m_tempOrderedStepStages; the begin() node followed by a node for each fluid
+	btAlignedObjectArray<int> m_tempIntegrateNodes;		//Per fluid; FLUID_STAGE_INTEGRATE node, or -1
+	btFluidStepGraph m_stepGraph;
 	
 	
 public:
 	btFluidRigidDynamicsWorld(btDispatcher* dispatcher, btBroadphaseInterface* pairCache, btConstraintSolver* constraintSolver, 
 							btCollisionConfiguration* collisionConfiguration, btFluidSphSolver* fluidSolver);
-	virtual ~btFluidRigidDynamicsWorld() {}
+	virtual ~btFluidRigidDynamicsWorld();	///<Removes the btFluidSphBroadphaseBlock of each fluid.
 	
 	virtual int stepSimulation( btScalar timeStep, int maxSubSteps = 1, btScalar fixedTimeStep = btScalar(1.0/60.0) );
 	
@@ -69,12 +88,21 @@ public:
 																		short int collisionFilterMask = btBroadphaseProxy::AllFilter);
 	virtual void removeCollisionObject(btCollisionObject* collisionObject);
 	
+	///The emitter is used at the start of each step. If its btFluidEmitter::m_fluid is in the world, 
+	///it is used in the FLUID_STAGE_EMIT node of that fluid; otherwise, it is used before the step graph is executed.
 	void addSphEmitter(btFluidEmitter* emitter);
 	void removeSphEmitter(btFluidEmitter* emitter);
 	
 	int getNumSphEmitters() const { return m_emitters.size(); }
 	btFluidEmitter* getSphEmitter(int index) { return m_emitters[index]; }
 	
+	///Absorbers are applied after the particles are integrated; the particles are removed during the next step.
+	void addSphAbsorber(btFluidAbsorber* absorber);
+	void removeSphAbsorber(btFluidAbsorber* absorber);
+	
+	int getNumSphAbsorbers() const { return m_absorbers.size(); }
+	btFluidAbsorber* getSphAbsorber(int index) { return m_absorbers[index]; }
+	
 	//
 	int getNumFluidSph() const { return m_fluids.size(); }
 	btFluidSph* getFluidSph(int index) { return m_fluids[index]; }
@@ -85,8 +113,33 @@ public:
 	btFluidSphSolver* getFluidSolver() const { return m_fluidSolver; }
 	void setFluidSolver(btFluidSphSolver* solver) { m_fluidSolver = solver; }
 	
+	btFluidSphRigidCollisionDetector& getFluidRigidCollisionDetector() { return *m_fluidRigidCollisionDetector; }
+	
+	///Replaces the default detector, e.g. with one that processes continuous collisions in parallel; set to 0 to restore the default.
+	///The detector is not owned by the world, and its btFluidSphRigidCollisionDetector::setSdfCache() is not copied from the previous detector.
+	void setFluidRigidCollisionDetector(btFluidSphRigidCollisionDetector* detector)
+	{
+		m_fluidRigidCollisionDetector = (detector) ? detector : &m_defaultFluidRigidCollisionDetector;
+	}
+	
+	btFluidSphRigidConstraintSolver& getFluidRigidConstraintSolver() { return *m_fluidRigidConstraintSolver; }
+	
+	///Replaces the default solver, e.g. with one that resolves contacts in parallel; set to 0 to restore the default.
+	///The solver is not owned by the world.
+	void setFluidRigidConstraintSolver(btFluidSphRigidConstraintSolver* solver)
+	{
+		m_fluidRigidConstraintSolver = (solver) ? solver : &m_defaultFluidRigidConstraintSolver;
+	}
+	
 	btAlignedObjectArray<btFluidSph*>& internalGetFluids() { return m_fluids; }
 	
+	///Returns the number of btAlignedAlloc() calls made during the last stepSimulation(), including those of the rigid body simulation.
+	///@remarks The fluid simulation keeps its temporary arrays between steps, so it does not allocate once the number of
+	///particles and contacts stops growing.
+	///The counter in btAlignedAllocator is not atomic, so the count is unreliable if other threads allocate memory during the step,
+	///which includes btFluidRigidDynamicsWorldMultithreaded and the multithreaded solvers when BT_NO_PROFILE is defined.
+	int getNumHeapAllocationsLastStep() const { return m_numHeapAllocationsLastStep; }
+	
 	//virtual btDynamicsWorldType getWorldType() const { return BT_FLUID_RIGID_DYNAMICS_WORLD; }
 	
 	virtual void debugDrawWorld();
@@ -100,8 +153,55 @@ public:
 	
 	void setInternalFluidMidTickcallback(btInternalFluidTickCallback cb) { m_internalFluidMidTickCallback = cb; }
 	
+	///Inserts user defined work into the fluid step; the stage is not owned by the world.
+	void addStepStage(btFluidStepStage* stage) { m_stepStages.push_back(stage); }
+	void removeStepStage(btFluidStepStage* stage) { m_stepStages.remove(stage); }
+	
+	int getNumStepStages() const { return m_stepStages.size(); }
+	btFluidStepStage* getStepStage(int index) { return m_stepStages[index]; }
+	
 protected:
 	virtual void internalSingleStepSimulation(btScalar timeStep) ;
+	
+	///Adds the work performed before the rigid body step(FLUID_STAGE_EMIT), or after it, to the graph.
+	///@remarks Derived worlds may override this to add nodes, with a type of at least FLUID_STEP_NODE_USER_TYPE, after the nodes of this class.
+	virtual void buildStepGraph(btFluidStepGraph& graph, bool beforeRigidStep);
+	
+	///Builds the graph, then executes its nodes one level at a time.
+	void executeStepGraph(bool beforeRigidStep, btScalar timeStep);
+	
+	///Executes the nodes of a level of the graph in sequence.
+	///@remarks The nodes of a level do not depend on each other, so this may be overridden to execute
+	///the first btFluidStepGraph::getNumConcurrentLevelNodes() nodes concurrently.
+	virtual void executeStepGraphLevel(const btFluidStepGraph& graph, int level, btScalar timeStep)
+	{
+		for(int i = 0; i < graph.getNumLevelNodes(level); ++i) executeStepNode( graph.getNode( graph.getLevelNode(level, i) ), timeStep );
+	}
+	
+	///Performs the work of a single node; may be called concurrently for nodes of the same level that are not exclusive.
+	virtual void executeStepNode(const btFluidStepNode& node, btScalar timeStep);
+	
+	///Overridden to call solveConstraintsAndCalculateSphForces() during the rigid body step, after collision detection.
+	virtual void solveConstraints(btContactSolverInfo& solverInfo);
+	
+	///Calls btDiscreteDynamicsWorld::solveConstraints() and calculateSphForces(false).
+	///@remarks The constraint solver only accesses rigid bodies, while calculateSphForces(false) only accesses the
+	///particles and grids of fluids without btFluidSphRigidBoundaryParticles, so this may be overridden to run both concurrently.
+	virtual void solveConstraintsAndCalculateSphForces(btContactSolverInfo& solverInfo)
+	{
+		btDiscreteDynamicsWorld::solveConstraints(solverInfo);
+		calculateSphForces(false);
+	}
+	
+	///Updates the grid and calculates SPH forces of either the fluids that have btFluidSph::getRigidBoundaryParticles(),
+	///or the fluids that do not. Fluids with boundary particles are processed after the rigid bodies are moved.
+	void calculateSphForces(bool boundaryFluids);
+	
+	///Creates and removes the btFluidSphBroadphaseBlock of a fluid, and fits them to its particles; see btFluidSph::setBroadphaseBlockCells().
+	void updateFluidBroadphaseBlocks(btFluidSph* fluid);
+	
+	///@param restoreFluidProxy If true, the broadphase proxy of the fluid is recreated with its original collision filter.
+	void removeFluidBroadphaseBlocks(btFluidSph* fluid, bool restoreFluidProxy);
 };
 
 
@@ -0,0 +1,196 @@
+/*
+Bullet-FLUIDS 
+Copyright (c) 2012-2014 Jackson Lee
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose, 
+including commercial applications, and to alter it and redistribute it freely, 
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef BT_FLUID_STEP_STAGE_H
+#define BT_FLUID_STEP_STAGE_H
+
+#include "LinearMath/btScalar.h"
+#include "LinearMath/btMinMax.h"
+#include "LinearMath/btAlignedObjectArray.h"
+
+class btFluidSph;
+class btFluidRigidDynamicsWorld;
+
+///Built-in stages of btFluidRigidDynamicsWorld::internalSingleStepSimulation(), in execution order for a single fluid.
+///Except for FLUID_STAGE_SPH_FORCES, each stage is a separate btFluidStepNode for each fluid, 
+///so different stages of different fluids may be executed concurrently.
+enum btFluidStepStageType
+{
+	FLUID_STAGE_EMIT,			///<btFluidEmitter::emit(); before the rigid body step.
+	FLUID_STAGE_SPH_FORCES,		///<Marked particles are removed, and the grid, density, and SPH forces are updated; after the rigid body step.
+								///<The btFluidSphSolver may couple fluids, so this is a single node for all fluids.
+	FLUID_STAGE_NARROWPHASE,	///<Fluid-rigid contacts are generated; btFluidSphRigidCollisionDetector::performNarrowphase().
+	FLUID_STAGE_RESPONSE,		///<Fluid-rigid contacts are resolved; btFluidSphRigidConstraintSolver.
+	FLUID_STAGE_INTEGRATE,		///<Particle velocities and positions are integrated, and btFluidAbsorber are applied.
+	
+	FLUID_STAGE_COUNT
+};
+
+///Types of btFluidStepNode that are not built-in stages.
+enum btFluidStepNodeType
+{
+	FLUID_STEP_NODE_STAGE_BEGIN = FLUID_STAGE_COUNT,	///<btFluidStepStage::begin().
+	FLUID_STEP_NODE_STAGE_PROCESS_FLUID,				///<btFluidStepStage::processFluid() for a single fluid.
+	
+	FLUID_STEP_NODE_USER_TYPE	///<First type that may be used by classes derived from btFluidRigidDynamicsWorld.
+};
+
+///@brief User defined work inserted into the step of a btFluidRigidDynamicsWorld.
+///@remarks For each fluid, a stage is executed after the built-in stage it is attached to, and after the stages it depends on.
+///The next built-in stage of that fluid is executed after the stage.
+///Dependencies must also be added to the world, must be attached to the same or an earlier built-in stage, and must not form a cycle.
+///@par
+///Stages are not owned by the world; see btFluidRigidDynamicsWorld::addStepStage().
+class btFluidStepStage
+{
+	btFluidStepStageType m_executeAfter;
+	btAlignedObjectArray<btFluidStepStage*> m_dependencies;
+
+public:
+	btFluidStepStage(btFluidStepStageType executeAfter) : m_executeAfter(executeAfter) {}
+	virtual ~btFluidStepStage() {}
+	
+	btFluidStepStageType getExecuteAfter() const { return m_executeAfter; }
+	
+	void addDependency(btFluidStepStage* stage) { m_dependencies.push_back(stage); }
+	void removeDependency(btFluidStepStage* stage) { m_dependencies.remove(stage); }
+	
+	int getNumDependencies() const { return m_dependencies.size(); }
+	btFluidStepStage* getDependency(int index) const { return m_dependencies[index]; }
+	
+	///If true, processFluid() only accesses the fluid it is called with, so it may be executed concurrently with
+	///any other work on other fluids. Otherwise, no other work is performed while processFluid() is executed.
+	virtual bool isParallel() const { return false; }
+	
+	///Called once per step, after begin() of the stages it depends on, and before processFluid() is called for any fluid.
+	///It is not ordered with the built-in stages, so other fluids may be at any stage; no other work is performed during the call.
+	virtual void begin(btFluidRigidDynamicsWorld* world, btScalar timeStep) {}
+	
+	///Called once per step for each fluid in the world.
+	virtual void processFluid(btFluidRigidDynamicsWorld* world, btFluidSph* fluid, btScalar timeStep) {}
+};
+
+///@brief Work item of the step graph of a btFluidRigidDynamicsWorld; see btFluidStepGraph.
+struct btFluidStepNode
+{
+	int m_type;					///<btFluidStepStageType, btFluidStepNodeType, or a type defined by a derived world.
+	btFluidSph* m_fluid;		///<0 if the node is not specific to a single fluid.
+	btFluidStepStage* m_stage;	///<Set for FLUID_STEP_NODE_STAGE_BEGIN and FLUID_STEP_NODE_STAGE_PROCESS_FLUID.
+	void* m_userPointer;		///<Data of nodes added by derived worlds.
+	bool m_exclusive;			///<If true, the node is not executed concurrently with any other node.
+	
+	int m_level;				///<1 + the highest level of the nodes it depends on; 0 if it has no dependencies.
+	int m_firstDependency;
+	int m_numDependencies;
+};
+
+///@brief Dependency graph of the work performed during a step of btFluidRigidDynamicsWorld.
+///@remarks Nodes are executed by level; the nodes of a level do not depend on each other, so nodes that 
+///are not btFluidStepNode::m_exclusive may be executed concurrently. Each node may only depend on nodes 
+///added before it, so the graph does not contain cycles.
+class btFluidStepGraph
+{
+	btAlignedObjectArray<btFluidStepNode> m_nodes;
+	btAlignedObjectArray<int> m_dependencies;		//Node indices; the dependencies of each node are contiguous
+	
+	btAlignedObjectArray<int> m_sortedNodes;		//Node indices sorted by level; within each level, nodes that are not exclusive are first
+	btAlignedObjectArray<int> m_levelFirstNode;		//Index of m_sortedNodes; contains getNumLevels() + 1 elements
+	btAlignedObjectArray<int> m_levelNumConcurrent;
+	btAlignedObjectArray<int> m_tempLevelInsertIndex;
+	
+public:
+	void clear()
+	{
+		m_nodes.resize(0);
+		m_dependencies.resize(0);
+		m_sortedNodes.resize(0);
+		m_levelFirstNode.resize(0);
+		m_levelNumConcurrent.resize(0);
+	}
+	
+	///Returns the index of the node; add its dependencies with addDependency() before adding another node.
+	int addNode(int type, btFluidSph* fluid, btFluidStepStage* stage, void* userPointer, bool exclusive)
+	{
+		btFluidStepNode& node = m_nodes.expandNonInitializing();
+		node.m_type = type;
+		node.m_fluid = fluid;
+		node.m_stage = stage;
+		node.m_userPointer = userPointer;
+		node.m_exclusive = exclusive;
+		node.m_level = 0;
+		node.m_firstDependency = m_dependencies.size();
+		node.m_numDependencies = 0;
+		
+		return m_nodes.size() - 1;
+	}
+	
+	///Makes the last added node depend on another node; negative indices are ignored.
+	void addDependency(int dependency)
+	{
+		if(dependency < 0) return;
+		
+		btFluidStepNode& node = m_nodes[m_nodes.size() - 1];
+		btAssert( dependency < m_nodes.size() - 1 );
+		
+		m_dependencies.push_back(dependency);
+		++node.m_numDependencies;
+		node.m_level = btMax( node.m_level, m_nodes[dependency].m_level + 1 );
+	}
+	
+	int getNumNodes() const { return m_nodes.size(); }
+	const btFluidStepNode& getNode(int index) const { return m_nodes[index]; }
+	int getDependency(const btFluidStepNode& node, int index) const { return m_dependencies[node.m_firstDependency + index]; }
+	
+	///Groups the nodes by level; must be called after the last node is added, and before the functions below are used.
+	void sortNodesByLevel()
+	{
+		int numLevels = 0;
+		for(int i = 0; i < m_nodes.size(); ++i) numLevels = btMax(numLevels, m_nodes[i].m_level + 1);
+		
+		m_levelFirstNode.resize(numLevels + 1);
+		m_levelNumConcurrent.resize(numLevels);
+		for(int i = 0; i < m_levelFirstNode.size(); ++i) m_levelFirstNode[i] = 0;
+		for(int i = 0; i < m_levelNumConcurrent.size(); ++i) m_levelNumConcurrent[i] = 0;
+		
+		for(int i = 0; i < m_nodes.size(); ++i)
+		{
+			const btFluidStepNode& node = m_nodes[i];
+			++m_levelFirstNode[node.m_level + 1];
+			if(!node.m_exclusive) ++m_levelNumConcurrent[node.m_level];
+		}
+		for(int i = 1; i < m_levelFirstNode.size(); ++i) m_levelFirstNode[i] += m_levelFirstNode[i - 1];
+		
+		m_tempLevelInsertIndex.resize(numLevels * 2);
+		for(int i = 0; i < numLevels; ++i)
+		{
+			m_tempLevelInsertIndex[i*2] = m_levelFirstNode[i];
+			m_tempLevelInsertIndex[i*2 + 1] = m_levelFirstNode[i] + m_levelNumConcurrent[i];
+		}
+		
+		m_sortedNodes.resize( m_nodes.size() );
+		for(int i = 0; i < m_nodes.size(); ++i)
+		{
+			const btFluidStepNode& node = m_nodes[i];
+			int& insertIndex = m_tempLevelInsertIndex[node.m_level*2 + node.m_exclusive];
+			m_sortedNodes[insertIndex++] = i;
+		}
+	}
+	
+	int getNumLevels() const { return m_levelNumConcurrent.size(); }
+	int getNumLevelNodes(int level) const { return m_levelFirstNode[level + 1] - m_levelFirstNode[level]; }
+	int getNumConcurrentLevelNodes(int level) const { return m_levelNumConcurrent[level]; }	///<Nodes that are not exclusive are first.
+	int getLevelNode(int level, int index) const { return m_sortedNodes[ m_levelFirstNode[level] + index ]; }
+};
+
+#endif